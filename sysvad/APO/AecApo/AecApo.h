@@ -13,6 +13,7 @@
 #include <AecApoDll.h>
 
 #include <commonmacros.h>
+#include "AecDsp.h"
 #include <devicetopology.h>
 
 #include <audioengineextensionapo.h>
@@ -40,6 +41,8 @@ public:
     {
     }
 
+    virtual ~CAecApoMFX();    // destructor
+
 DECLARE_REGISTRY_RESOURCEID(IDR_AECAPOMFX)
 
 BEGIN_COM_MAP(CAecApoMFX)
@@ -68,6 +71,8 @@ public:
         APO_CONNECTION_DESCRIPTOR** ppInputConnections,  
         UINT32 u32NumOutputConnections, APO_CONNECTION_DESCRIPTOR** ppOutputConnections);
 
+    STDMETHOD(UnlockForProcess)(void);
+
     STDMETHOD(Initialize)(UINT32 cbDataSize, BYTE* pbyData);
 
     // IAudioSystemEffects2
@@ -122,8 +127,14 @@ public:
     CComPtr<IMMDevice>                      m_spCaptureDevice;
     CComPtr<IMMDevice>                      m_spLoopbackDevice;
 
-    float                                   m_captureEndpointMasterVolume = 0;
-    float                                   m_loopbackEndpointMasterVolume = 0;
+    float                                   m_captureEndpointMasterVolume = 1.0f;
+    float                                   m_loopbackEndpointMasterVolume = 1.0f;
+
+    UINT32                                  m_u32CaptureChannels = 0;
+    UINT32                                  m_u32LoopbackChannels = 0;
+
+    // Locked memory
+    AEC_FDAF                                *m_pFdaf = nullptr;
 
 private:
     wil::com_ptr_nothrow<IAudioProcessingObjectLoggingService> m_apoLoggingService;
@@ -21,10 +21,9 @@
 
 #include "AecApo.h"
 #include <devicetopology.h>
+#include <endpointvolume.h>
 #include <CustomPropKeys.h>
 
-#define SUPPORTED_AEC_SAMPLINGRATE (16000)
-
 // Static declaration of the APO_REG_PROPERTIES structure
 // associated with this APO.  The number in <> brackets is the
 // number of IIDs supported by this APO.  If more than one, then additional
@@ -116,12 +115,29 @@ STDMETHODIMP_(void) CAecApoMFX::APOProcess(
             //
             // Provide microphone buffer and timestamps to AEC algorithm
             //
-            UNREFERENCED_PARAMETER(inConnection);
             UNREFERENCED_PARAMETER(outConnection);
 
+            UINT32 u32ValidFrameCount = ppInputConnections[0]->u32ValidFrameCount;
+            UINT64 u64QpcTime = (APO_CONNECTION_PROPERTY_V2_SIGNATURE == ppInputConnections[0]->u32Signature) ? inConnection->u64QpcTime : 0;
+
+            // Silence still goes through the canceller, to keep the
+            // capture in step with the queued reference and to flush the
+            // last block out, but skips the filter. Once that block is out
+            // the output is silent as well.
+            if (BUFFER_SILENT == ppInputConnections[0]->u32BufferFlags)
+            {
+                ProcessFdaf(m_pFdaf, pf32OutputFrames, NULL, u32ValidFrameCount, u64QpcTime);
+                ppOutputConnections[0]->u32BufferFlags = IsFdafOutputSilent(m_pFdaf, u32ValidFrameCount) ? BUFFER_SILENT : BUFFER_VALID;
+            }
+            else
+            {
+                DownmixFrames(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, m_u32CaptureChannels, 1.0f);
+                ProcessFdaf(m_pFdaf, pf32OutputFrames, pf32OutputFrames, u32ValidFrameCount, u64QpcTime);
+                ppOutputConnections[0]->u32BufferFlags = BUFFER_VALID;
+            }
+
             // Set the valid frame count.
-            ppOutputConnections[0]->u32ValidFrameCount = ppInputConnections[0]->u32ValidFrameCount;
-            ppOutputConnections[0]->u32BufferFlags = ppInputConnections[0]->u32BufferFlags;
+            ppOutputConnections[0]->u32ValidFrameCount = u32ValidFrameCount;
 
             break;
         }
@@ -152,7 +168,8 @@ STDMETHODIMP CAecApoMFX::GetLatency(HNSTIME* pTime)
   
     IF_TRUE_ACTION_JUMP(NULL == pTime, hr = E_POINTER, Exit);  
   
-    *pTime = 0;
+    // The canceller works on whole blocks.
+    *pTime = (HNSTIME)AEC_BLOCK_FRAMES * 10000000 / SUPPORTED_AEC_SAMPLINGRATE;
 
 Exit:  
     return hr;  
@@ -196,6 +213,18 @@ STDMETHODIMP CAecApoMFX::LockForProcess(UINT32 u32NumInputConnections,
 
     m_u32SamplesPerFrame = uncompAudioFormat.dwSamplesPerFrame;
 
+    hr = ppInputConnections[0]->pFormat->GetUncompressedAudioFormat(&uncompAudioFormat);
+    IF_FAILED_JUMP(hr, Exit);
+
+    m_u32CaptureChannels = uncompAudioFormat.dwSamplesPerFrame;
+
+    if (NULL == m_pFdaf)
+    {
+        hr = AERT_Allocate(sizeof(AEC_FDAF), (void**)&m_pFdaf);
+        IF_FAILED_JUMP(hr, Exit);
+    }
+    InitializeFdaf(m_pFdaf);
+
     hr = CBaseAudioProcessingObject::LockForProcess(u32NumInputConnections,
         ppInputConnections, u32NumOutputConnections, ppOutputConnections);
     IF_FAILED_JUMP(hr, Exit);
@@ -204,6 +233,88 @@ Exit:
     return hr;
 }
 
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Unlocks the APO, logging how well the loopback kept aligned with the
+//  microphone over the stream.
+//
+// Return values:
+//
+//      S_OK                                Object is unlocked.
+//      APOERR_ALREADY_UNLOCKED             Object was not locked.
+STDMETHODIMP CAecApoMFX::UnlockForProcess(void)
+{
+    ASSERT_NONREALTIME();
+
+    if (m_bIsLocked && m_apoLoggingService != nullptr && NULL != m_pFdaf)
+    {
+        const AEC_ALIGNMENT_STATISTICS* pAlignment = &m_pFdaf->Alignment;
+
+        m_apoLoggingService->ApoLog(APO_LOG_LEVEL_INFO,
+            L"CAecApoMFX reference alignment: %.2f frames mean error, %.2f max, %.0f ppm drift, %u resyncs, %u frames missing.",
+            pAlignment->f32MeanError, pAlignment->f32MaxError, pAlignment->f32Drift * 1e6f,
+            pAlignment->u32Resyncs, pAlignment->u32MissingFrames);
+    }
+
+    return CBaseAudioProcessingObject::UnlockForProcess();
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Destructor.
+//
+// Parameters:
+//
+//     void
+//
+// Return values:
+//
+//      void
+//
+// Remarks:
+//
+//      This method deletes whatever was allocated.
+//
+//      This method may not be called from a real-time processing thread.
+//
+CAecApoMFX::~CAecApoMFX(void)
+{
+    // Free locked memory allocations
+    if (NULL != m_pFdaf)
+    {
+        AERT_Free(m_pFdaf);
+        m_pFdaf = NULL;
+    }
+} // ~CAecApoMFX
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Reads an endpoint's volume, 0 when muted. Notifications only report
+//  changes, so this gives the value until the first one.
+//
+static float GetEndpointMasterVolume(IMMDevice* device)
+{
+    CComPtr<IAudioEndpointVolume> spEndpointVolume;
+    float masterVolume = 1.0f;
+    BOOL muted = FALSE;
+
+    if (SUCCEEDED(device->Activate(__uuidof(IAudioEndpointVolume), CLSCTX_ALL, nullptr, (void**)&spEndpointVolume)))
+    {
+        if (FAILED(spEndpointVolume->GetMasterVolumeLevelScalar(&masterVolume)))
+        {
+            masterVolume = 1.0f;
+        }
+        if (SUCCEEDED(spEndpointVolume->GetMute(&muted)) && muted)
+        {
+            masterVolume = 0.0f;
+        }
+    }
+    return masterVolume;
+}
+
 // The method that this long comment refers to is "Initialize()"
 //-------------------------------------------------------------------------
 // Description:
@@ -301,6 +412,8 @@ HRESULT CAecApoMFX::Initialize(UINT32 cbDataSize, BYTE* pbyData)
         hr = papoSysFxInit3->pDeviceCollection->Item(numDevices - 1, &m_spCaptureDevice);
         IF_FAILED_JUMP(hr, Exit);
 
+        m_captureEndpointMasterVolume = GetEndpointMasterVolume(m_spCaptureDevice);
+
         m_bIsInitialized = true;
 
         // Try to get the logging service, but ignore errors as failure to do logging it is not fatal.
@@ -587,6 +700,9 @@ CAecApoMFX::AddAuxiliaryInput(
     CComPtr<IAudioMediaType> spSupportedType;
     ASSERT_NONREALTIME();
 
+    // m_spLoopbackDevice is shared with the notification callbacks
+    auto lock = wil::EnterCriticalSection(&m_CritSec);
+
     IF_TRUE_ACTION_JUMP(m_bIsLocked, hResult = APOERR_APO_LOCKED, Exit);
     IF_TRUE_ACTION_JUMP(!m_bIsInitialized, hResult = APOERR_NOT_INITIALIZED, Exit);
 
@@ -598,13 +714,17 @@ CAecApoMFX::AddAuxiliaryInput(
     // This APO can only handle 1 auxiliary input
     IF_TRUE_ACTION_JUMP(m_auxiliaryInputId != 0, hResult = APOERR_NUM_CONNECTIONS_INVALID, Exit);
 
+    UNCOMPRESSEDAUDIOFORMAT uncompAudioFormat;
+    hResult = pInputConnection->pFormat->GetUncompressedAudioFormat(&uncompAudioFormat);
+    IF_FAILED_JUMP(hResult, Exit);
+
+    m_u32LoopbackChannels = uncompAudioFormat.dwSamplesPerFrame;
     m_auxiliaryInputId = dwInputId;
 
     IF_TRUE_ACTION_JUMP( ((NULL == pbyData) && (0 != cbDataSize)), hResult = E_INVALIDARG, Exit);
     IF_TRUE_ACTION_JUMP( ((NULL != pbyData) && (0 == cbDataSize)), hResult = E_INVALIDARG, Exit);
     if (cbDataSize == sizeof(APOInitSystemEffects3))
     {
-        /*
         //
         // pbyData contains APOInitSystemEffects3 structure describing the loopback endpoint
         //
@@ -622,7 +742,8 @@ CAecApoMFX::AddAuxiliaryInput(
 
         hResult = papoSysFxInit3->pDeviceCollection->Item(numDevices - 1, &m_spLoopbackDevice);
         IF_FAILED_JUMP(hResult, Exit);
-        */
+
+        m_loopbackEndpointMasterVolume = GetEndpointMasterVolume(m_spLoopbackDevice);
     }
     else
     {
@@ -631,8 +752,6 @@ CAecApoMFX::AddAuxiliaryInput(
         //
     }
 
-    // Signal to AEC algorithm that there is a reference audio stream
-
 Exit:
     return hResult;
 }
@@ -643,6 +762,9 @@ CAecApoMFX::RemoveAuxiliaryInput(DWORD dwInputId)
     HRESULT hResult = S_OK;
     ASSERT_NONREALTIME();
 
+    // HandleNotification may be comparing against m_spLoopbackDevice
+    auto lock = wil::EnterCriticalSection(&m_CritSec);
+
     IF_TRUE_ACTION_JUMP(m_bIsLocked, hResult = APOERR_APO_LOCKED, Exit);
     IF_TRUE_ACTION_JUMP(!m_bIsInitialized, hResult = APOERR_NOT_INITIALIZED, Exit);
 
@@ -650,8 +772,8 @@ CAecApoMFX::RemoveAuxiliaryInput(DWORD dwInputId)
     IF_TRUE_ACTION_JUMP(m_auxiliaryInputId != dwInputId, hResult = APOERR_INVALID_INPUTID, Exit);
 
     m_auxiliaryInputId = 0;
-
-    // Signal to AEC algorithm that there is no longer any reference audio stream
+    m_spLoopbackDevice.Release();
+    m_loopbackEndpointMasterVolume = 1.0f;
 
 Exit:
     return hResult;
@@ -694,14 +816,23 @@ CAecApoMFX::AcceptInput(DWORD dwInputId,
     ATLASSERT(m_bIsLocked);
 
     ATLASSERT(pInputConnection->u32Signature == APO_CONNECTION_PROPERTY_V2_SIGNATURE);
-    ATLASSERT(inputId == m_auxiliaryInputId);
+    ATLASSERT(dwInputId == m_auxiliaryInputId);
     UNREFERENCED_PARAMETER(dwInputId);
 
     const APO_CONNECTION_PROPERTY_V2* connectionV2 = reinterpret_cast<const APO_CONNECTION_PROPERTY_V2*>(pInputConnection);
 
-    // Check connectionV2->property.u32BufferFlags to see whether loopback buffer is silent
+    // Both endpoint volumes are applied after the loopback tap, the render
+    // one before the echo reaches the microphone and the capture one on the
+    // way into this APO, so the reference is scaled by the two.
+    FLOAT32 f32Gain = m_loopbackEndpointMasterVolume * m_captureEndpointMasterVolume;
+
     // Provide loopback buffer and timestamp to AEC algorithm
-    UNREFERENCED_PARAMETER(connectionV2);
+    WriteFdafReference(m_pFdaf,
+                       (BUFFER_SILENT == connectionV2->property.u32BufferFlags) ? NULL : reinterpret_cast<const FLOAT32*>(connectionV2->property.pBuffer),
+                       connectionV2->property.u32ValidFrameCount,
+                       m_u32LoopbackChannels,
+                       f32Gain,
+                       (APO_CONNECTION_PROPERTY_V2_SIGNATURE == pInputConnection->u32Signature) ? connectionV2->u64QpcTime : 0);
 }
 
 STDMETHODIMP CAecApoMFX::GetApoNotificationRegistrationInfo(_Out_writes_(*count) APO_NOTIFICATION_DESCRIPTOR** apoNotifications, _Out_ DWORD* count)
@@ -709,30 +840,43 @@ STDMETHODIMP CAecApoMFX::GetApoNotificationRegistrationInfo(_Out_writes_(*count)
     *apoNotifications = nullptr;
     *count = 0;
 
-    /*
-    RETURN_HR_IF_NULL(E_FAIL, m_spCaptureDevice);
-    RETURN_HR_IF_NULL(E_FAIL, m_spLoopbackDevice);
+    // Without APOInitSystemEffects3 there are no devices to register on.
+    DWORD numDescriptors = 0;
+    IMMDevice* devices[2];
+
+    auto lock = wil::EnterCriticalSection(&m_CritSec);
+
+    if (m_spCaptureDevice != nullptr)
+    {
+        devices[numDescriptors++] = m_spCaptureDevice;
+    }
+    if (m_spLoopbackDevice != nullptr)
+    {
+        devices[numDescriptors++] = m_spLoopbackDevice;
+    }
+    if (numDescriptors == 0)
+    {
+        return S_OK;
+    }
 
     // Let the OS know what notifications we are interested in by returning an array of
     // APO_NOTIFICATION_DESCRIPTORs.
-    constexpr DWORD numDescriptors = 2;
     wil::unique_cotaskmem_ptr<APO_NOTIFICATION_DESCRIPTOR[]> apoNotificationDescriptors;
 
     apoNotificationDescriptors.reset(
         static_cast<APO_NOTIFICATION_DESCRIPTOR*>(CoTaskMemAlloc(sizeof(APO_NOTIFICATION_DESCRIPTOR) * numDescriptors)));
     RETURN_IF_NULL_ALLOC(apoNotificationDescriptors);
 
-    // Our APO wants to get notified when a endpoint volume changes on the capture endpoint.
-    apoNotificationDescriptors[0].type = APO_NOTIFICATION_TYPE_ENDPOINT_VOLUME;
-    (void)m_spCaptureDevice->QueryInterface(&apoNotificationDescriptors[0].audioEndpointVolume.device);
-
-    // Our APO wants to get notified when a endpoint volume changes on the auxiliary input endpoint.
-    apoNotificationDescriptors[1].type = APO_NOTIFICATION_TYPE_ENDPOINT_VOLUME;
-    (void)m_spLoopbackDevice->QueryInterface(&apoNotificationDescriptors[1].audioEndpointVolume.device);
+    // Our APO wants to get notified when the endpoint volume changes on the capture
+    // endpoint and on the auxiliary input endpoint.
+    for (DWORD i = 0; i < numDescriptors; i++)
+    {
+        apoNotificationDescriptors[i].type = APO_NOTIFICATION_TYPE_ENDPOINT_VOLUME;
+        (void)devices[i]->QueryInterface(&apoNotificationDescriptors[i].audioEndpointVolume.device);
+    }
 
     *apoNotifications = apoNotificationDescriptors.release();
     *count = numDescriptors;
-    */
 
     return S_OK;
 }
@@ -757,29 +901,26 @@ static bool IsSameEndpointId(IMMDevice* device1, IMMDevice* device2)
 // APO_NOTIFICATION_DESCRIPTOR elements in the array that was returned by GetApoNotificationRegistrationInfo.
 // Note that the APO will have to query each property once to get its initial value because this method is
 // only invoked when any of the properties have changed.
-STDMETHODIMP_(void) CAecApoMFX::HandleNotification(_In_ APO_NOTIFICATION* /* apoNotification */)
+STDMETHODIMP_(void) CAecApoMFX::HandleNotification(_In_ APO_NOTIFICATION* apoNotification)
 {
     // Handle endpoint volume change
-    /* 
-    if (apoNotification->type == APO_NOTIFICATION_TYPE_ENDPOINT_PROPERTY_CHANGE)
+    if (apoNotification->type == APO_NOTIFICATION_TYPE_ENDPOINT_VOLUME)
     {
-        if (IsSameEndpointId(apoNotification->audioEndpointVolumeChange.endpoint, m_spCaptureDevice))
-        {            
-            m_captureEndpointMasterVolume = apoNotification->audioEndpointVolumeChange.volume->fMasterVolume;
+        // RemoveAuxiliaryInput releases the loopback device under the same
+        // lock, so it stays alive while it is compared here.
+        auto lock = wil::EnterCriticalSection(&m_CritSec);
+
+        PAUDIO_VOLUME_NOTIFICATION_DATA volume = apoNotification->audioEndpointVolumeChange.volume;
+        float masterVolume = volume->bMuted ? 0.0f : volume->fMasterVolume;
+
+        if (m_spCaptureDevice != nullptr && IsSameEndpointId(apoNotification->audioEndpointVolumeChange.endpoint, m_spCaptureDevice))
+        {
+            m_captureEndpointMasterVolume = masterVolume;
         }
-        else if (IsSameEndpointId(apoNotification->audioEndpointVolumeChange.endpoint, m_spLoopbackDevice))
+        else if (m_spLoopbackDevice != nullptr && IsSameEndpointId(apoNotification->audioEndpointVolumeChange.endpoint, m_spLoopbackDevice))
         {
-            m_loopbackEndpointMasterVolume = apoNotification->audioEndpointVolumeChange.volume->fMasterVolume;
+            m_loopbackEndpointMasterVolume = masterVolume;
         }
     }
-    else if (apoNotification->type == APO_NOTIFICATION_TYPE_ENDPOINT_PROPERTY_CHANGE)
-    {
-
-    }
-    else if(apoNotification->type == APO_NOTIFICATION_TYPE_SYSTEM_EFFECTS_PROPERTY_CHANGE)
-    {
-
-    } 
-    */
 }
 
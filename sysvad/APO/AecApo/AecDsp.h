@@ -0,0 +1,131 @@
+//
+// AecDsp.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//   Declaration of the echo canceller the AEC APO wraps.
+//
+
+#pragma once
+
+#include <ApoPlatform.h>
+#include <ApoDsp.h>
+
+//
+// Echo canceller: a partitioned block frequency domain adaptive filter.
+// The echo path is AEC_PARTITIONS partitions of AEC_BLOCK_FRAMES frames,
+// adapted once per block with a normalized step per frequency bin.
+//
+#define AEC_BLOCK_FRAMES            128                         // 8 ms at 16 kHz, also the latency.
+#define AEC_FFT_SIZE                (2 * AEC_BLOCK_FRAMES)
+#define AEC_BINS                    (AEC_BLOCK_FRAMES + 1)
+#define AEC_BINS_PADDED             (AEC_BLOCK_FRAMES + 4)      // A multiple of 4, zero past AEC_BINS.
+#define AEC_PARTITIONS              16                          // 128 ms of echo path.
+
+#define SUPPORTED_AEC_SAMPLINGRATE  (16000)
+
+//
+// The loopback is kept in a ring of AEC_REFERENCE_FRAMES frames, and read
+// at the frame whose loopback time is the capture time less a guard. The
+// read step follows the drift between the two clocks, reading between
+// frames with a windowed sinc of AEC_INTERPOLATION_TAPS taps, whose
+// AEC_INTERPOLATION_PHASES phases are interpolated in turn.
+//
+#define AEC_REFERENCE_FRAMES        4096                        // 256 ms of loopback, a power of two.
+#define AEC_INTERPOLATION_TAPS      8
+#define AEC_INTERPOLATION_PHASES    128
+#define AEC_ALIGNMENT_GUARD_FRAMES  32                          // 2 ms of echo path ahead of the capture time.
+#define AEC_ALIGNMENT_RESYNC_FRAMES 80                          // Errors past 5 ms are jumps, not drift.
+#define AEC_ALIGNMENT_MAX_DRIFT     0.001f                      // 1000 ppm
+
+typedef struct _AEC_ALIGNMENT_STATISTICS
+{
+    FLOAT32         f32LastError;                   // Frames the reference read was off at the last capture buffer.
+    FLOAT32         f32MeanError;                   // Smoothed magnitude of the error.
+    FLOAT32         f32MaxError;                    // Since the last resync.
+    FLOAT32         f32Drift;                       // Reference frames read per capture frame, less one.
+    UINT32          u32Resyncs;
+    UINT32          u32MissingFrames;               // Reference frames read before they were written.
+} AEC_ALIGNMENT_STATISTICS;
+
+typedef struct _AEC_SPECTRUM
+{
+    FLOAT32         af32Re[AEC_BINS_PADDED];
+    FLOAT32         af32Im[AEC_BINS_PADDED];
+} AEC_SPECTRUM;
+
+typedef struct _AEC_FDAF
+{
+    // The real FFT is an AEC_BLOCK_FRAMES point complex FFT, whose stage
+    // with butterflies h apart has its twiddles at h - 1, and a last pass
+    // with a twiddle per bin.
+    FLOAT32         af32TwiddleRe[AEC_BLOCK_FRAMES];
+    FLOAT32         af32TwiddleIm[AEC_BLOCK_FRAMES];
+    FLOAT32         af32BinTwiddleRe[AEC_BINS];
+    FLOAT32         af32BinTwiddleIm[AEC_BINS];
+    UINT8           au8BitReverse[AEC_BLOCK_FRAMES];
+
+    // Phase p reads p / AEC_INTERPOLATION_PHASES of a frame late; the last
+    // is the first one a whole frame on.
+    FLOAT32         af32Interpolation[AEC_INTERPOLATION_PHASES + 1][AEC_INTERPOLATION_TAPS];
+
+    AEC_SPECTRUM    aReference[AEC_PARTITIONS];     // Newest at u32Newest, each next one a block older.
+    AEC_SPECTRUM    aFilter[AEC_PARTITIONS];
+    FLOAT32         af32Power[AEC_BINS_PADDED];     // Smoothed reference power, times AEC_PARTITIONS.
+    UINT32          u32Newest;
+
+    FLOAT32         af32Reference[AEC_FFT_SIZE];    // The last block of reference, then the one being filled.
+    FLOAT32         af32Capture[AEC_BLOCK_FRAMES];  // The block being filled.
+    FLOAT32         af32Output[AEC_BLOCK_FRAMES];   // The last block, echo removed.
+    UINT32          u32Position;                    // Frames filled of the current block.
+    UINT32          u32SilentFrames;                // Silent capture frames since the last valid one.
+
+    FLOAT32         af32Queue[AEC_REFERENCE_FRAMES];
+    UINT32          u32QueueWrite;                  // Frames written, wrapping.
+    UINT32          u32QueueTimeFrame;              // The last frame written with a time,
+    UINT64          u64QueueTime;                   // and that time, or 0 for none.
+
+    UINT32          u32ReadFrame;                   // The frame before the read position,
+    FLOAT32         f32ReadFraction;                // and how far past it.
+    FLOAT32         f32ReadError;                   // Filtered alignment error, in frames.
+    BOOL            bAligned;
+    AEC_ALIGNMENT_STATISTICS Alignment;
+
+    AEC_SPECTRUM    Work;
+    AEC_SPECTRUM    Error;
+    FLOAT32         af32Time[AEC_FFT_SIZE];
+} AEC_FDAF;
+
+void InitializeFdaf(
+    _Out_ AEC_FDAF *pFdaf );
+
+void WriteFdafReference(
+    _Inout_ AEC_FDAF *pFdaf,
+    _In_reads_opt_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32Frames,
+    UINT32   u32FrameCount,
+    UINT32   u32SamplesPerFrame,
+    FLOAT32  f32Gain,
+    UINT64   u64QpcTime );
+
+void DownmixFrames(
+    _Out_writes_(u32FrameCount)
+        FLOAT32 *pf32Mono,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32Frames,
+    UINT32   u32FrameCount,
+    UINT32   u32SamplesPerFrame,
+    FLOAT32  f32Gain );
+
+void ProcessFdaf(
+    _Inout_ AEC_FDAF *pFdaf,
+    _Out_writes_(u32FrameCount)
+        FLOAT32 *pf32Output,
+    _In_reads_opt_(u32FrameCount)
+        const FLOAT32 *pf32Capture,
+    UINT32   u32FrameCount,
+    UINT64   u64QpcTime );
+
+BOOL IsFdafOutputSilent(
+    const AEC_FDAF *pFdaf,
+    UINT32   u32FrameCount );
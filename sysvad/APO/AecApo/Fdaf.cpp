@@ -0,0 +1,853 @@
+//
+// Fdaf.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Implementation of the echo canceller's adaptive filter
+//
+//  Overlap-save with blocks of N = AEC_BLOCK_FRAMES frames: every block, the
+//  last 2N reference frames are transformed into the newest partition, the
+//  echo estimate is the last N frames of the inverse transform of the sum of
+//  each partition times its filter, and the error is the capture minus the
+//  estimate. Each filter then steps along conj(reference) * error, divided
+//  per bin by the smoothed reference power, and is constrained back to N
+//  taps so that the circular convolution stays linear.
+//
+//  Spectra are kept as separate real and imaginary arrays, so complex math
+//  vectorizes across bins without any shuffling.
+//
+//  A block of silent capture has no echo to cancel and nothing to learn
+//  from: adapting to it would only pull the filter toward zero. Only its
+//  reference is transformed, so the partitions stay in step for the next
+//  block of capture, and its output is silence.
+//
+#include <ApoPlatform.h>
+
+#include <float.h>
+#include <math.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include "AecDsp.h"
+
+#define AEC_PI                  3.14159265358979323846
+
+#define AEC_STEP                0.5f        // Of the normalized step, less than 1 to converge.
+#define AEC_POWER_SMOOTHING     0.9f        // Per block, about 80 ms.
+#define AEC_REGULARIZATION      (AEC_FFT_SIZE * AEC_PARTITIONS * 1e-6f) // Keeps the step bounded in silence, -60 dBFS.
+#define AEC_POWER_FLOOR         0.03f       // Of the mean power, keeps bins the reference barely reaches from taking huge steps.
+
+#define AEC_ALIGNMENT_TIME_FRAMES   32000.0f    // Alignment errors are steered out over about 2 s,
+#define AEC_ALIGNMENT_FILTER_FRAMES 8000.0f     // after averaging out timestamp jitter over 500 ms.
+#define AEC_ALIGNMENT_SMOOTHING     0.01f       // Of the mean error, per capture buffer.
+#define AEC_INTERPOLATION_CUTOFF    0.9         // Of the Nyquist frequency.
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+
+#if defined(_M_ARM64)
+typedef float32x4_t AEC_VECTOR;
+#define AecVectorSplat(x)       vdupq_n_f32(x)
+#define AecVectorLoad(p)        vld1q_f32(p)
+#define AecVectorStore(p, v)    vst1q_f32(p, v)
+#define AecVectorAdd(a, b)      vaddq_f32(a, b)
+#define AecVectorSub(a, b)      vsubq_f32(a, b)
+#define AecVectorMul(a, b)      vmulq_f32(a, b)
+#define AecVectorDiv(a, b)      vdivq_f32(a, b)
+#define AecVectorMin(a, b)      vminq_f32(a, b)
+#define AecVectorSqrt(a)        vsqrtq_f32(a)
+#else
+typedef __m128 AEC_VECTOR;
+#define AecVectorSplat(x)       _mm_set1_ps(x)
+#define AecVectorLoad(p)        _mm_loadu_ps(p)
+#define AecVectorStore(p, v)    _mm_storeu_ps(p, v)
+#define AecVectorAdd(a, b)      _mm_add_ps(a, b)
+#define AecVectorSub(a, b)      _mm_sub_ps(a, b)
+#define AecVectorMul(a, b)      _mm_mul_ps(a, b)
+#define AecVectorDiv(a, b)      _mm_div_ps(a, b)
+#define AecVectorMin(a, b)      _mm_min_ps(a, b)
+#define AecVectorSqrt(a)        _mm_sqrt_ps(a)
+#endif
+
+#define AEC_SIMD
+
+#endif
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Builds the FFT tables and clears the filter and all history.
+//
+void InitializeFdaf(
+    _Out_ AEC_FDAF *pFdaf )
+{
+    UINT32 u32Bits = 0;
+
+    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pFdaf) );
+
+    ZeroMemory(pFdaf, sizeof(AEC_FDAF));
+
+    while ((1u << u32Bits) < AEC_BLOCK_FRAMES)
+    {
+        u32Bits++;
+    }
+
+    for (UINT32 n = 0; n < AEC_BLOCK_FRAMES; n++)
+    {
+        UINT32 r = 0;
+
+        for (UINT32 b = 0; b < u32Bits; b++)
+        {
+            r |= ((n >> b) & 1) << (u32Bits - 1 - b);
+        }
+        pFdaf->au8BitReverse[n] = (UINT8)r;
+    }
+
+    for (UINT32 h = 1; h < AEC_BLOCK_FRAMES; h *= 2)
+    {
+        for (UINT32 j = 0; j < h; j++)
+        {
+            pFdaf->af32TwiddleRe[h - 1 + j] = (FLOAT32)cos(AEC_PI * j / h);
+            pFdaf->af32TwiddleIm[h - 1 + j] = (FLOAT32)-sin(AEC_PI * j / h);
+        }
+    }
+
+    for (UINT32 k = 0; k < AEC_BINS; k++)
+    {
+        pFdaf->af32BinTwiddleRe[k] = (FLOAT32)cos(AEC_PI * k / AEC_BLOCK_FRAMES);
+        pFdaf->af32BinTwiddleIm[k] = (FLOAT32)-sin(AEC_PI * k / AEC_BLOCK_FRAMES);
+    }
+
+    // Tap k of phase p multiplies the frame k - AEC_INTERPOLATION_TAPS / 2 + 1
+    // after the one read, under a Blackman window. Each phase has unity gain.
+    for (UINT32 p = 0; p <= AEC_INTERPOLATION_PHASES; p++)
+    {
+        DOUBLE af64Taps[AEC_INTERPOLATION_TAPS];
+        DOUBLE f64Sum = 0.0;
+
+        for (UINT32 k = 0; k < AEC_INTERPOLATION_TAPS; k++)
+        {
+            DOUBLE x = (DOUBLE)k - (AEC_INTERPOLATION_TAPS / 2 - 1) - (DOUBLE)p / AEC_INTERPOLATION_PHASES;
+            DOUBLE w = 0.42 + 0.5 * cos(AEC_PI * x / (AEC_INTERPOLATION_TAPS / 2)) + 0.08 * cos(2.0 * AEC_PI * x / (AEC_INTERPOLATION_TAPS / 2));
+
+            af64Taps[k] = w * ((x == 0.0) ? AEC_INTERPOLATION_CUTOFF : sin(AEC_PI * AEC_INTERPOLATION_CUTOFF * x) / (AEC_PI * x));
+            f64Sum += af64Taps[k];
+        }
+
+        for (UINT32 k = 0; k < AEC_INTERPOLATION_TAPS; k++)
+        {
+            pFdaf->af32Interpolation[p][k] = (FLOAT32)(af64Taps[k] / f64Sum);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  In place AEC_BLOCK_FRAMES point FFT, radix 2 with decimation in time.
+//  Swapping the real and imaginary arrays makes it the inverse, unscaled.
+//
+#pragma AVRT_CODE_BEGIN
+static void FftBlock(
+    const AEC_FDAF *pFdaf,
+    FLOAT32 *pf32Re,
+    FLOAT32 *pf32Im )
+{
+    for (UINT32 n = 0; n < AEC_BLOCK_FRAMES; n++)
+    {
+        UINT32 r = pFdaf->au8BitReverse[n];
+
+        if (r > n)
+        {
+            FLOAT32 f32Re = pf32Re[n];
+            FLOAT32 f32Im = pf32Im[n];
+
+            pf32Re[n] = pf32Re[r];
+            pf32Im[n] = pf32Im[r];
+            pf32Re[r] = f32Re;
+            pf32Im[r] = f32Im;
+        }
+    }
+
+    // The first two stages have no twiddle but -i.
+    for (UINT32 g = 0; g < AEC_BLOCK_FRAMES; g += 4)
+    {
+        FLOAT32 f32Re0 = pf32Re[g] + pf32Re[g + 1];
+        FLOAT32 f32Im0 = pf32Im[g] + pf32Im[g + 1];
+        FLOAT32 f32Re1 = pf32Re[g] - pf32Re[g + 1];
+        FLOAT32 f32Im1 = pf32Im[g] - pf32Im[g + 1];
+        FLOAT32 f32Re2 = pf32Re[g + 2] + pf32Re[g + 3];
+        FLOAT32 f32Im2 = pf32Im[g + 2] + pf32Im[g + 3];
+        FLOAT32 f32Re3 = pf32Re[g + 2] - pf32Re[g + 3];
+        FLOAT32 f32Im3 = pf32Im[g + 2] - pf32Im[g + 3];
+
+        pf32Re[g] = f32Re0 + f32Re2;
+        pf32Im[g] = f32Im0 + f32Im2;
+        pf32Re[g + 2] = f32Re0 - f32Re2;
+        pf32Im[g + 2] = f32Im0 - f32Im2;
+        pf32Re[g + 1] = f32Re1 + f32Im3;
+        pf32Im[g + 1] = f32Im1 - f32Re3;
+        pf32Re[g + 3] = f32Re1 - f32Im3;
+        pf32Im[g + 3] = f32Im1 + f32Re3;
+    }
+
+    for (UINT32 h = 4; h < AEC_BLOCK_FRAMES; h *= 2)
+    {
+        const FLOAT32 *pf32TwiddleRe = pFdaf->af32TwiddleRe + h - 1;
+        const FLOAT32 *pf32TwiddleIm = pFdaf->af32TwiddleIm + h - 1;
+
+        for (UINT32 g = 0; g < AEC_BLOCK_FRAMES; g += 2 * h)
+        {
+            FLOAT32 *pf32ReA = pf32Re + g;
+            FLOAT32 *pf32ImA = pf32Im + g;
+            FLOAT32 *pf32ReB = pf32ReA + h;
+            FLOAT32 *pf32ImB = pf32ImA + h;
+#ifdef AEC_SIMD
+            for (UINT32 j = 0; j < h; j += 4)
+            {
+                AEC_VECTOR vWRe = AecVectorLoad(pf32TwiddleRe + j);
+                AEC_VECTOR vWIm = AecVectorLoad(pf32TwiddleIm + j);
+                AEC_VECTOR vBRe = AecVectorLoad(pf32ReB + j);
+                AEC_VECTOR vBIm = AecVectorLoad(pf32ImB + j);
+                AEC_VECTOR vARe = AecVectorLoad(pf32ReA + j);
+                AEC_VECTOR vAIm = AecVectorLoad(pf32ImA + j);
+                AEC_VECTOR vTRe = AecVectorSub(AecVectorMul(vWRe, vBRe), AecVectorMul(vWIm, vBIm));
+                AEC_VECTOR vTIm = AecVectorAdd(AecVectorMul(vWRe, vBIm), AecVectorMul(vWIm, vBRe));
+
+                AecVectorStore(pf32ReB + j, AecVectorSub(vARe, vTRe));
+                AecVectorStore(pf32ImB + j, AecVectorSub(vAIm, vTIm));
+                AecVectorStore(pf32ReA + j, AecVectorAdd(vARe, vTRe));
+                AecVectorStore(pf32ImA + j, AecVectorAdd(vAIm, vTIm));
+            }
+#else
+            for (UINT32 j = 0; j < h; j++)
+            {
+                FLOAT32 f32TRe = pf32TwiddleRe[j] * pf32ReB[j] - pf32TwiddleIm[j] * pf32ImB[j];
+                FLOAT32 f32TIm = pf32TwiddleRe[j] * pf32ImB[j] + pf32TwiddleIm[j] * pf32ReB[j];
+
+                pf32ReB[j] = pf32ReA[j] - f32TRe;
+                pf32ImB[j] = pf32ImA[j] - f32TIm;
+                pf32ReA[j] += f32TRe;
+                pf32ImA[j] += f32TIm;
+            }
+#endif
+        }
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Transforms AEC_FFT_SIZE real samples into AEC_BINS bins: the even and
+//  odd samples are the real and imaginary parts of one block sized FFT,
+//  separated again with a twiddle per bin.
+//
+#pragma AVRT_CODE_BEGIN
+static void FftReal(
+    AEC_FDAF *pFdaf,
+    AEC_SPECTRUM *pSpectrum,
+    const FLOAT32 *pf32Samples )
+{
+    FLOAT32 *pf32Re = pFdaf->Work.af32Re;
+    FLOAT32 *pf32Im = pFdaf->Work.af32Im;
+
+    for (UINT32 n = 0; n < AEC_BLOCK_FRAMES; n++)
+    {
+        pf32Re[n] = pf32Samples[2 * n];
+        pf32Im[n] = pf32Samples[2 * n + 1];
+    }
+
+    FftBlock(pFdaf, pf32Re, pf32Im);
+
+    pSpectrum->af32Re[0] = pf32Re[0] + pf32Im[0];
+    pSpectrum->af32Im[0] = 0.0f;
+    pSpectrum->af32Re[AEC_BLOCK_FRAMES] = pf32Re[0] - pf32Im[0];
+    pSpectrum->af32Im[AEC_BLOCK_FRAMES] = 0.0f;
+
+    for (UINT32 k = 1; k < AEC_BLOCK_FRAMES; k++)
+    {
+        UINT32 c = AEC_BLOCK_FRAMES - k;
+        FLOAT32 f32EvenRe = 0.5f * (pf32Re[k] + pf32Re[c]);
+        FLOAT32 f32EvenIm = 0.5f * (pf32Im[k] - pf32Im[c]);
+        FLOAT32 f32OddRe = 0.5f * (pf32Im[k] + pf32Im[c]);
+        FLOAT32 f32OddIm = 0.5f * (pf32Re[c] - pf32Re[k]);
+        FLOAT32 f32WRe = pFdaf->af32BinTwiddleRe[k];
+        FLOAT32 f32WIm = pFdaf->af32BinTwiddleIm[k];
+
+        pSpectrum->af32Re[k] = f32EvenRe + f32WRe * f32OddRe - f32WIm * f32OddIm;
+        pSpectrum->af32Im[k] = f32EvenIm + f32WRe * f32OddIm + f32WIm * f32OddRe;
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Inverse of FftReal, scaled by AEC_FFT_SIZE.
+//
+#pragma AVRT_CODE_BEGIN
+static void InverseFftReal(
+    AEC_FDAF *pFdaf,
+    FLOAT32 *pf32Samples,
+    const AEC_SPECTRUM *pSpectrum )
+{
+    FLOAT32 *pf32Re = pFdaf->Work.af32Re;
+    FLOAT32 *pf32Im = pFdaf->Work.af32Im;
+
+    for (UINT32 k = 0; k < AEC_BLOCK_FRAMES; k++)
+    {
+        UINT32 c = AEC_BLOCK_FRAMES - k;
+        FLOAT32 f32EvenRe = pSpectrum->af32Re[k] + pSpectrum->af32Re[c];
+        FLOAT32 f32EvenIm = pSpectrum->af32Im[k] - pSpectrum->af32Im[c];
+        FLOAT32 f32DiffRe = pSpectrum->af32Re[k] - pSpectrum->af32Re[c];
+        FLOAT32 f32DiffIm = pSpectrum->af32Im[k] + pSpectrum->af32Im[c];
+        FLOAT32 f32WRe = pFdaf->af32BinTwiddleRe[k];
+        FLOAT32 f32WIm = -pFdaf->af32BinTwiddleIm[k];
+        FLOAT32 f32OddRe = f32WRe * f32DiffRe - f32WIm * f32DiffIm;
+        FLOAT32 f32OddIm = f32WRe * f32DiffIm + f32WIm * f32DiffRe;
+
+        pf32Re[k] = f32EvenRe - f32OddIm;
+        pf32Im[k] = f32EvenIm + f32OddRe;
+    }
+
+    FftBlock(pFdaf, pf32Im, pf32Re);
+
+    for (UINT32 n = 0; n < AEC_BLOCK_FRAMES; n++)
+    {
+        pf32Samples[2 * n] = pf32Re[n];
+        pf32Samples[2 * n + 1] = pf32Im[n];
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Echo estimate: the sum of each partition times its filter.
+//
+#pragma AVRT_CODE_BEGIN
+static void FilterFdaf(
+    const AEC_FDAF *pFdaf,
+    AEC_SPECTRUM *pEstimate )
+{
+    ZeroMemory(pEstimate, sizeof(AEC_SPECTRUM));
+
+    for (UINT32 p = 0; p < AEC_PARTITIONS; p++)
+    {
+        const AEC_SPECTRUM *pX = &pFdaf->aReference[(pFdaf->u32Newest + p) % AEC_PARTITIONS];
+        const AEC_SPECTRUM *pW = &pFdaf->aFilter[p];
+#ifdef AEC_SIMD
+        for (UINT32 k = 0; k < AEC_BINS_PADDED; k += 4)
+        {
+            AEC_VECTOR vXRe = AecVectorLoad(pX->af32Re + k);
+            AEC_VECTOR vXIm = AecVectorLoad(pX->af32Im + k);
+            AEC_VECTOR vWRe = AecVectorLoad(pW->af32Re + k);
+            AEC_VECTOR vWIm = AecVectorLoad(pW->af32Im + k);
+            AEC_VECTOR vYRe = AecVectorLoad(pEstimate->af32Re + k);
+            AEC_VECTOR vYIm = AecVectorLoad(pEstimate->af32Im + k);
+
+            vYRe = AecVectorAdd(vYRe, AecVectorSub(AecVectorMul(vXRe, vWRe), AecVectorMul(vXIm, vWIm)));
+            vYIm = AecVectorAdd(vYIm, AecVectorAdd(AecVectorMul(vXRe, vWIm), AecVectorMul(vXIm, vWRe)));
+            AecVectorStore(pEstimate->af32Re + k, vYRe);
+            AecVectorStore(pEstimate->af32Im + k, vYIm);
+        }
+#else
+        for (UINT32 k = 0; k < AEC_BINS; k++)
+        {
+            pEstimate->af32Re[k] += pX->af32Re[k] * pW->af32Re[k] - pX->af32Im[k] * pW->af32Im[k];
+            pEstimate->af32Im[k] += pX->af32Re[k] * pW->af32Im[k] + pX->af32Im[k] * pW->af32Re[k];
+        }
+#endif
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Updates the reference power with the newest partition and turns the
+//  error spectrum into the normalized step. Each bin is normalized by its
+//  own power, but no less than a fraction of the mean: with tonal input,
+//  the bins between the tones would otherwise take steps far too large,
+//  which the constraint then spreads over all the bins. The error is also
+//  limited to the level the reference could account for, so near end
+//  speech moves the filter no further than echo would.
+//
+#pragma AVRT_CODE_BEGIN
+static void NormalizeFdafError(
+    AEC_FDAF *pFdaf )
+{
+    const AEC_SPECTRUM *pX = &pFdaf->aReference[pFdaf->u32Newest];
+    AEC_SPECTRUM *pE = &pFdaf->Error;
+    FLOAT32 *pf32Power = pFdaf->af32Power;
+    FLOAT32 f32Floor;
+#ifdef AEC_SIMD
+    FLOAT32 af32Sum[4];
+    AEC_VECTOR vSmoothing = AecVectorSplat(AEC_POWER_SMOOTHING);
+    AEC_VECTOR vWeight = AecVectorSplat((1.0f - AEC_POWER_SMOOTHING) * AEC_PARTITIONS);
+    AEC_VECTOR vRegularization = AecVectorSplat(AEC_REGULARIZATION);
+    AEC_VECTOR vStep = AecVectorSplat(AEC_STEP);
+    AEC_VECTOR vOne = AecVectorSplat(1.0f);
+    AEC_VECTOR vSum = AecVectorSplat(0.0f);
+    AEC_VECTOR vFloor;
+
+    for (UINT32 k = 0; k < AEC_BINS_PADDED; k += 4)
+    {
+        AEC_VECTOR vXRe = AecVectorLoad(pX->af32Re + k);
+        AEC_VECTOR vXIm = AecVectorLoad(pX->af32Im + k);
+        AEC_VECTOR vPower = AecVectorAdd(AecVectorMul(vSmoothing, AecVectorLoad(pf32Power + k)),
+                                         AecVectorMul(vWeight, AecVectorAdd(AecVectorMul(vXRe, vXRe), AecVectorMul(vXIm, vXIm))));
+
+        AecVectorStore(pf32Power + k, vPower);
+        vSum = AecVectorAdd(vSum, vPower);
+    }
+    AecVectorStore(af32Sum, vSum);
+    f32Floor = AEC_REGULARIZATION + AEC_POWER_FLOOR * (af32Sum[0] + af32Sum[1] + af32Sum[2] + af32Sum[3]) / AEC_BINS;
+    vFloor = AecVectorSplat(f32Floor);
+
+    for (UINT32 k = 0; k < AEC_BINS_PADDED; k += 4)
+    {
+        AEC_VECTOR vERe = AecVectorLoad(pE->af32Re + k);
+        AEC_VECTOR vEIm = AecVectorLoad(pE->af32Im + k);
+        AEC_VECTOR vPower = AecVectorAdd(AecVectorLoad(pf32Power + k), vRegularization);
+        AEC_VECTOR vError = AecVectorAdd(AecVectorAdd(AecVectorMul(vERe, vERe), AecVectorMul(vEIm, vEIm)), vRegularization);
+        AEC_VECTOR vGain = AecVectorMul(AecVectorSqrt(AecVectorMin(vOne, AecVectorDiv(vPower, vError))),
+                                        AecVectorDiv(vStep, AecVectorAdd(AecVectorLoad(pf32Power + k), vFloor)));
+
+        AecVectorStore(pE->af32Re + k, AecVectorMul(vERe, vGain));
+        AecVectorStore(pE->af32Im + k, AecVectorMul(vEIm, vGain));
+    }
+#else
+    FLOAT32 f32Sum = 0.0f;
+
+    for (UINT32 k = 0; k < AEC_BINS; k++)
+    {
+        pf32Power[k] = AEC_POWER_SMOOTHING * pf32Power[k] +
+                       (1.0f - AEC_POWER_SMOOTHING) * AEC_PARTITIONS * (pX->af32Re[k] * pX->af32Re[k] + pX->af32Im[k] * pX->af32Im[k]);
+        f32Sum += pf32Power[k];
+    }
+    f32Floor = AEC_REGULARIZATION + AEC_POWER_FLOOR * f32Sum / AEC_BINS;
+
+    for (UINT32 k = 0; k < AEC_BINS; k++)
+    {
+        FLOAT32 f32Error = pE->af32Re[k] * pE->af32Re[k] + pE->af32Im[k] * pE->af32Im[k] + AEC_REGULARIZATION;
+        FLOAT32 f32Gain = sqrtf(min(1.0f, (pf32Power[k] + AEC_REGULARIZATION) / f32Error)) * AEC_STEP / (pf32Power[k] + f32Floor);
+
+        pE->af32Re[k] *= f32Gain;
+        pE->af32Im[k] *= f32Gain;
+    }
+#endif
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Steps each filter along conj(reference) * normalized error, then
+//  constrains it to AEC_BLOCK_FRAMES taps.
+//
+#pragma AVRT_CODE_BEGIN
+static void AdaptFdaf(
+    AEC_FDAF *pFdaf )
+{
+    const AEC_SPECTRUM *pE = &pFdaf->Error;
+    FLOAT32 *pf32Time = pFdaf->af32Time;
+
+    for (UINT32 p = 0; p < AEC_PARTITIONS; p++)
+    {
+        const AEC_SPECTRUM *pX = &pFdaf->aReference[(pFdaf->u32Newest + p) % AEC_PARTITIONS];
+        AEC_SPECTRUM *pW = &pFdaf->aFilter[p];
+#ifdef AEC_SIMD
+        for (UINT32 k = 0; k < AEC_BINS_PADDED; k += 4)
+        {
+            AEC_VECTOR vXRe = AecVectorLoad(pX->af32Re + k);
+            AEC_VECTOR vXIm = AecVectorLoad(pX->af32Im + k);
+            AEC_VECTOR vERe = AecVectorLoad(pE->af32Re + k);
+            AEC_VECTOR vEIm = AecVectorLoad(pE->af32Im + k);
+            AEC_VECTOR vWRe = AecVectorLoad(pW->af32Re + k);
+            AEC_VECTOR vWIm = AecVectorLoad(pW->af32Im + k);
+
+            vWRe = AecVectorAdd(vWRe, AecVectorAdd(AecVectorMul(vXRe, vERe), AecVectorMul(vXIm, vEIm)));
+            vWIm = AecVectorAdd(vWIm, AecVectorSub(AecVectorMul(vXRe, vEIm), AecVectorMul(vXIm, vERe)));
+            AecVectorStore(pW->af32Re + k, vWRe);
+            AecVectorStore(pW->af32Im + k, vWIm);
+        }
+#else
+        for (UINT32 k = 0; k < AEC_BINS; k++)
+        {
+            pW->af32Re[k] += pX->af32Re[k] * pE->af32Re[k] + pX->af32Im[k] * pE->af32Im[k];
+            pW->af32Im[k] += pX->af32Re[k] * pE->af32Im[k] - pX->af32Im[k] * pE->af32Re[k];
+        }
+#endif
+
+        InverseFftReal(pFdaf, pf32Time, pW);
+        for (UINT32 n = 0; n < AEC_BLOCK_FRAMES; n++)
+        {
+            pf32Time[n] *= 1.0f / AEC_FFT_SIZE;
+        }
+        ZeroMemory(pf32Time + AEC_BLOCK_FRAMES, sizeof(FLOAT32) * AEC_BLOCK_FRAMES);
+        FftReal(pFdaf, pW, pf32Time);
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Transforms the last two blocks of reference into the newest partition.
+//
+#pragma AVRT_CODE_BEGIN
+static void ShiftFdafReference(
+    AEC_FDAF *pFdaf )
+{
+    pFdaf->u32Newest = (pFdaf->u32Newest + AEC_PARTITIONS - 1) % AEC_PARTITIONS;
+    FftReal(pFdaf, &pFdaf->aReference[pFdaf->u32Newest], pFdaf->af32Reference);
+    CopyMemory(pFdaf->af32Reference, pFdaf->af32Reference + AEC_BLOCK_FRAMES, sizeof(FLOAT32) * AEC_BLOCK_FRAMES);
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Cancels the echo from the block of capture just filled.
+//
+#pragma AVRT_CODE_BEGIN
+static void ProcessFdafBlock(
+    AEC_FDAF *pFdaf )
+{
+    FLOAT32 *pf32Time = pFdaf->af32Time;
+
+    ShiftFdafReference(pFdaf);
+
+    FilterFdaf(pFdaf, &pFdaf->Error);
+    InverseFftReal(pFdaf, pf32Time, &pFdaf->Error);
+
+    // Only the last half is free of circular wrap around.
+    ZeroMemory(pf32Time, sizeof(FLOAT32) * AEC_BLOCK_FRAMES);
+    for (UINT32 n = 0; n < AEC_BLOCK_FRAMES; n++)
+    {
+        FLOAT32 f32Error = pFdaf->af32Capture[n] - pf32Time[AEC_BLOCK_FRAMES + n] * (1.0f / AEC_FFT_SIZE);
+
+        pFdaf->af32Output[n] = f32Error;
+        pf32Time[AEC_BLOCK_FRAMES + n] = f32Error;
+    }
+
+    FftReal(pFdaf, &pFdaf->Error, pf32Time);
+    NormalizeFdafError(pFdaf);
+    AdaptFdaf(pFdaf);
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Averages the channels of each frame into one sample, times f32Gain.
+//
+#pragma AVRT_CODE_BEGIN
+void DownmixFrames(
+    _Out_writes_(u32FrameCount)
+        FLOAT32 *pf32Mono,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32Frames,
+    UINT32   u32FrameCount,
+    UINT32   u32SamplesPerFrame,
+    FLOAT32  f32Gain )
+{
+    FLOAT32 f32Scale = f32Gain / u32SamplesPerFrame;
+
+    if (u32SamplesPerFrame == 1)
+    {
+        ScaleFrames(pf32Mono, pf32Frames, u32FrameCount, 1, f32Scale);
+        return;
+    }
+
+    for (UINT32 n = 0; n < u32FrameCount; n++)
+    {
+        FLOAT32 f32Sum = 0.0f;
+
+        for (UINT32 c = 0; c < u32SamplesPerFrame; c++)
+        {
+            f32Sum += pf32Frames[c];
+        }
+        pf32Mono[n] = f32Sum * f32Scale;
+        pf32Frames += u32SamplesPerFrame;
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Writes reference frames to the ring, mixed down to mono and scaled by
+//  f32Gain. NULL frames are silence. u64QpcTime is the time of the first
+//  frame, 0 if unknown.
+//
+#pragma AVRT_CODE_BEGIN
+void WriteFdafReference(
+    _Inout_ AEC_FDAF *pFdaf,
+    _In_reads_opt_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32Frames,
+    UINT32   u32FrameCount,
+    UINT32   u32SamplesPerFrame,
+    FLOAT32  f32Gain,
+    UINT64   u64QpcTime )
+{
+    ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pFdaf) );
+
+    if (u64QpcTime != 0)
+    {
+        pFdaf->u32QueueTimeFrame = pFdaf->u32QueueWrite;
+        pFdaf->u64QueueTime = u64QpcTime;
+    }
+
+    if (u32FrameCount > AEC_REFERENCE_FRAMES)
+    {
+        if (pf32Frames != NULL)
+        {
+            pf32Frames += (u32FrameCount - AEC_REFERENCE_FRAMES) * u32SamplesPerFrame;
+        }
+        pFdaf->u32QueueWrite += u32FrameCount - AEC_REFERENCE_FRAMES;
+        u32FrameCount = AEC_REFERENCE_FRAMES;
+    }
+
+    while (u32FrameCount > 0)
+    {
+        UINT32 u32Position = pFdaf->u32QueueWrite & (AEC_REFERENCE_FRAMES - 1);
+        UINT32 u32Frames = min(u32FrameCount, AEC_REFERENCE_FRAMES - u32Position);
+
+        if (pf32Frames != NULL)
+        {
+            DownmixFrames(pFdaf->af32Queue + u32Position, pf32Frames, u32Frames, u32SamplesPerFrame, f32Gain);
+            pf32Frames += u32Frames * u32SamplesPerFrame;
+        }
+        else
+        {
+            WriteSilence(pFdaf->af32Queue + u32Position, u32Frames, 1);
+        }
+        pFdaf->u32QueueWrite += u32Frames;
+        u32FrameCount -= u32Frames;
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Moves the read position toward the reference frame for the capture
+//  frame at u64QpcTime, or without times toward the newest reference that
+//  covers u32FrameCount frames. Small errors are taken out by steering the
+//  drift, large ones by jumping. Returns the read step.
+//
+#pragma AVRT_CODE_BEGIN
+static FLOAT32 AlignFdafReference(
+    AEC_FDAF *pFdaf,
+    UINT32 u32FrameCount,
+    UINT64 u64QpcTime )
+{
+    AEC_ALIGNMENT_STATISTICS *pAlignment = &pFdaf->Alignment;
+    DOUBLE f64Target;
+    FLOAT32 f32Error;
+
+    if (u64QpcTime != 0 && pFdaf->u64QueueTime != 0)
+    {
+        DOUBLE f64Elapsed = (DOUBLE)(INT64)(u64QpcTime - pFdaf->u64QueueTime) * SUPPORTED_AEC_SAMPLINGRATE / 10000000;
+
+        f64Target = (INT32)(pFdaf->u32QueueTimeFrame - pFdaf->u32ReadFrame) + f64Elapsed - AEC_ALIGNMENT_GUARD_FRAMES;
+    }
+    else
+    {
+        // The last frame read needs more after it for interpolation.
+        f64Target = (INT32)(pFdaf->u32QueueWrite - pFdaf->u32ReadFrame) - (DOUBLE)u32FrameCount - AEC_INTERPOLATION_TAPS / 2;
+    }
+    f64Target -= pFdaf->f32ReadFraction;
+    f32Error = (FLOAT32)max(-(DOUBLE)AEC_REFERENCE_FRAMES, min((DOUBLE)AEC_REFERENCE_FRAMES, f64Target));
+
+    pAlignment->f32LastError = f32Error;
+
+    if (!pFdaf->bAligned || fabsf(f32Error) > AEC_ALIGNMENT_RESYNC_FRAMES)
+    {
+        FLOAT32 f32Position = pFdaf->f32ReadFraction + f32Error;
+        FLOAT32 f32Whole = floorf(f32Position);
+
+        pFdaf->u32ReadFrame += (INT32)f32Whole;
+        pFdaf->f32ReadFraction = f32Position - f32Whole;
+        if (pFdaf->bAligned)
+        {
+            pAlignment->u32Resyncs++;
+        }
+        pAlignment->f32MaxError = 0.0f;
+        pFdaf->f32ReadError = 0.0f;
+        pFdaf->bAligned = TRUE;
+        return 1.0f + pAlignment->f32Drift;
+    }
+
+    // Proportional and integral steering on the filtered error: it is taken
+    // out over about AEC_ALIGNMENT_TIME_FRAMES while the drift settles about
+    // four times slower.
+    pFdaf->f32ReadError += min(1.0f, u32FrameCount / AEC_ALIGNMENT_FILTER_FRAMES) * (f32Error - pFdaf->f32ReadError);
+    pAlignment->f32Drift += pFdaf->f32ReadError * u32FrameCount / (4.0f * AEC_ALIGNMENT_TIME_FRAMES * AEC_ALIGNMENT_TIME_FRAMES);
+    pAlignment->f32Drift = max(-AEC_ALIGNMENT_MAX_DRIFT, min(AEC_ALIGNMENT_MAX_DRIFT, pAlignment->f32Drift));
+    pAlignment->f32MeanError += AEC_ALIGNMENT_SMOOTHING * (fabsf(f32Error) - pAlignment->f32MeanError);
+    pAlignment->f32MaxError = max(pAlignment->f32MaxError, fabsf(f32Error));
+
+    return 1.0f + pAlignment->f32Drift + pFdaf->f32ReadError / AEC_ALIGNMENT_TIME_FRAMES;
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Reads u32FrameCount aligned reference frames, interpolated between the
+//  two phases either side of the read fraction. Frames not in the ring read
+//  as silence.
+//
+#pragma AVRT_CODE_BEGIN
+static void ReadFdafReference(
+    AEC_FDAF *pFdaf,
+    FLOAT32 *pf32Reference,
+    UINT32 u32FrameCount,
+    FLOAT32 f32Step )
+{
+    const FLOAT32 *pf32Queue = pFdaf->af32Queue;
+    UINT32 u32Frame = pFdaf->u32ReadFrame;
+    FLOAT32 f32Fraction = pFdaf->f32ReadFraction;
+
+    for (UINT32 n = 0; n < u32FrameCount; n++)
+    {
+        UINT32 u32First = u32Frame - (AEC_INTERPOLATION_TAPS / 2 - 1);
+
+        // All the taps' frames must still be in the ring.
+        if (pFdaf->u32QueueWrite - u32First - AEC_INTERPOLATION_TAPS <= AEC_REFERENCE_FRAMES - AEC_INTERPOLATION_TAPS)
+        {
+            FLOAT32 f32Phase = f32Fraction * AEC_INTERPOLATION_PHASES;
+            UINT32 p = min((UINT32)f32Phase, AEC_INTERPOLATION_PHASES - 1);
+            const FLOAT32 *pf32Taps0 = pFdaf->af32Interpolation[p];
+            const FLOAT32 *pf32Taps1 = pFdaf->af32Interpolation[p + 1];
+            FLOAT32 f32Sum0 = 0.0f;
+            FLOAT32 f32Sum1 = 0.0f;
+
+            for (UINT32 k = 0; k < AEC_INTERPOLATION_TAPS; k++)
+            {
+                FLOAT32 x = pf32Queue[(u32First + k) & (AEC_REFERENCE_FRAMES - 1)];
+
+                f32Sum0 += pf32Taps0[k] * x;
+                f32Sum1 += pf32Taps1[k] * x;
+            }
+            pf32Reference[n] = f32Sum0 + (f32Phase - p) * (f32Sum1 - f32Sum0);
+        }
+        else
+        {
+            pf32Reference[n] = 0.0f;
+            pFdaf->Alignment.u32MissingFrames++;
+        }
+
+        f32Fraction += f32Step;
+        while (f32Fraction >= 1.0f)
+        {
+            f32Fraction -= 1.0f;
+            u32Frame++;
+        }
+    }
+
+    pFdaf->u32ReadFrame = u32Frame;
+    pFdaf->f32ReadFraction = f32Fraction;
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Removes the echo of the reference from mono capture frames, u64QpcTime
+//  being the time of the first one, 0 if unknown. The output is
+//  AEC_BLOCK_FRAMES frames late and may be the capture. NULL capture is
+//  silence.
+//
+#pragma AVRT_CODE_BEGIN
+void ProcessFdaf(
+    _Inout_ AEC_FDAF *pFdaf,
+    _Out_writes_(u32FrameCount)
+        FLOAT32 *pf32Output,
+    _In_reads_opt_(u32FrameCount)
+        const FLOAT32 *pf32Capture,
+    UINT32   u32FrameCount,
+    UINT64   u64QpcTime )
+{
+    FLOAT32 f32Step;
+
+    ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pFdaf) );
+    ATLASSERT( (NULL == pf32Capture) || IS_VALID_TYPED_READ_POINTER(pf32Capture) );
+    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32Output) );
+
+    if (u32FrameCount == 0)
+    {
+        return;
+    }
+
+    f32Step = AlignFdafReference(pFdaf, u32FrameCount, u64QpcTime);
+
+    while (u32FrameCount > 0)
+    {
+        UINT32 u32Position = pFdaf->u32Position;
+        UINT32 u32Frames = min(u32FrameCount, AEC_BLOCK_FRAMES - u32Position);
+
+        ReadFdafReference(pFdaf, pFdaf->af32Reference + AEC_BLOCK_FRAMES + u32Position, u32Frames, f32Step);
+        for (UINT32 n = 0; n < u32Frames; n++)
+        {
+            FLOAT32 f32Capture = (NULL == pf32Capture) ? 0.0f : pf32Capture[n];
+
+            pf32Output[n] = pFdaf->af32Output[u32Position + n];
+            pFdaf->af32Capture[u32Position + n] = f32Capture;
+        }
+
+        if (NULL == pf32Capture)
+        {
+            pFdaf->u32SilentFrames = min(pFdaf->u32SilentFrames, (UINT32)MAXLONG) + u32Frames;
+        }
+        else
+        {
+            pFdaf->u32SilentFrames = 0;
+            pf32Capture += u32Frames;
+        }
+
+        pFdaf->u32Position = u32Position + u32Frames;
+        if (pFdaf->u32Position == AEC_BLOCK_FRAMES)
+        {
+            if (pFdaf->u32SilentFrames >= AEC_BLOCK_FRAMES)
+            {
+                ShiftFdafReference(pFdaf);
+                WriteSilence(pFdaf->af32Output, AEC_BLOCK_FRAMES, 1);
+            }
+            else
+            {
+                ProcessFdafBlock(pFdaf);
+            }
+            pFdaf->u32Position = 0;
+        }
+
+        pf32Output += u32Frames;
+        u32FrameCount -= u32Frames;
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  TRUE when the last u32FrameCount frames ProcessFdaf output all came from
+//  silent blocks, and so are silence. Those frames are a block late and
+//  their block may have started up to a block earlier.
+//
+#pragma AVRT_CODE_BEGIN
+BOOL IsFdafOutputSilent(
+    const AEC_FDAF *pFdaf,
+    UINT32   u32FrameCount )
+{
+    return pFdaf->u32SilentFrames >= u32FrameCount + 2 * AEC_BLOCK_FRAMES;
+}
+#pragma AVRT_CODE_END
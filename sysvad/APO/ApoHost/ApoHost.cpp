@@ -0,0 +1,1082 @@
+//
+// ApoHost.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Runs the APOs' DSP cores outside the audio engine
+//
+//  ApoHost streams a WAV file through a chain of the cores, once for each
+//  buffer size in a sweep, the way the audio engine would call APOProcess:
+//  one buffer at a time, the output of one stage the input of the next.
+//  Every buffer size starts from fresh state. For each buffer size and
+//  stage it reports the time per frame, the real-time factor (processing
+//  time over audio time) and a checksum of the stage's output, so a change
+//  to a core can be checked for speed and for the samples it produces.
+//  With -p the input is streamed several times over and the time is the
+//  median pass's, so a pass slowed by a cold start or another process does
+//  not move it.
+//
+//      ApoHost [options] input.wav [output.wav]
+//      ApoHost [options] -g seconds [output.wav]
+//
+//  The output file gets the chain's output from the first buffer size.
+//  See Usage for the options.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <ApoPlatform.h>
+#include <ApoDsp.h>
+
+#include <SwapDsp.h>
+#include <DelayDsp.h>
+#include <AecDsp.h>
+#include <KWSDsp.h>
+
+#define HOST_MAX_STAGES         16
+#define HOST_MAX_SWEEP          16
+#define HOST_MAX_CHANNELS       32
+#define HOST_DEFAULT_DELAY_MS   1000.0f     // HNS_DELAY.
+#define HOST_MAX_DELAY_MS       2000.0f     // HNS_MAX_DELAY.
+#define HOST_DELAY_FADE_MS      20.0f       // HNS_DELAY_FADE.
+#define HOST_HNS_PER_SECOND     10000000ull
+
+//
+// Audio read from or written to a WAV file, as interleaved FLOAT32 frames.
+//
+typedef struct _HOST_AUDIO
+{
+    UINT32                  u32Channels;
+    UINT32                  u32FramesPerSecond;
+    UINT32                  u32Frames;
+    std::vector<FLOAT32>    Samples;
+} HOST_AUDIO;
+
+typedef struct _HOST_OPTIONS
+{
+    const char  *pszChain;
+    UINT32      au32Sweep[HOST_MAX_SWEEP];
+    UINT32      u32Sweep;
+    UINT32      u32Passes;
+    FLOAT32     af32DelayMs[HOST_MAX_CHANNELS];
+    UINT32      u32Delays;
+    UINT32      u32Primary;                     // 0 for all but two loopback channels.
+    const char  *pszReference;
+    FLOAT32     f32GenerateSeconds;
+    UINT32      u32GenerateChannels;
+    UINT32      u32GenerateRate;
+    BOOL        fCsv;
+    const char  *pszKernel;                     // NULL for the widest supported.
+    const char  *pszInput;
+    const char  *pszOutput;
+} HOST_OPTIONS;
+
+//
+// One core, with the state an APO would keep for it between buffers.
+//
+class CHostStage
+{
+public:
+    virtual ~CHostStage() {}
+
+    virtual const char *GetName() = 0;
+
+    // Sets up fresh state for u32Channels channel input, and returns the
+    // output channel count, or 0 if the stage cannot take the stream.
+    virtual UINT32 Initialize(UINT32 u32Channels, UINT32 u32FramesPerSecond) = 0;
+
+    // u64Time is the time of the first frame, in 100 ns units.
+    virtual void Process(FLOAT32 *pf32OutputFrames, const FLOAT32 *pf32InputFrames, UINT32 u32FrameCount, UINT64 u64Time) = 0;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The swap SFX: the channels of each pair traded.
+//
+class CHostSwap : public CHostStage
+{
+public:
+    const char *GetName() { return "swap"; }
+
+    UINT32 Initialize(UINT32 u32Channels, UINT32 u32FramesPerSecond)
+    {
+        UNREFERENCED_PARAMETER(u32FramesPerSecond);
+        m_u32Channels = u32Channels;
+        return u32Channels;
+    }
+
+    void Process(FLOAT32 *pf32OutputFrames, const FLOAT32 *pf32InputFrames, UINT32 u32FrameCount, UINT64 u64Time)
+    {
+        UNREFERENCED_PARAMETER(u64Time);
+        ProcessSwap(pf32OutputFrames, pf32InputFrames, u32FrameCount, m_u32Channels);
+    }
+
+private:
+    UINT32  m_u32Channels;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Builds the channel matrix the swap MFX uses without a channel matrix
+//  property: swapped pairs scaled from 1 down toward 1/N, an odd channel
+//  out passed through.
+//
+static HRESULT BuildSwapScaleMatrix(SWAP_MIX_MATRIX *pMatrix, UINT32 u32Channels)
+{
+    FLOAT32 af32Matrix[SWAP_MIX_MAX_CHANNELS * SWAP_MIX_MAX_CHANNELS] = { 0 };
+
+    if (u32Channels > SWAP_MIX_MAX_CHANNELS)
+    {
+        return E_INVALIDARG;
+    }
+
+    for (UINT32 o = 0; o < u32Channels; o++)
+    {
+        if ((o ^ 1) < u32Channels)
+        {
+            af32Matrix[o * u32Channels + (o ^ 1)] = 1.0f - (1.0f / u32Channels) * o;
+        }
+        else
+        {
+            af32Matrix[o * u32Channels + o] = 1.0f;
+        }
+    }
+
+    return BuildMixMatrix(pMatrix, u32Channels, af32Matrix, u32Channels);
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The swap MFX without a channel matrix property: swapped pairs scaled
+//  from 1 down toward 1/N, by ProcessSwapScale ("swapscale") or by the
+//  channel matrix the MFX builds for it ("mix").
+//
+class CHostSwapScale : public CHostStage
+{
+public:
+    explicit CHostSwapScale(BOOL fMatrix) : m_fMatrix(fMatrix) {}
+
+    const char *GetName() { return m_fMatrix ? "mix" : "swapscale"; }
+
+    UINT32 Initialize(UINT32 u32Channels, UINT32 u32FramesPerSecond)
+    {
+        UNREFERENCED_PARAMETER(u32FramesPerSecond);
+        m_u32Channels = u32Channels;
+        m_Coefficients.resize(u32Channels);
+
+        for (UINT32 i = 0; i < u32Channels; i++)
+        {
+            m_Coefficients[i] = 1.0f - (1.0f / u32Channels) * i;
+        }
+
+        if (!m_fMatrix)
+        {
+            return u32Channels;
+        }
+
+        return SUCCEEDED(BuildSwapScaleMatrix(&m_Matrix, u32Channels)) ? u32Channels : 0;
+    }
+
+    void Process(FLOAT32 *pf32OutputFrames, const FLOAT32 *pf32InputFrames, UINT32 u32FrameCount, UINT64 u64Time)
+    {
+        UNREFERENCED_PARAMETER(u64Time);
+
+        if (m_fMatrix)
+        {
+            ProcessMix(pf32OutputFrames, pf32InputFrames, u32FrameCount, &m_Matrix);
+        }
+        else
+        {
+            ProcessSwapScale(pf32OutputFrames, pf32InputFrames, u32FrameCount, m_u32Channels, m_Coefficients.data());
+        }
+    }
+
+private:
+    BOOL                    m_fMatrix;
+    UINT32                  m_u32Channels;
+    std::vector<FLOAT32>    m_Coefficients;
+    SWAP_MIX_MATRIX         m_Matrix;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The delay MFX/SFX: each channel delayed by its own time, the line sized
+//  for the longest delay the APOs allow. As "chain", the delay MFX with
+//  the fused chain enabled at 0 dB: the swap MFX's "mix" mixed into the
+//  line a block at a time.
+//
+class CHostDelay : public CHostStage
+{
+public:
+    CHostDelay(const FLOAT32 *pf32DelayMs, UINT32 u32Delays, BOOL fChain) :
+        m_pf32DelayMs(pf32DelayMs), m_u32Delays(u32Delays), m_fChain(fChain) {}
+
+    const char *GetName() { return m_fChain ? "chain" : "delay"; }
+
+    UINT32 Initialize(UINT32 u32Channels, UINT32 u32FramesPerSecond)
+    {
+        UINT32 u32MaxDelayFrames = (UINT32)(HOST_MAX_DELAY_MS / 1000 * u32FramesPerSecond + 0.5f) + 1;
+
+        m_Ring.assign(GetDelayLineSamples(u32Channels, u32MaxDelayFrames), 0.0f);
+        m_Channels.resize(u32Channels);
+
+        InitializeDelayLine(&m_DelayLine, u32Channels, u32MaxDelayFrames,
+                            (UINT32)(HOST_DELAY_FADE_MS / 1000 * u32FramesPerSecond + 0.5f),
+                            m_Ring.data(), m_Channels.data());
+
+        for (UINT32 i = 0; i < u32Channels; i++)
+        {
+            FLOAT32 f32DelayMs = (m_u32Delays == 0) ? HOST_DEFAULT_DELAY_MS : m_pf32DelayMs[min(i, m_u32Delays - 1)];
+
+            f32DelayMs = min(f32DelayMs, HOST_MAX_DELAY_MS);
+            SetDelayLineChannel(&m_DelayLine, &m_Channels[i], f32DelayMs / 1000 * u32FramesPerSecond);
+        }
+
+        if (!m_fChain)
+        {
+            return u32Channels;
+        }
+
+        return SUCCEEDED(BuildSwapScaleMatrix(&m_Matrix, u32Channels)) ? u32Channels : 0;
+    }
+
+    void Process(FLOAT32 *pf32OutputFrames, const FLOAT32 *pf32InputFrames, UINT32 u32FrameCount, UINT64 u64Time)
+    {
+        UNREFERENCED_PARAMETER(u64Time);
+
+        if (m_fChain)
+        {
+            ProcessDelayChain(&m_DelayLine, &m_Matrix, pf32OutputFrames, pf32InputFrames, u32FrameCount);
+        }
+        else
+        {
+            ProcessDelayLine(&m_DelayLine, pf32OutputFrames, pf32InputFrames, u32FrameCount);
+        }
+    }
+
+private:
+    const FLOAT32               *m_pf32DelayMs;
+    UINT32                      m_u32Delays;
+    BOOL                        m_fChain;
+    SWAP_MIX_MATRIX             m_Matrix;
+    std::vector<FLOAT32>        m_Ring;
+    std::vector<DELAY_CHANNEL>  m_Channels;
+    DELAY_LINE                  m_DelayLine;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The copy-based delay the delay APOs ran before the delay line, kept as
+//  a yardstick for it ("delaycopy"): every channel delayed by the first
+//  channel's delay, rounded to whole frames, out of a buffer exactly that
+//  long. Each buffer is copied out of it and then over it at one position.
+//
+class CHostDelayCopy : public CHostStage
+{
+public:
+    CHostDelayCopy(const FLOAT32 *pf32DelayMs, UINT32 u32Delays) :
+        m_pf32DelayMs(pf32DelayMs), m_u32Delays(u32Delays) {}
+
+    const char *GetName() { return "delaycopy"; }
+
+    UINT32 Initialize(UINT32 u32Channels, UINT32 u32FramesPerSecond)
+    {
+        FLOAT32 f32DelayMs = (m_u32Delays == 0) ? HOST_DEFAULT_DELAY_MS : m_pf32DelayMs[0];
+
+        f32DelayMs = min(f32DelayMs, HOST_MAX_DELAY_MS);
+        m_u32Channels = u32Channels;
+        m_u32DelayFrames = (UINT32)(f32DelayMs / 1000 * u32FramesPerSecond + 0.5f);
+        m_u32DelayIndex = 0;
+        m_Delay.assign((size_t)m_u32DelayFrames * u32Channels, 0.0f);
+        return u32Channels;
+    }
+
+    void Process(FLOAT32 *pf32OutputFrames, const FLOAT32 *pf32InputFrames, UINT32 u32FrameCount, UINT64 u64Time)
+    {
+        UNREFERENCED_PARAMETER(u64Time);
+
+        if (m_u32DelayFrames == 0)
+        {
+            CopyFrames(pf32OutputFrames, pf32InputFrames, u32FrameCount, m_u32Channels);
+            return;
+        }
+
+        while (u32FrameCount > 0)
+        {
+            UINT32 u32Frames = min(u32FrameCount, m_u32DelayFrames - m_u32DelayIndex);
+            FLOAT32 *pf32Delay = m_Delay.data() + (size_t)m_u32DelayIndex * m_u32Channels;
+
+            CopyFrames(pf32OutputFrames, pf32Delay, u32Frames, m_u32Channels);
+            CopyFrames(pf32Delay, pf32InputFrames, u32Frames, m_u32Channels);
+
+            pf32OutputFrames += u32Frames * m_u32Channels;
+            pf32InputFrames += u32Frames * m_u32Channels;
+            u32FrameCount -= u32Frames;
+
+            m_u32DelayIndex += u32Frames;
+            if (m_u32DelayIndex == m_u32DelayFrames)
+            {
+                m_u32DelayIndex = 0;
+            }
+        }
+    }
+
+private:
+    const FLOAT32           *m_pf32DelayMs;
+    UINT32                  m_u32Delays;
+    UINT32                  m_u32Channels;
+    UINT32                  m_u32DelayFrames;
+    UINT32                  m_u32DelayIndex;
+    std::vector<FLOAT32>    m_Delay;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The KWS EFX: the microphone channels kept, the loopback channels after
+//  them stripped.
+//
+class CHostKws : public CHostStage
+{
+public:
+    explicit CHostKws(UINT32 u32Primary) : m_u32Primary(u32Primary) {}
+
+    const char *GetName() { return "kws"; }
+
+    UINT32 Initialize(UINT32 u32Channels, UINT32 u32FramesPerSecond)
+    {
+        UNREFERENCED_PARAMETER(u32FramesPerSecond);
+        m_u32Channels = u32Channels;
+        m_u32Kept = (m_u32Primary != 0) ? m_u32Primary : ((u32Channels > 2) ? u32Channels - 2 : u32Channels);
+        return (m_u32Kept <= u32Channels) ? m_u32Kept : 0;
+    }
+
+    void Process(FLOAT32 *pf32OutputFrames, const FLOAT32 *pf32InputFrames, UINT32 u32FrameCount, UINT64 u64Time)
+    {
+        UNREFERENCED_PARAMETER(u64Time);
+        ProcessBuffer(pf32OutputFrames, pf32InputFrames, u32FrameCount, 0, m_u32Kept, m_u32Channels);
+    }
+
+protected:
+    UINT32  m_u32Primary;
+    UINT32  m_u32Channels;
+    UINT32  m_u32Kept;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The sample at a time gather KWSApo ran before its layout kernels, kept
+//  as a yardstick for them ("kwscopy").
+//
+class CHostKwsCopy : public CHostKws
+{
+public:
+    explicit CHostKwsCopy(UINT32 u32Primary) : CHostKws(u32Primary) {}
+
+    const char *GetName() { return "kwscopy"; }
+
+    void Process(FLOAT32 *pf32OutputFrames, const FLOAT32 *pf32InputFrames, UINT32 u32FrameCount, UINT64 u64Time)
+    {
+        UNREFERENCED_PARAMETER(u64Time);
+
+        while (u32FrameCount--)
+        {
+            for (UINT32 i = 0; i < m_u32Kept; i++)
+            {
+                *pf32OutputFrames++ = pf32InputFrames[i];
+            }
+            pf32InputFrames += m_u32Channels;
+        }
+    }
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The AEC MFX: the capture downmixed to mono and the echo of the reference
+//  removed. The reference is written first, with the capture's times, as
+//  if loopback and capture were perfectly in step; without one the
+//  reference is silence.
+//
+class CHostAec : public CHostStage
+{
+public:
+    explicit CHostAec(const HOST_AUDIO *pReference) : m_pReference(pReference), m_pFdaf(NULL) {}
+    ~CHostAec() { free(m_pFdaf); }
+
+    const char *GetName() { return "aec"; }
+
+    UINT32 Initialize(UINT32 u32Channels, UINT32 u32FramesPerSecond)
+    {
+        if ((u32FramesPerSecond != SUPPORTED_AEC_SAMPLINGRATE) ||
+            ((m_pReference != NULL) && (m_pReference->u32FramesPerSecond != SUPPORTED_AEC_SAMPLINGRATE)))
+        {
+            return 0;
+        }
+
+        if (m_pFdaf == NULL)
+        {
+            m_pFdaf = (AEC_FDAF *)aligned_alloc(64, (sizeof(AEC_FDAF) + 63) & ~(size_t)63);
+            if (m_pFdaf == NULL)
+            {
+                return 0;
+            }
+        }
+
+        InitializeFdaf(m_pFdaf);
+        m_u32Channels = u32Channels;
+        m_u32ReferenceFrame = 0;
+        return 1;
+    }
+
+    void Process(FLOAT32 *pf32OutputFrames, const FLOAT32 *pf32InputFrames, UINT32 u32FrameCount, UINT64 u64Time)
+    {
+        const FLOAT32 *pf32Reference = NULL;
+        UINT32 u32ReferenceChannels = 1;
+
+        // the reference repeats if it is shorter than the capture
+        if ((m_pReference != NULL) && (m_pReference->u32Frames >= u32FrameCount))
+        {
+            if (m_u32ReferenceFrame + u32FrameCount > m_pReference->u32Frames)
+            {
+                m_u32ReferenceFrame = 0;
+            }
+            pf32Reference = &m_pReference->Samples[m_u32ReferenceFrame * m_pReference->u32Channels];
+            u32ReferenceChannels = m_pReference->u32Channels;
+            m_u32ReferenceFrame += u32FrameCount;
+        }
+
+        WriteFdafReference(m_pFdaf, pf32Reference, u32FrameCount, u32ReferenceChannels, 1.0f, u64Time + 1);
+        DownmixFrames(pf32OutputFrames, pf32InputFrames, u32FrameCount, m_u32Channels, 1.0f);
+        ProcessFdaf(m_pFdaf, pf32OutputFrames, pf32OutputFrames, u32FrameCount, u64Time + 1);
+    }
+
+private:
+    const HOST_AUDIO    *m_pReference;
+    AEC_FDAF            *m_pFdaf;
+    UINT32              m_u32Channels;
+    UINT32              m_u32ReferenceFrame;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Reads a little-endian value from a byte buffer.
+//
+static UINT32 ReadLe(const UINT8 *pu8Bytes, UINT32 u32Size)
+{
+    UINT32 u32Value = 0;
+
+    for (UINT32 i = 0; i < u32Size; i++)
+    {
+        u32Value |= (UINT32)pu8Bytes[i] << (8 * i);
+    }
+
+    return u32Value;
+}
+
+static void WriteLe(FILE *pFile, UINT32 u32Value, UINT32 u32Size)
+{
+    for (UINT32 i = 0; i < u32Size; i++)
+    {
+        fputc((u32Value >> (8 * i)) & 0xFF, pFile);
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Reads a WAV file of 16, 24 or 32 bit PCM or 32 bit float samples, plain
+//  or WAVE_FORMAT_EXTENSIBLE, into FLOAT32 frames.
+//
+static HRESULT ReadWav(const char *pszPath, HOST_AUDIO *pAudio)
+{
+    std::vector<UINT8> Bytes;
+    const UINT8 *pu8Data = NULL;
+    UINT32 u32DataSize = 0;
+    UINT32 u32Format = 0;
+    UINT32 u32Bits = 0;
+    UINT32 u32Position = 12;
+    FILE *pFile = fopen(pszPath, "rb");
+
+    if (pFile == NULL)
+    {
+        fprintf(stderr, "ApoHost: cannot open %s\n", pszPath);
+        return E_FAIL;
+    }
+
+    for (int c; (c = fgetc(pFile)) != EOF; )
+    {
+        Bytes.push_back((UINT8)c);
+    }
+    fclose(pFile);
+
+    if ((Bytes.size() < 12) || (memcmp(&Bytes[0], "RIFF", 4) != 0) || (memcmp(&Bytes[8], "WAVE", 4) != 0))
+    {
+        fprintf(stderr, "ApoHost: %s is not a WAV file\n", pszPath);
+        return E_INVALIDARG;
+    }
+
+    pAudio->u32Channels = 0;
+
+    while (u32Position + 8 <= Bytes.size())
+    {
+        const UINT8 *pu8Chunk = &Bytes[u32Position];
+        UINT32 u32ChunkSize = ReadLe(pu8Chunk + 4, 4);
+
+        u32ChunkSize = min(u32ChunkSize, (UINT32)Bytes.size() - u32Position - 8);
+
+        if ((memcmp(pu8Chunk, "fmt ", 4) == 0) && (u32ChunkSize >= 16))
+        {
+            u32Format = ReadLe(pu8Chunk + 8, 2);
+            pAudio->u32Channels = ReadLe(pu8Chunk + 10, 2);
+            pAudio->u32FramesPerSecond = ReadLe(pu8Chunk + 12, 4);
+            u32Bits = ReadLe(pu8Chunk + 22, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE, the format is the start of the subformat GUID
+            if ((u32Format == 0xFFFE) && (u32ChunkSize >= 40))
+            {
+                u32Format = ReadLe(pu8Chunk + 32, 2);
+            }
+        }
+        else if (memcmp(pu8Chunk, "data", 4) == 0)
+        {
+            pu8Data = pu8Chunk + 8;
+            u32DataSize = u32ChunkSize;
+        }
+
+        u32Position += 8 + u32ChunkSize + (u32ChunkSize & 1);
+    }
+
+    if ((pu8Data == NULL) || (pAudio->u32Channels == 0) || (pAudio->u32Channels > HOST_MAX_CHANNELS) ||
+        !(((u32Format == 1) && ((u32Bits == 16) || (u32Bits == 24) || (u32Bits == 32))) ||
+          ((u32Format == 3) && (u32Bits == 32))))
+    {
+        fprintf(stderr, "ApoHost: %s has no samples ApoHost can read\n", pszPath);
+        return E_INVALIDARG;
+    }
+
+    UINT32 u32Samples = u32DataSize / (u32Bits / 8) / pAudio->u32Channels * pAudio->u32Channels;
+
+    pAudio->u32Frames = u32Samples / pAudio->u32Channels;
+    pAudio->Samples.resize(u32Samples);
+
+    if (u32Format == 3)
+    {
+        memcpy(pAudio->Samples.data(), pu8Data, sizeof(FLOAT32) * u32Samples);
+    }
+    else if (u32Bits == 16)
+    {
+        std::vector<INT16> Pcm(u32Samples);
+
+        memcpy(Pcm.data(), pu8Data, sizeof(INT16) * u32Samples);
+        ConvertInt16ToFloat(pAudio->Samples.data(), Pcm.data(), u32Samples, 1);
+    }
+    else
+    {
+        std::vector<INT32> Pcm(u32Samples);
+
+        for (UINT32 i = 0; i < u32Samples; i++)
+        {
+            Pcm[i] = (u32Bits == 24) ? (INT32)(ReadLe(pu8Data + 3 * i, 3) << 8) : (INT32)ReadLe(pu8Data + 4 * i, 4);
+        }
+        ConvertInt32ToFloat(pAudio->Samples.data(), Pcm.data(), u32Samples, 1);
+    }
+
+    return S_OK;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Writes 32 bit float WAV file.
+//
+static HRESULT WriteWav(const char *pszPath, const HOST_AUDIO *pAudio)
+{
+    UINT32 u32DataSize = (UINT32)(sizeof(FLOAT32) * pAudio->Samples.size());
+    FILE *pFile = fopen(pszPath, "wb");
+
+    if (pFile == NULL)
+    {
+        fprintf(stderr, "ApoHost: cannot create %s\n", pszPath);
+        return E_FAIL;
+    }
+
+    fwrite("RIFF", 1, 4, pFile);
+    WriteLe(pFile, 36 + u32DataSize, 4);
+    fwrite("WAVEfmt ", 1, 8, pFile);
+    WriteLe(pFile, 16, 4);
+    WriteLe(pFile, 3, 2);
+    WriteLe(pFile, pAudio->u32Channels, 2);
+    WriteLe(pFile, pAudio->u32FramesPerSecond, 4);
+    WriteLe(pFile, pAudio->u32FramesPerSecond * pAudio->u32Channels * sizeof(FLOAT32), 4);
+    WriteLe(pFile, pAudio->u32Channels * sizeof(FLOAT32), 2);
+    WriteLe(pFile, 32, 2);
+    fwrite("data", 1, 4, pFile);
+    WriteLe(pFile, u32DataSize, 4);
+    fwrite(pAudio->Samples.data(), 1, u32DataSize, pFile);
+
+    if (fclose(pFile) != 0)
+    {
+        fprintf(stderr, "ApoHost: cannot write %s\n", pszPath);
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Fills pAudio with reproducible white noise at -6 dBFS peak.
+//
+static void GenerateNoise(HOST_AUDIO *pAudio, FLOAT32 f32Seconds, UINT32 u32Channels, UINT32 u32FramesPerSecond)
+{
+    UINT32 u32State = 0x12345678;
+
+    pAudio->u32Channels = u32Channels;
+    pAudio->u32FramesPerSecond = u32FramesPerSecond;
+    pAudio->u32Frames = (UINT32)(f32Seconds * u32FramesPerSecond);
+    pAudio->Samples.resize(pAudio->u32Frames * u32Channels);
+
+    for (size_t i = 0; i < pAudio->Samples.size(); i++)
+    {
+        u32State = u32State * 1664525 + 1013904223;
+        pAudio->Samples[i] = ((INT32)u32State >> 8) * (0.5f / 8388608.0f);
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Folds samples into a 64 bit FNV-1a checksum of their bits, so a
+//  checksum changes with any sample, even a sign of zero.
+//
+static UINT64 UpdateChecksum(UINT64 u64Checksum, const FLOAT32 *pf32Samples, size_t cSamples)
+{
+    const UINT8 *pu8Bytes = (const UINT8 *)pf32Samples;
+
+    for (size_t i = 0; i < cSamples * sizeof(FLOAT32); i++)
+    {
+        u64Checksum = (u64Checksum ^ pu8Bytes[i]) * 0x100000001B3ull;
+    }
+
+    return u64Checksum;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Makes the stages of a comma separated chain.
+//
+static UINT32 CreateChain(const HOST_OPTIONS *pOptions, const HOST_AUDIO *pReference, CHostStage **ppStages)
+{
+    char szChain[256];
+    UINT32 u32Stages = 0;
+
+    snprintf(szChain, sizeof(szChain), "%s", pOptions->pszChain);
+
+    for (char *pszName = strtok(szChain, ","); pszName != NULL; pszName = strtok(NULL, ","))
+    {
+        CHostStage *pStage = NULL;
+
+        if (u32Stages == HOST_MAX_STAGES)
+        {
+            fprintf(stderr, "ApoHost: more than %d stages\n", HOST_MAX_STAGES);
+            break;
+        }
+
+        if (strcmp(pszName, "swap") == 0)
+        {
+            pStage = new CHostSwap();
+        }
+        else if (strcmp(pszName, "swapscale") == 0)
+        {
+            pStage = new CHostSwapScale(FALSE);
+        }
+        else if (strcmp(pszName, "mix") == 0)
+        {
+            pStage = new CHostSwapScale(TRUE);
+        }
+        else if (strcmp(pszName, "delay") == 0)
+        {
+            pStage = new CHostDelay(pOptions->af32DelayMs, pOptions->u32Delays, FALSE);
+        }
+        else if (strcmp(pszName, "delaycopy") == 0)
+        {
+            pStage = new CHostDelayCopy(pOptions->af32DelayMs, pOptions->u32Delays);
+        }
+        else if (strcmp(pszName, "chain") == 0)
+        {
+            pStage = new CHostDelay(pOptions->af32DelayMs, pOptions->u32Delays, TRUE);
+        }
+        else if (strcmp(pszName, "kws") == 0)
+        {
+            pStage = new CHostKws(pOptions->u32Primary);
+        }
+        else if (strcmp(pszName, "kwscopy") == 0)
+        {
+            pStage = new CHostKwsCopy(pOptions->u32Primary);
+        }
+        else if (strcmp(pszName, "aec") == 0)
+        {
+            pStage = new CHostAec(pReference);
+        }
+        else
+        {
+            fprintf(stderr, "ApoHost: no stage is called %s\n", pszName);
+            break;
+        }
+
+        ppStages[u32Stages++] = pStage;
+    }
+
+    return u32Stages;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Streams the input through the chain u32FramesPerBuffer frames at a
+//  time, pOptions->u32Passes times, timing each stage over each pass, and
+//  prints a line per stage with its median pass. Fills pOutput with the
+//  chain's output if it is not NULL.
+//
+static HRESULT RunChain(
+    const HOST_OPTIONS *pOptions,
+    const HOST_AUDIO *pInput,
+    CHostStage **ppStages,
+    UINT32 u32Stages,
+    UINT32 u32FramesPerBuffer,
+    HOST_AUDIO *pOutput )
+{
+    UINT32 au32Channels[HOST_MAX_STAGES + 1];
+    std::vector<UINT64> Nanoseconds[HOST_MAX_STAGES];
+    UINT64 au64Checksum[HOST_MAX_STAGES];
+    std::vector<FLOAT32> Buffers[2];
+    UINT64 u64Frames = 0;
+
+    au32Channels[0] = pInput->u32Channels;
+
+    for (UINT32 s = 0; s < u32Stages; s++)
+    {
+        au32Channels[s + 1] = ppStages[s]->Initialize(au32Channels[s], pInput->u32FramesPerSecond);
+        if (au32Channels[s + 1] == 0)
+        {
+            fprintf(stderr, "ApoHost: %s cannot take %u channels at %u Hz\n",
+                    ppStages[s]->GetName(), au32Channels[s], pInput->u32FramesPerSecond);
+            return E_INVALIDARG;
+        }
+        au64Checksum[s] = 0xCBF29CE484222325ull;
+        Nanoseconds[s].assign(pOptions->u32Passes, 0);
+    }
+
+    Buffers[0].resize(u32FramesPerBuffer * HOST_MAX_CHANNELS);
+    Buffers[1].resize(u32FramesPerBuffer * HOST_MAX_CHANNELS);
+
+    if (pOutput != NULL)
+    {
+        pOutput->u32Channels = au32Channels[u32Stages];
+        pOutput->u32FramesPerSecond = pInput->u32FramesPerSecond;
+        pOutput->u32Frames = 0;
+        pOutput->Samples.clear();
+    }
+
+    for (UINT32 u32Pass = 0; u32Pass < pOptions->u32Passes; u32Pass++)
+    {
+        for (UINT32 u32Frame = 0; u32Frame < pInput->u32Frames; u32Frame += u32FramesPerBuffer)
+        {
+            UINT32 u32Frames = min(u32FramesPerBuffer, pInput->u32Frames - u32Frame);
+            UINT64 u64Time = u64Frames * HOST_HNS_PER_SECOND / pInput->u32FramesPerSecond;
+            const FLOAT32 *pf32In = &pInput->Samples[u32Frame * pInput->u32Channels];
+
+            for (UINT32 s = 0; s < u32Stages; s++)
+            {
+                FLOAT32 *pf32Out = Buffers[s & 1].data();
+
+                auto Start = std::chrono::steady_clock::now();
+                ppStages[s]->Process(pf32Out, pf32In, u32Frames, u64Time);
+                auto Stop = std::chrono::steady_clock::now();
+
+                Nanoseconds[s][u32Pass] += std::chrono::duration_cast<std::chrono::nanoseconds>(Stop - Start).count();
+                au64Checksum[s] = UpdateChecksum(au64Checksum[s], pf32Out, u32Frames * au32Channels[s + 1]);
+                pf32In = pf32Out;
+            }
+
+            if (pOutput != NULL)
+            {
+                pOutput->Samples.insert(pOutput->Samples.end(), pf32In, pf32In + u32Frames * au32Channels[u32Stages]);
+                pOutput->u32Frames += u32Frames;
+            }
+
+            u64Frames += u32Frames;
+        }
+    }
+
+    for (UINT32 s = 0; s < u32Stages; s++)
+    {
+        std::vector<UINT64>::iterator Median = Nanoseconds[s].begin() + pOptions->u32Passes / 2;
+
+        std::nth_element(Nanoseconds[s].begin(), Median, Nanoseconds[s].end());
+
+        DOUBLE f64NsPerFrame = (DOUBLE)*Median * pOptions->u32Passes / u64Frames;
+        DOUBLE f64Rtf = f64NsPerFrame * pInput->u32FramesPerSecond / 1e9;
+
+        printf(pOptions->fCsv ? "%u,%s,%u,%u,%.3f,%.6f,%016llx\n" : "%8u  %-10s %3u->%-3u %12.3f %12.6f  %016llx\n",
+               u32FramesPerBuffer, ppStages[s]->GetName(), au32Channels[s], au32Channels[s + 1],
+               f64NsPerFrame, f64Rtf, (unsigned long long)au64Checksum[s]);
+    }
+
+    return S_OK;
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+        "Usage: ApoHost [options] input.wav [output.wav]\n"
+        "       ApoHost [options] -g seconds [output.wav]\n"
+        "\n"
+        "  -c stage,...    chain of swap, swapscale, mix, delay, delaycopy, chain, kws,\n"
+        "                  kwscopy and aec (swap,delay)\n"
+        "  -f frames,...   frames per buffer to sweep (80,160,441,480,1024)\n"
+        "  -p passes       times the input is streamed per buffer size, timed by\n"
+        "                  the median pass (1)\n"
+        "  -d ms,...       delay per channel, the last for the rest (1000)\n"
+        "  -k channels     channels kws keeps (all but the last two)\n"
+        "  -r file.wav     loopback reference for aec (silence)\n"
+        "  -g seconds      generate noise instead of reading input.wav\n"
+        "  -n channels     channels of the generated noise (2)\n"
+        "  -s rate         sample rate of the generated noise (48000)\n"
+        "  -K kernel       scalar, 128 or 256 bit kernels (widest supported)\n"
+        "  -v              comma separated output\n");
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Reads a comma separated list of numbers, returns how many there were.
+//
+static UINT32 ParseList(const char *pszList, FLOAT32 *pf32Values, UINT32 u32MaxValues)
+{
+    UINT32 u32Values = 0;
+
+    while ((u32Values < u32MaxValues) && (*pszList != '\0'))
+    {
+        char *pszEnd;
+
+        pf32Values[u32Values++] = strtof(pszList, &pszEnd);
+        if ((pszEnd == pszList) || ((*pszEnd != ',') && (*pszEnd != '\0')))
+        {
+            return 0;
+        }
+        pszList = (*pszEnd == ',') ? pszEnd + 1 : pszEnd;
+    }
+
+    return u32Values;
+}
+
+static BOOL ParseOptions(int argc, char **argv, HOST_OPTIONS *pOptions)
+{
+    static const UINT32 au32DefaultSweep[] = { 80, 160, 441, 480, 1024 };
+    FLOAT32 af32Sweep[HOST_MAX_SWEEP];
+    int i;
+
+    memset(pOptions, 0, sizeof(*pOptions));
+    pOptions->pszChain = "swap,delay";
+    pOptions->u32Passes = 1;
+    pOptions->u32GenerateChannels = 2;
+    pOptions->u32GenerateRate = 48000;
+    pOptions->u32Sweep = sizeof(au32DefaultSweep) / sizeof(au32DefaultSweep[0]);
+    memcpy(pOptions->au32Sweep, au32DefaultSweep, sizeof(au32DefaultSweep));
+
+    for (i = 1; (i < argc) && (argv[i][0] == '-') && (argv[i][1] != '\0'); i++)
+    {
+        char chOption = argv[i][1];
+        const char *pszValue = NULL;
+
+        if (chOption == 'v')
+        {
+            pOptions->fCsv = TRUE;
+            continue;
+        }
+
+        if ((argv[i][2] != '\0') || (i + 1 == argc))
+        {
+            return FALSE;
+        }
+        pszValue = argv[++i];
+
+        switch (chOption)
+        {
+        case 'c':
+            pOptions->pszChain = pszValue;
+            break;
+        case 'f':
+            pOptions->u32Sweep = ParseList(pszValue, af32Sweep, HOST_MAX_SWEEP);
+            for (UINT32 s = 0; s < pOptions->u32Sweep; s++)
+            {
+                if (!(af32Sweep[s] >= 1.0f))
+                {
+                    return FALSE;
+                }
+                pOptions->au32Sweep[s] = (UINT32)af32Sweep[s];
+            }
+            if (pOptions->u32Sweep == 0)
+            {
+                return FALSE;
+            }
+            break;
+        case 'p':
+            pOptions->u32Passes = (UINT32)atoi(pszValue);
+            break;
+        case 'd':
+            pOptions->u32Delays = ParseList(pszValue, pOptions->af32DelayMs, HOST_MAX_CHANNELS);
+            if (pOptions->u32Delays == 0)
+            {
+                return FALSE;
+            }
+            break;
+        case 'k':
+            pOptions->u32Primary = (UINT32)atoi(pszValue);
+            break;
+        case 'r':
+            pOptions->pszReference = pszValue;
+            break;
+        case 'g':
+            pOptions->f32GenerateSeconds = strtof(pszValue, NULL);
+            break;
+        case 'n':
+            pOptions->u32GenerateChannels = (UINT32)atoi(pszValue);
+            break;
+        case 's':
+            pOptions->u32GenerateRate = (UINT32)atoi(pszValue);
+            break;
+        case 'K':
+            pOptions->pszKernel = pszValue;
+            break;
+        default:
+            return FALSE;
+        }
+    }
+
+    if ((pOptions->f32GenerateSeconds <= 0.0f) && (i < argc))
+    {
+        pOptions->pszInput = argv[i++];
+    }
+    if (i < argc)
+    {
+        pOptions->pszOutput = argv[i++];
+    }
+
+    return (i == argc) && (pOptions->u32Passes > 0) &&
+           ((pOptions->pszInput != NULL) ||
+            ((pOptions->f32GenerateSeconds > 0.0f) &&
+             (pOptions->u32GenerateChannels > 0) && (pOptions->u32GenerateChannels <= HOST_MAX_CHANNELS) &&
+             (pOptions->u32GenerateRate > 0)));
+}
+
+int main(int argc, char **argv)
+{
+    static const char *apszKernels[] = { "scalar", "128", "256" };
+    HOST_OPTIONS Options;
+    HOST_AUDIO Input;
+    HOST_AUDIO Reference;
+    HOST_AUDIO Output;
+    CHostStage *apStages[HOST_MAX_STAGES];
+    UINT32 u32Stages;
+    HRESULT hr = S_OK;
+
+    if (!ParseOptions(argc, argv, &Options))
+    {
+        Usage();
+        return 2;
+    }
+
+    if (Options.pszKernel != NULL)
+    {
+        UINT32 k = 0;
+
+        while ((k < (sizeof(apszKernels) / sizeof(apszKernels[0]))) && (strcmp(Options.pszKernel, apszKernels[k]) != 0))
+        {
+            k++;
+        }
+        if (k == (sizeof(apszKernels) / sizeof(apszKernels[0])))
+        {
+            Usage();
+            return 2;
+        }
+        if (!SelectDspKernel((DSP_KERNEL)k))
+        {
+            fprintf(stderr, "ApoHost: this processor cannot run the %s kernel\n", Options.pszKernel);
+            return 1;
+        }
+    }
+
+    if (Options.pszInput != NULL)
+    {
+        hr = ReadWav(Options.pszInput, &Input);
+    }
+    else
+    {
+        GenerateNoise(&Input, Options.f32GenerateSeconds, Options.u32GenerateChannels, Options.u32GenerateRate);
+    }
+
+    if (SUCCEEDED(hr) && (Options.pszReference != NULL))
+    {
+        hr = ReadWav(Options.pszReference, &Reference);
+    }
+
+    if (FAILED(hr))
+    {
+        return 1;
+    }
+
+    u32Stages = CreateChain(&Options, (Options.pszReference != NULL) ? &Reference : NULL, apStages);
+
+    if (SUCCEEDED(hr) && (u32Stages > 0) && (Input.u32Frames > 0))
+    {
+        if (!Options.fCsv)
+        {
+            printf("%u frames, %u channels at %u Hz, %u pass(es), %s kernel\n\n",
+                   Input.u32Frames, Input.u32Channels, Input.u32FramesPerSecond, Options.u32Passes, apszKernels[g_DspKernel]);
+            printf("  frames  stage      channels     ns/frame          rtf  checksum\n");
+        }
+        else
+        {
+            printf("frames,stage,in_channels,out_channels,ns_per_frame,rtf,checksum\n");
+        }
+
+        for (UINT32 s = 0; SUCCEEDED(hr) && (s < Options.u32Sweep); s++)
+        {
+            hr = RunChain(&Options, &Input, apStages, u32Stages, Options.au32Sweep[s],
+                          ((s == 0) && (Options.pszOutput != NULL)) ? &Output : NULL);
+        }
+
+        if (SUCCEEDED(hr) && (Options.pszOutput != NULL))
+        {
+            hr = WriteWav(Options.pszOutput, &Output);
+        }
+    }
+    else
+    {
+        hr = E_INVALIDARG;
+    }
+
+    for (UINT32 s = 0; s < u32Stages; s++)
+    {
+        delete apStages[s];
+    }
+
+    return SUCCEEDED(hr) ? 0 : 1;
+}
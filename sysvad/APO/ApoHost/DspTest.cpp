@@ -0,0 +1,676 @@
+//
+// DspTest.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Checks and times the vector kernels against the scalar ones
+//
+//  Every kernel in ApoDsp.cpp, the swap and swap-scale loops in Swap.cpp,
+//  the channel matrices in mix.cpp and the delay line's interpolation in
+//  Delay.cpp promise the scalar loop's results bit for bit whatever the
+//  vector width. DspTest runs each one over a spread of
+//  channel counts, buffer lengths and awkward samples (ties, full scale,
+//  out of range, NaN), once with the scalar kernel and once with every
+//  wider kernel the processor supports, and compares the whole output
+//  buffer, including a guard area past its end. It exits with 1 if any
+//  result differs.
+//
+//      DspTest             check every kernel
+//      DspTest -b          also time every kernel, in ns per sample
+//
+//  See Usage for the options.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#include <ApoPlatform.h>
+#include <ApoDsp.h>
+
+#include <SwapDsp.h>
+#include <DelayDsp.h>
+
+#define TEST_GUARD_SAMPLES      16
+#define TEST_GUARD_BYTE         0xA5
+
+// Buffers each delay line case runs, fading to new delays at the second.
+#define TEST_DELAY_BUFFERS      4
+#define TEST_DELAY_MAX_FRAMES   600
+#define TEST_DELAY_FADE_FRAMES  64
+
+static const char *g_apszKernels[] = { "scalar", "128", "256" };
+
+static const UINT32 g_au32Channels[] = { 1, 2, 3, 4, 6, 8 };
+static const UINT32 g_au32Frames[] = { 0, 1, 2, 3, 5, 8, 15, 33, 480 };
+
+// Every pattern length the swap kernels build, and odd counts they pass on.
+static const UINT32 g_au32SwapChannels[] = { 1, 2, 3, 4, 5, 6, 8, 10, 12, 16, 30, 32, 34 };
+
+// Groups of four channels the delay line interpolates together, and the
+// channels left over.
+static const UINT32 g_au32DelayChannels[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 12 };
+
+typedef struct _TEST_OPTIONS
+{
+    BOOL    fBenchmark;
+    UINT32  u32Frames;
+    UINT32  u32Channels;
+    UINT32  u32Passes;
+} TEST_OPTIONS;
+
+//
+// Input shared by all the tests: noise with awkward samples mixed in, the
+// noise alone, and 16 and 32 bit PCM noise.
+//
+static std::vector<FLOAT32> g_Float;
+static std::vector<FLOAT32> g_Noise;
+static std::vector<INT16> g_Int16;
+static std::vector<INT32> g_Int32;
+
+static void MakeInput(UINT32 u32Samples)
+{
+    static const FLOAT32 af32Special[] =
+    {
+        0.0f, -0.0f, 1.0f, -1.0f, 2.0f, -2.0f, 1e30f, -1e30f,
+        0.5f / 32768.0f, 1.5f / 32768.0f, -0.5f / 32768.0f, -2.5f / 32768.0f,
+        32767.5f / 32768.0f, -32768.5f / 32768.0f, 1e-40f, NAN,
+    };
+    UINT32 u32Seed = 1;
+
+    g_Float.resize(u32Samples);
+    g_Noise.resize(u32Samples);
+    g_Int16.resize(u32Samples);
+    g_Int32.resize(u32Samples);
+
+    for (UINT32 i = 0; i < u32Samples; i++)
+    {
+        u32Seed = u32Seed * 1664525u + 1013904223u;
+        g_Noise[i] = (FLOAT32)(INT32)u32Seed / 2147483648.0f;
+        if ((i % 7) == 3)
+        {
+            g_Float[i] = af32Special[(u32Seed >> 16) % (sizeof(af32Special) / sizeof(af32Special[0]))];
+        }
+        else
+        {
+            g_Float[i] = (FLOAT32)(INT32)u32Seed / 1073741824.0f;   // -2 to 2.
+        }
+        g_Int16[i] = (INT16)(u32Seed >> 16);
+        g_Int32[i] = (INT32)u32Seed;
+    }
+}
+
+//
+// The kernels checked, and the runs of each per vector kernel.
+//
+enum TEST_KERNEL
+{
+    TestScale,
+    TestRamp,
+    TestMix,
+    TestExtract,
+    TestExtractInPlace,
+    TestInsert,
+    TestInt16ToFloat,
+    TestFloatToInt16,
+    TestInt32ToFloat,
+    TestFloatToInt32,
+    TestPeak,
+    TestRms,
+    TestSwap,
+    TestSwapScale,
+    TestMixGain,
+    TestMixSwapPairs,
+    TestMixRoute,
+    TestMixDense,
+    TestDelayFractional,
+    TestDelayMixed,
+    TestDelayGrouped,
+    TestDelayCopy,
+    TestCount
+};
+
+static const char *g_apszTests[TestCount] =
+{
+    "ScaleFrames", "RampFrames", "MixFrames",
+    "ExtractChannels", "ExtractChannels(in)", "InsertChannels",
+    "ConvertInt16ToFloat", "ConvertFloatToInt16", "ConvertInt32ToFloat", "ConvertFloatToInt32",
+    "GetPeakLevel", "GetRmsLevel",
+    "ProcessSwap", "ProcessSwapScale",
+    "ProcessMix(gain)", "ProcessMix(pairs)", "ProcessMix(route)", "ProcessMix(dense)",
+    "ProcessDelay(frac)", "ProcessDelay(mixed)", "ProcessDelay(group)", "ProcessDelay(copy)",
+};
+
+typedef struct _TEST_RESULT
+{
+    const char  *pszName;
+    UINT32      au32Cases[3];
+    UINT32      au32Failures[3];
+} TEST_RESULT;
+
+//
+// Runs pfnRun, which writes u32Samples samples of type T, with the scalar
+// kernel and then with every wider kernel the processor has, and counts the
+// runs whose output differs from the scalar one anywhere, the guard area
+// after the output included, in pResult.
+//
+template <typename T, typename F>
+static void CompareKernels(UINT32 u32Samples, TEST_RESULT *pResult, F pfnRun)
+{
+    size_t cbBuffer = (u32Samples + TEST_GUARD_SAMPLES) * sizeof(T);
+    std::vector<UINT8> Expected(cbBuffer);
+    std::vector<UINT8> Actual(cbBuffer);
+
+    SelectDspKernel(DspKernelScalar);
+    memset(Expected.data(), TEST_GUARD_BYTE, cbBuffer);
+    pfnRun(reinterpret_cast<T *>(Expected.data()));
+
+    for (UINT32 k = DspKernel128; k <= DspKernel256; k++)
+    {
+        if (!SelectDspKernel((DSP_KERNEL)k))
+        {
+            break;
+        }
+
+        memset(Actual.data(), TEST_GUARD_BYTE, cbBuffer);
+        pfnRun(reinterpret_cast<T *>(Actual.data()));
+
+        pResult->au32Cases[k]++;
+        if (memcmp(Expected.data(), Actual.data(), cbBuffer) != 0)
+        {
+            pResult->au32Failures[k]++;
+        }
+    }
+}
+
+static UINT32 ReportResult(const TEST_RESULT *pResult)
+{
+    UINT32 u32Failures = 0;
+
+    for (UINT32 k = DspKernel128; k <= DspKernel256; k++)
+    {
+        if (pResult->au32Cases[k] == 0)
+        {
+            continue;
+        }
+
+        printf("  %-20s %-6s %5u cases  %s\n", pResult->pszName, g_apszKernels[k], pResult->au32Cases[k],
+               (pResult->au32Failures[k] == 0) ? "ok" : "FAILED");
+        if (pResult->au32Failures[k] != 0)
+        {
+            printf("  %-20s %-6s %5u differ from scalar\n", "", "", pResult->au32Failures[k]);
+        }
+        u32Failures += pResult->au32Failures[k];
+    }
+
+    return u32Failures;
+}
+
+//
+// Builds a u32Channels matrix of the given kind, with gains from the noise,
+// whose first u32Outputs outputs are used. FALSE if no such matrix has that
+// many channels, as a dense one of one channel or swapped pairs of an odd
+// number.
+//
+static BOOL BuildTestMatrix(SWAP_MIX_MATRIX *pMatrix, SWAP_MIX_KIND Kind, UINT32 u32Channels, UINT32 u32Outputs)
+{
+    FLOAT32 af32Coefficients[SWAP_MIX_MAX_CHANNELS * SWAP_MIX_MAX_CHANNELS] = { 0 };
+    const FLOAT32 *pf32Gains = g_Noise.data() + 7;
+
+    for (UINT32 o = 0; o < u32Outputs; o++)
+    {
+        FLOAT32 *pf32Row = af32Coefficients + o * u32Channels;
+
+        switch (Kind)
+        {
+        case SwapMixGain:
+            pf32Row[o] = pf32Gains[o];
+            break;
+        case SwapMixSwapPairs:
+            pf32Row[o ^ 1] = pf32Gains[o];
+            break;
+        case SwapMixRoute:
+            // A permutation with the last output left silent.
+            if (o + 1 < u32Channels)
+            {
+                pf32Row[(o * 5 + 1) % u32Channels] = pf32Gains[o];
+            }
+            break;
+        default:
+            // Every input but the second on every output.
+            for (UINT32 i = 0; i < u32Channels; i++)
+            {
+                pf32Row[i] = (i == 1 && u32Channels > 2) ? 0.0f : pf32Gains[o * u32Channels + i];
+            }
+            break;
+        }
+    }
+
+    return SUCCEEDED(BuildMixMatrix(pMatrix, u32Channels, af32Coefficients, u32Outputs)) &&
+           (pMatrix->Kind == Kind);
+}
+
+//
+// Delays of channel c for a delay line test, before and after the fade.
+// Fractional: a different fraction and delay per channel, some under a
+// frame. Mixed: whole and fractional delays in turn. Grouped: runs of four
+// channels on the same samples with different fractions. Copy: one whole
+// delay, long enough to run as a copy.
+//
+static FLOAT32 GetTestDelay(UINT32 t, UINT32 c, BOOL fFaded)
+{
+    switch (t)
+    {
+    case TestDelayFractional:
+        return fFaded ? 0.25f + 0.3f * c : 3.5f + 37.25f * c;
+    case TestDelayMixed:
+        return ((c & 1) == (fFaded ? 1u : 0u)) ? (FLOAT32)(10 * c) : 10.0f * c + 0.3f;
+    case TestDelayCopy:
+        return fFaded ? (FLOAT32)DELAY_COPY_MIN_FRAMES : 100.0f;
+    default:
+        return (fFaded ? 0.0f : 100.0f + 7.0f * (c / 4)) + 0.1f + 0.2f * (c % 4);
+    }
+}
+
+//
+// Runs a delay line with the delays of test t over TEST_DELAY_BUFFERS
+// buffers of input, every other one in place, into u32Frames frames of
+// output per buffer.
+//
+static void RunDelayLine(FLOAT32 *pf32Out, const FLOAT32 *pf32In, UINT32 t, UINT32 u32Frames, UINT32 u32Channels)
+{
+    std::vector<FLOAT32> Memory(GetDelayLineSamples(u32Channels, TEST_DELAY_MAX_FRAMES));
+    std::vector<DELAY_CHANNEL> Channels(u32Channels);
+    std::vector<DELAY_CHANNEL> FadedChannels(u32Channels);
+    DELAY_LINE Line;
+
+    InitializeDelayLine(&Line, u32Channels, TEST_DELAY_MAX_FRAMES, TEST_DELAY_FADE_FRAMES, Memory.data(), Channels.data());
+    for (UINT32 c = 0; c < u32Channels; c++)
+    {
+        SetDelayLineChannel(&Line, &Channels[c], GetTestDelay(t, c, FALSE));
+        SetDelayLineChannel(&Line, &FadedChannels[c], GetTestDelay(t, c, TRUE));
+    }
+
+    for (UINT32 b = 0; b < TEST_DELAY_BUFFERS; b++)
+    {
+        UINT32 u32Samples = u32Frames * u32Channels;
+
+        if (b == 1)
+        {
+            FadeDelayLine(&Line, FadedChannels.data());
+        }
+
+        if (b & 1)
+        {
+            memcpy(pf32Out, pf32In, u32Samples * sizeof(FLOAT32));
+            ProcessDelayLine(&Line, pf32Out, pf32Out, u32Frames);
+        }
+        else
+        {
+            ProcessDelayLine(&Line, pf32Out, pf32In, u32Frames);
+        }
+        pf32In += u32Samples;
+        pf32Out += u32Samples;
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Checks every kernel over every channel count and buffer length, with
+//  the input one sample past an aligned address so no vector load or
+//  store happens to be aligned.
+//
+// Return values:
+//
+//      Number of runs that differed from the scalar kernel
+//
+static UINT32 CheckKernels()
+{
+    const FLOAT32 *pf32In = g_Float.data() + 1;
+    TEST_RESULT aResults[TestCount];
+    UINT32 u32Failures = 0;
+
+    memset(aResults, 0, sizeof(aResults));
+    for (UINT32 t = 0; t < TestCount; t++)
+    {
+        aResults[t].pszName = g_apszTests[t];
+    }
+
+    for (UINT32 f = 0; f < sizeof(g_au32Frames) / sizeof(g_au32Frames[0]); f++)
+    {
+        UINT32 u32Frames = g_au32Frames[f];
+
+        for (UINT32 c = 0; c < sizeof(g_au32Channels) / sizeof(g_au32Channels[0]); c++)
+        {
+            UINT32 u32Channels = g_au32Channels[c];
+            UINT32 u32Samples = u32Frames * u32Channels;
+
+            CompareKernels<FLOAT32>(u32Samples, &aResults[TestScale], [&](FLOAT32 *pf32Out)
+            {
+                ScaleFrames(pf32Out, pf32In, u32Frames, u32Channels, 0.7f);
+            });
+
+            // Up, down, and past unity as the crossfades and mutes use it.
+            CompareKernels<FLOAT32>(u32Samples, &aResults[TestRamp], [&](FLOAT32 *pf32Out)
+            {
+                RampFrames(pf32Out, pf32In, u32Frames, u32Channels, 0.0f, 1.0f);
+            });
+            CompareKernels<FLOAT32>(u32Samples, &aResults[TestRamp], [&](FLOAT32 *pf32Out)
+            {
+                RampFrames(pf32Out, pf32In, u32Frames, u32Channels, 1.3f, 0.1f);
+            });
+
+            CompareKernels<FLOAT32>(u32Samples, &aResults[TestMix], [&](FLOAT32 *pf32Out)
+            {
+                memcpy(pf32Out, g_Float.data() + 5, u32Samples * sizeof(FLOAT32));
+                MixFrames(pf32Out, pf32In, u32Frames, u32Channels, -0.3f);
+            });
+
+            CompareKernels<FLOAT32>(u32Samples, &aResults[TestInt16ToFloat], [&](FLOAT32 *pf32Out)
+            {
+                ConvertInt16ToFloat(pf32Out, g_Int16.data() + 1, u32Frames, u32Channels);
+            });
+            CompareKernels<INT16>(u32Samples, &aResults[TestFloatToInt16], [&](INT16 *pi16Out)
+            {
+                ConvertFloatToInt16(pi16Out, pf32In, u32Frames, u32Channels);
+            });
+            CompareKernels<FLOAT32>(u32Samples, &aResults[TestInt32ToFloat], [&](FLOAT32 *pf32Out)
+            {
+                ConvertInt32ToFloat(pf32Out, g_Int32.data() + 1, u32Frames, u32Channels);
+            });
+            CompareKernels<INT32>(u32Samples, &aResults[TestFloatToInt32], [&](INT32 *pi32Out)
+            {
+                ConvertFloatToInt32(pi32Out, pf32In, u32Frames, u32Channels);
+            });
+
+            CompareKernels<FLOAT32>(1, &aResults[TestPeak], [&](FLOAT32 *pf32Out)
+            {
+                *pf32Out = GetPeakLevel(pf32In, u32Frames, u32Channels);
+            });
+            CompareKernels<FLOAT32>(1, &aResults[TestRms], [&](FLOAT32 *pf32Out)
+            {
+                // One NaN makes any sum NaN, so the sums are checked on noise.
+                *pf32Out = GetRmsLevel(g_Noise.data() + 1, u32Frames, u32Channels);
+            });
+
+            // Every narrower frame out of this one, which takes in the
+            // one of two, two and four channel gathers.
+            for (UINT32 u32Other = 1; u32Other <= u32Channels; u32Other++)
+            {
+                UINT32 u32Wide = u32Frames * u32Channels;
+                UINT32 u32Narrow = u32Frames * u32Other;
+
+                CompareKernels<FLOAT32>(u32Narrow, &aResults[TestExtract], [&](FLOAT32 *pf32Out)
+                {
+                    ExtractChannels(pf32Out, pf32In, u32Frames, u32Other, u32Channels);
+                });
+                CompareKernels<FLOAT32>(u32Wide, &aResults[TestExtractInPlace], [&](FLOAT32 *pf32Out)
+                {
+                    memcpy(pf32Out, pf32In, u32Wide * sizeof(FLOAT32));
+                    ExtractChannels(pf32Out, pf32Out, u32Frames, u32Other, u32Channels);
+                });
+                CompareKernels<FLOAT32>(u32Wide, &aResults[TestInsert], [&](FLOAT32 *pf32Out)
+                {
+                    memcpy(pf32Out, g_Float.data() + 5, u32Wide * sizeof(FLOAT32));
+                    InsertChannels(pf32Out, pf32In, u32Frames, u32Other, u32Channels);
+                });
+            }
+        }
+
+        for (UINT32 c = 0; c < sizeof(g_au32SwapChannels) / sizeof(g_au32SwapChannels[0]); c++)
+        {
+            UINT32 u32Channels = g_au32SwapChannels[c];
+            UINT32 u32Samples = u32Frames * u32Channels;
+            FLOAT32 *pf32Coefficients = g_Noise.data() + 3;
+
+            CompareKernels<FLOAT32>(u32Samples, &aResults[TestSwap], [&](FLOAT32 *pf32Out)
+            {
+                ProcessSwap(pf32Out, pf32In, u32Frames, u32Channels);
+            });
+            CompareKernels<FLOAT32>(u32Samples, &aResults[TestSwapScale], [&](FLOAT32 *pf32Out)
+            {
+                ProcessSwapScale(pf32Out, pf32In, u32Frames, u32Channels, pf32Coefficients);
+            });
+        }
+
+        // Each kind of matrix out of place and in place, the dense ones
+        // also as a downmix that leaves the upper half of the outputs silent.
+        for (UINT32 u32Channels = 1; u32Channels <= SWAP_MIX_MAX_CHANNELS; u32Channels++)
+        {
+            UINT32 u32Samples = u32Frames * u32Channels;
+            UINT32 au32Outputs[] = { u32Channels, (u32Channels + 1) / 2 };
+
+            for (UINT32 t = TestMixGain; t <= TestMixDense; t++)
+            {
+                SWAP_MIX_KIND Kind = (SWAP_MIX_KIND)(SwapMixGain + (t - TestMixGain));
+
+                for (UINT32 m = 0; m < ((Kind == SwapMixDense) ? 2u : 1u); m++)
+                {
+                    SWAP_MIX_MATRIX Matrix;
+
+                    if (!BuildTestMatrix(&Matrix, Kind, u32Channels, au32Outputs[m]))
+                    {
+                        continue;
+                    }
+
+                    CompareKernels<FLOAT32>(u32Samples, &aResults[t], [&](FLOAT32 *pf32Out)
+                    {
+                        ProcessMix(pf32Out, pf32In, u32Frames, &Matrix);
+                    });
+                    CompareKernels<FLOAT32>(u32Samples, &aResults[t], [&](FLOAT32 *pf32Out)
+                    {
+                        memcpy(pf32Out, pf32In, u32Samples * sizeof(FLOAT32));
+                        ProcessMix(pf32Out, pf32Out, u32Frames, &Matrix);
+                    });
+                }
+            }
+        }
+
+        // Whole runs of the delay line, so reads that wrap the ring and the
+        // crossfade are covered.
+        for (UINT32 c = 0; c < sizeof(g_au32DelayChannels) / sizeof(g_au32DelayChannels[0]); c++)
+        {
+            UINT32 u32Channels = g_au32DelayChannels[c];
+
+            for (UINT32 t = TestDelayFractional; t <= TestDelayCopy; t++)
+            {
+                CompareKernels<FLOAT32>(TEST_DELAY_BUFFERS * u32Frames * u32Channels, &aResults[t], [&](FLOAT32 *pf32Out)
+                {
+                    RunDelayLine(pf32Out, pf32In, t, u32Frames, u32Channels);
+                });
+            }
+        }
+    }
+
+    for (UINT32 t = 0; t < TestCount; t++)
+    {
+        u32Failures += ReportResult(&aResults[t]);
+    }
+
+    return u32Failures;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Times pfnRun, one buffer of u32Samples samples per call, with every
+//  kernel the processor has and prints the time per sample for each.
+//
+template <typename F>
+static void TimeKernel(const char *pszName, const TEST_OPTIONS *pOptions, F pfnRun)
+{
+    UINT32 u32Samples = pOptions->u32Frames * pOptions->u32Channels;
+    // About 50 million samples per kernel and pass.
+    UINT32 u32Calls = max(1u, 50000000u / u32Samples) * pOptions->u32Passes;
+
+    printf("  %-20s", pszName);
+
+    for (UINT32 k = DspKernelScalar; k <= DspKernel256; k++)
+    {
+        if (!SelectDspKernel((DSP_KERNEL)k))
+        {
+            break;
+        }
+
+        pfnRun();
+
+        auto tStart = std::chrono::steady_clock::now();
+        for (UINT32 n = 0; n < u32Calls; n++)
+        {
+            pfnRun();
+        }
+        auto tEnd = std::chrono::steady_clock::now();
+
+        printf(" %10.4f", std::chrono::duration<double, std::nano>(tEnd - tStart).count() / ((double)u32Calls * u32Samples));
+    }
+
+    printf("\n");
+}
+
+static void TimeKernels(const TEST_OPTIONS *pOptions)
+{
+    UINT32 u32Frames = pOptions->u32Frames;
+    UINT32 u32Channels = pOptions->u32Channels;
+    UINT32 u32Samples = u32Frames * u32Channels;
+    std::vector<FLOAT32> Out(u32Samples);
+    std::vector<INT16> Out16(u32Samples);
+    std::vector<INT32> Out32(u32Samples);
+    const FLOAT32 *pf32In = g_Noise.data();
+    FLOAT32 *pf32Coefficients = g_Noise.data() + 3;
+    SWAP_MIX_MATRIX RouteMatrix;
+    SWAP_MIX_MATRIX DenseMatrix;
+    std::vector<FLOAT32> DelayMemory(GetDelayLineSamples(u32Channels, TEST_DELAY_MAX_FRAMES));
+    std::vector<DELAY_CHANNEL> DelayChannels(u32Channels);
+    DELAY_LINE DelayLine;
+    volatile FLOAT32 f32Level;
+
+    printf("\n%u frames of %u channels, ns per sample\n\n", u32Frames, u32Channels);
+    printf("  %-20s %10s %10s %10s\n", "kernel", g_apszKernels[0], g_apszKernels[1], g_apszKernels[2]);
+
+    TimeKernel("ScaleFrames", pOptions, [&]() { ScaleFrames(Out.data(), pf32In, u32Frames, u32Channels, 0.7f); });
+    TimeKernel("RampFrames", pOptions, [&]() { RampFrames(Out.data(), pf32In, u32Frames, u32Channels, 0.0f, 1.0f); });
+    TimeKernel("MixFrames", pOptions, [&]() { MixFrames(Out.data(), pf32In, u32Frames, u32Channels, 0.3f); });
+    if (u32Channels >= 2)
+    {
+        TimeKernel("ExtractChannels(2)", pOptions, [&]() { ExtractChannels(Out.data(), pf32In, u32Frames, 2, u32Channels); });
+        TimeKernel("InsertChannels(2)", pOptions, [&]() { InsertChannels(Out.data(), pf32In, u32Frames, 2, u32Channels); });
+    }
+    TimeKernel("ConvertInt16ToFloat", pOptions, [&]() { ConvertInt16ToFloat(Out.data(), g_Int16.data(), u32Frames, u32Channels); });
+    TimeKernel("ConvertFloatToInt16", pOptions, [&]() { ConvertFloatToInt16(Out16.data(), pf32In, u32Frames, u32Channels); });
+    TimeKernel("ConvertInt32ToFloat", pOptions, [&]() { ConvertInt32ToFloat(Out.data(), g_Int32.data(), u32Frames, u32Channels); });
+    TimeKernel("ConvertFloatToInt32", pOptions, [&]() { ConvertFloatToInt32(Out32.data(), pf32In, u32Frames, u32Channels); });
+    TimeKernel("GetPeakLevel", pOptions, [&]() { f32Level = GetPeakLevel(pf32In, u32Frames, u32Channels); });
+    TimeKernel("GetRmsLevel", pOptions, [&]() { f32Level = GetRmsLevel(pf32In, u32Frames, u32Channels); });
+    TimeKernel("ProcessSwap", pOptions, [&]() { ProcessSwap(Out.data(), pf32In, u32Frames, u32Channels); });
+    TimeKernel("ProcessSwapScale", pOptions, [&]() { ProcessSwapScale(Out.data(), pf32In, u32Frames, u32Channels, pf32Coefficients); });
+    if (BuildTestMatrix(&RouteMatrix, SwapMixRoute, u32Channels, u32Channels))
+    {
+        TimeKernel("ProcessMix(route)", pOptions, [&]() { ProcessMix(Out.data(), pf32In, u32Frames, &RouteMatrix); });
+    }
+    if (BuildTestMatrix(&DenseMatrix, SwapMixDense, u32Channels, u32Channels))
+    {
+        TimeKernel("ProcessMix(dense)", pOptions, [&]() { ProcessMix(Out.data(), pf32In, u32Frames, &DenseMatrix); });
+    }
+
+    InitializeDelayLine(&DelayLine, u32Channels, TEST_DELAY_MAX_FRAMES, TEST_DELAY_FADE_FRAMES, DelayMemory.data(), DelayChannels.data());
+    for (UINT32 c = 0; c < u32Channels; c++)
+    {
+        SetDelayLineChannel(&DelayLine, &DelayChannels[c], GetTestDelay(TestDelayFractional, c, FALSE));
+    }
+    TimeKernel("ProcessDelay(frac)", pOptions, [&]() { ProcessDelayLine(&DelayLine, Out.data(), pf32In, u32Frames); });
+
+    UNREFERENCED_PARAMETER(f32Level);
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+        "Usage: DspTest [options]\n"
+        "\n"
+        "  -b              time every kernel after checking them\n"
+        "  -f frames       frames per buffer to time (480)\n"
+        "  -n channels     channels to time (2)\n"
+        "  -p passes       multiplies the time spent timing (1)\n");
+}
+
+static BOOL ParseOptions(int argc, char **argv, TEST_OPTIONS *pOptions)
+{
+    int i;
+
+    memset(pOptions, 0, sizeof(*pOptions));
+    pOptions->u32Frames = 480;
+    pOptions->u32Channels = 2;
+    pOptions->u32Passes = 1;
+
+    for (i = 1; (i < argc) && (argv[i][0] == '-') && (argv[i][1] != '\0'); i++)
+    {
+        char chOption = argv[i][1];
+        const char *pszValue = NULL;
+
+        if (chOption == 'b')
+        {
+            pOptions->fBenchmark = TRUE;
+            continue;
+        }
+
+        if ((argv[i][2] != '\0') || (i + 1 == argc))
+        {
+            return FALSE;
+        }
+        pszValue = argv[++i];
+
+        switch (chOption)
+        {
+        case 'f':
+            pOptions->u32Frames = (UINT32)atoi(pszValue);
+            break;
+        case 'n':
+            pOptions->u32Channels = (UINT32)atoi(pszValue);
+            break;
+        case 'p':
+            pOptions->u32Passes = (UINT32)atoi(pszValue);
+            break;
+        default:
+            return FALSE;
+        }
+    }
+
+    return (i == argc) && (pOptions->u32Frames > 0) && (pOptions->u32Frames <= 65536) &&
+           (pOptions->u32Channels > 0) && (pOptions->u32Channels <= 32) && (pOptions->u32Passes > 0);
+}
+
+int main(int argc, char **argv)
+{
+    TEST_OPTIONS Options;
+    DSP_KERNEL widest = g_DspKernel;
+    UINT32 u32Failures;
+
+    if (!ParseOptions(argc, argv, &Options))
+    {
+        Usage();
+        return 2;
+    }
+
+    MakeInput(max(Options.u32Frames * Options.u32Channels, 480u * 64u) + 8);
+
+    printf("Kernels against scalar, %s widest\n\n", g_apszKernels[widest]);
+    u32Failures = CheckKernels();
+
+    if (Options.fBenchmark)
+    {
+        TimeKernels(&Options);
+    }
+
+    SelectDspKernel(widest);
+
+    if (u32Failures != 0)
+    {
+        printf("\n%u runs differ from the scalar kernel\n", u32Failures);
+        return 1;
+    }
+
+    return 0;
+}
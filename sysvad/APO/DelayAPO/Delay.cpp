@@ -3,110 +3,970 @@
 //
 // Description:
 //
-//  Implementation of ProcessDelay
+//  Implementation of the delay line
 //
-#include <atlbase.h>
-#include <atlcom.h>
-#include <atlcoll.h>
-#include <atlsync.h>
-#include <mmreg.h>
-
-#include <audioenginebaseapo.h>
-#include <baseaudioprocessingobject.h>
-#include <resource.h>
+#include <ApoPlatform.h>
 
 #include <float.h>
 
-#include "DelayAPO.h"
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include "DelayDsp.h"
+
+//
+// Delay line
+//
+//  The ring holds a power of two interleaved frames, so a position is masked
+//  instead of compared, followed by a copy of its first DELAY_GUARD_FRAMES
+//  frames: a window of up to DELAY_BLOCK_FRAMES + 3 frames starting anywhere
+//  in the ring is contiguous. A block of input is copied to the ring once,
+//  then the output is read from the ring once, so the input may be the
+//  output. When every channel has the same whole frame delay, the read is a
+//  single copy as well. Blocks are cut to DELAY_BLOCK_SAMPLES samples, so a
+//  block of input, the ring it is written to and the output it is read to
+//  stay in L1 for wide streams too.
+//
+//  When every channel has the same whole frame delay D, with no matrix and
+//  no fade, the line instead runs as the copy delay did: the D frames
+//  before the write position are a copy of exactly D frames, and each frame
+//  of it is read out and then overwritten by the input in the same pass.
+//  A long ring is then touched once per frame rather than at two places D
+//  frames apart, and the guard is not kept. The copy starts where the ring
+//  already holds its frames, so it costs nothing to begin; it is rotated
+//  back into the ring when the settings change. The frames older than D
+//  were overwritten by then, so a longer delay fades in from silence.
+//
+//  The memory holds a ring for the longest delay the line allows, but the
+//  ring in use is only as long as the delays in use need, so the blocks it
+//  writes are read back while they are still in cache. When a longer delay
+//  is set the ring grows in place: the frames it holds keep their age, and
+//  the frames it never held read as silence.
+//
+//  ProcessDelayChain runs a channel matrix, the Swap MFX's swap, scale and
+//  gain, in the same pass: each block is mixed straight into the ring
+//  instead of copied, so the mix costs no pass of its own over the buffer
+//  and no intermediate buffer. The ring holds exactly what ProcessMix would
+//  have written, so the output is the same bit for bit as the two run one
+//  after the other.
+//
+//  Silent input is written to the ring as zeros, and the line counts how
+//  much it has written since the last input. Once that covers the longest
+//  delay and the taps behind it, every sample a read can reach is zero: the
+//  line is silent and may be skipped, without even advancing, until input
+//  comes back.
+//
+//  New delays are faded in: for the next u32FadeFrames frames the block is
+//  also read with the old ones, into pf32Fade, and the two are mixed with
+//  a linear ramp, so a change never steps the waveform.
+//
+//  A whole frame delay D reads x[n - D]. A fractional one reads a cubic
+//  Lagrange interpolation of the four samples around n - D - f, centered
+//  when D > 0; the four taps depend only on f, so they are the Farrow
+//  polynomials evaluated once, when the delay is set. A channel is
+//  interpolated four frames at a time; four neighbouring channels with
+//  fractional delays on the same samples are interpolated together instead,
+//  their samples being adjacent in each frame. The sums are in the order of
+//  the scalar loop either way.
+//
+
+//
+// Frames of the ring, a power of two.
+//
+static UINT32 GetDelayRingFrames(
+    UINT32   u32MaxDelayFrames )
+{
+    UINT32 u32RingFrames = DELAY_BLOCK_FRAMES;
+
+    // The oldest sample a block reads is the delay plus 3 taps plus a block
+    // behind the newest one written.
+    while (u32RingFrames < u32MaxDelayFrames + 3 + DELAY_BLOCK_FRAMES)
+    {
+        u32RingFrames *= 2;
+    }
+
+    return u32RingFrames;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Number of samples of memory a delay line needs.
+//
+// Parameters:
+//
+//      u32Channels         - [in] channels of a frame
+//      u32MaxDelayFrames   - [in] longest delay any channel will be given
+//
+UINT32 GetDelayLineSamples(
+    UINT32   u32Channels,
+    UINT32   u32MaxDelayFrames )
+{
+    ASSERT_NONREALTIME();
+
+    // The ring and its guard, then the block faded out.
+    return u32Channels * (GetDelayRingFrames(u32MaxDelayFrames) + DELAY_GUARD_FRAMES + DELAY_BLOCK_FRAMES);
+}
 
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Sets up a delay line on caller memory, silent and with no delay.
+//
+// Parameters:
+//
+//      pDelayLine          - [out] the delay line
+//      u32Channels         - [in] channels of a frame
+//      u32MaxDelayFrames   - [in] longest delay any channel will be given
+//      u32FadeFrames       - [in] frames FadeDelayLine crossfades over
+//      pf32Memory          - [in] GetDelayLineSamples samples
+//      pChannels           - [in] u32Channels channel settings
+//
+void InitializeDelayLine(
+    _Out_ DELAY_LINE *pDelayLine,
+    UINT32   u32Channels,
+    UINT32   u32MaxDelayFrames,
+    UINT32   u32FadeFrames,
+    _Out_ FLOAT32 *pf32Memory,
+    _Out_writes_(u32Channels) DELAY_CHANNEL *pChannels )
+{
+    ASSERT_NONREALTIME();
+
+    pDelayLine->u32Channels = u32Channels;
+    pDelayLine->u32MaxDelayFrames = u32MaxDelayFrames;
+    pDelayLine->u32MaxRingFrames = GetDelayRingFrames(u32MaxDelayFrames);
+    pDelayLine->u32RingFrames = GetDelayRingFrames(0);
+    pDelayLine->u32WriteIndex = 0;
+    pDelayLine->u32BlockFrames = max(min(DELAY_BLOCK_FRAMES, DELAY_BLOCK_SAMPLES / u32Channels), 1);
+    pDelayLine->u32FadeFrames = max(u32FadeFrames, 1);
+    pDelayLine->u32FadePosition = 0;
+    pDelayLine->f32FadeStep = 1.0f / pDelayLine->u32FadeFrames;
+    pDelayLine->pf32Ring = pf32Memory;
+    pDelayLine->pf32Fade = pf32Memory + u32Channels * (pDelayLine->u32MaxRingFrames + DELAY_GUARD_FRAMES);
+    pDelayLine->pChannels = pChannels;
+    pDelayLine->pFadeChannels = NULL;
+    pDelayLine->u32SilentFrames = pDelayLine->u32RingFrames;
+    pDelayLine->u32ReachFrames = 3;
+    pDelayLine->u32CopyFrames = 0;
+    pDelayLine->u32CopyBase = 0;
+
+    ZeroMemory(pf32Memory, sizeof(FLOAT32) * GetDelayLineSamples(u32Channels, u32MaxDelayFrames));
+    ZeroMemory(pChannels, sizeof(DELAY_CHANNEL) * u32Channels);
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Sets the delay of one channel, in frames, clamped to the longest delay
+//  the line was set up for. The channel is one of the line's settings
+//  before it streams, or one of a set to hand to FadeDelayLine.
+//
+void SetDelayLineChannel(
+    const DELAY_LINE *pDelayLine,
+    _Out_ DELAY_CHANNEL *pChannel,
+    FLOAT32  f32DelayFrames )
+{
+    ASSERT_NONREALTIME();
+    UINT32  u32Frames;
+    FLOAT32 f32Fraction;
+    FLOAT32 t;
+
+    if (!(f32DelayFrames > 0.0f))
+    {
+        f32DelayFrames = 0.0f;                  // Also NaN.
+    }
+    else if (f32DelayFrames > (FLOAT32)pDelayLine->u32MaxDelayFrames)
+    {
+        f32DelayFrames = (FLOAT32)pDelayLine->u32MaxDelayFrames;
+    }
+
+    u32Frames = (UINT32)f32DelayFrames;
+    f32Fraction = f32DelayFrames - (FLOAT32)u32Frames;
+
+    pChannel->fFractional = (f32Fraction != 0.0f);
+    if (!pChannel->fFractional)
+    {
+        pChannel->u32Frames = u32Frames;
+    }
+    else
+    {
+        // Taps on x[n - B], ..., x[n - B - 3] with B one frame short of the
+        // delay, so the point falls between the middle two, or B = 0 for
+        // delays under a frame. t is the point's distance from x[n - B].
+        pChannel->u32Frames = (u32Frames > 0) ? u32Frames - 1 : 0;
+        t = f32DelayFrames - (FLOAT32)pChannel->u32Frames;
+
+        // Oldest sample's tap first.
+        pChannel->af32Taps[3] = -(t - 1.0f) * (t - 2.0f) * (t - 3.0f) / 6.0f;
+        pChannel->af32Taps[2] = t * (t - 2.0f) * (t - 3.0f) / 2.0f;
+        pChannel->af32Taps[1] = -t * (t - 1.0f) * (t - 3.0f) / 2.0f;
+        pChannel->af32Taps[0] = t * (t - 1.0f) * (t - 2.0f) / 6.0f;
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Starts delaying by new channel settings, crossfading from the current
+//  ones. The line uses both until it sets pFadeChannels back to NULL.
+//
 #pragma AVRT_CODE_BEGIN
-void WriteSilence(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32Frames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame )
+void FadeDelayLine(
+    _Inout_ DELAY_LINE *pDelayLine,
+    _In_ DELAY_CHANNEL *pChannels )
 {
-    ZeroMemory(pf32Frames, sizeof(FLOAT32) * u32FrameCount * u32SamplesPerFrame);
+    pDelayLine->pFadeChannels = pDelayLine->pChannels;
+    pDelayLine->pChannels = pChannels;
+    pDelayLine->u32FadePosition = 0;
 }
 #pragma AVRT_CODE_END
 
+//
+// Copies one block of input frames to the ring, or mixes them into it with
+// pMatrix if it is not NULL, or writes zeros for NULL input; then copies the
+// start of the ring to the guard when the block wrote any of it.
+//
 #pragma AVRT_CODE_BEGIN
-void CopyFrames(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32OutFrames,
-    _In_reads_(u32FrameCount * u32SamplesPerFrame)
-        const FLOAT32 *pf32InFrames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame )
+static void WriteDelayBlock(
+    _Inout_ DELAY_LINE *pDelayLine,
+    const SWAP_MIX_MATRIX *pMatrix,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32Frames )
 {
-    CopyMemory(pf32OutFrames, pf32InFrames, sizeof(FLOAT32) * u32FrameCount * u32SamplesPerFrame);
+    UINT32 u32Channels = pDelayLine->u32Channels;
+    UINT32 u32Position = pDelayLine->u32WriteIndex;
+    UINT32 u32ToEnd = min(u32Frames, pDelayLine->u32RingFrames - u32Position);
+
+    if (NULL == pf32InputFrames)
+    {
+        WriteSilence(pDelayLine->pf32Ring + u32Position * u32Channels, u32ToEnd, u32Channels);
+        WriteSilence(pDelayLine->pf32Ring, u32Frames - u32ToEnd, u32Channels);
+        pDelayLine->u32SilentFrames = min(pDelayLine->u32SilentFrames + u32Frames, pDelayLine->u32RingFrames);
+    }
+    else if (NULL != pMatrix)
+    {
+        ProcessMix(pDelayLine->pf32Ring + u32Position * u32Channels, pf32InputFrames, u32ToEnd, pMatrix);
+        ProcessMix(pDelayLine->pf32Ring, pf32InputFrames + u32ToEnd * u32Channels, u32Frames - u32ToEnd, pMatrix);
+        pDelayLine->u32SilentFrames = 0;
+    }
+    else
+    {
+        CopyFrames(pDelayLine->pf32Ring + u32Position * u32Channels, pf32InputFrames, u32ToEnd, u32Channels);
+        CopyFrames(pDelayLine->pf32Ring, pf32InputFrames + u32ToEnd * u32Channels, u32Frames - u32ToEnd, u32Channels);
+        pDelayLine->u32SilentFrames = 0;
+    }
+
+    if (u32Position < DELAY_GUARD_FRAMES || u32ToEnd < u32Frames)
+    {
+        CopyFrames(pDelayLine->pf32Ring + pDelayLine->u32RingFrames * u32Channels, pDelayLine->pf32Ring, DELAY_GUARD_FRAMES, u32Channels);
+    }
 }
 #pragma AVRT_CODE_END
 
+//
+// Reads one block of a channel's output, given its oldest tap's window.
+// Four frames at a time, each frame's sample is loaded once and the three
+// later windows are shifted out of two vectors.
+//
 #pragma AVRT_CODE_BEGIN
-void ProcessDelay(
-    _Out_writes_(u32ValidFrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32OutputFrames,
-    _In_reads_(u32ValidFrameCount * u32SamplesPerFrame)
-        const FLOAT32 *pf32InputFrames,
-    UINT32       u32ValidFrameCount,
-    UINT32       u32SamplesPerFrame,
-    _Inout_updates_(u32DelayFrames * u32SamplesPerFrame)
-        FLOAT32 *pf32DelayBuffer,
-    UINT32       u32DelayFrames,
-    _Inout_
-        UINT32  *pu32DelayIndex )
+static void InterpolateDelayBlock(
+    FLOAT32 *pf32Output,
+    const FLOAT32 *pf32Window,
+    UINT32   u32Frames,
+    UINT32   u32Channels,
+    const FLOAT32 *pf32Taps )
 {
-    ASSERT_REALTIME();
-    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
-    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32OutputFrames) );
-    
-    if (u32DelayFrames == 0)
+    FLOAT32 f32Tap0 = pf32Taps[0];
+    FLOAT32 f32Tap1 = pf32Taps[1];
+    FLOAT32 f32Tap2 = pf32Taps[2];
+    FLOAT32 f32Tap3 = pf32Taps[3];
+    UINT32 n = 0;
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+    if (g_DspKernel != DspKernelScalar)
     {
-        CopyFrames( pf32OutputFrames,
-                    pf32InputFrames,
-                    u32ValidFrameCount,
-                    u32SamplesPerFrame );
+        FLOAT32 af32Vector[4];
+        const FLOAT32 *pf32Next;
+
+        // The guard covers the one frame past the window the last load reads.
+#if defined(_M_ARM64)
+        float32x4_t vTap0 = vdupq_n_f32(f32Tap0);
+        float32x4_t vTap1 = vdupq_n_f32(f32Tap1);
+        float32x4_t vTap2 = vdupq_n_f32(f32Tap2);
+        float32x4_t vTap3 = vdupq_n_f32(f32Tap3);
+        float32x4_t vLast;
+
+        af32Vector[0] = pf32Window[0];
+        af32Vector[1] = pf32Window[u32Channels];
+        af32Vector[2] = pf32Window[2 * u32Channels];
+        af32Vector[3] = pf32Window[3 * u32Channels];
+        vLast = vld1q_f32(af32Vector);
+
+        for (; n + 4 <= u32Frames; n += 4)
+        {
+            pf32Next = pf32Window + (n + 4) * u32Channels;
+            af32Vector[0] = pf32Next[0];
+            af32Vector[1] = pf32Next[u32Channels];
+            af32Vector[2] = pf32Next[2 * u32Channels];
+            af32Vector[3] = pf32Next[3 * u32Channels];
+
+            float32x4_t vNext = vld1q_f32(af32Vector);
+            float32x4_t vSum = vmulq_f32(vTap0, vLast);
+
+            vSum = vaddq_f32(vSum, vmulq_f32(vTap1, vextq_f32(vLast, vNext, 1)));
+            vSum = vaddq_f32(vSum, vmulq_f32(vTap2, vextq_f32(vLast, vNext, 2)));
+            vSum = vaddq_f32(vSum, vmulq_f32(vTap3, vextq_f32(vLast, vNext, 3)));
+            vst1q_f32(af32Vector, vSum);
+            vLast = vNext;
+#else
+        __m128 vTap0 = _mm_set1_ps(f32Tap0);
+        __m128 vTap1 = _mm_set1_ps(f32Tap1);
+        __m128 vTap2 = _mm_set1_ps(f32Tap2);
+        __m128 vTap3 = _mm_set1_ps(f32Tap3);
+        __m128 vLast = _mm_setr_ps(pf32Window[0], pf32Window[u32Channels], pf32Window[2 * u32Channels], pf32Window[3 * u32Channels]);
+
+        for (; n + 4 <= u32Frames; n += 4)
+        {
+            pf32Next = pf32Window + (n + 4) * u32Channels;
+
+            __m128 vNext = _mm_setr_ps(pf32Next[0], pf32Next[u32Channels], pf32Next[2 * u32Channels], pf32Next[3 * u32Channels]);
+            __m128 vMiddle = _mm_shuffle_ps(vLast, vNext, _MM_SHUFFLE(0, 0, 3, 3));
+            __m128 vSum = _mm_mul_ps(vTap0, vLast);
+
+            vSum = _mm_add_ps(vSum, _mm_mul_ps(vTap1, _mm_shuffle_ps(vLast, vMiddle, _MM_SHUFFLE(2, 0, 2, 1))));
+            vSum = _mm_add_ps(vSum, _mm_mul_ps(vTap2, _mm_shuffle_ps(vLast, vNext, _MM_SHUFFLE(1, 0, 3, 2))));
+            vSum = _mm_add_ps(vSum, _mm_mul_ps(vTap3, _mm_shuffle_ps(vMiddle, vNext, _MM_SHUFFLE(2, 1, 2, 0))));
+            _mm_storeu_ps(af32Vector, vSum);
+            vLast = vNext;
+#endif
+            pf32Output[(n + 0) * u32Channels] = af32Vector[0];
+            pf32Output[(n + 1) * u32Channels] = af32Vector[1];
+            pf32Output[(n + 2) * u32Channels] = af32Vector[2];
+            pf32Output[(n + 3) * u32Channels] = af32Vector[3];
+        }
     }
-    else
+#endif
+
+    for (pf32Window += n * u32Channels; n < u32Frames; n++, pf32Window += u32Channels)
+    {
+        pf32Output[n * u32Channels] = f32Tap0 * pf32Window[0] + f32Tap1 * pf32Window[u32Channels] +
+                                      f32Tap2 * pf32Window[2 * u32Channels] + f32Tap3 * pf32Window[3 * u32Channels];
+    }
+}
+#pragma AVRT_CODE_END
+
+//
+// Reads one block of four adjacent channels with fractional delays on the
+// same samples, given the oldest tap's window of the first.
+//
+#pragma AVRT_CODE_BEGIN
+static void InterpolateDelayBlock4(
+    FLOAT32 *pf32Output,
+    const FLOAT32 *pf32Window,
+    UINT32   u32Frames,
+    UINT32   u32Channels,
+    const DELAY_CHANNEL *pChannels )
+{
+#if defined(_M_ARM64)
+    float32x4_t vTap[4];
+
+    for (UINT32 k = 0; k < 4; k++)
+    {
+        FLOAT32 af32Taps[4] = { pChannels[0].af32Taps[k], pChannels[1].af32Taps[k], pChannels[2].af32Taps[k], pChannels[3].af32Taps[k] };
+
+        vTap[k] = vld1q_f32(af32Taps);
+    }
+
+    for (UINT32 n = 0; n < u32Frames; n++, pf32Output += u32Channels, pf32Window += u32Channels)
+    {
+        float32x4_t vSum = vmulq_f32(vTap[0], vld1q_f32(pf32Window));
+
+        vSum = vaddq_f32(vSum, vmulq_f32(vTap[1], vld1q_f32(pf32Window + u32Channels)));
+        vSum = vaddq_f32(vSum, vmulq_f32(vTap[2], vld1q_f32(pf32Window + 2 * u32Channels)));
+        vSum = vaddq_f32(vSum, vmulq_f32(vTap[3], vld1q_f32(pf32Window + 3 * u32Channels)));
+        vst1q_f32(pf32Output, vSum);
+    }
+#elif defined(_M_IX86) || defined(_M_X64)
+    __m128 vTap[4];
+
+    for (UINT32 k = 0; k < 4; k++)
+    {
+        vTap[k] = _mm_setr_ps(pChannels[0].af32Taps[k], pChannels[1].af32Taps[k], pChannels[2].af32Taps[k], pChannels[3].af32Taps[k]);
+    }
+
+    for (UINT32 n = 0; n < u32Frames; n++, pf32Output += u32Channels, pf32Window += u32Channels)
+    {
+        __m128 vSum = _mm_mul_ps(vTap[0], _mm_loadu_ps(pf32Window));
+
+        vSum = _mm_add_ps(vSum, _mm_mul_ps(vTap[1], _mm_loadu_ps(pf32Window + u32Channels)));
+        vSum = _mm_add_ps(vSum, _mm_mul_ps(vTap[2], _mm_loadu_ps(pf32Window + 2 * u32Channels)));
+        vSum = _mm_add_ps(vSum, _mm_mul_ps(vTap[3], _mm_loadu_ps(pf32Window + 3 * u32Channels)));
+        _mm_storeu_ps(pf32Output, vSum);
+    }
+#else
+    UNREFERENCED_PARAMETER(pf32Output);
+    UNREFERENCED_PARAMETER(pf32Window);
+    UNREFERENCED_PARAMETER(u32Frames);
+    UNREFERENCED_PARAMETER(u32Channels);
+    UNREFERENCED_PARAMETER(pChannels);
+#endif
+}
+#pragma AVRT_CODE_END
+
+//
+// TRUE when the first four of u32Channels settings can go through
+// InterpolateDelayBlock4.
+//
+#pragma AVRT_CODE_BEGIN
+static BOOL IsDelayGroup4(
+    const DELAY_CHANNEL *pChannels,
+    UINT32   u32Channels )
+{
+    if (g_DspKernel == DspKernelScalar || u32Channels < 4)
+    {
+        return FALSE;
+    }
+
+    for (UINT32 i = 0; i < 4; i++)
+    {
+        if (!pChannels[i].fFractional || pChannels[i].u32Frames != pChannels[0].u32Frames)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+#pragma AVRT_CODE_END
+
+//
+// Reads one block, written to the ring, with one set of channel settings.
+//
+#pragma AVRT_CODE_BEGIN
+static void ReadDelayBlock(
+    const DELAY_LINE *pDelayLine,
+    const DELAY_CHANNEL *pChannels,
+    FLOAT32 *pf32OutputFrames,
+    UINT32   u32Frames )
+{
+    UINT32 u32Channels = pDelayLine->u32Channels;
+    UINT32 u32Mask = pDelayLine->u32RingFrames - 1;
+    BOOL   fUniform = TRUE;
+
+    for (UINT32 c = 0; c < u32Channels; c++)
+    {
+        if (pChannels[c].fFractional || pChannels[c].u32Frames != pChannels[0].u32Frames)
+        {
+            fUniform = FALSE;
+        }
+    }
+
+    if (fUniform)
     {
+        UINT32 u32Start = (pDelayLine->u32WriteIndex - pChannels[0].u32Frames) & u32Mask;
+
+        CopyFrames(pf32OutputFrames, pDelayLine->pf32Ring + u32Start * u32Channels, u32Frames, u32Channels);
+        return;
+    }
 
-        // Invariants:
-        // 0 <= (*pu32DelayIndex) < u32DelayFrames
-        // pf32OutputFrames[0 ... u32ValidFrameCount * u32SamplesPerFrame - 1] is writable
-        // pf32InputFrames[0 ... u32ValidFrameCount * u32SamplesPerFrame - 1] is readable
-        while (u32ValidFrameCount > 0)
-        {
-            // copy either the rest of the input/output buffer,
-            // or the rest of the delay buffer,
-            // whichever is smaller
-            UINT32 framesToCopy = min(u32ValidFrameCount, u32DelayFrames - (*pu32DelayIndex));
-            
-            // delay => output
-#pragma prefast(suppress: __WARNING_POTENTIAL_BUFFER_OVERFLOW_HIGH_PRIORITY, "this copy to pf32OutputFrames is in-range")
-            CopyFrames( pf32OutputFrames,
-                        &pf32DelayBuffer[(*pu32DelayIndex) * u32SamplesPerFrame],
-                        framesToCopy,
-                        u32SamplesPerFrame );
-            
-            // input => delay
-            CopyFrames( &pf32DelayBuffer[(*pu32DelayIndex) * u32SamplesPerFrame],
-                        pf32InputFrames,
-                        framesToCopy,
-                        u32SamplesPerFrame );
-
-            pf32OutputFrames += framesToCopy * u32SamplesPerFrame;
-            pf32InputFrames += framesToCopy * u32SamplesPerFrame;
-            u32ValidFrameCount -= framesToCopy;
-            
-            *pu32DelayIndex += framesToCopy;
-            if (*pu32DelayIndex == u32DelayFrames)
+    for (UINT32 c = 0; c < u32Channels; c++)
+    {
+        const DELAY_CHANNEL *pChannel = &pChannels[c];
+        UINT32 u32Start = (pDelayLine->u32WriteIndex - pChannel->u32Frames - (pChannel->fFractional ? 3 : 0)) & u32Mask;
+        const FLOAT32 *pf32Window = pDelayLine->pf32Ring + u32Start * u32Channels + c;
+        FLOAT32 *pf32Output = pf32OutputFrames + c;
+
+        if (IsDelayGroup4(pChannels + c, u32Channels - c))
+        {
+            InterpolateDelayBlock4(pf32Output, pf32Window, u32Frames, u32Channels, pChannel);
+            c += 3;
+        }
+        else if (pChannel->fFractional)
+        {
+            InterpolateDelayBlock(pf32Output, pf32Window, u32Frames, u32Channels, pChannel->af32Taps);
+        }
+        else
+        {
+            for (UINT32 n = 0; n < u32Frames; n++, pf32Output += u32Channels, pf32Window += u32Channels)
             {
-                *pu32DelayIndex = 0;
+                *pf32Output = *pf32Window;
             }
         }
+    }
+}
+#pragma AVRT_CODE_END
 
+//
+// Mixes a block read with the faded out settings into one read with the
+// new ones, ending the fade when the ramp reaches them.
+//
+#pragma AVRT_CODE_BEGIN
+static void CrossfadeDelayBlock(
+    _Inout_ DELAY_LINE *pDelayLine,
+    FLOAT32 *pf32OutputFrames,
+    UINT32   u32Frames )
+{
+    UINT32 u32Channels = pDelayLine->u32Channels;
+    const FLOAT32 *pf32Fade = pDelayLine->pf32Fade;
+    UINT32 u32FadeFrames = min(u32Frames, pDelayLine->u32FadeFrames - pDelayLine->u32FadePosition);
+
+    for (UINT32 n = 0; n < u32FadeFrames; n++)
+    {
+        FLOAT32 f32New = (pDelayLine->u32FadePosition + n + 1) * pDelayLine->f32FadeStep;
+
+        for (UINT32 c = 0; c < u32Channels; c++, pf32OutputFrames++, pf32Fade++)
+        {
+            *pf32OutputFrames = *pf32Fade + f32New * (*pf32OutputFrames - *pf32Fade);
+        }
+    }
+
+    pDelayLine->u32FadePosition += u32FadeFrames;
+    if (pDelayLine->u32FadePosition == pDelayLine->u32FadeFrames)
+    {
+        pDelayLine->pFadeChannels = NULL;
     }
 }
 #pragma AVRT_CODE_END
 
+//-------------------------------------------------------------------------
+// Description:
+//
+//  TRUE when all the line would output for silent input is silence, so
+//  ProcessDelayLine need not be called for it: silence covers what the
+//  delays in use read back. Longer delays set later find silence there
+//  too, see FitDelayRing.
+//
+#pragma AVRT_CODE_BEGIN
+BOOL IsDelayLineSilent(
+    const DELAY_LINE *pDelayLine )
+{
+    return (NULL == pDelayLine->pFadeChannels) &&
+           (pDelayLine->u32SilentFrames >= pDelayLine->u32ReachFrames);
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Drops the audio the line holds and ends any crossfade, leaving it as if
+//  it had only been fed silence. For a line that stops being fed, so it
+//  does not replay that audio when it is fed again.
+//
+#pragma AVRT_CODE_BEGIN
+void ClearDelayLine(
+    _Inout_ DELAY_LINE *pDelayLine )
+{
+    if (!IsDelayLineSilent(pDelayLine))
+    {
+        WriteSilence(pDelayLine->pf32Ring, pDelayLine->u32RingFrames + DELAY_GUARD_FRAMES, pDelayLine->u32Channels);
+        pDelayLine->pFadeChannels = NULL;
+        pDelayLine->u32SilentFrames = pDelayLine->u32RingFrames;
+        pDelayLine->u32CopyFrames = 0;
+    }
+}
+#pragma AVRT_CODE_END
+
+//
+// Longest delay of u32Channels settings.
+//
+#pragma AVRT_CODE_BEGIN
+static UINT32 GetLongestDelay(
+    const DELAY_CHANNEL *pChannels,
+    UINT32   u32Channels )
+{
+    UINT32 u32Frames = 0;
+
+    for (UINT32 c = 0; c < u32Channels; c++)
+    {
+        u32Frames = max(u32Frames, pChannels[c].u32Frames);
+    }
+
+    return u32Frames;
+}
+#pragma AVRT_CODE_END
+
+//
+// Grows the ring in use to what the current and faded out settings need.
+// The frames from the write position to the old end are the oldest, so
+// they move to the new end; the frames between are ones the ring never
+// held, and are silence.
+//
+// Then, if the line was silent by IsDelayLineSilent, the caller may have
+// skipped any amount of silence, so everything older is silence as well:
+// the frames a longer delay now reaches past the silence written are
+// zeroed rather than replaying the audio from before it.
+//
+#pragma AVRT_CODE_BEGIN
+static void FitDelayRing(
+    _Inout_ DELAY_LINE *pDelayLine )
+{
+    UINT32 u32Channels = pDelayLine->u32Channels;
+    UINT32 u32Longest = GetLongestDelay(pDelayLine->pChannels, u32Channels);
+    UINT32 u32OldFrames = pDelayLine->u32RingFrames;
+    UINT32 u32NewFrames;
+    UINT32 u32Position = pDelayLine->u32WriteIndex;
+    UINT32 u32Reach;
+    FLOAT32 *pf32Ring = pDelayLine->pf32Ring;
+
+    if (NULL != pDelayLine->pFadeChannels)
+    {
+        u32Longest = max(u32Longest, GetLongestDelay(pDelayLine->pFadeChannels, u32Channels));
+    }
+
+    u32NewFrames = min(GetDelayRingFrames(u32Longest), pDelayLine->u32MaxRingFrames);
+    if (u32NewFrames > u32OldFrames)
+    {
+        MoveMemory(pf32Ring + (u32Position + u32NewFrames - u32OldFrames) * u32Channels,
+                   pf32Ring + u32Position * u32Channels,
+                   sizeof(FLOAT32) * (u32OldFrames - u32Position) * u32Channels);
+        WriteSilence(pf32Ring + u32Position * u32Channels, u32NewFrames - u32OldFrames, u32Channels);
+        CopyFrames(pf32Ring + u32NewFrames * u32Channels, pf32Ring, DELAY_GUARD_FRAMES, u32Channels);
+
+        if (pDelayLine->u32SilentFrames == u32OldFrames)
+        {
+            pDelayLine->u32SilentFrames = u32NewFrames;
+        }
+        pDelayLine->u32RingFrames = u32NewFrames;
+    }
+
+    u32Reach = u32Longest + 3;
+    if ((pDelayLine->u32SilentFrames >= pDelayLine->u32ReachFrames) && (pDelayLine->u32SilentFrames < u32Reach))
+    {
+        UINT32 u32Start = (u32Position + pDelayLine->u32RingFrames - u32Reach) & (pDelayLine->u32RingFrames - 1);
+        UINT32 u32Frames = u32Reach - pDelayLine->u32SilentFrames;
+        UINT32 u32ToEnd = min(u32Frames, pDelayLine->u32RingFrames - u32Start);
+
+        WriteSilence(pf32Ring + u32Start * u32Channels, u32ToEnd, u32Channels);
+        WriteSilence(pf32Ring, u32Frames - u32ToEnd, u32Channels);
+        CopyFrames(pf32Ring + pDelayLine->u32RingFrames * u32Channels, pf32Ring, DELAY_GUARD_FRAMES, u32Channels);
+        pDelayLine->u32SilentFrames = u32Reach;
+    }
+    pDelayLine->u32ReachFrames = u32Reach;
+}
+#pragma AVRT_CODE_END
+
+//
+// The delay ProcessDelayBlocks runs as a copy for, or 0 when the settings
+// need the ring.
+//
+#pragma AVRT_CODE_BEGIN
+static UINT32 GetDelayCopyFrames(
+    const DELAY_LINE *pDelayLine,
+    const SWAP_MIX_MATRIX *pMatrix )
+{
+    const DELAY_CHANNEL *pChannels = pDelayLine->pChannels;
+
+    if ((NULL != pMatrix) || (NULL != pDelayLine->pFadeChannels) || (pChannels[0].u32Frames < DELAY_COPY_MIN_FRAMES))
+    {
+        return 0;
+    }
+
+    for (UINT32 c = 0; c < pDelayLine->u32Channels; c++)
+    {
+        if (pChannels[c].fFractional || pChannels[c].u32Frames != pChannels[0].u32Frames)
+        {
+            return 0;
+        }
+    }
+
+    return pChannels[0].u32Frames;
+}
+#pragma AVRT_CODE_END
+
+//
+// Swaps u32Frames frames of the ring, starting at u32First and going up,
+// with as many ending at u32Last and going down.
+//
+#pragma AVRT_CODE_BEGIN
+static void ReverseDelayFrames(
+    _Inout_ DELAY_LINE *pDelayLine,
+    UINT32   u32First,
+    UINT32   u32Last,
+    UINT32   u32Frames )
+{
+    UINT32 u32Channels = pDelayLine->u32Channels;
+    UINT32 u32Mask = pDelayLine->u32RingFrames - 1;
+
+    for (UINT32 n = 0; n < u32Frames; n++)
+    {
+        FLOAT32 *pf32First = pDelayLine->pf32Ring + ((u32First + n) & u32Mask) * u32Channels;
+        FLOAT32 *pf32Last = pDelayLine->pf32Ring + ((u32Last - n) & u32Mask) * u32Channels;
+
+        for (UINT32 c = 0; c < u32Channels; c++)
+        {
+            FLOAT32 f32Sample = pf32First[c];
+
+            pf32First[c] = pf32Last[c];
+            pf32Last[c] = f32Sample;
+        }
+    }
+}
+#pragma AVRT_CODE_END
+
+//
+// Turns the copy back into the ring: rotates it so its oldest frame comes
+// first and the write position follows its newest, silences the frames
+// outside it, which it overwrote at other ages, and restores the guard.
+//
+#pragma AVRT_CODE_BEGIN
+static void EndDelayCopy(
+    _Inout_ DELAY_LINE *pDelayLine )
+{
+    UINT32 u32Channels = pDelayLine->u32Channels;
+    UINT32 u32Mask = pDelayLine->u32RingFrames - 1;
+    UINT32 u32Base = pDelayLine->u32CopyBase;
+    UINT32 u32Copy = pDelayLine->u32CopyFrames;
+    UINT32 u32Oldest = (pDelayLine->u32WriteIndex - u32Base) & u32Mask;
+    UINT32 u32Start = (u32Base + u32Copy) & u32Mask;
+    UINT32 u32Frames = pDelayLine->u32RingFrames - u32Copy;
+    UINT32 u32ToEnd = min(u32Frames, pDelayLine->u32RingFrames - u32Start);
+
+    if (u32Oldest != 0)
+    {
+        ReverseDelayFrames(pDelayLine, u32Base, u32Base + u32Oldest - 1, u32Oldest / 2);
+        ReverseDelayFrames(pDelayLine, u32Base + u32Oldest, u32Base + u32Copy - 1, (u32Copy - u32Oldest) / 2);
+        ReverseDelayFrames(pDelayLine, u32Base, u32Base + u32Copy - 1, u32Copy / 2);
+    }
+
+    WriteSilence(pDelayLine->pf32Ring + u32Start * u32Channels, u32ToEnd, u32Channels);
+    WriteSilence(pDelayLine->pf32Ring, u32Frames - u32ToEnd, u32Channels);
+    CopyFrames(pDelayLine->pf32Ring + pDelayLine->u32RingFrames * u32Channels, pDelayLine->pf32Ring, DELAY_GUARD_FRAMES, u32Channels);
+
+    if (pDelayLine->u32SilentFrames >= u32Copy)
+    {
+        pDelayLine->u32SilentFrames = pDelayLine->u32RingFrames;
+    }
+    pDelayLine->u32WriteIndex = u32Start;
+    pDelayLine->u32CopyFrames = 0;
+}
+#pragma AVRT_CODE_END
+
+//
+// Reads u32Frames frames of the copy into the output and overwrites them
+// with the input, or zeros for NULL input. Out of place these are two
+// whole copies, as the copy delay made; in place each vector of input is
+// loaded before the copy's is stored over it.
+//
+#pragma AVRT_CODE_BEGIN
+static void ExchangeDelayFrames(
+    FLOAT32 *pf32Copy,
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32Frames,
+    UINT32   u32Channels )
+{
+    UINT32 u32Samples = u32Frames * u32Channels;
+    UINT32 i = 0;
+
+    if (pf32OutputFrames != pf32InputFrames)
+    {
+        CopyFrames(pf32OutputFrames, pf32Copy, u32Frames, u32Channels);
+        if (NULL == pf32InputFrames)
+        {
+            WriteSilence(pf32Copy, u32Frames, u32Channels);
+        }
+        else
+        {
+            CopyFrames(pf32Copy, pf32InputFrames, u32Frames, u32Channels);
+        }
+        return;
+    }
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        for (; i + 8 <= u32Samples; i += 8)
+        {
+#if defined(_M_ARM64)
+            float32x4_t vInput0 = vld1q_f32(pf32OutputFrames + i);
+            float32x4_t vInput1 = vld1q_f32(pf32OutputFrames + i + 4);
+
+            vst1q_f32(pf32OutputFrames + i, vld1q_f32(pf32Copy + i));
+            vst1q_f32(pf32OutputFrames + i + 4, vld1q_f32(pf32Copy + i + 4));
+            vst1q_f32(pf32Copy + i, vInput0);
+            vst1q_f32(pf32Copy + i + 4, vInput1);
+#else
+            __m128 vInput0 = _mm_loadu_ps(pf32OutputFrames + i);
+            __m128 vInput1 = _mm_loadu_ps(pf32OutputFrames + i + 4);
+
+            _mm_storeu_ps(pf32OutputFrames + i, _mm_loadu_ps(pf32Copy + i));
+            _mm_storeu_ps(pf32OutputFrames + i + 4, _mm_loadu_ps(pf32Copy + i + 4));
+            _mm_storeu_ps(pf32Copy + i, vInput0);
+            _mm_storeu_ps(pf32Copy + i + 4, vInput1);
+#endif
+        }
+    }
+#endif
+
+    for (; i < u32Samples; i++)
+    {
+        FLOAT32 f32Input = pf32OutputFrames[i];
+
+        pf32OutputFrames[i] = pf32Copy[i];
+        pf32Copy[i] = f32Input;
+    }
+}
+#pragma AVRT_CODE_END
+
+//
+// Runs the line as a copy of u32Copy frames, starting one where the ring
+// holds those frames if it is not one already.
+//
+#pragma AVRT_CODE_BEGIN
+static void ProcessDelayCopy(
+    _Inout_ DELAY_LINE *pDelayLine,
+    UINT32   u32Copy,
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32       u32ValidFrameCount )
+{
+    UINT32 u32Channels = pDelayLine->u32Channels;
+    UINT32 u32Mask = pDelayLine->u32RingFrames - 1;
+    UINT32 u32Base;
+    UINT32 u32Index;
+
+    if (pDelayLine->u32CopyFrames != u32Copy)
+    {
+        pDelayLine->u32CopyBase = (pDelayLine->u32WriteIndex - u32Copy) & u32Mask;
+        pDelayLine->u32CopyFrames = u32Copy;
+        pDelayLine->u32WriteIndex = pDelayLine->u32CopyBase;
+    }
+
+    u32Base = pDelayLine->u32CopyBase;
+    u32Index = (pDelayLine->u32WriteIndex - u32Base) & u32Mask;
+
+    if (NULL == pf32InputFrames)
+    {
+        pDelayLine->u32SilentFrames = min(pDelayLine->u32SilentFrames + u32ValidFrameCount, pDelayLine->u32RingFrames);
+    }
+    else
+    {
+        pDelayLine->u32SilentFrames = 0;
+    }
+
+    while (u32ValidFrameCount > 0)
+    {
+        UINT32 u32Position = (u32Base + u32Index) & u32Mask;
+        UINT32 u32Frames = min(min(u32ValidFrameCount, u32Copy - u32Index), pDelayLine->u32RingFrames - u32Position);
+
+        ExchangeDelayFrames(pDelayLine->pf32Ring + u32Position * u32Channels, pf32OutputFrames, pf32InputFrames, u32Frames, u32Channels);
+
+        u32Index = (u32Index + u32Frames == u32Copy) ? 0 : u32Index + u32Frames;
+        if (NULL != pf32InputFrames)
+        {
+            pf32InputFrames += u32Frames * u32Channels;
+        }
+        pf32OutputFrames += u32Frames * u32Channels;
+        u32ValidFrameCount -= u32Frames;
+    }
+
+    pDelayLine->u32WriteIndex = (u32Base + u32Index) & u32Mask;
+}
+#pragma AVRT_CODE_END
+
+//
+// Writes and reads the line a block at a time, each block mixed by pMatrix
+// on its way into the ring if it is not NULL.
+//
+#pragma AVRT_CODE_BEGIN
+static void ProcessDelayBlocks(
+    _Inout_ DELAY_LINE *pDelayLine,
+    const SWAP_MIX_MATRIX *pMatrix,
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32       u32ValidFrameCount )
+{
+    UINT32 u32Channels = pDelayLine->u32Channels;
+    UINT32 u32Copy = GetDelayCopyFrames(pDelayLine, pMatrix);
+    UINT32 u32Mask;
+
+    if ((0 != pDelayLine->u32CopyFrames) && (pDelayLine->u32CopyFrames != u32Copy))
+    {
+        EndDelayCopy(pDelayLine);
+    }
+
+    FitDelayRing(pDelayLine);
+    u32Mask = pDelayLine->u32RingFrames - 1;
+
+    if (0 != u32Copy)
+    {
+        ProcessDelayCopy(pDelayLine, u32Copy, pf32OutputFrames, pf32InputFrames, u32ValidFrameCount);
+        return;
+    }
+
+    while (u32ValidFrameCount > 0)
+    {
+        UINT32 u32Frames = min(u32ValidFrameCount, pDelayLine->u32BlockFrames);
+
+        WriteDelayBlock(pDelayLine, pMatrix, pf32InputFrames, u32Frames);
+        ReadDelayBlock(pDelayLine, pDelayLine->pChannels, pf32OutputFrames, u32Frames);
+
+        if (NULL != pDelayLine->pFadeChannels)
+        {
+            ReadDelayBlock(pDelayLine, pDelayLine->pFadeChannels, pDelayLine->pf32Fade, u32Frames);
+            CrossfadeDelayBlock(pDelayLine, pf32OutputFrames, u32Frames);
+        }
+
+        pDelayLine->u32WriteIndex = (pDelayLine->u32WriteIndex + u32Frames) & u32Mask;
+        if (NULL != pf32InputFrames)
+        {
+            pf32InputFrames += u32Frames * u32Channels;
+        }
+        pf32OutputFrames += u32Frames * u32Channels;
+        u32ValidFrameCount -= u32Frames;
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Delays each channel by its own delay. The output may be the input, NULL
+//  input is silence.
+//
+#pragma AVRT_CODE_BEGIN
+void ProcessDelayLine(
+    _Inout_ DELAY_LINE *pDelayLine,
+    _Out_writes_(u32ValidFrameCount * pDelayLine->u32Channels)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_opt_(u32ValidFrameCount * pDelayLine->u32Channels)
+        const FLOAT32 *pf32InputFrames,
+    UINT32       u32ValidFrameCount )
+{
+    ASSERT_REALTIME();
+    ATLASSERT( (NULL == pf32InputFrames) || IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
+    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
+
+    ProcessDelayBlocks(pDelayLine, NULL, pf32OutputFrames, pf32InputFrames, u32ValidFrameCount);
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Mixes the channels by a matrix from BuildMixMatrix, with as many
+//  channels as the line, then delays each channel by its own delay, in one
+//  pass. The output may be the input, NULL input is silence.
+//
+#pragma AVRT_CODE_BEGIN
+void ProcessDelayChain(
+    _Inout_ DELAY_LINE *pDelayLine,
+    _In_ const SWAP_MIX_MATRIX *pMatrix,
+    _Out_writes_(u32ValidFrameCount * pDelayLine->u32Channels)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_opt_(u32ValidFrameCount * pDelayLine->u32Channels)
+        const FLOAT32 *pf32InputFrames,
+    UINT32       u32ValidFrameCount )
+{
+    ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pMatrix) );
+    ATLASSERT( pMatrix->u32Channels == pDelayLine->u32Channels );
+    ATLASSERT( (NULL == pf32InputFrames) || IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
+    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
+
+    ProcessDelayBlocks(pDelayLine, pMatrix, pf32OutputFrames, pf32InputFrames, u32ValidFrameCount);
+}
+#pragma AVRT_CODE_END
@@ -14,6 +14,8 @@
 #include <DelayAPODll.h>
 
 #include <commonmacros.h>
+#include <ApoSnapshot.h>
+#include "DelayDsp.h"
 #include <devicetopology.h>
 
 _Analysis_mode_(_Analysis_code_type_user_driver_)
@@ -33,10 +35,30 @@ DEFINE_GUID(DelayEffectId,      0x29FBFBB5, 0x9002, 0x4ABC, 0xDC, 0xBC, 0xDD, 0x
 // 1000 ms of delay
 #define HNS_DELAY HNS_PER_SECOND
 
+// Longest delay a channel can be given, the delay line is allocated for it
+#define HNS_MAX_DELAY (2 * HNS_PER_SECOND)
+
+// 20 ms crossfade from the old delays to the new ones
+#define HNS_DELAY_FADE (HNS_PER_SECOND / 50)
+
+#define HNS_PER_MILLISECOND (HNS_PER_SECOND / 1000)
+
 #define FRAMES_FROM_HNS(hns) (ULONG)(1.0 * hns / HNS_PER_SECOND * GetFramesPerSecond() + 0.5)
 
+// Channel settings for APOProcess: the set it delays by, the set it may
+// still be fading out, one in between and the one being built.
+#define DELAY_CHANNEL_SETS          4
+
+// Range of the fused chain gain, in hundredths of a dB
+#define CHAIN_MIN_GAIN_LEVEL        -6000
+#define CHAIN_MAX_GAIN_LEVEL        2000
+
 LONG GetCurrentEffectsSetting(IPropertyStore* properties, PROPERTYKEY pkeyEnable, GUID processingMode);
 
+HNSTIME GetChannelDelays(IPropertyStore* properties, PROPERTYKEY pkeyDelays, UINT32 u32Channels, _Out_writes_opt_(u32Channels) HNSTIME* phnsDelays);
+
+FLOAT32 GetChainGain(IPropertyStore* properties, PROPERTYKEY pkeyGain);
+
 #pragma AVRT_VTABLES_BEGIN
 // Delay APO class - MFX
 class CDelayAPOMFX :
@@ -57,8 +79,8 @@ public:
     ,   m_hEffectsChangedEvent(NULL)
     ,   m_AudioProcessingMode(AUDIO_SIGNALPROCESSINGMODE_DEFAULT)
     ,   m_fEnableDelayMFX(FALSE)
-    ,   m_nDelayFrames(0)
-    ,   m_iDelayIndex(0)
+    ,   m_fEnableFusedChain(FALSE)
+    ,   m_hnsDelay(HNS_DELAY)
     {
         m_pf32Coefficients = NULL;
     }
@@ -138,6 +160,7 @@ public:
 
 public:
     LONG                                    m_fEnableDelayMFX;
+    LONG                                    m_fEnableFusedChain;
     GUID                                    m_AudioProcessingMode;
     CComPtr<IPropertyStore>                 m_spAPOSystemEffectsProperties;
     CComPtr<IMMDeviceEnumerator>            m_spEnumerator;
@@ -145,16 +168,20 @@ public:
 
     // Locked memory
     FLOAT32                                 *m_pf32Coefficients;
+    CParameterSnapshots<SWAP_MIX_MATRIX>    m_ChainMatrices;    // Built under m_EffectsLock.
 
     CComHeapPtr<FLOAT32>                    m_pf32DelayBuffer;
-    UINT32                                  m_nDelayFrames;
-    UINT32                                  m_iDelayIndex;
+    CParameterSnapshots<DELAY_CHANNEL, DELAY_CHANNEL_SETS> m_DelayChannels;  // Built under m_EffectsLock.
+    DELAY_LINE                              m_DelayLine;
+    HNSTIME                                 m_hnsDelay;         // Longest channel delay.
 
 private:
     CCriticalSection                        m_EffectsLock;
     HANDLE                                  m_hEffectsChangedEvent;
 
     HRESULT ProprietaryCommunicationWithDriver(APOInitSystemEffects2 *_pAPOSysFxInit2);
+    HRESULT UpdateDelayChannels(DELAY_CHANNEL *pChannels);
+    void    UpdateChainMatrix();
 
 };
 #pragma AVRT_VTABLES_END
@@ -177,8 +204,7 @@ public:
     ,   m_hEffectsChangedEvent(NULL)
     ,   m_AudioProcessingMode(AUDIO_SIGNALPROCESSINGMODE_DEFAULT)
     ,   m_fEnableDelaySFX(FALSE)
-    ,   m_nDelayFrames(0)
-    ,   m_iDelayIndex(0)
+    ,   m_hnsDelay(HNS_DELAY)
     {
     }
 
@@ -251,44 +277,13 @@ public:
     HANDLE                                  m_hEffectsChangedEvent;
 
     CComHeapPtr<FLOAT32>                    m_pf32DelayBuffer;
-    UINT32                                  m_nDelayFrames;
-    UINT32                                  m_iDelayIndex;
+    CParameterSnapshots<DELAY_CHANNEL, DELAY_CHANNEL_SETS> m_DelayChannels;  // Built under m_EffectsLock.
+    DELAY_LINE                              m_DelayLine;
+    HNSTIME                                 m_hnsDelay;         // Longest channel delay.
+
+    HRESULT UpdateDelayChannels(DELAY_CHANNEL *pChannels);
 };
 #pragma AVRT_VTABLES_END
 
 OBJECT_ENTRY_AUTO(__uuidof(DelayAPOMFX), CDelayAPOMFX)
 OBJECT_ENTRY_AUTO(__uuidof(DelayAPOSFX), CDelayAPOSFX)
-
-//
-//   Declaration of the ProcessDelay routine.
-//
-void ProcessDelay(
-    _Out_writes_(u32ValidFrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32OutputFrames,
-    _In_reads_(u32ValidFrameCount * u32SamplesPerFrame)
-        const FLOAT32 *pf32InputFrames,
-    UINT32       u32ValidFrameCount,
-    UINT32       u32SamplesPerFrame,
-    _Inout_updates_(u32DelayFrames * u32SamplesPerFrame)
-        FLOAT32 *pf32DelayBuffer,
-    UINT32       u32DelayFrames,
-    _Inout_
-        UINT32  *pu32DelayIndex );
-
-//
-//   Convenience methods
-//
-
-void WriteSilence(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32Frames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame );
-
-void CopyFrames(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32OutFrames,
-    _In_reads_(u32FrameCount * u32SamplesPerFrame)
-        const FLOAT32 *pf32InFrames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame );
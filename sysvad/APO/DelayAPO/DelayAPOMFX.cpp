@@ -18,6 +18,7 @@
 #include <resource.h>
 
 #include <float.h>
+#include <math.h>
 #include "DelayAPO.h"
 #include "SysVadShared.h"
 #include <CustomPropKeys.h>
@@ -101,6 +102,129 @@ LONG GetCurrentEffectsSetting(IPropertyStore* properties, PROPERTYKEY pkeyEnable
     return (LONG)enabled;
 }
 
+//-------------------------------------------------------------------------
+// Description:
+//
+//  GetChannelDelays
+//      Gets the delay of each channel
+//
+// Parameters:
+//
+//  properties - Property store holding configurable effects settings, may be NULL
+//
+//  pkeyDelays - VT_VECTOR | VT_R4 property holding each channel's delay in ms
+//
+//  u32Channels - Number of channels to get the delay of, may be 0
+//
+//  phnsDelays - Receives the delay of each channel
+//
+// Return values:
+//  HNSTIME - the longest delay the property holds
+//
+// Remarks:
+//  Channels past the end of the vector take its last value. Without a valid
+//  vector every channel takes HNS_DELAY. Delays are clamped to HNS_MAX_DELAY.
+//
+HNSTIME GetChannelDelays(IPropertyStore* properties, PROPERTYKEY pkeyDelays, UINT32 u32Channels, _Out_writes_opt_(u32Channels) HNSTIME* phnsDelays)
+{
+    HRESULT hr = E_FAIL;
+    HNSTIME hnsLongest = HNS_DELAY;
+    PROPVARIANT var;
+
+    PropVariantInit(&var);
+
+    if (properties != NULL)
+    {
+        hr = properties->GetValue(pkeyDelays, &var);
+    }
+
+    if (SUCCEEDED(hr) && (var.vt == (VT_VECTOR | VT_R4)) && (var.caflt.cElems > 0))
+    {
+        hnsLongest = 0;
+
+        for (ULONG i = 0; i < max(var.caflt.cElems, u32Channels); i++)
+        {
+            FLOAT32 f32Delay = var.caflt.pElems[min(i, var.caflt.cElems - 1)];
+            HNSTIME hnsDelay;
+
+            // Also NaN
+            if (!(f32Delay > 0.0f))
+            {
+                hnsDelay = 0;
+            }
+            else if (f32Delay >= (FLOAT32)HNS_MAX_DELAY / HNS_PER_MILLISECOND)
+            {
+                hnsDelay = HNS_MAX_DELAY;
+            }
+            else
+            {
+                hnsDelay = (HNSTIME)(f32Delay * HNS_PER_MILLISECOND + 0.5f);
+            }
+
+            if (i < var.caflt.cElems)
+            {
+                hnsLongest = max(hnsLongest, hnsDelay);
+            }
+            if (i < u32Channels)
+            {
+                phnsDelays[i] = hnsDelay;
+            }
+        }
+    }
+    else
+    {
+        for (UINT32 i = 0; i < u32Channels; i++)
+        {
+            phnsDelays[i] = HNS_DELAY;
+        }
+    }
+
+    PropVariantClear(&var);
+
+    return hnsLongest;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  GetChainGain
+//      Gets the gain of the fused chain
+//
+// Parameters:
+//
+//  properties - Property store holding configurable effects settings, may be NULL
+//
+//  pkeyGain - VT_I4 property holding the gain in hundredths of a dB
+//
+// Return values:
+//  FLOAT32 - the linear gain, 1.0 without a valid property
+//
+// Remarks:
+//  The level is clamped to CHAIN_MIN_GAIN_LEVEL .. CHAIN_MAX_GAIN_LEVEL.
+//
+FLOAT32 GetChainGain(IPropertyStore* properties, PROPERTYKEY pkeyGain)
+{
+    HRESULT hr = E_FAIL;
+    LONG lLevel = 0;
+    PROPVARIANT var;
+
+    PropVariantInit(&var);
+
+    if (properties != NULL)
+    {
+        hr = properties->GetValue(pkeyGain, &var);
+    }
+
+    if (SUCCEEDED(hr) && (var.vt == VT_I4))
+    {
+        lLevel = max(CHAIN_MIN_GAIN_LEVEL, min(CHAIN_MAX_GAIN_LEVEL, var.lVal));
+    }
+
+    PropVariantClear(&var);
+
+    return (FLOAT32)pow(10.0, lLevel / 2000.0);
+}
+
 #pragma AVRT_CODE_BEGIN
 //-------------------------------------------------------------------------
 // Description:
@@ -162,33 +286,55 @@ STDMETHODIMP_(void) CDelayAPOMFX::APOProcess(
             pf32OutputFrames = reinterpret_cast<FLOAT32*>(ppOutputConnections[0]->pBuffer);
             ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32OutputFrames) );
 
-            if (BUFFER_SILENT == ppInputConnections[0]->u32BufferFlags)
-            {
-                WriteSilence( pf32InputFrames,
-                              ppInputConnections[0]->u32ValidFrameCount,
-                              GetSamplesPerFrame() );
-            }
-
             // copy to the delay buffer
             if (
                 !IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW) &&
                 m_fEnableDelayMFX
             )
             {
-                ProcessDelay(pf32OutputFrames, pf32InputFrames,
-                             ppInputConnections[0]->u32ValidFrameCount,
-                             GetSamplesPerFrame(),
-                             m_pf32DelayBuffer,
-                             m_nDelayFrames,
-                             &m_iDelayIndex);
-
-                // we don't try to remember silence
-                ppOutputConnections[0]->u32BufferFlags = BUFFER_VALID;
+                BOOL fSilent = (BUFFER_SILENT == ppInputConnections[0]->u32BufferFlags);
+
+                if (fSilent && IsDelayLineSilent(&m_DelayLine))
+                {
+                    // the line has nothing left to flush, leave it as it is
+                    ppOutputConnections[0]->u32BufferFlags = BUFFER_SILENT;
+                }
+                else
+                {
+                    // pick up the delays OnPropertyValueChanged left, once the last change has faded in
+                    if ((NULL == m_DelayLine.pFadeChannels) && m_DelayChannels.Acquire())
+                    {
+                        FadeDelayLine(&m_DelayLine, m_DelayChannels.GetFront());
+                    }
+
+                    // silence flushes the delayed tail out of the line
+                    if (m_fEnableFusedChain && m_ChainMatrices.IsAllocated())
+                    {
+                        // swap, scale and gain each block on its way into the line
+                        m_ChainMatrices.Acquire();
+
+                        ProcessDelayChain(&m_DelayLine, m_ChainMatrices.GetFront(),
+                                          pf32OutputFrames, fSilent ? NULL : pf32InputFrames,
+                                          ppInputConnections[0]->u32ValidFrameCount);
+                    }
+                    else
+                    {
+                        ProcessDelayLine(&m_DelayLine,
+                                         pf32OutputFrames, fSilent ? NULL : pf32InputFrames,
+                                         ppInputConnections[0]->u32ValidFrameCount);
+                    }
+
+                    ppOutputConnections[0]->u32BufferFlags = BUFFER_VALID;
+                }
             }
             else
             {
-                // copy the memory only if there is an output connection, and input/output pointers are unequal
+                // drop what the line held when the effect was turned off, so turning it back on does not replay it
+                ClearDelayLine(&m_DelayLine);
+
+                // copy the memory only if there is an output connection, the input isn't silent, and input/output pointers are unequal
                 if ( (0 != u32NumOutputConnections) &&
+                      (BUFFER_SILENT != ppInputConnections[0]->u32BufferFlags) &&
                       (ppOutputConnections[0]->pBuffer != ppInputConnections[0]->pBuffer) )
                 {
                     CopyFrames( pf32OutputFrames, pf32InputFrames,
@@ -241,7 +387,10 @@ STDMETHODIMP CDelayAPOMFX::GetLatency(HNSTIME* pTime)
     }
     else
     {
-        *pTime = (m_fEnableDelayMFX ? HNS_DELAY : 0);
+        // OnPropertyValueChanged may be changing the delay
+        m_EffectsLock.Enter();
+        *pTime = (m_fEnableDelayMFX ? m_hnsDelay : 0);
+        m_EffectsLock.Leave();
     }
   
 Exit:  
@@ -278,27 +427,43 @@ STDMETHODIMP CDelayAPOMFX::LockForProcess(UINT32 u32NumInputConnections,
         ppInputConnections, u32NumOutputConnections, ppOutputConnections);
     IF_FAILED_JUMP(hr, Exit);
     
-    if (!IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW) && m_fEnableDelayMFX)
+    // The delay line is set up even while the effect is disabled, and for the
+    // longest delay, so neither enabling it nor changing the delay needs the
+    // graph to be locked again
+    if (!IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW))
     {
-        m_nDelayFrames = FRAMES_FROM_HNS(HNS_DELAY);
-        m_iDelayIndex = 0;
+        UINT32 u32MaxDelayFrames = FRAMES_FROM_HNS(HNS_MAX_DELAY) + 1;
+
+        // Synchronize with OnPropertyValueChanged
+        m_EffectsLock.Enter();
 
         m_pf32DelayBuffer.Free();
+        m_DelayChannels.Free();
 
-        // Allocate one second's worth of audio
+        // Allocate a power of two ring holding the longest delay
         // 
         // This allocation is being done using CoTaskMemAlloc because the delay is very large
         // This introduces a risk of glitches if the delay buffer gets paged out
         //
         // A more typical approach would be to allocate the memory using AERT_Allocate, which locks the memory
         // But for the purposes of this APO, CoTaskMemAlloc suffices, and the risk of glitches is not important
-        m_pf32DelayBuffer.Allocate(GetSamplesPerFrame() * m_nDelayFrames);
-        WriteSilence(m_pf32DelayBuffer, m_nDelayFrames, GetSamplesPerFrame());
-        if (nullptr == m_pf32DelayBuffer)
+        m_pf32DelayBuffer.Allocate(GetDelayLineSamples(GetSamplesPerFrame(), u32MaxDelayFrames));
+        hr = m_DelayChannels.Allocate(GetSamplesPerFrame());
+        if ((nullptr == m_pf32DelayBuffer) || FAILED(hr))
         {
+            m_pf32DelayBuffer.Free();
+            m_DelayChannels.Free();
             hr = E_OUTOFMEMORY;
-            goto Exit;
         }
+        else
+        {
+            InitializeDelayLine(&m_DelayLine, GetSamplesPerFrame(), u32MaxDelayFrames, FRAMES_FROM_HNS(HNS_DELAY_FADE),
+                                m_pf32DelayBuffer, m_DelayChannels.GetFront());
+            hr = UpdateDelayChannels(m_DelayChannels.GetFront());
+        }
+
+        m_EffectsLock.Leave();
+        IF_FAILED_JUMP(hr, Exit);
     }
     
 Exit:
@@ -448,6 +613,8 @@ HRESULT CDelayAPOMFX::Initialize(UINT32 cbDataSize, BYTE* pbyData)
     if (m_spAPOSystemEffectsProperties != NULL)
     {
         m_fEnableDelayMFX = GetCurrentEffectsSetting(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Enable_Delay_MFX, m_AudioProcessingMode);
+        m_fEnableFusedChain = GetCurrentEffectsSetting(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Enable_Fused_Chain_MFX, m_AudioProcessingMode);
+        m_hnsDelay = GetChannelDelays(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Delay_Channel_Times_MFX, 0, NULL);
     }
 
     //
@@ -699,6 +866,7 @@ HRESULT CDelayAPOMFX::OnPropertyValueChanged(LPCWSTR pwstrDeviceId, const PROPER
 
     // If either the master disable or our APO's enable properties changed...
     if (PK_EQUAL(key, PKEY_Endpoint_Enable_Delay_MFX) ||
+        PK_EQUAL(key, PKEY_Endpoint_Enable_Fused_Chain_MFX) ||
         PK_EQUAL(key, PKEY_AudioEndpoint_Disable_SysFx))
     {
         LONG nChanges = 0;
@@ -715,6 +883,7 @@ HRESULT CDelayAPOMFX::OnPropertyValueChanged(LPCWSTR pwstrDeviceId, const PROPER
         KeyControl controls[] =
         {
             { PKEY_Endpoint_Enable_Delay_MFX,        &m_fEnableDelayMFX },
+            { PKEY_Endpoint_Enable_Fused_Chain_MFX,  &m_fEnableFusedChain },
         };
         
         for (int i = 0; i < ARRAYSIZE(controls); i++)
@@ -743,9 +912,116 @@ HRESULT CDelayAPOMFX::OnPropertyValueChanged(LPCWSTR pwstrDeviceId, const PROPER
         m_EffectsLock.Leave();
     }
 
+    // If the channel delays changed, hand them to APOProcess, which fades them in
+    if (PK_EQUAL(key, PKEY_Endpoint_Delay_Channel_Times_MFX))
+    {
+        m_EffectsLock.Enter();
+
+        if (m_DelayChannels.IsAllocated())
+        {
+            if (SUCCEEDED(UpdateDelayChannels(m_DelayChannels.GetBack())))
+            {
+                m_DelayChannels.Publish();
+            }
+        }
+        else
+        {
+            // LockForProcess reads them
+            m_hnsDelay = GetChannelDelays(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Delay_Channel_Times_MFX, 0, NULL);
+        }
+
+        m_EffectsLock.Leave();
+    }
+
+    // If the chain gain changed while the APO is locked for processing...
+    if (PK_EQUAL(key, PKEY_Endpoint_Fused_Chain_Gain_MFX))
+    {
+        m_EffectsLock.Enter();
+
+        if (m_ChainMatrices.IsAllocated())
+        {
+            UpdateChainMatrix();
+        }
+
+        m_EffectsLock.Leave();
+    }
+
     return hr;
 }
 
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Sets pChannels to the delays of PKEY_Endpoint_Delay_Channel_Times_MFX,
+//  and m_hnsDelay to the longest of them.
+//
+// Remarks:
+//
+//      The caller holds m_EffectsLock. pChannels is the back set of
+//      m_DelayChannels, or the front one before streaming.
+//
+HRESULT CDelayAPOMFX::UpdateDelayChannels(DELAY_CHANNEL *pChannels)
+{
+    CComHeapPtr<HNSTIME> phnsDelays;
+    HNSTIME hnsLongest = 0;
+
+    if (!phnsDelays.Allocate(GetSamplesPerFrame()))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    GetChannelDelays(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Delay_Channel_Times_MFX, GetSamplesPerFrame(), phnsDelays);
+
+    for (UINT32 u32Channel = 0; u32Channel < GetSamplesPerFrame(); u32Channel++)
+    {
+        SetDelayLineChannel(&m_DelayLine, &pChannels[u32Channel], (FLOAT32)(1.0 * phnsDelays[u32Channel] / HNS_PER_SECOND * GetFramesPerSecond()));
+        hnsLongest = max(hnsLongest, phnsDelays[u32Channel]);
+    }
+
+    m_hnsDelay = hnsLongest;
+
+    return S_OK;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Builds the fused chain's channel matrix, the Swap MFX's default swap
+//  and scale times the gain of PKEY_Endpoint_Fused_Chain_Gain_MFX, and
+//  hands it to APOProcess.
+//
+// Remarks:
+//
+//      The caller holds m_EffectsLock. As in CSwapAPOMFX::UpdateMixMatrix,
+//      the matrix is built in the back block of m_ChainMatrices and
+//      published.
+//
+void CDelayAPOMFX::UpdateChainMatrix()
+{
+    HRESULT         hr;
+    FLOAT32         af32Matrix[SWAP_MIX_MAX_CHANNELS * SWAP_MIX_MAX_CHANNELS] = { 0 };
+    FLOAT32         f32Gain = GetChainGain(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Fused_Chain_Gain_MFX);
+
+    // Swap each stereo pair and scale by the coefficients; an odd channel
+    // out only takes the gain.
+    for (UINT32 o = 0; o < m_u32SamplesPerFrame; o++)
+    {
+        if ((o ^ 1) < m_u32SamplesPerFrame)
+        {
+            af32Matrix[o * m_u32SamplesPerFrame + (o ^ 1)] = m_pf32Coefficients[o] * f32Gain;
+        }
+        else
+        {
+            af32Matrix[o * m_u32SamplesPerFrame + o] = f32Gain;
+        }
+    }
+
+    hr = BuildMixMatrix(m_ChainMatrices.GetBack(), m_u32SamplesPerFrame, af32Matrix, m_u32SamplesPerFrame);
+    ATLASSERT(SUCCEEDED(hr));
+
+    m_ChainMatrices.Publish();
+}
+
 //-------------------------------------------------------------------------
 // Description:
 //
@@ -868,7 +1144,26 @@ HRESULT CDelayAPOMFX::ValidateAndCacheConnectionInfo(UINT32 u32NumInputConnectio
         m_pf32Coefficients[u16Index] = 1.0f - (FLOAT32)(f32InverseChannelCount)*u16Index;
     }
 
-    
+    // Channel matrices for APOProcess->ProcessDelayChain. Wider streams are
+    // only delayed, fused chain or not.
+    m_EffectsLock.Enter();
+
+    if (m_u32SamplesPerFrame <= SWAP_MIX_MAX_CHANNELS)
+    {
+        hResult = m_ChainMatrices.Allocate(1);
+
+        if (SUCCEEDED(hResult))
+        {
+            UpdateChainMatrix();
+        }
+    }
+    else
+    {
+        m_ChainMatrices.Free();
+    }
+
+    m_EffectsLock.Leave();
+
 Exit:
     LeaveCriticalSection(&m_CritSec);
     return hResult;}
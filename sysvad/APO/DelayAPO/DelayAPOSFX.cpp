@@ -111,33 +111,43 @@ STDMETHODIMP_(void) CDelayAPOSFX::APOProcess(
             pf32OutputFrames = reinterpret_cast<FLOAT32*>(ppOutputConnections[0]->pBuffer);
             ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
 
-            if (BUFFER_SILENT == ppInputConnections[0]->u32BufferFlags)
-            {
-                WriteSilence( pf32InputFrames,
-                              ppInputConnections[0]->u32ValidFrameCount,
-                              GetSamplesPerFrame() );
-            }
-
             // copy to the delay buffer
             if (
                 !IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW) &&
                 m_fEnableDelaySFX
             )
             {
-                ProcessDelay(pf32OutputFrames, pf32InputFrames,
-                             ppInputConnections[0]->u32ValidFrameCount,
-                             GetSamplesPerFrame(),
-                             m_pf32DelayBuffer,
-                             m_nDelayFrames,
-                             &m_iDelayIndex);
-
-                // we don't try to remember silence
-                ppOutputConnections[0]->u32BufferFlags = BUFFER_VALID;
+                BOOL fSilent = (BUFFER_SILENT == ppInputConnections[0]->u32BufferFlags);
+
+                if (fSilent && IsDelayLineSilent(&m_DelayLine))
+                {
+                    // the line has nothing left to flush, leave it as it is
+                    ppOutputConnections[0]->u32BufferFlags = BUFFER_SILENT;
+                }
+                else
+                {
+                    // pick up the delays OnPropertyValueChanged left, once the last change has faded in
+                    if ((NULL == m_DelayLine.pFadeChannels) && m_DelayChannels.Acquire())
+                    {
+                        FadeDelayLine(&m_DelayLine, m_DelayChannels.GetFront());
+                    }
+
+                    // silence flushes the delayed tail out of the line
+                    ProcessDelayLine(&m_DelayLine,
+                                     pf32OutputFrames, fSilent ? NULL : pf32InputFrames,
+                                     ppInputConnections[0]->u32ValidFrameCount);
+
+                    ppOutputConnections[0]->u32BufferFlags = BUFFER_VALID;
+                }
             }
             else
             {
-                // copy the memory only if there is an output connection, and input/output pointers are unequal
+                // drop what the line held when the effect was turned off, so turning it back on does not replay it
+                ClearDelayLine(&m_DelayLine);
+
+                // copy the memory only if there is an output connection, the input isn't silent, and input/output pointers are unequal
                 if ( (0 != u32NumOutputConnections) &&
+                      (BUFFER_SILENT != ppInputConnections[0]->u32BufferFlags) &&
                       (ppOutputConnections[0]->pBuffer != ppInputConnections[0]->pBuffer) )
                 {
                     CopyFrames( pf32OutputFrames, pf32InputFrames,
@@ -190,7 +200,10 @@ STDMETHODIMP CDelayAPOSFX::GetLatency(HNSTIME* pTime)
     }
     else
     {
-        *pTime = (m_fEnableDelaySFX ? HNS_DELAY : 0);
+        // OnPropertyValueChanged may be changing the delay
+        m_EffectsLock.Enter();
+        *pTime = (m_fEnableDelaySFX ? m_hnsDelay : 0);
+        m_EffectsLock.Leave();
     }
   
 Exit:  
@@ -227,28 +240,43 @@ STDMETHODIMP CDelayAPOSFX::LockForProcess(UINT32 u32NumInputConnections,
         ppInputConnections, u32NumOutputConnections, ppOutputConnections);
     IF_FAILED_JUMP(hr, Exit);
     
-    if (!IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW) && m_fEnableDelaySFX)
+    // The delay line is set up even while the effect is disabled, and for the
+    // longest delay, so neither enabling it nor changing the delay needs the
+    // graph to be locked again
+    if (!IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW))
     {
-        m_nDelayFrames = FRAMES_FROM_HNS(HNS_DELAY);
-        m_iDelayIndex = 0;
+        UINT32 u32MaxDelayFrames = FRAMES_FROM_HNS(HNS_MAX_DELAY) + 1;
+
+        // Synchronize with OnPropertyValueChanged
+        m_EffectsLock.Enter();
 
         m_pf32DelayBuffer.Free();
-        
-        // Allocate one second's worth of audio
+        m_DelayChannels.Free();
+
+        // Allocate a power of two ring holding the longest delay
         // 
         // This allocation is being done using CoTaskMemAlloc because the delay is very large
         // This introduces a risk of glitches if the delay buffer gets paged out
         //
         // A more typical approach would be to allocate the memory using AERT_Allocate, which locks the memory
         // But for the purposes of this APO, CoTaskMemAlloc suffices, and the risk of glitches is not important
-        m_pf32DelayBuffer.Allocate(GetSamplesPerFrame() * m_nDelayFrames);
-                
-        WriteSilence(m_pf32DelayBuffer, m_nDelayFrames, GetSamplesPerFrame());
-        if (nullptr == m_pf32DelayBuffer)
+        m_pf32DelayBuffer.Allocate(GetDelayLineSamples(GetSamplesPerFrame(), u32MaxDelayFrames));
+        hr = m_DelayChannels.Allocate(GetSamplesPerFrame());
+        if ((nullptr == m_pf32DelayBuffer) || FAILED(hr))
         {
+            m_pf32DelayBuffer.Free();
+            m_DelayChannels.Free();
             hr = E_OUTOFMEMORY;
-            goto Exit;
         }
+        else
+        {
+            InitializeDelayLine(&m_DelayLine, GetSamplesPerFrame(), u32MaxDelayFrames, FRAMES_FROM_HNS(HNS_DELAY_FADE),
+                                m_pf32DelayBuffer, m_DelayChannels.GetFront());
+            hr = UpdateDelayChannels(m_DelayChannels.GetFront());
+        }
+
+        m_EffectsLock.Leave();
+        IF_FAILED_JUMP(hr, Exit);
     }
     
 Exit:
@@ -406,6 +434,7 @@ HRESULT CDelayAPOSFX::Initialize(UINT32 cbDataSize, BYTE* pbyData)
     if (m_spAPOSystemEffectsProperties != NULL)
     {
         m_fEnableDelaySFX = GetCurrentEffectsSetting(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Enable_Delay_SFX, m_AudioProcessingMode);
+        m_hnsDelay = GetChannelDelays(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Delay_Channel_Times_SFX, 0, NULL);
     }
 
     //
@@ -622,9 +651,64 @@ HRESULT CDelayAPOSFX::OnPropertyValueChanged(LPCWSTR pwstrDeviceId, const PROPER
         m_EffectsLock.Leave();
     }
 
+    // If the channel delays changed, hand them to APOProcess, which fades them in
+    if (PK_EQUAL(key, PKEY_Endpoint_Delay_Channel_Times_SFX))
+    {
+        m_EffectsLock.Enter();
+
+        if (m_DelayChannels.IsAllocated())
+        {
+            if (SUCCEEDED(UpdateDelayChannels(m_DelayChannels.GetBack())))
+            {
+                m_DelayChannels.Publish();
+            }
+        }
+        else
+        {
+            // LockForProcess reads them
+            m_hnsDelay = GetChannelDelays(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Delay_Channel_Times_SFX, 0, NULL);
+        }
+
+        m_EffectsLock.Leave();
+    }
+
     return hr;
 }
 
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Sets pChannels to the delays of PKEY_Endpoint_Delay_Channel_Times_SFX,
+//  and m_hnsDelay to the longest of them.
+//
+// Remarks:
+//
+//      The caller holds m_EffectsLock. pChannels is the back set of
+//      m_DelayChannels, or the front one before streaming.
+//
+HRESULT CDelayAPOSFX::UpdateDelayChannels(DELAY_CHANNEL *pChannels)
+{
+    CComHeapPtr<HNSTIME> phnsDelays;
+    HNSTIME hnsLongest = 0;
+
+    if (!phnsDelays.Allocate(GetSamplesPerFrame()))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    GetChannelDelays(m_spAPOSystemEffectsProperties, PKEY_Endpoint_Delay_Channel_Times_SFX, GetSamplesPerFrame(), phnsDelays);
+
+    for (UINT32 u32Channel = 0; u32Channel < GetSamplesPerFrame(); u32Channel++)
+    {
+        SetDelayLineChannel(&m_DelayLine, &pChannels[u32Channel], (FLOAT32)(1.0 * phnsDelays[u32Channel] / HNS_PER_SECOND * GetFramesPerSecond()));
+        hnsLongest = max(hnsLongest, phnsDelays[u32Channel]);
+    }
+
+    m_hnsDelay = hnsLongest;
+
+    return S_OK;
+}
+
 
 //-------------------------------------------------------------------------
 // Description:
@@ -0,0 +1,98 @@
+//
+// DelayDsp.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//   Declaration of the delay line behind the delay APOs.
+//
+
+#pragma once
+
+#include <ApoPlatform.h>
+#include <ApoDsp.h>
+#include <SwapDsp.h>
+
+//
+// Delay line: a power of two ring of frames, each channel delayed by its own
+// whole or fractional number of frames. It works a block at a time, of up to
+// DELAY_BLOCK_FRAMES frames and DELAY_BLOCK_SAMPLES samples.
+//
+#define DELAY_BLOCK_FRAMES          256
+#define DELAY_BLOCK_SAMPLES         2048                        // 8 KB, with the ring and output blocks well inside L1.
+#define DELAY_GUARD_FRAMES          (DELAY_BLOCK_FRAMES + 4)
+#define DELAY_COPY_MIN_FRAMES       64                          // Shortest delay run as a copy.
+
+typedef struct _DELAY_CHANNEL
+{
+    UINT32          u32Frames;          // Delay, or the newest tap's when fractional.
+    BOOL            fFractional;
+    FLOAT32         af32Taps[4];        // Oldest sample's tap first.
+} DELAY_CHANNEL;
+
+typedef struct _DELAY_LINE
+{
+    UINT32          u32Channels;
+    UINT32          u32MaxDelayFrames;
+    UINT32          u32MaxRingFrames;   // A power of two, for u32MaxDelayFrames.
+    UINT32          u32RingFrames;      // A power of two, for the delays in use.
+    UINT32          u32WriteIndex;
+    UINT32          u32BlockFrames;
+    UINT32          u32FadeFrames;
+    UINT32          u32FadePosition;
+    FLOAT32         f32FadeStep;        // 1 / u32FadeFrames.
+    FLOAT32         *pf32Ring;          // Interleaved frames, then the guard.
+    FLOAT32         *pf32Fade;          // A block read with pFadeChannels.
+    DELAY_CHANNEL   *pChannels;
+    DELAY_CHANNEL   *pFadeChannels;     // Faded out, NULL once the fade is over.
+    UINT32          u32SilentFrames;    // Silence written since the last input, up to u32RingFrames.
+    UINT32          u32ReachFrames;     // Frames the settings in use read back, the longest delay + 3.
+    UINT32          u32CopyFrames;      // Delay of the copy the ring holds, 0 when it holds none.
+    UINT32          u32CopyBase;        // Ring position of the copy's first frame.
+} DELAY_LINE;
+
+//
+//   Declaration of the delay line routines.
+//
+UINT32 GetDelayLineSamples(
+    UINT32   u32Channels,
+    UINT32   u32MaxDelayFrames );
+
+void InitializeDelayLine(
+    _Out_ DELAY_LINE *pDelayLine,
+    UINT32   u32Channels,
+    UINT32   u32MaxDelayFrames,
+    UINT32   u32FadeFrames,
+    _Out_ FLOAT32 *pf32Memory,
+    _Out_writes_(u32Channels) DELAY_CHANNEL *pChannels );
+
+void SetDelayLineChannel(
+    const DELAY_LINE *pDelayLine,
+    _Out_ DELAY_CHANNEL *pChannel,
+    FLOAT32  f32DelayFrames );
+
+void FadeDelayLine(
+    _Inout_ DELAY_LINE *pDelayLine,
+    _In_ DELAY_CHANNEL *pChannels );
+
+BOOL IsDelayLineSilent(
+    const DELAY_LINE *pDelayLine );
+
+void ClearDelayLine(
+    _Inout_ DELAY_LINE *pDelayLine );
+
+void ProcessDelayLine(
+    _Inout_ DELAY_LINE *pDelayLine,
+    _Out_writes_(u32ValidFrameCount * pDelayLine->u32Channels)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_opt_(u32ValidFrameCount * pDelayLine->u32Channels)
+        const FLOAT32 *pf32InputFrames,
+    UINT32       u32ValidFrameCount );
+
+void ProcessDelayChain(
+    _Inout_ DELAY_LINE *pDelayLine,
+    _In_ const SWAP_MIX_MATRIX *pMatrix,
+    _Out_writes_(u32ValidFrameCount * pDelayLine->u32Channels)
+        FLOAT32 *pf32OutputFrames,
+    _In_reads_opt_(u32ValidFrameCount * pDelayLine->u32Channels)
+        const FLOAT32 *pf32InputFrames,
+    UINT32       u32ValidFrameCount );
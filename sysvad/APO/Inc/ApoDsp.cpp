@@ -0,0 +1,824 @@
+//
+// ApoDsp.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Implementation of the sample kernels the APOs share
+//
+//  Each kernel runs its vector loop over as much of the buffer as it can
+//  and the scalar loop over the rest, so the results never depend on where
+//  a buffer starts or how long it is. Nothing is fused or reassociated: a
+//  vector lane computes what the scalar loop computes for its sample. The
+//  RMS sum is kept in four partial sums by the scalar loop as well.
+//
+//  The widest kernel the processor and OS support is picked once, when the
+//  DLL loads, and every APO in the DLL uses the same choice. The 256 bit
+//  loops are in ApoDsp256.cpp.
+//
+#include <ApoPlatform.h>
+
+#include <float.h>
+#include <math.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include "ApoDsp.h"
+#include "ApoDsp256.h"
+
+#define DSP_INT16_SCALE     32768.0f
+#define DSP_INT32_SCALE     2147483648.0f
+#define DSP_INT32_MAX       2147483520.0f   // Largest float below 2^31.
+#define DSP_ROUNDING        8388608.0f      // 2^23, floats from it on are whole.
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+
+#if defined(_M_ARM64)
+typedef float32x4_t DSP_VECTOR;
+#define DspVectorSplat(x)       vdupq_n_f32(x)
+#define DspVectorLoad(p)        vld1q_f32(p)
+#define DspVectorStore(p, v)    vst1q_f32(p, v)
+#define DspVectorAdd(a, b)      vaddq_f32(a, b)
+#define DspVectorMul(a, b)      vmulq_f32(a, b)
+#define DspVectorMax(a, b)      vmaxnmq_f32(a, b)
+#define DspVectorAbs(a)         vabsq_f32(a)
+#else
+typedef __m128 DSP_VECTOR;
+#define DspVectorSplat(x)       _mm_set1_ps(x)
+#define DspVectorLoad(p)        _mm_loadu_ps(p)
+#define DspVectorStore(p, v)    _mm_storeu_ps(p, v)
+#define DspVectorAdd(a, b)      _mm_add_ps(a, b)
+#define DspVectorMul(a, b)      _mm_mul_ps(a, b)
+#define DspVectorMax(a, b)      _mm_max_ps(a, b)
+#define DspVectorAbs(a)         _mm_and_ps(a, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)))
+#endif
+
+#define DSP_SIMD
+
+#endif
+
+#ifndef PF_AVX_INSTRUCTIONS_AVAILABLE
+#define PF_AVX_INSTRUCTIONS_AVAILABLE   39
+#endif
+
+static DSP_KERNEL GetDspKernel()
+{
+#if defined(_M_X64)
+    return IsProcessorFeaturePresent(PF_AVX_INSTRUCTIONS_AVAILABLE) ? DspKernel256 : DspKernel128;
+#elif defined(_M_IX86)
+    if (IsProcessorFeaturePresent(PF_AVX_INSTRUCTIONS_AVAILABLE))
+    {
+        return DspKernel256;
+    }
+    return IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? DspKernel128 : DspKernelScalar;
+#elif defined(_M_ARM64)
+    return DspKernel128;
+#else
+    return DspKernelScalar;
+#endif
+}
+
+static const DSP_KERNEL s_DspKernelSupported = GetDspKernel();
+
+DSP_KERNEL g_DspKernel = s_DspKernelSupported;
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Makes the kernels use a narrower vector width than the processor
+//  supports, or the widest again. For hosts and tests comparing the
+//  kernels; not while any APO can be processing.
+//
+// Return values:
+//
+//      FALSE if the processor does not support the kernel
+//
+BOOL SelectDspKernel(DSP_KERNEL kernel)
+{
+    ASSERT_NONREALTIME();
+
+    if (kernel > s_DspKernelSupported)
+    {
+        return FALSE;
+    }
+
+    g_DspKernel = kernel;
+    return TRUE;
+}
+
+//
+// Rounds to the nearest whole number, ties to even, as the vector
+// conversions do in the default rounding mode.
+//
+#pragma AVRT_CODE_BEGIN
+static FLOAT32 RoundSample(FLOAT32 f32Sample)
+{
+    if (f32Sample >= 0.0f)
+    {
+        if (f32Sample < DSP_ROUNDING)
+        {
+            f32Sample = (f32Sample + DSP_ROUNDING) - DSP_ROUNDING;
+        }
+    }
+    else if (f32Sample > -DSP_ROUNDING)
+    {
+        f32Sample = (f32Sample - DSP_ROUNDING) + DSP_ROUNDING;
+    }
+
+    return f32Sample;
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Zeroes a buffer of frames.
+//
+#pragma AVRT_CODE_BEGIN
+void WriteSilence(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32Frames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    ZeroMemory(pf32Frames, sizeof(FLOAT32) * u32FrameCount * u32SamplesPerFrame);
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Copies a buffer of frames. The buffers must not overlap.
+//
+#pragma AVRT_CODE_BEGIN
+void CopyFrames(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    CopyMemory(pf32OutFrames, pf32InFrames, sizeof(FLOAT32) * u32FrameCount * u32SamplesPerFrame);
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Multiplies every sample by one gain.
+//
+#pragma AVRT_CODE_BEGIN
+void ScaleFrames(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    FLOAT32 f32Gain )
+{
+    UINT32 u32Samples = u32FrameCount * u32SamplesPerFrame;
+    UINT32 i = 0;
+
+#if defined(_M_IX86) || defined(_M_X64)
+    if (g_DspKernel == DspKernel256)
+    {
+        i = ScaleSamples256(pf32OutFrames, pf32InFrames, u32Samples, f32Gain);
+    }
+#endif
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        DSP_VECTOR vGain = DspVectorSplat(f32Gain);
+
+        for (; i + 4 <= u32Samples; i += 4)
+        {
+            DspVectorStore(pf32OutFrames + i, DspVectorMul(DspVectorLoad(pf32InFrames + i), vGain));
+        }
+    }
+#endif
+
+    for (; i < u32Samples; i++)
+    {
+        pf32OutFrames[i] = pf32InFrames[i] * f32Gain;
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Multiplies every frame by a gain that moves in a straight line from the
+//  start gain, reaching the end gain on the last frame, so a run of
+//  buffers ramped one after the other never repeats a step.
+//
+#pragma AVRT_CODE_BEGIN
+void RampFrames(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    FLOAT32 f32StartGain,
+    FLOAT32 f32EndGain )
+{
+    FLOAT32 f32Step;
+    UINT32 n = 0;
+
+    if (u32FrameCount == 0)
+    {
+        return;
+    }
+
+    f32Step = (f32EndGain - f32StartGain) / (FLOAT32)u32FrameCount;
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar && (u32SamplesPerFrame == 1 || u32SamplesPerFrame == 2))
+    {
+        // The frame numbers, counted from 1, of the samples of a vector.
+        UINT32 u32VectorFrames = 4 / u32SamplesPerFrame;
+        FLOAT32 af32Index[4] = { 1.0f, 2.0f, 3.0f, 4.0f };
+        DSP_VECTOR vStart = DspVectorSplat(f32StartGain);
+        DSP_VECTOR vStep = DspVectorSplat(f32Step);
+        DSP_VECTOR vAdvance = DspVectorSplat((FLOAT32)u32VectorFrames);
+        DSP_VECTOR vIndex;
+
+        if (u32SamplesPerFrame == 2)
+        {
+            af32Index[1] = 1.0f;
+            af32Index[2] = 2.0f;
+            af32Index[3] = 2.0f;
+        }
+        vIndex = DspVectorLoad(af32Index);
+
+        for (; n + u32VectorFrames <= u32FrameCount; n += u32VectorFrames)
+        {
+            DSP_VECTOR vGain = DspVectorAdd(vStart, DspVectorMul(vStep, vIndex));
+            UINT32 i = n * u32SamplesPerFrame;
+
+            DspVectorStore(pf32OutFrames + i, DspVectorMul(DspVectorLoad(pf32InFrames + i), vGain));
+            vIndex = DspVectorAdd(vIndex, vAdvance);
+        }
+    }
+    else if (g_DspKernel != DspKernelScalar && (u32SamplesPerFrame & 3) == 0)
+    {
+        for (; n < u32FrameCount; n++)
+        {
+            DSP_VECTOR vGain = DspVectorSplat(f32StartGain + f32Step * (FLOAT32)(n + 1));
+            UINT32 i = n * u32SamplesPerFrame;
+
+            for (UINT32 c = 0; c < u32SamplesPerFrame; c += 4)
+            {
+                DspVectorStore(pf32OutFrames + i + c, DspVectorMul(DspVectorLoad(pf32InFrames + i + c), vGain));
+            }
+        }
+    }
+#endif
+
+    for (; n < u32FrameCount; n++)
+    {
+        FLOAT32 f32Gain = f32StartGain + f32Step * (FLOAT32)(n + 1);
+        UINT32 i = n * u32SamplesPerFrame;
+
+        for (UINT32 c = 0; c < u32SamplesPerFrame; c++)
+        {
+            pf32OutFrames[i + c] = pf32InFrames[i + c] * f32Gain;
+        }
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Adds the input, times a gain, to the output.
+//
+#pragma AVRT_CODE_BEGIN
+void MixFrames(
+    _Inout_updates_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    FLOAT32 f32Gain )
+{
+    UINT32 u32Samples = u32FrameCount * u32SamplesPerFrame;
+    UINT32 i = 0;
+
+#if defined(_M_IX86) || defined(_M_X64)
+    if (g_DspKernel == DspKernel256)
+    {
+        i = MixSamples256(pf32OutFrames, pf32InFrames, u32Samples, f32Gain);
+    }
+#endif
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        DSP_VECTOR vGain = DspVectorSplat(f32Gain);
+
+        for (; i + 4 <= u32Samples; i += 4)
+        {
+            DspVectorStore(pf32OutFrames + i, DspVectorAdd(DspVectorLoad(pf32OutFrames + i), DspVectorMul(DspVectorLoad(pf32InFrames + i), vGain)));
+        }
+    }
+#endif
+
+    for (; i < u32Samples; i++)
+    {
+        pf32OutFrames[i] = pf32OutFrames[i] + pf32InFrames[i] * f32Gain;
+    }
+}
+#pragma AVRT_CODE_END
+
+//
+// Channel gathers for the common layouts. Each one reads every input frame
+// before it writes the output samples taken from it, and the output never
+// runs ahead of the input, so all of them also work in place.
+//
+
+#if defined(DSP_SIMD)
+
+// One channel out of two, four frames per vector.
+#pragma AVRT_CODE_BEGIN
+static UINT32 ExtractOneOfTwo(
+    FLOAT32 *pf32OutFrames,
+    const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount )
+{
+    UINT32 n = 0;
+
+    for (; n + 4 <= u32FrameCount; n += 4)
+    {
+#if defined(_M_ARM64)
+        vst1q_f32(pf32OutFrames + n, vld2q_f32(pf32InFrames + 2 * n).val[0]);
+#else
+        __m128 v0 = _mm_loadu_ps(pf32InFrames + 2 * n);
+        __m128 v1 = _mm_loadu_ps(pf32InFrames + 2 * n + 4);
+
+        _mm_storeu_ps(pf32OutFrames + n, _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0)));
+#endif
+    }
+
+    return n;
+}
+#pragma AVRT_CODE_END
+
+// Two channels out of any frame width, two frames per vector.
+#pragma AVRT_CODE_BEGIN
+static UINT32 ExtractTwo(
+    FLOAT32 *pf32OutFrames,
+    const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32InChannels )
+{
+    UINT32 n = 0;
+
+    for (; n + 2 <= u32FrameCount; n += 2)
+    {
+        const FLOAT32 *pf32In = pf32InFrames + n * u32InChannels;
+
+#if defined(_M_ARM64)
+        vst1q_f32(pf32OutFrames + 2 * n, vcombine_f32(vld1_f32(pf32In), vld1_f32(pf32In + u32InChannels)));
+#else
+        __m128 v = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64 *>(pf32In));
+
+        v = _mm_loadh_pi(v, reinterpret_cast<const __m64 *>(pf32In + u32InChannels));
+        _mm_storeu_ps(pf32OutFrames + 2 * n, v);
+#endif
+    }
+
+    return n;
+}
+#pragma AVRT_CODE_END
+
+// Four channels out of any frame width, one vector per frame.
+#pragma AVRT_CODE_BEGIN
+static UINT32 ExtractFour(
+    FLOAT32 *pf32OutFrames,
+    const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32InChannels )
+{
+    for (UINT32 n = 0; n < u32FrameCount; n++)
+    {
+        DspVectorStore(pf32OutFrames + 4 * n, DspVectorLoad(pf32InFrames + n * u32InChannels));
+    }
+
+    return u32FrameCount;
+}
+#pragma AVRT_CODE_END
+
+#endif
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Copies the first u32OutChannels samples of every input frame of
+//  u32InChannels samples to the output, frame after frame. Offset the input
+//  to start from another channel. The output may be the input.
+//
+#pragma AVRT_CODE_BEGIN
+void ExtractChannels(
+    _Out_writes_(u32FrameCount * u32OutChannels)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32InChannels)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32OutChannels,
+    UINT32 u32InChannels )
+{
+    UINT32 n = 0;
+
+    ATLASSERT(u32OutChannels <= u32InChannels);
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        if (u32OutChannels == 1 && u32InChannels == 2)
+        {
+            n = ExtractOneOfTwo(pf32OutFrames, pf32InFrames, u32FrameCount);
+        }
+        else if (u32OutChannels == 2)
+        {
+            n = ExtractTwo(pf32OutFrames, pf32InFrames, u32FrameCount, u32InChannels);
+        }
+        else if (u32OutChannels == 4)
+        {
+            n = ExtractFour(pf32OutFrames, pf32InFrames, u32FrameCount, u32InChannels);
+        }
+    }
+#endif
+
+    pf32OutFrames += n * u32OutChannels;
+    pf32InFrames += n * u32InChannels;
+
+    for (; n < u32FrameCount; n++)
+    {
+        for (UINT32 c = 0; c < u32OutChannels; c++)
+        {
+            pf32OutFrames[c] = pf32InFrames[c];
+        }
+
+        pf32OutFrames += u32OutChannels;
+        pf32InFrames += u32InChannels;
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Copies every input frame of u32InChannels samples over the first samples
+//  of an output frame of u32OutChannels, leaving the others as they are.
+//  Offset the output to start from another channel. The buffers must not
+//  overlap.
+//
+#pragma AVRT_CODE_BEGIN
+void InsertChannels(
+    _Inout_updates_(u32FrameCount * u32OutChannels)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32InChannels)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32InChannels,
+    UINT32 u32OutChannels )
+{
+    UINT32 n = 0;
+
+    ATLASSERT(u32InChannels <= u32OutChannels);
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar && u32InChannels == 2)
+    {
+        // Two frames per vector, stored a half at a time.
+        for (; n + 2 <= u32FrameCount; n += 2)
+        {
+            FLOAT32 *pf32Out = pf32OutFrames + n * u32OutChannels;
+
+#if defined(_M_ARM64)
+            float32x4_t v = vld1q_f32(pf32InFrames + 2 * n);
+
+            vst1_f32(pf32Out, vget_low_f32(v));
+            vst1_f32(pf32Out + u32OutChannels, vget_high_f32(v));
+#else
+            __m128 v = _mm_loadu_ps(pf32InFrames + 2 * n);
+
+            _mm_storel_pi(reinterpret_cast<__m64 *>(pf32Out), v);
+            _mm_storeh_pi(reinterpret_cast<__m64 *>(pf32Out + u32OutChannels), v);
+#endif
+        }
+    }
+    else if (g_DspKernel != DspKernelScalar && u32InChannels == 4)
+    {
+        for (; n < u32FrameCount; n++)
+        {
+            DspVectorStore(pf32OutFrames + n * u32OutChannels, DspVectorLoad(pf32InFrames + 4 * n));
+        }
+    }
+#endif
+
+    pf32OutFrames += n * u32OutChannels;
+    pf32InFrames += n * u32InChannels;
+
+    for (; n < u32FrameCount; n++)
+    {
+        for (UINT32 c = 0; c < u32InChannels; c++)
+        {
+            pf32OutFrames[c] = pf32InFrames[c];
+        }
+
+        pf32OutFrames += u32OutChannels;
+        pf32InFrames += u32InChannels;
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Converts 16 bit PCM to float, full scale to 1.0.
+//
+#pragma AVRT_CODE_BEGIN
+void ConvertInt16ToFloat(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const INT16 *pi16InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    UINT32 u32Samples = u32FrameCount * u32SamplesPerFrame;
+    UINT32 i = 0;
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        DSP_VECTOR vScale = DspVectorSplat(1.0f / DSP_INT16_SCALE);
+
+        for (; i + 8 <= u32Samples; i += 8)
+        {
+#if defined(_M_ARM64)
+            int16x8_t v = vld1q_s16(pi16InFrames + i);
+
+            vst1q_f32(pf32OutFrames + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), vScale));
+            vst1q_f32(pf32OutFrames + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), vScale));
+#else
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pi16InFrames + i));
+
+            // Each sample to the top of a 32 bit lane, then shifted back down with its sign.
+            _mm_storeu_ps(pf32OutFrames + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), vScale));
+            _mm_storeu_ps(pf32OutFrames + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), vScale));
+#endif
+        }
+    }
+#endif
+
+    for (; i < u32Samples; i++)
+    {
+        pf32OutFrames[i] = (FLOAT32)pi16InFrames[i] * (1.0f / DSP_INT16_SCALE);
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Converts float to 16 bit PCM, rounded to nearest and saturated. NaN
+//  becomes negative full scale.
+//
+#pragma AVRT_CODE_BEGIN
+void ConvertFloatToInt16(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        INT16 *pi16OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    UINT32 u32Samples = u32FrameCount * u32SamplesPerFrame;
+    UINT32 i = 0;
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        DSP_VECTOR vScale = DspVectorSplat(DSP_INT16_SCALE);
+        DSP_VECTOR vLow = DspVectorSplat(-DSP_INT16_SCALE);
+        DSP_VECTOR vHigh = DspVectorSplat(DSP_INT16_SCALE - 1.0f);
+
+        for (; i + 8 <= u32Samples; i += 8)
+        {
+#if defined(_M_ARM64)
+            float32x4_t v0 = vminnmq_f32(vmaxnmq_f32(vmulq_f32(vld1q_f32(pf32InFrames + i), vScale), vLow), vHigh);
+            float32x4_t v1 = vminnmq_f32(vmaxnmq_f32(vmulq_f32(vld1q_f32(pf32InFrames + i + 4), vScale), vLow), vHigh);
+
+            vst1q_s16(pi16OutFrames + i, vcombine_s16(vmovn_s32(vcvtnq_s32_f32(v0)), vmovn_s32(vcvtnq_s32_f32(v1))));
+#else
+            __m128 v0 = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(pf32InFrames + i), vScale), vLow), vHigh);
+            __m128 v1 = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(pf32InFrames + i + 4), vScale), vLow), vHigh);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pi16OutFrames + i), _mm_packs_epi32(_mm_cvtps_epi32(v0), _mm_cvtps_epi32(v1)));
+#endif
+        }
+    }
+#endif
+
+    for (; i < u32Samples; i++)
+    {
+        FLOAT32 f32Sample = pf32InFrames[i] * DSP_INT16_SCALE;
+
+        f32Sample = (f32Sample > -DSP_INT16_SCALE) ? f32Sample : -DSP_INT16_SCALE;
+        f32Sample = (f32Sample < DSP_INT16_SCALE - 1.0f) ? f32Sample : DSP_INT16_SCALE - 1.0f;
+        pi16OutFrames[i] = (INT16)RoundSample(f32Sample);
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Converts 32 bit PCM to float, full scale to 1.0.
+//
+#pragma AVRT_CODE_BEGIN
+void ConvertInt32ToFloat(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const INT32 *pi32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    UINT32 u32Samples = u32FrameCount * u32SamplesPerFrame;
+    UINT32 i = 0;
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        DSP_VECTOR vScale = DspVectorSplat(1.0f / DSP_INT32_SCALE);
+
+        for (; i + 4 <= u32Samples; i += 4)
+        {
+#if defined(_M_ARM64)
+            vst1q_f32(pf32OutFrames + i, vmulq_f32(vcvtq_f32_s32(vld1q_s32(pi32InFrames + i)), vScale));
+#else
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pi32InFrames + i));
+
+            _mm_storeu_ps(pf32OutFrames + i, _mm_mul_ps(_mm_cvtepi32_ps(v), vScale));
+#endif
+        }
+    }
+#endif
+
+    for (; i < u32Samples; i++)
+    {
+        pf32OutFrames[i] = (FLOAT32)pi32InFrames[i] * (1.0f / DSP_INT32_SCALE);
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Converts float to 32 bit PCM, rounded to nearest and saturated to what
+//  a float can hold. NaN becomes negative full scale.
+//
+#pragma AVRT_CODE_BEGIN
+void ConvertFloatToInt32(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        INT32 *pi32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    UINT32 u32Samples = u32FrameCount * u32SamplesPerFrame;
+    UINT32 i = 0;
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        DSP_VECTOR vScale = DspVectorSplat(DSP_INT32_SCALE);
+        DSP_VECTOR vLow = DspVectorSplat(-DSP_INT32_SCALE);
+        DSP_VECTOR vHigh = DspVectorSplat(DSP_INT32_MAX);
+
+        for (; i + 4 <= u32Samples; i += 4)
+        {
+#if defined(_M_ARM64)
+            float32x4_t v = vminnmq_f32(vmaxnmq_f32(vmulq_f32(vld1q_f32(pf32InFrames + i), vScale), vLow), vHigh);
+
+            vst1q_s32(pi32OutFrames + i, vcvtnq_s32_f32(v));
+#else
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(pf32InFrames + i), vScale), vLow), vHigh);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pi32OutFrames + i), _mm_cvtps_epi32(v));
+#endif
+        }
+    }
+#endif
+
+    for (; i < u32Samples; i++)
+    {
+        FLOAT32 f32Sample = pf32InFrames[i] * DSP_INT32_SCALE;
+
+        f32Sample = (f32Sample > -DSP_INT32_SCALE) ? f32Sample : -DSP_INT32_SCALE;
+        f32Sample = (f32Sample < DSP_INT32_MAX) ? f32Sample : DSP_INT32_MAX;
+        pi32OutFrames[i] = (INT32)RoundSample(f32Sample);
+    }
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Largest magnitude of any sample, 0 for an empty buffer. NaN samples are
+//  skipped.
+//
+#pragma AVRT_CODE_BEGIN
+FLOAT32 GetPeakLevel(
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32Frames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    UINT32 u32Samples = u32FrameCount * u32SamplesPerFrame;
+    FLOAT32 f32Peak = 0.0f;
+    UINT32 i = 0;
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar && u32Samples >= 4)
+    {
+        FLOAT32 af32Peak[4];
+        DSP_VECTOR vPeak = DspVectorSplat(0.0f);
+
+        for (; i + 4 <= u32Samples; i += 4)
+        {
+            vPeak = DspVectorMax(DspVectorAbs(DspVectorLoad(pf32Frames + i)), vPeak);
+        }
+
+        DspVectorStore(af32Peak, vPeak);
+        f32Peak = max(max(af32Peak[0], af32Peak[1]), max(af32Peak[2], af32Peak[3]));
+    }
+#endif
+
+    for (; i < u32Samples; i++)
+    {
+        f32Peak = max(fabsf(pf32Frames[i]), f32Peak);
+    }
+
+    return f32Peak;
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Root mean square of all samples, 0 for an empty buffer.
+//
+#pragma AVRT_CODE_BEGIN
+FLOAT32 GetRmsLevel(
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32Frames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame )
+{
+    UINT32 u32Samples = u32FrameCount * u32SamplesPerFrame;
+    FLOAT32 af32Sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    UINT32 i = 0;
+
+    if (u32Samples == 0)
+    {
+        return 0.0f;
+    }
+
+#if defined(DSP_SIMD)
+    if (g_DspKernel != DspKernelScalar)
+    {
+        DSP_VECTOR vSum = DspVectorSplat(0.0f);
+
+        for (; i + 4 <= u32Samples; i += 4)
+        {
+            DSP_VECTOR v = DspVectorLoad(pf32Frames + i);
+
+            vSum = DspVectorAdd(vSum, DspVectorMul(v, v));
+        }
+
+        DspVectorStore(af32Sum, vSum);
+    }
+#endif
+
+    // Sample i goes to sum i mod 4, as in a vector lane.
+    for (; i < u32Samples; i++)
+    {
+        af32Sum[i & 3] = af32Sum[i & 3] + pf32Frames[i] * pf32Frames[i];
+    }
+
+    return sqrtf(((af32Sum[0] + af32Sum[1]) + (af32Sum[2] + af32Sum[3])) / (FLOAT32)u32Samples);
+}
+#pragma AVRT_CODE_END
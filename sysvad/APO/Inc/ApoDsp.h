@@ -0,0 +1,133 @@
+//
+// ApoDsp.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Declaration of the sample kernels the APOs share
+//
+//  Every kernel is real-time safe and works on interleaved FLOAT32 frames
+//  unless it converts them. A kernel whose input and output have the same
+//  layout also works in place. The vector code is picked once, when the DLL
+//  loads, and gives the scalar code's results bit for bit.
+//
+#pragma once
+
+//
+//   Vector kernel the processor supports, picked when the DLL loads.
+//   SelectDspKernel narrows it for hosts and tests.
+//
+enum DSP_KERNEL
+{
+    DspKernelScalar,
+    DspKernel128,                   // SSE2, or NEON on ARM64.
+    DspKernel256,                   // AVX.
+};
+
+extern DSP_KERNEL g_DspKernel;
+
+BOOL SelectDspKernel(
+    DSP_KERNEL kernel );
+
+void WriteSilence(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32Frames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
+
+void CopyFrames(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
+
+void ScaleFrames(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    FLOAT32 f32Gain );
+
+void RampFrames(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    FLOAT32 f32StartGain,
+    FLOAT32 f32EndGain );
+
+void MixFrames(
+    _Inout_updates_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame,
+    FLOAT32 f32Gain );
+
+void ExtractChannels(
+    _Out_writes_(u32FrameCount * u32OutChannels)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32InChannels)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32OutChannels,
+    UINT32 u32InChannels );
+
+void InsertChannels(
+    _Inout_updates_(u32FrameCount * u32OutChannels)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32InChannels)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32InChannels,
+    UINT32 u32OutChannels );
+
+void ConvertInt16ToFloat(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const INT16 *pi16InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
+
+void ConvertFloatToInt16(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        INT16 *pi16OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
+
+void ConvertInt32ToFloat(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        FLOAT32 *pf32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const INT32 *pi32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
+
+void ConvertFloatToInt32(
+    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
+        INT32 *pi32OutFrames,
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32InFrames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
+
+FLOAT32 GetPeakLevel(
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32Frames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
+
+FLOAT32 GetRmsLevel(
+    _In_reads_(u32FrameCount * u32SamplesPerFrame)
+        const FLOAT32 *pf32Frames,
+    UINT32 u32FrameCount,
+    UINT32 u32SamplesPerFrame );
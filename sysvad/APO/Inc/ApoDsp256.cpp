@@ -0,0 +1,125 @@
+//
+// ApoDsp256.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Implementation of the 256 bit kernels
+//
+//  The gain kernels for ApoDsp.cpp and the pair swaps for Swap.cpp. Like
+//  the 128 bit loops they stand in for, every lane computes exactly what
+//  the scalar loop computes for its sample. Each ends with
+//  _mm256_zeroupper so the SSE code after it pays no transition penalty.
+//
+#include <ApoPlatform.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "ApoDsp256.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  ScaleFrames over whole vectors.
+//
+#pragma AVRT_CODE_BEGIN
+UINT32 ScaleSamples256(
+    _Out_writes_(u32Samples) FLOAT32 *pf32Output,
+    _In_reads_(u32Samples) const FLOAT32 *pf32Input,
+    UINT32 u32Samples,
+    FLOAT32 f32Gain )
+{
+    __m256 vGain = _mm256_set1_ps(f32Gain);
+    UINT32 i = 0;
+
+    for (; i + 8 <= u32Samples; i += 8)
+    {
+        _mm256_storeu_ps(pf32Output + i, _mm256_mul_ps(_mm256_loadu_ps(pf32Input + i), vGain));
+    }
+
+    _mm256_zeroupper();
+    return i;
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  MixFrames over whole vectors.
+//
+#pragma AVRT_CODE_BEGIN
+UINT32 MixSamples256(
+    _Inout_updates_(u32Samples) FLOAT32 *pf32Output,
+    _In_reads_(u32Samples) const FLOAT32 *pf32Input,
+    UINT32 u32Samples,
+    FLOAT32 f32Gain )
+{
+    __m256 vGain = _mm256_set1_ps(f32Gain);
+    UINT32 i = 0;
+
+    for (; i + 8 <= u32Samples; i += 8)
+    {
+        __m256 vSum = _mm256_add_ps(_mm256_loadu_ps(pf32Output + i), _mm256_mul_ps(_mm256_loadu_ps(pf32Input + i), vGain));
+
+        _mm256_storeu_ps(pf32Output + i, vSum);
+    }
+
+    _mm256_zeroupper();
+    return i;
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Swaps the samples of every pair, four pairs per vector.
+//
+#pragma AVRT_CODE_BEGIN
+void SwapPairs256(
+    _Out_writes_(8 * u32Vectors) FLOAT32 *pf32Output,
+    _In_reads_(8 * u32Vectors) const FLOAT32 *pf32Input,
+    UINT32 u32Vectors )
+{
+    for (UINT32 i = 0; i < u32Vectors; i++)
+    {
+        _mm256_storeu_ps(pf32Output + 8 * i, _mm256_permute_ps(_mm256_loadu_ps(pf32Input + 8 * i), _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+
+    _mm256_zeroupper();
+}
+#pragma AVRT_CODE_END
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Swaps the samples of every pair and multiplies them by a pattern of
+//  coefficients that repeats every u32PatternVectors vectors.
+//
+#pragma AVRT_CODE_BEGIN
+void SwapScalePairs256(
+    _Out_writes_(8 * u32Patterns * u32PatternVectors) FLOAT32 *pf32Output,
+    _In_reads_(8 * u32Patterns * u32PatternVectors) const FLOAT32 *pf32Input,
+    UINT32 u32Patterns,
+    _In_reads_(8 * u32PatternVectors) const FLOAT32 *pf32Pattern,
+    UINT32 u32PatternVectors )
+{
+    while (u32Patterns--)
+    {
+        for (UINT32 i = 0; i < u32PatternVectors; i++)
+        {
+            __m256 v = _mm256_permute_ps(_mm256_loadu_ps(pf32Input + 8 * i), _MM_SHUFFLE(2, 3, 0, 1));
+
+            _mm256_storeu_ps(pf32Output + 8 * i, _mm256_mul_ps(v, _mm256_loadu_ps(pf32Pattern + 8 * i)));
+        }
+        pf32Input += 8 * u32PatternVectors;
+        pf32Output += 8 * u32PatternVectors;
+    }
+
+    _mm256_zeroupper();
+}
+#pragma AVRT_CODE_END
+
+#endif
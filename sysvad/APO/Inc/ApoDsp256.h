@@ -0,0 +1,43 @@
+//
+// ApoDsp256.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Declaration of the 256 bit kernels
+//
+//  Every AVX instruction the APOs use is in ApoDsp256.cpp. Compilers that
+//  need a switch to generate AVX get it for that file only, so no other
+//  code, scalar fallbacks included, can fault on a processor without AVX.
+//  Call these only when g_DspKernel is DspKernel256. Each returns the
+//  number of samples, or takes the number of vectors, it processed; the
+//  caller finishes the rest with its narrower loops.
+//
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+UINT32 ScaleSamples256(
+    _Out_writes_(u32Samples) FLOAT32 *pf32Output,
+    _In_reads_(u32Samples) const FLOAT32 *pf32Input,
+    UINT32 u32Samples,
+    FLOAT32 f32Gain );
+
+UINT32 MixSamples256(
+    _Inout_updates_(u32Samples) FLOAT32 *pf32Output,
+    _In_reads_(u32Samples) const FLOAT32 *pf32Input,
+    UINT32 u32Samples,
+    FLOAT32 f32Gain );
+
+void SwapPairs256(
+    _Out_writes_(8 * u32Vectors) FLOAT32 *pf32Output,
+    _In_reads_(8 * u32Vectors) const FLOAT32 *pf32Input,
+    UINT32 u32Vectors );
+
+void SwapScalePairs256(
+    _Out_writes_(8 * u32Patterns * u32PatternVectors) FLOAT32 *pf32Output,
+    _In_reads_(8 * u32Patterns * u32PatternVectors) const FLOAT32 *pf32Input,
+    UINT32 u32Patterns,
+    _In_reads_(8 * u32PatternVectors) const FLOAT32 *pf32Pattern,
+    UINT32 u32PatternVectors );
+
+#endif
@@ -0,0 +1,127 @@
+//
+// ApoPlatform.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  What the APOs' DSP cores need from the platform
+//
+//  The cores (ApoDsp.cpp, swap.cpp, mix.cpp, Delay.cpp, Fdaf.cpp and
+//  KWSApo.cpp) include this instead of the COM and APO headers, so they
+//  build into the APO DLLs as before and, elsewhere, into ApoHost. Outside
+//  Windows the types, memory macros, asserts and processor checks are
+//  defined here; the real-time annotations compile to nothing.
+//
+#pragma once
+
+#if defined(_WIN32)
+
+#include <atlbase.h>
+#include <atlcom.h>
+#include <atlcoll.h>
+#include <atlsync.h>
+#include <mmreg.h>
+
+#include <audioenginebaseapo.h>
+#include <baseaudioprocessingobject.h>
+
+#else
+
+// The C++ library undefines min and max, so it comes first
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(_M_X64)
+#define _M_X64
+#elif defined(__i386__) && !defined(_M_IX86)
+#define _M_IX86
+#elif defined(__aarch64__) && !defined(_M_ARM64)
+#define _M_ARM64
+#endif
+
+typedef float           FLOAT32;
+typedef double          DOUBLE;
+typedef uint8_t         UINT8;
+typedef int16_t         INT16;
+typedef uint16_t        UINT16;
+typedef int32_t         INT32;
+typedef uint32_t        UINT32;
+typedef int64_t         INT64;
+typedef uint64_t        UINT64;
+typedef int32_t         LONG;
+typedef uint32_t        ULONG;
+typedef int             BOOL;
+typedef int32_t         HRESULT;
+
+#define TRUE            1
+#define FALSE           0
+#define MAXLONG         0x7fffffff
+
+#define S_OK            ((HRESULT)0)
+#define E_FAIL          ((HRESULT)0x80004005)
+#define E_INVALIDARG    ((HRESULT)0x80070057)
+#define E_POINTER       ((HRESULT)0x80004003)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000E)
+#define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)      (((HRESULT)(hr)) < 0)
+
+#ifndef min
+#define min(a, b)       (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b)       (((a) > (b)) ? (a) : (b))
+#endif
+
+#define _finite(x)              isfinite(x)
+
+#define CopyMemory(d, s, n)     memcpy((d), (s), (n))
+#define MoveMemory(d, s, n)     memmove((d), (s), (n))
+#define ZeroMemory(d, n)        memset((d), 0, (n))
+
+#define UNREFERENCED_PARAMETER(p)   ((void)(p))
+#define C_ASSERT(e)                 static_assert(e, #e)
+#define ATLASSERT(e)                assert(e)
+#define _ASSERTE(e)                 assert(e)
+
+#define ASSERT_REALTIME()
+#define ASSERT_NONREALTIME()
+#define IS_VALID_TYPED_READ_POINTER(p)  (NULL != (p))
+#define IS_VALID_TYPED_WRITE_POINTER(p) (NULL != (p))
+
+#define AVRT_CODE_BEGIN
+#define AVRT_CODE_END
+#define AVRT_DATA_BEGIN
+#define AVRT_DATA_END
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _In_reads_(n)
+#define _In_reads_opt_(n)
+#define _Out_writes_(n)
+#define _Inout_updates_(n)
+
+#define PF_XMMI64_INSTRUCTIONS_AVAILABLE    10
+#define PF_AVX_INSTRUCTIONS_AVAILABLE       39
+
+inline BOOL IsProcessorFeaturePresent(UINT32 u32Feature)
+{
+#if defined(_M_X64) || defined(_M_IX86)
+    switch (u32Feature)
+    {
+    case PF_XMMI64_INSTRUCTIONS_AVAILABLE:
+        return __builtin_cpu_supports("sse2");
+    case PF_AVX_INSTRUCTIONS_AVAILABLE:
+        return __builtin_cpu_supports("avx");
+    }
+#endif
+    UNREFERENCED_PARAMETER(u32Feature);
+    return FALSE;
+}
+
+#endif
@@ -0,0 +1,180 @@
+//
+// ApoSnapshot.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Declaration and implementation of CParameterSnapshots, which hands
+//  parameter blocks from the threads that change them to APOProcess
+//  without a lock
+//
+//  The blocks are allocated up front, in locked memory, lSlots of them. A
+//  writer builds the next block in the back slot, which APOProcess never
+//  reads, and trades it for the middle slot, flagged fresh. APOProcess
+//  trades the oldest slot it holds for the middle one when that is fresh.
+//  Neither side waits, APOProcess never sees a half built block, and a
+//  block APOProcess skipped is simply built over: nothing is freed while
+//  streaming, on either thread.
+//
+//  APOProcess holds lSlots - 2 blocks, the newest first, so with more than
+//  three slots it can go on using an older block, one it handed a pointer
+//  to, for a while after picking up a new one.
+//
+#pragma once
+
+template <class T, LONG lSlots = 3>
+class CParameterSnapshots
+{
+public:
+    CParameterSnapshots();
+    ~CParameterSnapshots();
+
+    // Not on the real-time thread, nor while APOProcess can run
+    HRESULT Allocate(UINT32 u32Elements);
+    void    Free();
+    BOOL    IsAllocated() const;
+
+    // Writers, serialized by their own lock
+    T*      GetBack();
+    void    Publish();
+
+    // APOProcess
+    BOOL    Acquire();
+    T*      GetFront();
+
+private:
+    static const LONG INDEX_MASK = 0x7;
+    static const LONG FRESH = 0x8;
+
+    T*              m_pBlocks;
+    UINT32          m_u32Elements;              // In each block.
+    LONG            m_alHeld[lSlots - 2];       // APOProcess, the newest first.
+    LONG volatile   m_lMiddle;
+    LONG            m_lBack;                    // Writers.
+
+    void    Reset();
+};
+
+template <class T, LONG lSlots>
+CParameterSnapshots<T, lSlots>::CParameterSnapshots() :
+    m_pBlocks(NULL),
+    m_u32Elements(0)
+{
+    C_ASSERT(lSlots >= 3 && lSlots <= INDEX_MASK + 1);
+    Reset();
+}
+
+template <class T, LONG lSlots>
+CParameterSnapshots<T, lSlots>::~CParameterSnapshots()
+{
+    Free();
+}
+
+template <class T, LONG lSlots>
+void CParameterSnapshots<T, lSlots>::Reset()
+{
+    for (LONG l = 0; l < lSlots - 2; l++)
+    {
+        m_alHeld[l] = l;
+    }
+    m_lMiddle = lSlots - 2;
+    m_lBack = lSlots - 1;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Allocates lSlots blocks of u32Elements each, zeroed, and takes back every
+//  slot, with nothing fresh. The caller fills GetFront before streaming.
+//
+template <class T, LONG lSlots>
+HRESULT CParameterSnapshots<T, lSlots>::Allocate(UINT32 u32Elements)
+{
+    HRESULT hr;
+
+    Free();
+
+    hr = AERT_Allocate(lSlots * u32Elements * sizeof(T), (void**)&m_pBlocks);
+    if (SUCCEEDED(hr))
+    {
+        ZeroMemory(m_pBlocks, lSlots * u32Elements * sizeof(T));
+        m_u32Elements = u32Elements;
+        Reset();
+    }
+
+    return hr;
+}
+
+template <class T, LONG lSlots>
+void CParameterSnapshots<T, lSlots>::Free()
+{
+    if (NULL != m_pBlocks)
+    {
+        AERT_Free(m_pBlocks);
+        m_pBlocks = NULL;
+    }
+    m_u32Elements = 0;
+}
+
+template <class T, LONG lSlots>
+BOOL CParameterSnapshots<T, lSlots>::IsAllocated() const
+{
+    return (NULL != m_pBlocks);
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The block to build the next parameters in. Only GetBack and Publish see
+//  it, so a writer may build it a piece at a time.
+//
+template <class T, LONG lSlots>
+T* CParameterSnapshots<T, lSlots>::GetBack()
+{
+    return &m_pBlocks[m_lBack * m_u32Elements];
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Hands the back block to APOProcess. If APOProcess has not picked up the
+//  last one yet, that one becomes the back block and is built over.
+//
+template <class T, LONG lSlots>
+void CParameterSnapshots<T, lSlots>::Publish()
+{
+    m_lBack = InterlockedExchange(&m_lMiddle, m_lBack | FRESH) & INDEX_MASK;
+}
+
+#pragma AVRT_CODE_BEGIN
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Picks up the block a writer published last, if it has not been picked up
+//  already, and lets go of the oldest block held. Returns TRUE if the front
+//  block changed.
+//
+template <class T, LONG lSlots>
+BOOL CParameterSnapshots<T, lSlots>::Acquire()
+{
+    if (0 == (m_lMiddle & FRESH))
+    {
+        return FALSE;
+    }
+
+    LONG lNewest = InterlockedExchange(&m_lMiddle, m_alHeld[lSlots - 3]) & INDEX_MASK;
+
+    for (LONG l = lSlots - 3; l > 0; l--)
+    {
+        m_alHeld[l] = m_alHeld[l - 1];
+    }
+    m_alHeld[0] = lNewest;
+
+    return TRUE;
+}
+
+template <class T, LONG lSlots>
+T* CParameterSnapshots<T, lSlots>::GetFront()
+{
+    return &m_pBlocks[m_alHeld[0] * m_u32Elements];
+}
+#pragma AVRT_CODE_END
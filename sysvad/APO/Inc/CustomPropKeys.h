@@ -48,6 +48,40 @@ DEFINE_PROPERTYKEY(PKEY_Endpoint_Enable_Interface_SFX, 0xa44531ef, 0x5377, 0x494
 // vartype = VT_UI4
 DEFINE_PROPERTYKEY(PKEY_Endpoint_Enable_Interface_MFX, 0xa44531ef, 0x5377, 0x4944, 0xae, 0x15, 0x53, 0x78, 0x9a, 0x96, 0x29, 0xc7, 7);
 
+// PKEY_Endpoint_Channel_Matrix_MFX: Channel matrix the Channel Swap global effect applies instead of its
+// default swap. Two UINT32 values, the input and output channel counts, then one row of input count FLOAT32
+// gains per output. The input count must be the channel count of the stream and the output count at most that;
+// outputs past the output count are silent.
+// {A44531EF-5377-4944-AE15-53789A9629C7},8
+// vartype = VT_BLOB
+DEFINE_PROPERTYKEY(PKEY_Endpoint_Channel_Matrix_MFX, 0xa44531ef, 0x5377, 0x4944, 0xae, 0x15, 0x53, 0x78, 0x9a, 0x96, 0x29, 0xc7, 8);
+
+// PKEY_Endpoint_Delay_Channel_Times_SFX: Delay of each channel in milliseconds, fractions included, for the
+// Delay local effect. Channels past the end of the vector take its last value. When absent every channel is
+// delayed by 1000 ms.
+// {A44531EF-5377-4944-AE15-53789A9629C7},9
+// vartype = VT_VECTOR | VT_R4
+DEFINE_PROPERTYKEY(PKEY_Endpoint_Delay_Channel_Times_SFX, 0xa44531ef, 0x5377, 0x4944, 0xae, 0x15, 0x53, 0x78, 0x9a, 0x96, 0x29, 0xc7, 9);
+
+// PKEY_Endpoint_Delay_Channel_Times_MFX: Delay of each channel in milliseconds, as above, for the Delay global effect
+// {A44531EF-5377-4944-AE15-53789A9629C7},10
+// vartype = VT_VECTOR | VT_R4
+DEFINE_PROPERTYKEY(PKEY_Endpoint_Delay_Channel_Times_MFX, 0xa44531ef, 0x5377, 0x4944, 0xae, 0x15, 0x53, 0x78, 0x9a, 0x96, 0x29, 0xc7, 10);
+
+// PKEY_Endpoint_Enable_Fused_Chain_MFX: When value is 0x00000001, the Delay global effect, while enabled, also applies
+// the Channel Swap global effect's default swap and scale and the gain of PKEY_Endpoint_Fused_Chain_Gain_MFX, in the
+// same pass over each buffer as its delay. Meant for endpoints that register the Delay global effect without the
+// Channel Swap one.
+// {A44531EF-5377-4944-AE15-53789A9629C7},11
+// vartype = VT_UI4
+DEFINE_PROPERTYKEY(PKEY_Endpoint_Enable_Fused_Chain_MFX, 0xa44531ef, 0x5377, 0x4944, 0xae, 0x15, 0x53, 0x78, 0x9a, 0x96, 0x29, 0xc7, 11);
+
+// PKEY_Endpoint_Fused_Chain_Gain_MFX: Gain of the fused chain in hundredths of a dB, -6000 .. 2000. When absent the
+// gain is 0 dB.
+// {A44531EF-5377-4944-AE15-53789A9629C7},12
+// vartype = VT_I4
+DEFINE_PROPERTYKEY(PKEY_Endpoint_Fused_Chain_Gain_MFX, 0xa44531ef, 0x5377, 0x4944, 0xae, 0x15, 0x53, 0x78, 0x9a, 0x96, 0x29, 0xc7, 12);
+
 
 // PKEY_Endpoint_Inter_Gain_Level_SFX: Inter APO gain level times by 100, typically -3000 .. 3000  
 // {0F2212E5-3612-459C-BE43-1FF0E576786A},0
@@ -14,6 +14,7 @@
 #include <KWSApoDll.h>
 
 #include <commonmacros.h>
+#include "KWSDsp.h"
 #include <devicetopology.h>
 
 #include <audioengineextensionapo.h>
@@ -140,23 +141,3 @@ private:
 #pragma AVRT_VTABLES_END
 
 OBJECT_ENTRY_AUTO(__uuidof(KWSApoEFX), CKWSApoEFX)
-
-//
-//   Declaration of the ProcessBuffer routine.
-//
-void ProcessBuffer(
-    FLOAT32 *pf32OutputFrames,
-    const FLOAT32 *pf32InputFrames,
-    UINT32   u32ValidFrameCount,
-    INTERLEAVED_AUDIO_FORMAT_INFORMATION *formatInfo);
-
-//
-//   Convenience methods
-//
-
-void WriteSilence(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32Frames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame );
-
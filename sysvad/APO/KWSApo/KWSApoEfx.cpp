@@ -36,7 +36,7 @@ const AVRT_DATA CRegAPOProperties<1> CKWSApoEFX::sm_RegProperties(
     1,                                              // major version #
     0,                                              // minor version #
     __uuidof(IKWSApoEFX),                          // iid of primary interface
-    (APO_FLAG) (APO_FLAG_BITSPERSAMPLE_MUST_MATCH | APO_FLAG_FRAMESPERSECOND_MUST_MATCH),
+    (APO_FLAG) (APO_FLAG_INPLACE | APO_FLAG_BITSPERSAMPLE_MUST_MATCH | APO_FLAG_FRAMESPERSECOND_MUST_MATCH),
     DEFAULT_APOREG_MININPUTCONNECTIONS,
     DEFAULT_APOREG_MAXINPUTCONNECTIONS,
     DEFAULT_APOREG_MINOUTPUTCONNECTIONS,
@@ -106,19 +106,19 @@ STDMETHODIMP_(void) CKWSApoEFX::APOProcess(
             pf32OutputFrames = reinterpret_cast<FLOAT32*>(ppOutputConnections[0]->pBuffer);
             ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
 
+            // silence stays silent without the interleaved channels, there is nothing to process
             if (BUFFER_SILENT == ppInputConnections[0]->u32BufferFlags)
             {
-                WriteSilence( pf32OutputFrames,
-                              ppInputConnections[0]->u32ValidFrameCount,
-                              GetSamplesPerFrame() );
+                ppOutputConnections[0]->u32BufferFlags = BUFFER_SILENT;
             }
             else
             {
                 ProcessBuffer(pf32OutputFrames, pf32InputFrames,
                              ppInputConnections[0]->u32ValidFrameCount,
-                             &m_FormatInfo);
+                             m_FormatInfo.PrimaryChannelStartPosition,
+                             m_FormatInfo.PrimaryChannelCount,
+                             m_FormatInfo.PrimaryChannelCount + m_FormatInfo.InterleavedChannelCount);
 
-                // we don't try to remember silence
                 ppOutputConnections[0]->u32BufferFlags = BUFFER_VALID;
             }
 
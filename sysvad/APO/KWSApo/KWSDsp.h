@@ -0,0 +1,26 @@
+//
+// KWSDsp.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//   Declaration of the routine the KWS APO strips interleaved loopback
+//   channels with.
+//
+
+#pragma once
+
+#include <ApoPlatform.h>
+#include <ApoDsp.h>
+
+//
+//   Declaration of the ProcessBuffer routine. The output may be the input
+//   buffer, the u32PrimaryChannels channels from u32PrimaryStart of each
+//   u32Channels channel input frame are gathered front to back.
+//
+void ProcessBuffer(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    UINT32   u32PrimaryStart,
+    UINT32   u32PrimaryChannels,
+    UINT32   u32Channels);
@@ -14,6 +14,8 @@
 #include <SwapAPODll.h>
 
 #include <commonmacros.h>
+#include <ApoSnapshot.h>
+#include "SwapDsp.h"
 #include <devicetopology.h>
 
 _Analysis_mode_(_Analysis_code_type_user_driver_)
@@ -138,12 +140,14 @@ public:
 
     // Locked memory
     FLOAT32                                 *m_pf32Coefficients;
+    CParameterSnapshots<SWAP_MIX_MATRIX>    m_MixMatrices;      // Built by UpdateMixMatrix under m_EffectsLock.
 
 private:
     CCriticalSection                        m_EffectsLock;
     HANDLE                                  m_hEffectsChangedEvent;
 
     HRESULT ProprietaryCommunicationWithDriver(APOInitSystemEffects2 *_pAPOSysFxInit2);
+    void UpdateMixMatrix();
 
 };
 #pragma AVRT_VTABLES_END
@@ -243,40 +247,3 @@ public:
 
 OBJECT_ENTRY_AUTO(__uuidof(SwapAPOMFX), CSwapAPOMFX)
 OBJECT_ENTRY_AUTO(__uuidof(SwapAPOSFX), CSwapAPOSFX)
-
-//
-//   Declaration of the ProcessSwap routine.
-//
-void ProcessSwap(
-    FLOAT32 *pf32OutputFrames,
-    const FLOAT32 *pf32InputFrames,
-    UINT32   u32ValidFrameCount,
-    UINT32   u32SamplesPerFrame);
-
-//
-//   Declaration of the ProcessSwapScale routine.
-//
-void ProcessSwapScale(
-    FLOAT32 *pf32OutputFrames,
-    const FLOAT32 *pf32InputFrames,
-    UINT32   u32ValidFrameCount,
-    UINT32   u32SamplesPerFrame,
-    FLOAT32 *pf32Coefficients );
-
-//
-//   Convenience methods
-//
-
-void WriteSilence(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32Frames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame );
-
-void CopyFrames(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32OutFrames,
-    _In_reads_(u32FrameCount * u32SamplesPerFrame)
-        const FLOAT32 *pf32InFrames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame );
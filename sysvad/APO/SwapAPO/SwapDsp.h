@@ -0,0 +1,85 @@
+//
+// SwapDsp.h -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//   Declaration of the swap and channel matrix routines the swap APOs run
+//   on their buffers.
+//
+
+#pragma once
+
+#include <ApoPlatform.h>
+#include <ApoDsp.h>
+
+//
+// Channel matrix
+//
+//  out[o] = sum over i of C[o][i] * in[i], with as many outputs as inputs;
+//  a downmix leaves the outputs it doesn't use silent. BuildMixMatrix sorts
+//  the matrix into the cheapest way to apply it.
+//
+#define SWAP_MIX_MAX_CHANNELS       32
+#define SWAP_MIX_SILENT             0xFFFFFFFF  // Source of an output no input reaches.
+
+enum SWAP_MIX_KIND
+{
+    SwapMixIdentity,
+    SwapMixGain,                    // Each output is its own input times a gain.
+    SwapMixSwapPairs,               // Each output is the other input of its pair times a gain.
+    SwapMixRoute,                   // Each output is at most one input times a gain.
+    SwapMixDense,
+};
+
+typedef struct _SWAP_MIX_MATRIX
+{
+    SWAP_MIX_KIND   Kind;
+    UINT32          u32Channels;
+
+    // Routing, for every kind but SwapMixDense.
+    UINT32          au32Source[SWAP_MIX_MAX_CHANNELS];
+    FLOAT32         af32Gain[SWAP_MIX_MAX_CHANNELS];
+
+    // SwapMixDense: the inputs with a gain on any output, and per input the
+    // gains of the first 4 * u32DenseVectors outputs. Outputs past those
+    // are silent.
+    UINT32          u32DenseInputs;
+    UINT32          au32DenseInput[SWAP_MIX_MAX_CHANNELS];
+    UINT32          u32DenseVectors;
+    FLOAT32         af32DenseColumns[SWAP_MIX_MAX_CHANNELS * SWAP_MIX_MAX_CHANNELS];
+} SWAP_MIX_MATRIX;
+
+//
+//   Declaration of the ProcessSwap routine.
+//
+void ProcessSwap(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    UINT32   u32SamplesPerFrame);
+
+//
+//   Declaration of the ProcessSwapScale routine.
+//
+void ProcessSwapScale(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    UINT32   u32SamplesPerFrame,
+    FLOAT32 *pf32Coefficients );
+
+//
+//   Declaration of the channel matrix routines.
+//
+HRESULT BuildMixMatrix(
+    _Out_ SWAP_MIX_MATRIX *pMatrix,
+    UINT32   u32Channels,
+    _In_reads_(u32Outputs * u32Channels)
+        const FLOAT32 *pf32Coefficients,
+    UINT32   u32Outputs );
+
+void ProcessMix(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    const SWAP_MIX_MATRIX *pMatrix );
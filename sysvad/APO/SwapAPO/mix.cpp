@@ -0,0 +1,411 @@
+//
+// Mix.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Implementation of the channel matrix
+//
+#include <ApoPlatform.h>
+
+#include <float.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include "SwapDsp.h"
+
+//
+// Most matrices an endpoint uses have at most one gain per output: channel
+// swaps, per-channel trims, picking one microphone. Those are applied as a
+// route, one source and one gain per output, and the identity, diagonal
+// and swapped-pair routes go to the copy, scale and swap kernels. A route
+// with a silent output stays a route, which writes 0 rather than
+// multiplying a NaN by 0. Anything
+// else is dense, done four outputs to a vector and four frames to a block:
+// each input is broadcast and multiplied by its column of gains, skipping
+// inputs no output uses.
+//
+// The dense sums run in input order with separate multiplies and adds on
+// every path, so the scalar and vector results are the same bit for bit.
+//
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Sorts a matrix and lays it out for ProcessMix.
+//
+// Parameters:
+//
+//      pMatrix             - [out] the matrix, ready for ProcessMix
+//      u32Channels         - [in] channels of a frame, in and out
+//      pf32Coefficients    - [in] u32Outputs rows of u32Channels gains, row o
+//                            holding the gain of each input on output o
+//      u32Outputs          - [in] outputs the rows give; the rest are silent
+//
+// Return values:
+//
+//      S_OK, E_POINTER, or E_INVALIDARG if the sizes are out of range or a
+//      gain is not finite
+//
+HRESULT BuildMixMatrix(
+    _Out_ SWAP_MIX_MATRIX *pMatrix,
+    UINT32   u32Channels,
+    _In_reads_(u32Outputs * u32Channels)
+        const FLOAT32 *pf32Coefficients,
+    UINT32   u32Outputs )
+{
+    ASSERT_NONREALTIME();
+    BOOL    fRoute = TRUE;
+    BOOL    fDiagonal = TRUE;
+    BOOL    fSwapPairs = ((u32Channels & 1) == 0);
+    BOOL    fUnity = TRUE;
+    BOOL    fSilent = FALSE;
+    UINT32  u32Stride;
+
+    if (pMatrix == NULL || pf32Coefficients == NULL)
+    {
+        return E_POINTER;
+    }
+
+    if (u32Channels == 0 || u32Channels > SWAP_MIX_MAX_CHANNELS || u32Outputs == 0 || u32Outputs > u32Channels)
+    {
+        return E_INVALIDARG;
+    }
+
+    ZeroMemory(pMatrix, sizeof(*pMatrix));
+    pMatrix->u32Channels = u32Channels;
+
+    for (UINT32 o = 0; o < u32Channels; o++)
+    {
+        UINT32  u32Source = SWAP_MIX_SILENT;
+        UINT32  u32Gains = 0;
+
+        for (UINT32 i = 0; o < u32Outputs && i < u32Channels; i++)
+        {
+            FLOAT32 f32Gain = pf32Coefficients[o * u32Channels + i];
+
+            if (!_finite(f32Gain))
+            {
+                return E_INVALIDARG;
+            }
+
+            if (f32Gain != 0.0f)
+            {
+                u32Source = i;
+                pMatrix->af32Gain[o] = f32Gain;
+                u32Gains++;
+            }
+        }
+
+        pMatrix->au32Source[o] = u32Source;
+
+        fRoute = fRoute && (u32Gains <= 1);
+        fDiagonal = fDiagonal && (u32Source == o);
+        fSwapPairs = fSwapPairs && (u32Source == (o ^ 1));
+        fUnity = fUnity && (u32Source == o) && (pMatrix->af32Gain[o] == 1.0f);
+        fSilent = fSilent || (u32Source == SWAP_MIX_SILENT);
+    }
+
+    if (fRoute)
+    {
+        if (fSilent)
+        {
+            pMatrix->Kind = SwapMixRoute;
+        }
+        else if (fDiagonal)
+        {
+            pMatrix->Kind = fUnity ? SwapMixIdentity : SwapMixGain;
+        }
+        else
+        {
+            pMatrix->Kind = fSwapPairs ? SwapMixSwapPairs : SwapMixRoute;
+        }
+        return S_OK;
+    }
+
+    pMatrix->Kind = SwapMixDense;
+    pMatrix->u32DenseVectors = (u32Outputs + 3) / 4;
+    u32Stride = 4 * pMatrix->u32DenseVectors;
+
+    for (UINT32 i = 0; i < u32Channels; i++)
+    {
+        BOOL fUsed = FALSE;
+
+        for (UINT32 o = 0; o < u32Outputs; o++)
+        {
+            FLOAT32 f32Gain = pf32Coefficients[o * u32Channels + i];
+
+            pMatrix->af32DenseColumns[i * u32Stride + o] = f32Gain;
+            fUsed = fUsed || (f32Gain != 0.0f);
+        }
+
+        if (fUsed)
+        {
+            pMatrix->au32DenseInput[pMatrix->u32DenseInputs++] = i;
+        }
+    }
+
+    return S_OK;
+}
+
+#pragma AVRT_CODE_BEGIN
+static void MixGain(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    const SWAP_MIX_MATRIX *pMatrix )
+{
+    UINT32 u32Channels = pMatrix->u32Channels;
+
+    while (u32ValidFrameCount--)
+    {
+        for (UINT32 c = 0; c < u32Channels; c++)
+        {
+            pf32OutputFrames[c] = pf32InputFrames[c] * pMatrix->af32Gain[c];
+        }
+        pf32InputFrames += u32Channels;
+        pf32OutputFrames += u32Channels;
+    }
+}
+#pragma AVRT_CODE_END
+
+//
+// Routes out of place gather straight into the output. In place, a block of
+// input is copied aside first, as an output may overwrite another's source.
+//
+#define SWAP_MIX_ROUTE_BLOCK_SAMPLES    512
+
+#pragma AVRT_CODE_BEGIN
+static void MixRouteFrames(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    const SWAP_MIX_MATRIX *pMatrix )
+{
+    UINT32  u32Channels = pMatrix->u32Channels;
+
+    while (u32ValidFrameCount--)
+    {
+        for (UINT32 o = 0; o < u32Channels; o++)
+        {
+            UINT32 u32Source = pMatrix->au32Source[o];
+
+            pf32OutputFrames[o] = (u32Source == SWAP_MIX_SILENT) ? 0.0f : pf32InputFrames[u32Source] * pMatrix->af32Gain[o];
+        }
+        pf32InputFrames += u32Channels;
+        pf32OutputFrames += u32Channels;
+    }
+}
+#pragma AVRT_CODE_END
+
+#pragma AVRT_CODE_BEGIN
+static void MixRoute(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    const SWAP_MIX_MATRIX *pMatrix )
+{
+    FLOAT32 af32Block[SWAP_MIX_ROUTE_BLOCK_SAMPLES];
+    UINT32  u32Channels = pMatrix->u32Channels;
+    UINT32  u32BlockFrames = SWAP_MIX_ROUTE_BLOCK_SAMPLES / u32Channels;
+
+    if (pf32OutputFrames != pf32InputFrames)
+    {
+        MixRouteFrames(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, pMatrix);
+        return;
+    }
+
+    while (u32ValidFrameCount > 0)
+    {
+        UINT32 u32Frames = min(u32ValidFrameCount, u32BlockFrames);
+
+        CopyMemory(af32Block, pf32InputFrames, sizeof(FLOAT32) * u32Frames * u32Channels);
+        MixRouteFrames(pf32OutputFrames, af32Block, u32Frames, pMatrix);
+        pf32InputFrames += u32Frames * u32Channels;
+        pf32OutputFrames += u32Frames * u32Channels;
+        u32ValidFrameCount -= u32Frames;
+    }
+}
+#pragma AVRT_CODE_END
+
+#pragma AVRT_CODE_BEGIN
+static void MixDenseScalar(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    const SWAP_MIX_MATRIX *pMatrix )
+{
+    FLOAT32 af32Frame[SWAP_MIX_MAX_CHANNELS] = { 0 };
+    UINT32  u32Channels = pMatrix->u32Channels;
+    UINT32  u32Stride = 4 * pMatrix->u32DenseVectors;
+
+    while (u32ValidFrameCount--)
+    {
+        for (UINT32 o = 0; o < u32Stride; o++)
+        {
+            FLOAT32 f32Sum = 0.0f;
+
+            for (UINT32 k = 0; k < pMatrix->u32DenseInputs; k++)
+            {
+                UINT32 i = pMatrix->au32DenseInput[k];
+
+                f32Sum = f32Sum + pMatrix->af32DenseColumns[i * u32Stride + o] * pf32InputFrames[i];
+            }
+            af32Frame[o] = f32Sum;
+        }
+        CopyMemory(pf32OutputFrames, af32Frame, sizeof(FLOAT32) * u32Channels);
+        pf32InputFrames += u32Channels;
+        pf32OutputFrames += u32Channels;
+    }
+}
+#pragma AVRT_CODE_END
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+
+#if defined(_M_ARM64)
+typedef float32x4_t SWAP_MIX_VECTOR;
+#define MixVectorZero()         vdupq_n_f32(0.0f)
+#define MixVectorSplat(x)       vdupq_n_f32(x)
+#define MixVectorLoad(p)        vld1q_f32(p)
+#define MixVectorStore(p, v)    vst1q_f32(p, v)
+#define MixVectorMulAdd(s, a, b) vaddq_f32(s, vmulq_f32(a, b))
+#else
+typedef __m128 SWAP_MIX_VECTOR;
+#define MixVectorZero()         _mm_setzero_ps()
+#define MixVectorSplat(x)       _mm_set1_ps(x)
+#define MixVectorLoad(p)        _mm_loadu_ps(p)
+#define MixVectorStore(p, v)    _mm_storeu_ps(p, v)
+#define MixVectorMulAdd(s, a, b) _mm_add_ps(s, _mm_mul_ps(a, b))
+#endif
+
+//
+// Four frames at a time: each column vector is loaded once for the block,
+// and the four sums don't wait on each other.
+//
+#define SWAP_MIX_BLOCK_FRAMES   4
+
+#pragma AVRT_CODE_BEGIN
+static void MixDense128(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    const SWAP_MIX_MATRIX *pMatrix )
+{
+    FLOAT32 af32Block[SWAP_MIX_BLOCK_FRAMES][SWAP_MIX_MAX_CHANNELS] = { 0 };
+    UINT32  u32Channels = pMatrix->u32Channels;
+    UINT32  u32Stride = 4 * pMatrix->u32DenseVectors;
+
+    // The whole block is read before any of it is written, for in place mixing.
+    while (u32ValidFrameCount >= SWAP_MIX_BLOCK_FRAMES)
+    {
+        for (UINT32 v = 0; v < u32Stride; v += 4)
+        {
+            const FLOAT32 *pf32Column = pMatrix->af32DenseColumns + v;
+            SWAP_MIX_VECTOR vSum0 = MixVectorZero();
+            SWAP_MIX_VECTOR vSum1 = MixVectorZero();
+            SWAP_MIX_VECTOR vSum2 = MixVectorZero();
+            SWAP_MIX_VECTOR vSum3 = MixVectorZero();
+
+            for (UINT32 k = 0; k < pMatrix->u32DenseInputs; k++)
+            {
+                UINT32 i = pMatrix->au32DenseInput[k];
+                SWAP_MIX_VECTOR vGains = MixVectorLoad(pf32Column + i * u32Stride);
+
+                vSum0 = MixVectorMulAdd(vSum0, vGains, MixVectorSplat(pf32InputFrames[i]));
+                vSum1 = MixVectorMulAdd(vSum1, vGains, MixVectorSplat(pf32InputFrames[u32Channels + i]));
+                vSum2 = MixVectorMulAdd(vSum2, vGains, MixVectorSplat(pf32InputFrames[2 * u32Channels + i]));
+                vSum3 = MixVectorMulAdd(vSum3, vGains, MixVectorSplat(pf32InputFrames[3 * u32Channels + i]));
+            }
+            MixVectorStore(&af32Block[0][v], vSum0);
+            MixVectorStore(&af32Block[1][v], vSum1);
+            MixVectorStore(&af32Block[2][v], vSum2);
+            MixVectorStore(&af32Block[3][v], vSum3);
+        }
+        for (UINT32 f = 0; f < SWAP_MIX_BLOCK_FRAMES; f++)
+        {
+            CopyMemory(pf32OutputFrames + f * u32Channels, af32Block[f], sizeof(FLOAT32) * u32Channels);
+        }
+        pf32InputFrames += SWAP_MIX_BLOCK_FRAMES * u32Channels;
+        pf32OutputFrames += SWAP_MIX_BLOCK_FRAMES * u32Channels;
+        u32ValidFrameCount -= SWAP_MIX_BLOCK_FRAMES;
+    }
+
+    while (u32ValidFrameCount--)
+    {
+        for (UINT32 v = 0; v < u32Stride; v += 4)
+        {
+            const FLOAT32 *pf32Column = pMatrix->af32DenseColumns + v;
+            SWAP_MIX_VECTOR vSum = MixVectorZero();
+
+            for (UINT32 k = 0; k < pMatrix->u32DenseInputs; k++)
+            {
+                UINT32 i = pMatrix->au32DenseInput[k];
+
+                vSum = MixVectorMulAdd(vSum, MixVectorLoad(pf32Column + i * u32Stride), MixVectorSplat(pf32InputFrames[i]));
+            }
+            MixVectorStore(&af32Block[0][v], vSum);
+        }
+        CopyMemory(pf32OutputFrames, af32Block[0], sizeof(FLOAT32) * u32Channels);
+        pf32InputFrames += u32Channels;
+        pf32OutputFrames += u32Channels;
+    }
+}
+#pragma AVRT_CODE_END
+
+#endif
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Applies a matrix from BuildMixMatrix. The output may be the input.
+//
+#pragma AVRT_CODE_BEGIN
+void ProcessMix(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    const SWAP_MIX_MATRIX *pMatrix )
+{
+    ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
+    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pMatrix) );
+
+    switch (pMatrix->Kind)
+    {
+    case SwapMixIdentity:
+        if (pf32OutputFrames != pf32InputFrames)
+        {
+            CopyFrames(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, pMatrix->u32Channels);
+        }
+        break;
+
+    case SwapMixGain:
+        MixGain(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, pMatrix);
+        break;
+
+    case SwapMixSwapPairs:
+        ProcessSwapScale(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, pMatrix->u32Channels,
+                         const_cast<FLOAT32 *>(pMatrix->af32Gain));
+        break;
+
+    case SwapMixRoute:
+        MixRoute(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, pMatrix);
+        break;
+
+    default:
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+        if (g_DspKernel != DspKernelScalar)
+        {
+            MixDense128(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, pMatrix);
+            break;
+        }
+#endif
+        MixDenseScalar(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, pMatrix);
+        break;
+    }
+}
+#pragma AVRT_CODE_END
@@ -5,46 +5,69 @@
 //
 //  Implementation of SwapSamples
 //
-#include <atlbase.h>
-#include <atlcom.h>
-#include <atlcoll.h>
-#include <atlsync.h>
-#include <mmreg.h>
-
-#include <audioenginebaseapo.h>
-#include <baseaudioprocessingobject.h>
-#include <resource.h>
+#include <ApoPlatform.h>
 
 #include <float.h>
 
-#include "SwapAPO.h"
+#if defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include "SwapDsp.h"
+#include <ApoDsp256.h>
+
+//
+// Vector kernels
+//
+//  For an even channel count every frame is whole stereo pairs, so the
+//  buffer is one run of pairs: the swap is a shuffle within each vector and
+//  the scale multiplies the shuffled vector by the coefficients laid out in
+//  channel order, repeated every lcm(channels, vector width) samples. The
+//  products are the scalar products, bit for bit, as there is nothing to
+//  fuse a multiply with. Odd channel counts, huge ones and the frames left
+//  over after the last whole pattern take the scalar loops.
+//
+//  The kernel width is the one ApoDsp picked when the DLL loaded; the 256
+//  bit kernels are in ApoDsp256.cpp. The channel matrix in Mix.cpp uses
+//  the same choice.
+//
+#define SWAP_MAX_VECTOR_CHANNELS    32
+#define SWAP_MAX_PATTERN            (SWAP_MAX_VECTOR_CHANNELS * 4)
 
 #pragma AVRT_CODE_BEGIN
-void WriteSilence(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32Frames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame )
+static UINT32 GetVectorWidth(DSP_KERNEL kernel)
 {
-    ZeroMemory(pf32Frames, sizeof(FLOAT32) * u32FrameCount * u32SamplesPerFrame);
+    return (kernel == DspKernel256) ? 8 : 4;
 }
 #pragma AVRT_CODE_END
 
+//
+// Number of samples after which the per-channel coefficients line up with
+// the vectors again, 0 if the vector kernels can't take this layout.
+//
 #pragma AVRT_CODE_BEGIN
-void CopyFrames(
-    _Out_writes_(u32FrameCount * u32SamplesPerFrame)
-        FLOAT32 *pf32OutFrames,
-    _In_reads_(u32FrameCount * u32SamplesPerFrame)
-        const FLOAT32 *pf32InFrames,
-    UINT32 u32FrameCount,
-    UINT32 u32SamplesPerFrame )
+static UINT32 GetPatternLength(UINT32 u32SamplesPerFrame, UINT32 u32VectorWidth)
 {
-    CopyMemory(pf32OutFrames, pf32InFrames, sizeof(FLOAT32) * u32FrameCount * u32SamplesPerFrame);
+    UINT32 u32Length = u32SamplesPerFrame;
+
+    if (u32SamplesPerFrame == 0 || (u32SamplesPerFrame & 1) || u32SamplesPerFrame > SWAP_MAX_VECTOR_CHANNELS)
+    {
+        return 0;
+    }
+
+    while (u32Length % u32VectorWidth)
+    {
+        u32Length += u32SamplesPerFrame;
+    }
+
+    return u32Length;
 }
 #pragma AVRT_CODE_END
 
 #pragma AVRT_CODE_BEGIN
-void ProcessSwap(
+static void ProcessSwapScalar(
     FLOAT32 *pf32OutputFrames,
     const FLOAT32 *pf32InputFrames,
     UINT32   u32ValidFrameCount,
@@ -53,10 +76,6 @@ void ProcessSwap(
     UINT32   u32SampleIndex;
     FLOAT32  fSwap32;
 
-    ASSERT_REALTIME();
-    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
-    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
-
     // loop through samples
     while (u32ValidFrameCount--)
     {
@@ -74,22 +93,17 @@ void ProcessSwap(
 }
 #pragma AVRT_CODE_END
 
-
 #pragma AVRT_CODE_BEGIN
-void ProcessSwapScale(
+static void ProcessSwapScaleScalar(
     FLOAT32 *pf32OutputFrames,
     const FLOAT32 *pf32InputFrames,
     UINT32   u32ValidFrameCount,
     UINT32   u32SamplesPerFrame,
-    FLOAT32  *pf32Coefficients )
+    const FLOAT32 *pf32Coefficients )
 {
     UINT32   u32SampleIndex;
     FLOAT32  fSwap32;
 
-    ASSERT_REALTIME();
-    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
-    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32OutputFrames) );
-
     // loop through samples
     while (u32ValidFrameCount--)
     {
@@ -112,3 +126,200 @@ void ProcessSwapScale(
     }
 }
 #pragma AVRT_CODE_END
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+#pragma AVRT_CODE_BEGIN
+static void SwapPairs128(
+    FLOAT32 *pf32Output,
+    const FLOAT32 *pf32Input,
+    UINT32   u32Vectors )
+{
+    for (UINT32 i = 0; i < u32Vectors; i++)
+    {
+        __m128 v = _mm_loadu_ps(pf32Input + 4 * i);
+
+        _mm_storeu_ps(pf32Output + 4 * i, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+}
+#pragma AVRT_CODE_END
+
+#pragma AVRT_CODE_BEGIN
+static void SwapScalePairs128(
+    FLOAT32 *pf32Output,
+    const FLOAT32 *pf32Input,
+    UINT32   u32Patterns,
+    const FLOAT32 *pf32Pattern,
+    UINT32   u32PatternVectors )
+{
+    while (u32Patterns--)
+    {
+        for (UINT32 i = 0; i < u32PatternVectors; i++)
+        {
+            __m128 v = _mm_loadu_ps(pf32Input + 4 * i);
+
+            v = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+            _mm_storeu_ps(pf32Output + 4 * i, _mm_mul_ps(v, _mm_loadu_ps(pf32Pattern + 4 * i)));
+        }
+        pf32Input += 4 * u32PatternVectors;
+        pf32Output += 4 * u32PatternVectors;
+    }
+}
+#pragma AVRT_CODE_END
+
+#elif defined(_M_ARM64)
+
+#pragma AVRT_CODE_BEGIN
+static void SwapPairs128(
+    FLOAT32 *pf32Output,
+    const FLOAT32 *pf32Input,
+    UINT32   u32Vectors )
+{
+    for (UINT32 i = 0; i < u32Vectors; i++)
+    {
+        vst1q_f32(pf32Output + 4 * i, vrev64q_f32(vld1q_f32(pf32Input + 4 * i)));
+    }
+}
+#pragma AVRT_CODE_END
+
+#pragma AVRT_CODE_BEGIN
+static void SwapScalePairs128(
+    FLOAT32 *pf32Output,
+    const FLOAT32 *pf32Input,
+    UINT32   u32Patterns,
+    const FLOAT32 *pf32Pattern,
+    UINT32   u32PatternVectors )
+{
+    while (u32Patterns--)
+    {
+        for (UINT32 i = 0; i < u32PatternVectors; i++)
+        {
+            float32x4_t v = vrev64q_f32(vld1q_f32(pf32Input + 4 * i));
+
+            vst1q_f32(pf32Output + 4 * i, vmulq_f32(v, vld1q_f32(pf32Pattern + 4 * i)));
+        }
+        pf32Input += 4 * u32PatternVectors;
+        pf32Output += 4 * u32PatternVectors;
+    }
+}
+#pragma AVRT_CODE_END
+
+#endif
+
+//
+// Runs the vector kernel over the whole patterns of the buffer and returns
+// the number of frames it processed.
+//
+#pragma AVRT_CODE_BEGIN
+static UINT32 ProcessSwapVector(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    UINT32   u32SamplesPerFrame,
+    const FLOAT32 *pf32Coefficients )
+{
+#if defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+    FLOAT32 af32Pattern[SWAP_MAX_PATTERN];
+    UINT32  u32VectorWidth = GetVectorWidth(g_DspKernel);
+    UINT32  u32PatternLength;
+    UINT32  u32FramesPerPattern;
+    UINT32  u32Frames;
+
+    if (g_DspKernel == DspKernelScalar)
+    {
+        return 0;
+    }
+
+    u32PatternLength = GetPatternLength(u32SamplesPerFrame, u32VectorWidth);
+    if (u32PatternLength == 0)
+    {
+        return 0;
+    }
+
+    u32FramesPerPattern = u32PatternLength / u32SamplesPerFrame;
+    u32Frames = u32ValidFrameCount - (u32ValidFrameCount % u32FramesPerPattern);
+
+    if (pf32Coefficients == NULL)
+    {
+#if defined(_M_IX86) || defined(_M_X64)
+        if (g_DspKernel == DspKernel256)
+        {
+            SwapPairs256(pf32OutputFrames, pf32InputFrames, u32Frames * u32SamplesPerFrame / 8);
+            return u32Frames;
+        }
+#endif
+        SwapPairs128(pf32OutputFrames, pf32InputFrames, u32Frames * u32SamplesPerFrame / 4);
+        return u32Frames;
+    }
+
+    for (UINT32 i = 0; i < u32PatternLength; i++)
+    {
+        af32Pattern[i] = pf32Coefficients[i % u32SamplesPerFrame];
+    }
+
+#if defined(_M_IX86) || defined(_M_X64)
+    if (g_DspKernel == DspKernel256)
+    {
+        SwapScalePairs256(pf32OutputFrames, pf32InputFrames, u32Frames / u32FramesPerPattern, af32Pattern, u32PatternLength / 8);
+        return u32Frames;
+    }
+#endif
+    SwapScalePairs128(pf32OutputFrames, pf32InputFrames, u32Frames / u32FramesPerPattern, af32Pattern, u32PatternLength / 4);
+    return u32Frames;
+#else
+    UNREFERENCED_PARAMETER(pf32OutputFrames);
+    UNREFERENCED_PARAMETER(pf32InputFrames);
+    UNREFERENCED_PARAMETER(u32ValidFrameCount);
+    UNREFERENCED_PARAMETER(u32SamplesPerFrame);
+    UNREFERENCED_PARAMETER(pf32Coefficients);
+    return 0;
+#endif
+}
+#pragma AVRT_CODE_END
+
+#pragma AVRT_CODE_BEGIN
+void ProcessSwap(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    UINT32   u32SamplesPerFrame )
+{
+    UINT32   u32Frames;
+
+    ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
+    ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
+
+    u32Frames = ProcessSwapVector(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, u32SamplesPerFrame, NULL);
+
+    ProcessSwapScalar(pf32OutputFrames + u32Frames * u32SamplesPerFrame,
+                      pf32InputFrames + u32Frames * u32SamplesPerFrame,
+                      u32ValidFrameCount - u32Frames,
+                      u32SamplesPerFrame);
+}
+#pragma AVRT_CODE_END
+
+
+#pragma AVRT_CODE_BEGIN
+void ProcessSwapScale(
+    FLOAT32 *pf32OutputFrames,
+    const FLOAT32 *pf32InputFrames,
+    UINT32   u32ValidFrameCount,
+    UINT32   u32SamplesPerFrame,
+    FLOAT32  *pf32Coefficients )
+{
+    UINT32   u32Frames;
+
+    ASSERT_REALTIME();
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32InputFrames) );
+    ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32OutputFrames) );
+
+    u32Frames = ProcessSwapVector(pf32OutputFrames, pf32InputFrames, u32ValidFrameCount, u32SamplesPerFrame, pf32Coefficients);
+
+    ProcessSwapScaleScalar(pf32OutputFrames + u32Frames * u32SamplesPerFrame,
+                           pf32InputFrames + u32Frames * u32SamplesPerFrame,
+                           u32ValidFrameCount - u32Frames,
+                           u32SamplesPerFrame,
+                           pf32Coefficients);
+}
+#pragma AVRT_CODE_END
@@ -162,23 +162,35 @@ STDMETHODIMP_(void) CSwapAPOMFX::APOProcess(
             pf32OutputFrames = reinterpret_cast<FLOAT32*>(ppOutputConnections[0]->pBuffer);
             ATLASSERT( IS_VALID_TYPED_READ_POINTER(pf32OutputFrames) );
 
+            // silence stays silent through the channel matrix, there is nothing to process or copy
             if (BUFFER_SILENT == ppInputConnections[0]->u32BufferFlags)
             {
-                WriteSilence( pf32InputFrames,
-                              ppInputConnections[0]->u32ValidFrameCount,
-                              GetSamplesPerFrame() );
+                ppOutputConnections[0]->u32BufferFlags = BUFFER_SILENT;
+                ppOutputConnections[0]->u32ValidFrameCount = ppInputConnections[0]->u32ValidFrameCount;
+                break;
             }
 
-            // swap and apply coefficients to the input buffer in-place
+            // apply the channel matrix to the input buffer in-place
             if (
                 !IsEqualGUID(m_AudioProcessingMode, AUDIO_SIGNALPROCESSINGMODE_RAW) &&
-                m_fEnableSwapMFX &&
-                (1 < m_u32SamplesPerFrame)
+                m_fEnableSwapMFX
             )
             {
-                ProcessSwapScale(pf32InputFrames, pf32InputFrames,
-                            ppInputConnections[0]->u32ValidFrameCount,
-                            m_u32SamplesPerFrame, m_pf32Coefficients );
+                if (m_MixMatrices.IsAllocated())
+                {
+                    // pick up the matrix UpdateMixMatrix left, if there is a new one
+                    m_MixMatrices.Acquire();
+
+                    ProcessMix(pf32InputFrames, pf32InputFrames,
+                               ppInputConnections[0]->u32ValidFrameCount,
+                               m_MixMatrices.GetFront() );
+                }
+                else if (1 < m_u32SamplesPerFrame)
+                {
+                    ProcessSwapScale(pf32InputFrames, pf32InputFrames,
+                                ppInputConnections[0]->u32ValidFrameCount,
+                                m_u32SamplesPerFrame, m_pf32Coefficients );
+                }
             }
             
             // copy the memory only if there is an output connection, and input/output pointers are unequal
@@ -706,9 +718,88 @@ HRESULT CSwapAPOMFX::OnPropertyValueChanged(LPCWSTR pwstrDeviceId, const PROPERT
         m_EffectsLock.Leave();
     }
 
+    // If the channel matrix changed while the APO is locked for processing...
+    if (PK_EQUAL(key, PKEY_Endpoint_Channel_Matrix_MFX))
+    {
+        m_EffectsLock.Enter();
+
+        if (m_MixMatrices.IsAllocated())
+        {
+            UpdateMixMatrix();
+        }
+
+        m_EffectsLock.Leave();
+    }
+
     return hr;
 }
 
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Builds the channel matrix from PKEY_Endpoint_Channel_Matrix_MFX, or the
+//  default swap if the property is missing or not valid for the stream, and
+//  hands it to APOProcess.
+//
+// Remarks:
+//
+//      The caller holds m_EffectsLock. The matrix is built in the back
+//      block of m_MixMatrices and published, so APOProcess neither waits
+//      nor sees a half built matrix. If it has not picked up the last
+//      matrix yet, that one is simply replaced.
+//
+void CSwapAPOMFX::UpdateMixMatrix()
+{
+    HRESULT             hr = E_FAIL;
+    PROPVARIANT         var;
+    SWAP_MIX_MATRIX     *pMatrix = m_MixMatrices.GetBack();
+
+    PropVariantInit(&var);
+
+    if ((m_spAPOSystemEffectsProperties != NULL) &&
+        SUCCEEDED(m_spAPOSystemEffectsProperties->GetValue(PKEY_Endpoint_Channel_Matrix_MFX, &var)) &&
+        (var.vt == VT_BLOB) &&
+        (var.blob.cbSize >= 2 * sizeof(UINT32)))
+    {
+        const UINT32 *pu32Blob = (const UINT32 *)var.blob.pBlobData;
+        UINT32 u32Inputs = pu32Blob[0];
+        UINT32 u32Outputs = pu32Blob[1];
+
+        if ((u32Inputs == m_u32SamplesPerFrame) &&
+            (u32Outputs <= u32Inputs) &&
+            (var.blob.cbSize == 2 * sizeof(UINT32) + sizeof(FLOAT32) * u32Inputs * u32Outputs))
+        {
+            hr = BuildMixMatrix(pMatrix, u32Inputs, (const FLOAT32 *)(pu32Blob + 2), u32Outputs);
+        }
+    }
+
+    PropVariantClear(&var);
+
+    if (FAILED(hr))
+    {
+        FLOAT32 af32Default[SWAP_MIX_MAX_CHANNELS * SWAP_MIX_MAX_CHANNELS] = { 0 };
+
+        // Swap each stereo pair and scale by the coefficients, as ProcessSwapScale
+        // does; an odd channel out passes through.
+        for (UINT32 o = 0; o < m_u32SamplesPerFrame; o++)
+        {
+            if ((o ^ 1) < m_u32SamplesPerFrame)
+            {
+                af32Default[o * m_u32SamplesPerFrame + (o ^ 1)] = m_pf32Coefficients[o];
+            }
+            else
+            {
+                af32Default[o * m_u32SamplesPerFrame + o] = 1.0f;
+            }
+        }
+
+        hr = BuildMixMatrix(pMatrix, m_u32SamplesPerFrame, af32Default, m_u32SamplesPerFrame);
+        ATLASSERT(SUCCEEDED(hr));
+    }
+
+    m_MixMatrices.Publish();
+}
+
 //-------------------------------------------------------------------------
 // Description:
 //
@@ -833,7 +924,25 @@ HRESULT CSwapAPOMFX::ValidateAndCacheConnectionInfo(UINT32 u32NumInputConnection
         m_pf32Coefficients[u16Index] = 1.0f - (FLOAT32)(f32InverseChannelCount)*u16Index;
     }
 
-    
+    // Channel matrices for APOProcess->ProcessMix. Wider streams keep ProcessSwapScale.
+    m_EffectsLock.Enter();
+
+    if (m_u32SamplesPerFrame <= SWAP_MIX_MAX_CHANNELS)
+    {
+        hResult = m_MixMatrices.Allocate(1);
+
+        if (SUCCEEDED(hResult))
+        {
+            UpdateMixMatrix();
+        }
+    }
+    else
+    {
+        m_MixMatrices.Free();
+    }
+
+    m_EffectsLock.Leave();
+
 Exit:
     LeaveCriticalSection(&m_CritSec);
     return hResult;}
@@ -111,11 +111,12 @@ STDMETHODIMP_(void) CSwapAPOSFX::APOProcess(
             pf32OutputFrames = reinterpret_cast<FLOAT32*>(ppOutputConnections[0]->pBuffer);
             ATLASSERT( IS_VALID_TYPED_WRITE_POINTER(pf32OutputFrames) );
 
+            // silence stays silent through the swap, there is nothing to process or copy
             if (BUFFER_SILENT == ppInputConnections[0]->u32BufferFlags)
             {
-                WriteSilence( pf32InputFrames,
-                              ppInputConnections[0]->u32ValidFrameCount,
-                              GetSamplesPerFrame() );
+                ppOutputConnections[0]->u32BufferFlags = BUFFER_SILENT;
+                ppOutputConnections[0]->u32ValidFrameCount = ppInputConnections[0]->u32ValidFrameCount;
+                break;
             }
 
             // swap the input buffer in-place
@@ -32,6 +32,70 @@ typedef struct
     LONGLONG                    ContosoDetectorConfigurationData;
 } CONTOSO_KEYWORDCONFIGURATION;
 
+//
+// Compiled Contoso keyword model.
+//
+// One image holds the codebook of a language (and optionally of a user)
+// and every keyword compiled against it. All offsets are from the start of
+// the image and every section starts on a CONTOSO_KEYWORDMODEL_ALIGNMENT
+// boundary, so a mapped model file or a copy in pool memory is used in
+// place; loading only checks the bounds.
+//
+#define CONTOSO_KEYWORDMODEL_SIGNATURE      0x4D4B5743      // 'CWKM'
+#define CONTOSO_KEYWORDMODEL_VERSION        1
+#define CONTOSO_KEYWORDMODEL_ALIGNMENT      16
+#define CONTOSO_KEYWORDMODEL_BANDS          16              // Log-mel values per codeword.
+#define CONTOSO_KEYWORDMODEL_MAX_CODEWORDS  256
+#define CONTOSO_KEYWORDMODEL_MAX_FRAMES     100
+#define CONTOSO_KEYWORDMODEL_MAX_KEYWORDS   32
+#define CONTOSO_KEYWORDMODEL_NAME_LENGTH    32
+#define CONTOSO_KEYWORDMODEL_LOADED_IMAGES  4               // Images the driver keeps loaded.
+
+typedef struct
+{
+    ULONG       Signature;                  // CONTOSO_KEYWORDMODEL_SIGNATURE
+    USHORT      Version;                    // CONTOSO_KEYWORDMODEL_VERSION
+    USHORT      LangId;
+    ULONG       ImageSize;                  // Header and all sections.
+    ULONG       UserId;                     // 0 for a speaker independent model.
+    GUID        ModelId;                    // New for every compiled image.
+    ULONG       CodewordCount;
+    ULONG       CodebookOffset;             // CodewordCount * CONTOSO_KEYWORDMODEL_BANDS SHORTs.
+    ULONG       KeywordCount;
+    ULONG       KeywordsOffset;             // KeywordCount CONTOSO_KEYWORDMODEL_KEYWORDs.
+} CONTOSO_KEYWORDMODEL_HEADER;
+
+typedef struct
+{
+    GUID        EventId;
+    ULONG       FrameCount;
+    ULONG       Threshold;                  // Largest average per-frame distance that still matches.
+    ULONG       CodesOffset;                // FrameCount BYTE codebook indices.
+    ULONG       Reserved;
+    WCHAR       DisplayName[CONTOSO_KEYWORDMODEL_NAME_LENGTH];
+} CONTOSO_KEYWORDMODEL_KEYWORD;
+
+C_ASSERT(sizeof(CONTOSO_KEYWORDMODEL_HEADER) % CONTOSO_KEYWORDMODEL_ALIGNMENT == 0);
+C_ASSERT(sizeof(CONTOSO_KEYWORDMODEL_KEYWORD) % CONTOSO_KEYWORDMODEL_ALIGNMENT == 0);
+
+//
+// Keyword pattern matching data carrying a compiled model. Same pattern
+// type as CONTOSO_KEYWORDCONFIGURATION, told apart by its size. The image
+// starts ModelOffset bytes into the pattern. A ModelOffset of 0 carries
+// no image and arms the one the driver already has loaded with ModelId
+// and ModelSize; the driver keeps the CONTOSO_KEYWORDMODEL_LOADED_IMAGES
+// most recently armed images, and fails the pattern with
+// STATUS_NOT_FOUND if it no longer has the image.
+//
+typedef struct
+{
+    SOUNDDETECTOR_PATTERNHEADER Header;
+    LONGLONG                    ContosoDetectorConfigurationData;
+    ULONG                       ModelOffset;
+    ULONG                       ModelSize;
+    GUID                        ModelId;    // CONTOSO_KEYWORDMODEL_HEADER::ModelId
+} CONTOSO_KEYWORDMODELCONFIGURATION;
+
 //
 // The format of the Contoso match result data.
 //
@@ -15,6 +15,8 @@ Abstract:
 #ifndef _SYSVAD_A2DPHPSPEAKERWAVTABLE_H_
 #define _SYSVAD_A2DPHPSPEAKERWAVTABLE_H_
 
+#include "SysVadShared.h"
+
 //
 // Function prototypes.
 //
@@ -596,11 +598,32 @@ PCPROPERTY_ITEM PropertiesA2dpHpSpeakerOffloadPin[] =
         KSPROPERTY_OFFLOAD_PIN_VERIFY_STREAM_OBJECT_POINTER, // define properties
         KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
         PropertyHandler_OffloadPin
-    }
+    },
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
 };
 
 DEFINE_PCAUTOMATION_TABLE_PROP(AutomationA2dpHpSpeakerOffloadPin, PropertiesA2dpHpSpeakerOffloadPin);
 
+//=============================================================================
+
+static
+PCPROPERTY_ITEM PropertiesA2dpHpSpeakerHostPin[] =
+{
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationA2dpHpSpeakerHostPin, PropertiesA2dpHpSpeakerHostPin);
+
 //=============================================================================
 static
 PCPIN_DESCRIPTOR A2dpHpSpeakerWaveMiniportPins[] =
@@ -610,7 +633,7 @@ PCPIN_DESCRIPTOR A2dpHpSpeakerWaveMiniportPins[] =
         A2DPHPSPEAKER_MAX_INPUT_SYSTEM_STREAMS,
         A2DPHPSPEAKER_MAX_INPUT_SYSTEM_STREAMS, 
         0,
-        NULL,
+        &AutomationA2dpHpSpeakerHostPin,        // AutomationTable
         {
             0,
             NULL,
@@ -15,6 +15,8 @@ Abstract:
 #ifndef _SYSVAD_BTHHFPSPEAKERWAVTABLE_H_
 #define _SYSVAD_BTHHFPSPEAKERWAVTABLE_H_
 
+#include "SysVadShared.h"
+
 //
 // Function prototypes.
 //
@@ -145,6 +147,21 @@ PKSDATARANGE BthHfpSpeakerPinDataRangePointersBridge[] =
     &BthHfpSpeakerPinDataRangesBridge[0]
 };
 
+//=============================================================================
+
+static
+PCPROPERTY_ITEM PropertiesBthHfpSpeakerHostPin[] =
+{
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationBthHfpSpeakerHostPin, PropertiesBthHfpSpeakerHostPin);
+
 //=============================================================================
 static
 PCPIN_DESCRIPTOR BthHfpSpeakerWaveMiniportPins[] =
@@ -154,7 +171,7 @@ PCPIN_DESCRIPTOR BthHfpSpeakerWaveMiniportPins[] =
         MAX_INPUT_SYSTEM_STREAMS,
         MAX_INPUT_SYSTEM_STREAMS, 
         0,
-        NULL,
+        &AutomationBthHfpSpeakerHostPin,        // AutomationTable
         {
             0,
             NULL,
@@ -16,6 +16,8 @@ Abstract:
 #ifndef _SYSVAD_BTHHFPSPEAKERWBWAVTABLE_H_
 #define _SYSVAD_BTHHFPSPEAKERWBWAVTABLE_H_
 
+#include "SysVadShared.h"
+
 //
 // Function prototypes.
 //
@@ -147,6 +149,21 @@ PKSDATARANGE BthHfpSpeakerWBPinDataRangePointersBridge[] =
     &BthHfpSpeakerWBPinDataRangesBridge[0]
 };
 
+//=============================================================================
+
+static
+PCPROPERTY_ITEM PropertiesBthHfpSpeakerWBHostPin[] =
+{
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationBthHfpSpeakerWBHostPin, PropertiesBthHfpSpeakerWBHostPin);
+
 //=============================================================================
 static
 PCPIN_DESCRIPTOR BthHfpSpeakerWBWaveMiniportPins[] =
@@ -156,7 +173,7 @@ PCPIN_DESCRIPTOR BthHfpSpeakerWBWaveMiniportPins[] =
         MAX_INPUT_SYSTEM_STREAMS,
         MAX_INPUT_SYSTEM_STREAMS,
         0,
-        NULL,
+        &AutomationBthHfpSpeakerWBHostPin,        // AutomationTable
         {
             0,
             NULL,
@@ -121,6 +121,16 @@ Return Value:
 
     DPF_ENTER(("[CMiniportWaveRT::~CMiniportWaveRT]"));
 
+    // Every stream holds a miniport reference until it released its source.
+    ASSERT(IsListEmpty(&m_SharedToneSources));
+
+    // A queued detection work item holds a miniport reference.
+    if (m_pKeywordDetectionWorkItem)
+    {
+        IoFreeWorkItem(m_pKeywordDetectionWorkItem);
+        m_pKeywordDetectionWorkItem = NULL;
+    }
+
     if (m_pDeviceFormat)
     {
         ExFreePoolWithTag( m_pDeviceFormat, MINWAVERT_POOLTAG );
@@ -597,6 +607,25 @@ Return Value:
         }
     }
     
+    //
+    // Keyword history buffer.
+    //
+    if (m_ulMaxKeywordDetectorStreams > 0)
+    {
+        ntStatus = m_KeywordDetector.Init();
+        if (!NT_SUCCESS(ntStatus))
+        {
+            return ntStatus;
+        }
+
+        // Detections happen in the DPC and are reported from this work item.
+        m_pKeywordDetectionWorkItem = IoAllocateWorkItem(m_pAdapterCommon->GetDeviceObject());
+        if (m_pKeywordDetectionWorkItem == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
     // 
     // For KS event support.
     //
@@ -1346,6 +1375,144 @@ CMiniportWaveRT::StreamClosed
     return STATUS_SUCCESS;
 }
 
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+CMiniportWaveRT::AcquireSharedToneSource
+(
+    _In_  ULONG                     _Pin,
+    _In_  PSHARED_TONE_PARAMETERS   _ToneParameters,
+    _In_  PWAVEFORMATEXTENSIBLE     _WfExt,
+    _Out_ PSharedToneSource *       _ppSource
+)
+/*++
+
+Routine Description:
+
+  Returns the capture tone source for this pin, format and tone settings,
+  creating it on first use. Every capture stream with identical settings
+  shares one source, so the tone is rendered once per unique format instead
+  of once per stream.
+
+Arguments:
+
+  _Pin - capture pin.
+
+  _ToneParameters - tone settings of the stream.
+
+  _WfExt - format of the stream.
+
+  _ppSource - receives a referenced source, release with ReleaseSharedToneSource.
+
+Return Value:
+
+  NT status code.
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS            ntStatus    = STATUS_SUCCESS;
+    PSharedToneSource   source      = NULL;
+    PLIST_ENTRY         le          = NULL;
+
+    DPF_ENTER(("[CMiniportWaveRT::AcquireSharedToneSource]"));
+
+    *_ppSource = NULL;
+
+    KeWaitForSingleObject(&m_SharedToneSourcesLock, Executive, KernelMode, FALSE, NULL);
+
+    for (le = m_SharedToneSources.Flink; le != &m_SharedToneSources; le = le->Flink)
+    {
+        PSharedToneSource candidate = CONTAINING_RECORD(le, SharedToneSource, m_ListEntry);
+        if (candidate->IsMatch(_Pin, _ToneParameters, _WfExt))
+        {
+            source = candidate;
+            break;
+        }
+    }
+
+    if (source == NULL)
+    {
+        source = new (POOL_FLAG_NON_PAGED, MINWAVERT_POOLTAG) SharedToneSource();
+        if (source == NULL)
+        {
+            ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+        }
+        else
+        {
+            ntStatus = source->Init(_Pin, _ToneParameters, _WfExt);
+            if (NT_SUCCESS(ntStatus))
+            {
+                InsertTailList(&m_SharedToneSources, &source->m_ListEntry);
+            }
+            else
+            {
+                delete source;
+                source = NULL;
+            }
+        }
+    }
+
+    if (source != NULL)
+    {
+        source->m_lRefCount++;
+        *_ppSource = source;
+    }
+
+    KeReleaseMutex(&m_SharedToneSourcesLock, FALSE);
+
+    return ntStatus;
+}
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CMiniportWaveRT::ReleaseSharedToneSource
+(
+    _In_  PSharedToneSource         _Source
+)
+/*++
+
+Routine Description:
+
+  Drops a stream's reference on a shared capture tone source, freeing the
+  source when the last stream detaches. The stream's DPC must no longer run.
+
+Arguments:
+
+  _Source - source returned by AcquireSharedToneSource.
+
+Return Value:
+
+  VOID
+
+--*/
+{
+    PAGED_CODE();
+
+    DPF_ENTER(("[CMiniportWaveRT::ReleaseSharedToneSource]"));
+
+    KeWaitForSingleObject(&m_SharedToneSourcesLock, Executive, KernelMode, FALSE, NULL);
+
+    ASSERT(_Source->m_lRefCount > 0);
+    if (--_Source->m_lRefCount == 0)
+    {
+        RemoveEntryList(&_Source->m_ListEntry);
+    }
+    else
+    {
+        _Source = NULL;
+    }
+
+    KeReleaseMutex(&m_SharedToneSourcesLock, FALSE);
+
+    if (_Source != NULL)
+    {
+        delete _Source;
+    }
+}
+
 //=============================================================================
 #pragma code_seg("PAGE")
 NTSTATUS
@@ -1863,6 +2030,125 @@ exit:
     }
 }
 
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+KeywordDetectionWorkItemCallback
+(
+    _In_        PDEVICE_OBJECT  DeviceObject,
+    _In_opt_    PVOID           Context
+)
+/*++
+
+Routine Description:
+
+  Reports a keyword the DPC detected, at passive level.
+
+Arguments:
+
+  DeviceObject - not used.
+
+  Context - the miniport, referenced when the work item was queued.
+
+Return Value:
+
+  VOID
+
+--*/
+{
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    PAGED_CODE();
+
+    PCMiniportWaveRT miniport = (PCMiniportWaveRT)Context;
+
+    ASSERT(miniport);
+
+    InterlockedExchange(&miniport->m_lKeywordDetectionQueued, 0);
+    miniport->ProcessKeywordDetection();
+
+    // Pick up a detection that raced with the flag reset.
+    if (miniport->m_KeywordDetector.IsDetectionPending())
+    {
+        miniport->QueueKeywordDetection();
+    }
+
+    miniport->Release();
+}
+
+//=============================================================================
+#pragma code_seg()
+VOID
+CMiniportWaveRT::QueueKeywordDetection()
+/*++
+
+Routine Description:
+
+  Queues the keyword detection work item unless it is already queued.
+  Called from the DPC.
+
+--*/
+{
+    if (m_pKeywordDetectionWorkItem == NULL)
+    {
+        return;
+    }
+
+    if (InterlockedCompareExchange(&m_lKeywordDetectionQueued, 1, 0) == 0)
+    {
+        AddRef(); // Released by the work item.
+        IoQueueWorkItem(m_pKeywordDetectionWorkItem, KeywordDetectionWorkItemCallback, DelayedWorkQueue, this);
+    }
+}
+
+//=============================================================================
+#pragma code_seg("PAGE")
+VOID
+CMiniportWaveRT::ProcessKeywordDetection()
+/*++
+
+Routine Description:
+
+  Signals a keyword detected by CKeywordDetector the same way for both
+  versions of the sound detector interface, then disarms that keyword.
+
+--*/
+{
+    PAGED_CODE();
+
+    GUID eventId;
+
+    DPF_ENTER(("[CMiniportWaveRT::ProcessKeywordDetection]"));
+
+    if (!m_KeywordDetector.TakeDetection(&eventId))
+    {
+        return;
+    }
+
+    if (m_pPortEvents)
+    {
+        m_pPortEvents->GenerateEventList(const_cast<GUID*>(&KSEVENTSETID_SoundDetector), KSEVENT_SOUNDDETECTOR_MATCHDETECTED, FALSE, 0, FALSE, 0);
+    }
+
+    if (m_pPortClsNotifications)
+    {
+        CONTOSO_KEYWORDDETECTIONRESULT value = {0};
+
+        value.EventId = eventId;
+        value.Header.Size = sizeof(CONTOSO_KEYWORDDETECTIONRESULT);
+        value.Header.PatternType = CONTOSO_KEYWORDCONFIGURATION_IDENTIFIER2;
+        value.KeywordStartTimestamp = m_KeywordDetector.GetStartTimestamp();
+        value.KeywordStopTimestamp = m_KeywordDetector.GetStopTimestamp();
+        m_KeywordDetector.GetDetectorData(eventId, &(value.ContosoDetectorResultData));
+
+        SendPNPNotification(&KSNOTIFICATIONID_SoundDetector, &value, sizeof(value));
+    }
+
+    // Keep buffering: the OS opens the keyword stream after this to read
+    // the keyword and the history before it.
+    m_KeywordDetector.DisarmDetected(eventId);
+}
+
 //=============================================================================
 #pragma code_seg("PAGE")
 NTSTATUS
@@ -2800,15 +3086,6 @@ DEFINE_CLASSPROPERTYHANDLER(CMiniportWaveRT, Set_SoundDetectorArmed)
 
     ntStatus = m_KeywordDetector.SetArmed(CONTOSO_KEYWORD1, armed);
 
-    if (NT_SUCCESS(ntStatus) && armed)
-    {
-        // FUTURE-2014/10/20 For now immediately signal a detection as soon as
-        // it is armed, but later, find a better way to demonstrate this from
-        // within CKeywordDetector.
-        m_pPortEvents->GenerateEventList(const_cast<GUID*>(&KSEVENTSETID_SoundDetector), KSEVENT_SOUNDDETECTOR_MATCHDETECTED, FALSE, 0, FALSE, 0);
-        m_KeywordDetector.SetArmed(CONTOSO_KEYWORD1, FALSE);
-    }
-
     return ntStatus;
 }
 
@@ -2954,6 +3231,36 @@ DEFINE_CLASSPROPERTYHANDLER(CMiniportWaveRT, Set_SoundDetectorPatterns2)
         return STATUS_INVALID_PARAMETER;
     }
 
+    // A pattern larger than the configuration data carries a compiled model,
+    // or names one already loaded if it has no ModelOffset.
+    if (patternHeader->Size >= sizeof(CONTOSO_KEYWORDMODELCONFIGURATION))
+    {
+        CONTOSO_KEYWORDMODELCONFIGURATION *modelPattern = (CONTOSO_KEYWORDMODELCONFIGURATION*)(patternHeader);
+        const BYTE *image = NULL;
+        NTSTATUS ntStatus;
+
+        if (modelPattern->ModelOffset != 0)
+        {
+            if (modelPattern->ModelOffset < sizeof(*modelPattern) ||
+                (ULONGLONG)modelPattern->ModelOffset + modelPattern->ModelSize > patternHeader->Size)
+            {
+                PropertyRequest->ValueSize = 0;
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            image = (BYTE*)modelPattern + modelPattern->ModelOffset;
+        }
+
+        ntStatus = m_KeywordDetector.LoadKeywordModel(modelPattern->ModelId, image, modelPattern->ModelSize);
+        if (!NT_SUCCESS(ntStatus))
+        {
+            PropertyRequest->ValueSize = 0;
+            return ntStatus;
+        }
+
+        return m_KeywordDetector.DownloadDetectorData(propertyInstance->EventId, modelPattern->ContosoDetectorConfigurationData);
+    }
+
     // Verify the pattern is large enough.
     if (patternHeader->Size != sizeof(CONTOSO_KEYWORDCONFIGURATION))
     {
@@ -3010,25 +3317,6 @@ DEFINE_CLASSPROPERTYHANDLER(CMiniportWaveRT, Set_SoundDetectorArmed2)
 
     ntStatus = m_KeywordDetector.SetArmed(propertyInstance->EventId, armed);
 
-    // THIS BLOCK IS FOR SYSVAD TESTING ONLY AND WILL NEED TO BE REMOVED
-    if (NT_SUCCESS(ntStatus) && armed &&
-        (propertyInstance->EventId == CONTOSO_KEYWORD1 || 
-        propertyInstance->EventId == CONTOSO_KEYWORD2))
-    {
-        CONTOSO_KEYWORDDETECTIONRESULT value = {0};
-
-        m_KeywordDetector.NotifyDetection();
-
-        value.EventId = propertyInstance->EventId;
-        value.Header.Size = sizeof(CONTOSO_KEYWORDDETECTIONRESULT);
-        value.Header.PatternType = CONTOSO_KEYWORDCONFIGURATION_IDENTIFIER2;
-        value.KeywordStartTimestamp = m_KeywordDetector.GetStartTimestamp();
-        value.KeywordStopTimestamp = m_KeywordDetector.GetStopTimestamp();        
-        m_KeywordDetector.GetDetectorData(propertyInstance->EventId, &(value.ContosoDetectorResultData));
-
-        SendPNPNotification(&KSNOTIFICATIONID_SoundDetector, &value, sizeof(value));
-    }
-
     return ntStatus;
 }
 
@@ -3413,6 +3701,18 @@ PropertyHandler_GenericPin
             DPF(D_TERSE, ("[PropertyHandler_GenericPin: Invalid Device Request]"));
         }
     }
+    else if (IsEqualGUIDAligned(*PropertyRequest->PropertyItem->Set, KSPROPSETID_SysVAD))
+    {
+        switch (PropertyRequest->PropertyItem->Id)
+        {
+        case KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS:
+            ntStatus = pStream->PropertyHandlerSaveDataStatistics(PropertyRequest);
+            break;
+
+        default:
+            DPF(D_TERSE, ("[PropertyHandler_GenericPin: Invalid Device Request]"));
+        }
+    }
 
 exit:
 
@@ -3430,156 +3730,271 @@ CKeywordDetector::CKeywordDetector()
     m_streamRunning(FALSE),
     m_qpcStartCapture(0),
     m_nLastQueuedPacket(-1),
-    m_SoundDetectorArmed1(FALSE),
-    m_SoundDetectorArmed2(FALSE),
-    m_SoundDetectorData1(0),
-    m_SoundDetectorData2(0),
+    m_nNextReadPacket(0),
+    PacketRing(NULL),
+    PacketCount(0),
+    m_nFilledThroughPacket(-1),
+    m_ulBurstPackets(1),
+    m_nOverrunPackets(0),
+    m_llLastReadLatency(0),
+    m_pWaveRtBuffer(NULL),
+    m_ulWaveRtBufferSize(0),
+    m_ulWaveRtPacketSize(0),
+    m_ulPacketsPerWaveRtBuffer(0),
+    m_ulKeywordImages(0),
+    m_pActiveImage(NULL),
+    m_pScoredImage(NULL),
+    m_lDetectedKeyword(0),
+    m_nKeywordStartPacket(0),
+    m_nKeywordStopPacket(0),
     m_ullKeywordStartTimestamp(0),
-    m_ullKeywordStopTimestamp(0)
+    m_ullKeywordStopTimestamp(0),
+    m_pTapOwner(NULL),
+    m_pTapCoefficients(NULL),
+    m_pTapRing(NULL),
+    m_bTapPrimed(FALSE),
+    m_lTapProduced(0),
+    m_lTapConsumed(0)
 {
     PAGED_CODE();
 
-    // Initialize our pool of packets and the list structures
-    KeInitializeSpinLock(&PacketPoolSpinLock);
-    KeInitializeSpinLock(&PacketFifoSpinLock);
+    RtlZeroMemory(m_Models, sizeof(m_Models));
+    m_Models[0].EventId = CONTOSO_KEYWORD1;
+    m_Models[1].EventId = CONTOSO_KEYWORD2;
+
+    InitializeListHead(&m_KeywordImages);
+    KeInitializeMutex(&m_KeywordImagesLock, 0);
+    KeInitializeSpinLock(&m_ProducerLock);
+
     ResetFifo();
 }
 
 #pragma code_seg("PAGE")
-_IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS CKeywordDetector::ReadKeywordTimestampRegistry()
+CKeywordDetector::~CKeywordDetector()
 {
     PAGED_CODE();
 
-    NTSTATUS                    ntStatus;
-    UNICODE_STRING              parametersPath;
-
-    RTL_QUERY_REGISTRY_TABLE    paramTable[] = {
-        // QueryRoutine     Flags                                               Name                            EntryContext                            DefaultType                                                     DefaultData                                 DefaultLength
-        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"KeywordDetectorStartTimestamp",   &m_ullKeywordStartTimestamp,    (REG_QWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_QWORD,  &m_ullKeywordStartTimestamp,        sizeof(ULONGLONG) },
-        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"KeywordDetectorStopTimestamp",    &m_ullKeywordStopTimestamp,     (REG_QWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_QWORD,  &m_ullKeywordStopTimestamp,         sizeof(ULONGLONG) },
-        { NULL,   0,                                                        NULL,                               NULL,                                   0,                                                              NULL,                                       0 }
-    };
-
-    RtlInitUnicodeString(&parametersPath, NULL);
-
-    // The sizeof(WCHAR) is added to the maximum length, for allowing a space for null termination of the string.
-    parametersPath.MaximumLength =
-        g_RegistryPath.Length + sizeof(L"\\Parameters") + sizeof(WCHAR);
-
-    parametersPath.Buffer = (PWCH)ExAllocatePool2(POOL_FLAG_PAGED, parametersPath.MaximumLength, MINWAVERT_POOLTAG);
-    if (parametersPath.Buffer == NULL)
+    if (PacketRing)
     {
-        return STATUS_INSUFFICIENT_RESOURCES;
+        ExFreePoolWithTag(PacketRing, MINWAVERT_POOLTAG);
+        PacketRing = NULL;
     }
 
-    RtlAppendUnicodeToString(&parametersPath, g_RegistryPath.Buffer);
-    RtlAppendUnicodeToString(&parametersPath, L"\\Parameters");
-
-    ntStatus = RtlQueryRegistryValues(
-        RTL_REGISTRY_ABSOLUTE | RTL_REGISTRY_OPTIONAL,
-        parametersPath.Buffer,
-        &paramTable[0],
-        NULL,
-        NULL
-    );
+    if (m_pTapCoefficients)
+    {
+        ExFreePoolWithTag(m_pTapCoefficients, MINWAVERT_POOLTAG);
+        m_pTapCoefficients = NULL;
+    }
 
-    ExFreePool(parametersPath.Buffer);
+    if (m_pTapRing)
+    {
+        ExFreePoolWithTag(m_pTapRing, MINWAVERT_POOLTAG);
+        m_pTapRing = NULL;
+    }
 
-    return ntStatus;
+    m_pActiveImage = NULL;
+    while (!IsListEmpty(&m_KeywordImages))
+    {
+        KEYWORD_IMAGE *image = CONTAINING_RECORD(RemoveHeadList(&m_KeywordImages), KEYWORD_IMAGE, ListEntry);
+        ExFreePoolWithTag(image, MINWAVERT_POOLTAG);
+    }
 }
 
-
 #pragma code_seg("PAGE")
 _IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS CKeywordDetector::ResetDetector(_In_ GUID eventId)
+NTSTATUS CKeywordDetector::Init()
 {
     PAGED_CODE();
 
-    if (eventId == CONTOSO_KEYWORD1)
+    ULONG historyMs = g_KeywordHistoryMs;
+
+    if (historyMs < MinHistoryMs)
     {
-        m_SoundDetectorData1 = 0;
-        m_SoundDetectorArmed1 = FALSE;
+        historyMs = MinHistoryMs;
     }
-    else if(eventId == CONTOSO_KEYWORD2)
+    else if (historyMs > MaxHistoryMs)
     {
-        m_SoundDetectorData2 = 0;
-        m_SoundDetectorArmed2 = FALSE;
+        historyMs = MaxHistoryMs;
     }
-    else if(eventId == GUID_NULL)
+
+    m_ulBurstPackets = g_KeywordBurstPackets;
+    if (m_ulBurstPackets < 1)
     {
-        // When DownloadDetectorData is called to set the pattern for multiple keywords
-        // at once, all keyword detectors must be reset. Also used during keyword detector
-        // initialization and cleanup to restore it back to initial state and power down.
-        m_SoundDetectorData1 = 0;
-        m_SoundDetectorArmed1 = FALSE;
-        m_SoundDetectorData2 = 0;
-        m_SoundDetectorArmed2 = FALSE;
+        m_ulBurstPackets = 1;
     }
-    else
+    else if (m_ulBurstPackets > MaxBurstPackets)
     {
-        return STATUS_INVALID_PARAMETER;
+        m_ulBurstPackets = MaxBurstPackets;
     }
 
-    return STATUS_SUCCESS;
+    PacketCount = historyMs * (SamplesPerSecond / SamplesPerPacket) / 1000;
+
+    // Allocations of a page or more are page aligned, which keeps every
+    // entry on its own cache lines.
+    C_ASSERT(MinHistoryMs * (SamplesPerSecond / SamplesPerPacket) / 1000 * sizeof(PACKET_ENTRY) >= PAGE_SIZE);
+    PacketRing = (PACKET_ENTRY *)ExAllocatePool2(POOL_FLAG_NON_PAGED, (SIZE_T)PacketCount * sizeof(PACKET_ENTRY), MINWAVERT_POOLTAG);
+    if (PacketRing == NULL)
+    {
+        PacketCount = 0;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    C_ASSERT((TapRingSamples & (TapRingSamples - 1)) == 0);
+    C_ASSERT(MaxTapLagSamples < TapRingSamples);
+    m_pTapRing = (short *)ExAllocatePool2(POOL_FLAG_NON_PAGED, TapRingSamples * sizeof(short), MINWAVERT_POOLTAG);
+    if (m_pTapRing == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    DPF(D_VERBOSE, ("Keyword history: %u ms, burst: %u packets", historyMs, m_ulBurstPackets));
+
+    return STATUS_SUCCESS;
 }
 
 #pragma code_seg("PAGE")
 _IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS CKeywordDetector::DownloadDetectorData(_In_ GUID eventId, _In_ LONGLONG Data)
+LONG CKeywordDetector::FindModel(_In_ GUID eventId, _In_ BOOL Add)
 {
     PAGED_CODE();
 
-    // reset the detector for this event Id
-    ResetDetector(eventId);
+    LONG freeSlot = -1;
 
-    // In this example, the driver supports detection data 
-    // set with a single call for both detectors, or each
-    // detector set individually.
-    if (eventId == CONTOSO_KEYWORD1)
+    if (eventId == GUID_NULL)
     {
-        m_SoundDetectorData1 = Data;
+        return -1;
     }
-    else if(eventId == CONTOSO_KEYWORD2)
+
+    for (LONG i = 0; i < MaxKeywordModels; i++)
     {
-        m_SoundDetectorData2 = Data;
+        if (m_Models[i].EventId == eventId)
+        {
+            return i;
+        }
+        if (freeSlot < 0 && m_Models[i].EventId == GUID_NULL)
+        {
+            freeSlot = i;
+        }
     }
-    else if(eventId == GUID_NULL)
+
+    if (!Add || freeSlot < 0)
     {
-        // in this simplified example "Data" is set on both detectors,
-        // however in a real system "Data" could be a data structure which
-        // contains different values for each detector.
-        m_SoundDetectorData1 = m_SoundDetectorData2 = Data;
+        return -1;
+    }
+
+    // Free slots are never armed, so the DPC does not look at this one
+    // until it is.
+    m_Models[freeSlot].Armed = FALSE;
+    m_Models[freeSlot].Data = 0;
+    m_Models[freeSlot].Matcher.Reset();
+    m_Models[freeSlot].EventId = eventId;
+
+    return freeSlot;
+}
+
+#pragma code_seg()
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOL CKeywordDetector::IsAnyModelArmed()
+{
+    for (LONG i = 0; i < MaxKeywordModels; i++)
+    {
+        if (m_Models[i].Armed)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS CKeywordDetector::ResetDetector(_In_ GUID eventId)
+{
+    PAGED_CODE();
+
+    if (eventId == GUID_NULL)
+    {
+        // When DownloadDetectorData is called to set the pattern for multiple keywords
+        // at once, all keyword detectors must be reset. Also used during keyword detector
+        // initialization and cleanup to restore it back to initial state and power down.
+        for (LONG i = 0; i < MaxKeywordModels; i++)
+        {
+            m_Models[i].Data = 0;
+            m_Models[i].Armed = FALSE;
+        }
     }
     else
     {
-        return STATUS_INVALID_PARAMETER;
+        LONG model = FindModel(eventId, FALSE);
+
+        if (model < 0)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        m_Models[model].Data = 0;
+        m_Models[model].Armed = FALSE;
     }
 
     return STATUS_SUCCESS;
 }
 
-// The following function is only applicable to single keyword detection systems,
-// and assumes keyword detector #1.
 #pragma code_seg("PAGE")
 _IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS CKeywordDetector::GetDetectorData(_In_ GUID eventId, _Out_ LONGLONG *Data)
+NTSTATUS CKeywordDetector::DownloadDetectorData(_In_ GUID eventId, _In_ LONGLONG Data)
 {
     PAGED_CODE();
 
-    if (eventId == CONTOSO_KEYWORD1)
+    // reset the detector for this event Id
+    ResetDetector(eventId);
+
+    // In this example, the driver supports detection data 
+    // set with a single call for all detectors, or each
+    // detector set individually. A new event id gets a
+    // model slot of its own.
+    if (eventId == GUID_NULL)
     {
-        *Data = m_SoundDetectorData1;
+        // in this simplified example "Data" is set on every detector,
+        // however in a real system "Data" could be a data structure which
+        // contains different values for each detector.
+        for (LONG i = 0; i < MaxKeywordModels; i++)
+        {
+            if (m_Models[i].EventId != GUID_NULL)
+            {
+                m_Models[i].Data = Data;
+            }
+        }
     }
-    else if(eventId == CONTOSO_KEYWORD2)
+    else
     {
-        *Data = m_SoundDetectorData2;
+        LONG model = FindModel(eventId, TRUE);
+
+        if (model < 0)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        m_Models[model].Data = Data;
     }
-    else
+
+    return STATUS_SUCCESS;
+}
+
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS CKeywordDetector::GetDetectorData(_In_ GUID eventId, _Out_ LONGLONG *Data)
+{
+    PAGED_CODE();
+
+    LONG model = FindModel(eventId, FALSE);
+
+    if (model < 0)
     {
         return STATUS_INVALID_PARAMETER;
     }
 
+    *Data = m_Models[model].Data;
 
     return STATUS_SUCCESS;
 }
@@ -3602,21 +4017,34 @@ ULONGLONG CKeywordDetector::GetStopTimestamp()
     return m_ullKeywordStopTimestamp;
 }
 
-#pragma code_seg("PAGE")
-_IRQL_requires_max_(PASSIVE_LEVEL)
+//
+// ResetFifo()
+//
+//  Empties the packet ring and resets the detection pipeline. Holds
+//  m_ProducerLock so DpcRoutine is not producing meanwhile.
+//
+#pragma code_seg()
+_IRQL_requires_max_(DISPATCH_LEVEL)
 VOID CKeywordDetector::ResetFifo()
 {
-    PAGED_CODE();
+    KIRQL oldIrql;
+
+    KeAcquireSpinLock(&m_ProducerLock, &oldIrql);
 
     m_qpcStartCapture = 0;
     m_nLastQueuedPacket = (-1);
-    InitializeListHead(&PacketPoolHead);
-    InitializeListHead(&PacketFifoHead);
+    m_nNextReadPacket = 0;
+    m_nFilledThroughPacket = (-1);
+    m_nOverrunPackets = 0;
+    m_llLastReadLatency = 0;
 
-    for (int i = 0; i < ARRAYSIZE(PacketPool); i++)
+    m_FrontEnd.Reset();
+    for (LONG i = 0; i < MaxKeywordModels; i++)
     {
-        InsertTailList(&PacketPoolHead, &PacketPool[i].ListEntry);
+        m_Models[i].Matcher.Reset();
     }
+
+    KeReleaseSpinLock(&m_ProducerLock, oldIrql);
     return;
 }
 
@@ -3628,59 +4056,72 @@ NTSTATUS CKeywordDetector::SetArmed(_In_ GUID eventId, _In_ BOOL Arm)
 
     BOOL previousArming = FALSE;
     NTSTATUS ntStatus = STATUS_SUCCESS;
+    LONG model;
 
-    // the previous state is "armed" if either detector is armed.
-    // this reflects the fact that both detectors are sharing the
+    // the previous state is "armed" if any detector is armed.
+    // this reflects the fact that all detectors are sharing the
     // same stream.
-    previousArming = m_SoundDetectorArmed1 || m_SoundDetectorArmed2;
+    previousArming = IsAnyModelArmed();
 
-    if (eventId == CONTOSO_KEYWORD1)
-    {
-        m_SoundDetectorArmed1 = Arm;
-    }
-    else if(eventId == CONTOSO_KEYWORD2)
-    {
-        m_SoundDetectorArmed2 = Arm;
-    }
-    else
+    model = FindModel(eventId, FALSE);
+    if (model < 0)
     {
         return STATUS_INVALID_PARAMETER;
     }
 
+    m_Models[model].Armed = Arm;
+
     if (Arm && !previousArming && m_qpcStartCapture == 0)
     {
         StartBufferingStream();
     }
-    else if (!Arm && previousArming && !m_streamRunning)
+    else if (!Arm && !IsAnyModelArmed() && !m_streamRunning && m_qpcStartCapture != 0)
     {
         // if it's not actively streaming and everything has been disarmed,
-        // then stop buffering.
+        // then stop buffering. This includes the history DisarmDetected
+        // kept for a detection nobody read.
         ResetFifo();
     }
 
     return ntStatus;
 }
 
+//
+// DisarmDetected()
+//
+//  Disarms the model that just detected its keyword, leaving the history
+//  buffered for the keyword stream. Stop or an explicit disarm through
+//  SetArmed drops it.
+//
 #pragma code_seg("PAGE")
 _IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS CKeywordDetector::GetArmed(_In_ GUID eventId, _Out_ BOOL *Arm)
+VOID CKeywordDetector::DisarmDetected(_In_ GUID eventId)
 {
     PAGED_CODE();
-    NTSTATUS ntStatus = STATUS_SUCCESS;
 
-    if (eventId == CONTOSO_KEYWORD1)
-    {
-        *Arm = m_SoundDetectorArmed1;
-    }
-    else if(eventId == CONTOSO_KEYWORD2)
+    LONG model = FindModel(eventId, FALSE);
+
+    if (model >= 0)
     {
-        *Arm = m_SoundDetectorArmed2;
+        m_Models[model].Armed = FALSE;
     }
-    else
+}
+
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS CKeywordDetector::GetArmed(_In_ GUID eventId, _Out_ BOOL *Arm)
+{
+    PAGED_CODE();
+    NTSTATUS ntStatus = STATUS_SUCCESS;
+    LONG model = FindModel(eventId, FALSE);
+
+    if (model < 0)
     {
         return STATUS_INVALID_PARAMETER;
     }
 
+    *Arm = m_Models[model].Armed;
+
     return ntStatus;
 }
 
@@ -3723,181 +4164,904 @@ VOID CKeywordDetector::Stop()
 {
     PAGED_CODE();
 
+    LARGE_INTEGER qpcFrequency;
+
+    WritePointerRelease((PVOID *)&m_pWaveRtBuffer, NULL);
+
+    KeQueryPerformanceCounter(&qpcFrequency);
+    DPF(D_VERBOSE, ("[CKeywordDetector::Stop : %I64d packets queued, %I64d read, %I64d skipped on overrun, last read after %I64d us]",
+                    m_nLastQueuedPacket + 1,
+                    m_nNextReadPacket,
+                    m_nOverrunPackets,
+                    m_llLastReadLatency * 1000000 / qpcFrequency.QuadPart));
+
     ResetFifo();
     m_streamRunning = FALSE;
 }
 
 #pragma code_seg("PAGE")
 _IRQL_requires_max_(PASSIVE_LEVEL)
-VOID CKeywordDetector::StartBufferingStream()
+VOID CKeywordDetector::AttachWaveRtBuffer
+(
+    _In_ ULONG PacketsPerWaveRtBuffer,
+    _In_ ULONG WaveRtBufferSize,
+    _In_reads_(WaveRtBufferSize) BYTE *WaveRtBuffer
+)
 {
-    LARGE_INTEGER qpc;
-    LARGE_INTEGER qpcFrequency;
-
     PAGED_CODE();
 
-    NT_ASSERT(m_qpcStartCapture == 0);
-    NT_ASSERT(IsListEmpty(&PacketFifoHead));
+    NT_ASSERT(PacketsPerWaveRtBuffer > 1);
+    NT_ASSERT(WaveRtBufferSize / PacketsPerWaveRtBuffer == sizeof(PacketRing->Samples));
 
-    qpc = KeQueryPerformanceCounter(&qpcFrequency);
-    m_qpcStartCapture = qpc.QuadPart;
-    m_qpcFrequency = qpcFrequency.QuadPart;
+    m_ulPacketsPerWaveRtBuffer = PacketsPerWaveRtBuffer;
+    m_ulWaveRtBufferSize = WaveRtBufferSize;
+    m_ulWaveRtPacketSize = WaveRtBufferSize / PacketsPerWaveRtBuffer;
 
-    return;
+    // Publish the buffer after its geometry.
+    WritePointerRelease((PVOID *)&m_pWaveRtBuffer, WaveRtBuffer);
 }
 
+//
+// AttachCaptureTap()
+//
+//  Makes a running host capture stream the source of the keyword packets
+//  instead of silence. Its audio, in any rate the decimator supports and
+//  any channel count, is downmixed and decimated to 16 kHz mono as the
+//  stream writes it, see WriteCaptureTap. One stream feeds the detector at
+//  a time, others get STATUS_DEVICE_BUSY.
+//
+//  Owner - The stream, passed again to WriteCaptureTap and DetachCaptureTap.
+//  WfExt - The stream's format.
+//
 #pragma code_seg("PAGE")
 _IRQL_requires_max_(PASSIVE_LEVEL)
-VOID CKeywordDetector::NotifyDetection()
+NTSTATUS CKeywordDetector::AttachCaptureTap
+(
+    _In_ PVOID Owner,
+    _In_ PWAVEFORMATEXTENSIBLE WfExt
+)
 {
     PAGED_CODE();
 
-    // A detection will only happen if armed and the
-    // stream is already running. If there isn't a client
-    // running, then set the stream start time to align
-    // with this detection.
-    if (!m_streamRunning)
-    {
-        StartBufferingStream();
+    KWDEC_SAMPLE_TYPE sampleType;
+    ULONG coefficientCount;
+    KFLOATING_SAVE saveData;
+    BOOL isFloat;
+    BOOL isPcm;
+    NTSTATUS ntStatus;
 
-        // The following code is for testing purposes only.
-        // m_qpcFrequency is defined to be the number of ticks in 1 second.
-        // Use the stream start time (the current time retrieved in StartBufferStream) to 
-        // mark when the keyword ended, and the start time minus 1 second worth of ticks
-        // to mark when the keyword started. Also, adjust the stream start time to align
-        // to this new keyword start time, so that the simulated stream contains the full keyword.
+    if (m_pTapRing == NULL)
+    {
+        return STATUS_INVALID_DEVICE_STATE;
+    }
 
-        m_ullKeywordStopTimestamp = m_qpcStartCapture; // stop time is the current time
-        m_qpcStartCapture = m_qpcStartCapture - m_qpcFrequency; // buffer start time is 1 second ago
-        m_ullKeywordStartTimestamp = m_qpcStartCapture; // buffer start time = keyword start time
+    isFloat = (WfExt->Format.wFormatTag == WAVE_FORMAT_IEEE_FLOAT) ||
+              (WfExt->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+               IsEqualGUIDAligned(WfExt->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT));
+    isPcm = (WfExt->Format.wFormatTag == WAVE_FORMAT_PCM) ||
+            (WfExt->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+             IsEqualGUIDAligned(WfExt->SubFormat, KSDATAFORMAT_SUBTYPE_PCM));
 
+    if (isFloat && WfExt->Format.wBitsPerSample == 32)
+    {
+        sampleType = KwdecFloat32;
+    }
+    else if (isPcm && WfExt->Format.wBitsPerSample == 16)
+    {
+        sampleType = KwdecPcm16;
+    }
+    else if (isPcm && WfExt->Format.wBitsPerSample == 24)
+    {
+        sampleType = KwdecPcm24;
+    }
+    else if (isPcm && WfExt->Format.wBitsPerSample == 32)
+    {
+        sampleType = KwdecPcm32;
     }
     else
     {
-        // The following code is for testing purposes only.
-        // If the stream is running, we cannot modify qpcStartCapture to be in
-        // the past, so instead make the keyword start & stop times fit within the
-        // time period that the keyword has been running. If it has been running
-        // for more than 1 second, then set the keyword start time to be 1 second back
-        // into the stream, as though we just figured out there was a keyword there.
-        // If it has been running less than one second, then the keyword size ends
-        // up being however long the stream has been running. 
+        return STATUS_NOT_SUPPORTED;
+    }
 
-        LARGE_INTEGER qpc;
-        qpc = KeQueryPerformanceCounter(NULL);
+    if (WfExt->Format.nBlockAlign != WfExt->Format.nChannels * WfExt->Format.wBitsPerSample / 8)
+    {
+        return STATUS_NOT_SUPPORTED;
+    }
 
-        m_ullKeywordStopTimestamp = qpc.QuadPart; // stop time is the current time
+    if (InterlockedCompareExchangePointer(&m_pTapOwner, Owner, NULL) != NULL)
+    {
+        return STATUS_DEVICE_BUSY;
+    }
 
-        if (m_qpcStartCapture < (qpc.QuadPart - m_qpcFrequency))
+    // The owner does not write before this returns, nothing else reads
+    // the decimator.
+    coefficientCount = KeywordDecimator::GetCoefficientCount(WfExt->Format.nSamplesPerSec);
+    if (coefficientCount > 0)
+    {
+        m_pTapCoefficients = (short *)ExAllocatePool2(POOL_FLAG_NON_PAGED, coefficientCount * sizeof(short), MINWAVERT_POOLTAG);
+        if (m_pTapCoefficients == NULL)
         {
-            m_ullKeywordStartTimestamp = (qpc.QuadPart - m_qpcFrequency); 
+            ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
         }
-        else
+    }
+
+    ntStatus = KeSaveFloatingPointState(&saveData);
+    if (!NT_SUCCESS(ntStatus))
+    {
+        goto Done;
+    }
+
+    if (!m_Decimator.Init(WfExt->Format.nSamplesPerSec, WfExt->Format.nChannels, sampleType, m_pTapCoefficients, coefficientCount))
+    {
+        ntStatus = STATUS_NOT_SUPPORTED;
+    }
+
+    KeRestoreFloatingPointState(&saveData);
+
+    if (NT_SUCCESS(ntStatus))
+    {
+        DPF(D_VERBOSE, ("Keyword capture tap: %u Hz, %u channels, %u bits",
+            WfExt->Format.nSamplesPerSec, WfExt->Format.nChannels, WfExt->Format.wBitsPerSample));
+    }
+
+Done:
+    if (!NT_SUCCESS(ntStatus))
+    {
+        if (m_pTapCoefficients)
         {
-            m_ullKeywordStartTimestamp = m_qpcStartCapture;
+            ExFreePoolWithTag(m_pTapCoefficients, MINWAVERT_POOLTAG);
+            m_pTapCoefficients = NULL;
         }
-
+        WritePointerRelease(&m_pTapOwner, NULL);
     }
 
-    return;
+    return ntStatus;
 }
 
-#pragma code_seg()
-_IRQL_requires_min_(DISPATCH_LEVEL)
-VOID CKeywordDetector::DpcRoutine(_In_ LONGLONG PerformanceCounter, _In_ LONGLONG PerformanceFrequency)
+//
+// DetachCaptureTap()
+//
+//  Stops feeding the detector from Owner. The caller has made sure its
+//  WriteCaptureTap calls are over; DpcRoutine goes back to silence once
+//  the ring runs dry.
+//
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID CKeywordDetector::DetachCaptureTap(_In_ PVOID Owner)
 {
-    LONGLONG currentPacket;
-    LONGLONG packetsToQueue;
+    PAGED_CODE();
 
-    if (m_qpcStartCapture <= 0)
+    if (ReadPointerAcquire(&m_pTapOwner) != Owner)
     {
         return;
     }
 
-    currentPacket = (PerformanceCounter - m_qpcStartCapture) * (SamplesPerSecond / SamplesPerPacket) / PerformanceFrequency;
-    packetsToQueue = currentPacket - m_nLastQueuedPacket;
-
-    while (packetsToQueue > 0)
+    if (m_pTapCoefficients)
     {
-        LIST_ENTRY*     packetListEntry;
-        PACKET_ENTRY*   packetEntry;
+        ExFreePoolWithTag(m_pTapCoefficients, MINWAVERT_POOLTAG);
+        m_pTapCoefficients = NULL;
+    }
 
-        do
-        {
-            packetListEntry = ExInterlockedRemoveHeadList(&PacketPoolHead, &PacketPoolSpinLock);
-            if (packetListEntry != NULL) break;
+    WritePointerRelease(&m_pTapOwner, NULL);
+}
+
+//
+// WriteCaptureTap()
+//
+//  Decimates Length bytes the owner just captured into the tap ring. The
+//  decimator always runs so frames stay aligned across calls, but samples
+//  are only queued while the detector produces packets; when DpcRoutine
+//  falls a ring behind the newest samples are dropped.
+//
+#pragma code_seg()
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID CKeywordDetector::WriteCaptureTap
+(
+    _In_ PVOID Owner,
+    _In_reads_bytes_(Length) const BYTE *Data,
+    _In_ ULONG Length
+)
+{
+    short decimated[SamplesPerPacket];
+    ULONG maxRun;
 
-            // Pool is empty, no room to buffer more, an overrun is occurring. Drop and reuse the
-            // oldest packet from head of fifo.
+    if (ReadPointerNoFence(&m_pTapOwner) != Owner)
+    {
+        return;
+    }
 
-            // Since the pool is empty, the fifo should be full. However, although unlikely, the
-            // driver might empty the fifo before this routine removes a packet. In that case, the
-            // pool should have packets available again. Therefore this is a retry loop.
-            packetListEntry = ExInterlockedRemoveHeadList(&PacketFifoHead, &PacketFifoSpinLock);
-            if (packetListEntry != NULL) break;
-        } while (TRUE);
+    maxRun = m_Decimator.GetMaxInputLength(SamplesPerPacket);
 
-        packetEntry = CONTAINING_RECORD(packetListEntry, PACKET_ENTRY, ListEntry);
+    while (Length > 0)
+    {
+        ULONG run = min(Length, maxRun);
+        ULONG count = m_Decimator.Process(Data, run, decimated);
+        LONG produced = m_lTapProduced;
 
-        packetEntry->PacketNumber = ++m_nLastQueuedPacket;
-        packetEntry->QpcWhenSampled = m_qpcStartCapture + (packetEntry->PacketNumber * PerformanceFrequency * SamplesPerPacket / SamplesPerSecond);
+        Data += run;
+        Length -= run;
 
-        RtlZeroMemory(&packetEntry->Samples[0], sizeof(packetEntry->Samples));
+        // m_qpcStartCapture is only a hint here, a packet more or less
+        // queued around Run and Stop does not matter.
+        if (count == 0 ||
+            m_qpcStartCapture <= 0 ||
+            (ULONG)(produced - ReadAcquire(&m_lTapConsumed)) + count > (ULONG)TapRingSamples)
+        {
+            continue;
+        }
 
-        InitializeListHead(packetListEntry);
-        ExInterlockedInsertTailList(&PacketFifoHead, packetListEntry, &PacketFifoSpinLock);
+        for (ULONG i = 0; i < count; i++)
+        {
+            m_pTapRing[(produced + i) & (TapRingSamples - 1)] = decimated[i];
+        }
 
-        packetsToQueue -= 1;
+        // Publish the samples after writing them.
+        WriteRelease(&m_lTapProduced, produced + (LONG)count);
     }
 }
 
+//
+// ReadCaptureTap()
+//
+//  Fills one packet from the tap ring. Reading starts once two packets
+//  are queued, which absorbs the jitter between the owner's DPC and this
+//  one; an underrun fills the packet with silence and waits for two
+//  packets again, a backlog of more than MaxTapLagSamples is dropped.
+//  The caller holds m_ProducerLock, which makes it the ring's only
+//  consumer.
+//
 #pragma code_seg()
-_IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS CKeywordDetector::GetReadPacket
-(
-    _In_ ULONG PacketsPerWaveRtBuffer,
-    _In_ ULONG WaveRtBufferSize,
-    _Out_writes_(WaveRtBufferSize) BYTE *WaveRtBuffer,
-    _Out_ ULONG *PacketNumber,
-    _Out_ ULONG64 *PerformanceCounterValue,
-    _Out_ BOOL *MoreData
-)
+_IRQL_requires_min_(DISPATCH_LEVEL)
+_Requires_lock_held_(m_ProducerLock)
+VOID CKeywordDetector::ReadCaptureTap(_Out_writes_(SamplesPerPacket) UINT16 *Samples)
 {
-    NTSTATUS ntStatus;
-    BYTE *packetData;
-    PACKET_ENTRY *packetEntry;
-    LIST_ENTRY *packetListEntry = NULL;
-    ULONG packetSize = WaveRtBufferSize / PacketsPerWaveRtBuffer;
-
-    NT_ASSERT(SamplesPerPacket * 2 == packetSize);
-    NT_ASSERT(sizeof(packetEntry->Samples) == packetSize);
+    LONG consumed = m_lTapConsumed;
+    LONG produced = ReadAcquire(&m_lTapProduced);
+    ULONG queued = (ULONG)(produced - consumed);
 
-    packetListEntry = ExInterlockedRemoveHeadList(&PacketFifoHead, &PacketFifoSpinLock);
-    if (packetListEntry == NULL)
+    if (queued > (ULONG)MaxTapLagSamples)
     {
-        ntStatus = STATUS_DEVICE_NOT_READY;
-        goto Exit;
+        consumed = produced - 2 * SamplesPerPacket;
+        queued = 2 * SamplesPerPacket;
     }
-    packetEntry = CONTAINING_RECORD(packetListEntry, PACKET_ENTRY, ListEntry);
-
-    packetData = WaveRtBuffer + ((packetEntry->PacketNumber * packetSize) % WaveRtBufferSize);
 
-    ntStatus = RtlLongLongToULong(packetEntry->PacketNumber, PacketNumber);
-    if (!NT_SUCCESS(ntStatus))
+    if (queued >= 2 * (ULONG)SamplesPerPacket)
     {
-        goto Exit;
+        m_bTapPrimed = TRUE;
+    }
+    else if (queued < (ULONG)SamplesPerPacket)
+    {
+        m_bTapPrimed = FALSE;
     }
 
-    *PerformanceCounterValue = packetEntry->QpcWhenSampled;
-    *MoreData = !IsListEmpty(&PacketFifoHead);
-    RtlCopyMemory(packetData, packetEntry->Samples, sizeof(packetEntry->Samples));
-
-Exit:
-    if (packetListEntry != NULL)
+    if (!m_bTapPrimed)
     {
-        ExInterlockedInsertTailList(&PacketPoolHead, packetListEntry, &PacketPoolSpinLock);
+        RtlZeroMemory(Samples, SamplesPerPacket * sizeof(UINT16));
+    }
+    else
+    {
+        for (LONG i = 0; i < SamplesPerPacket; i++)
+        {
+            Samples[i] = (UINT16)m_pTapRing[(consumed + i) & (TapRingSamples - 1)];
+        }
+        consumed += SamplesPerPacket;
     }
 
+    // Hand the slots back after reading them.
+    WriteRelease(&m_lTapConsumed, consumed);
+}
+
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID CKeywordDetector::StartBufferingStream()
+{
+    LARGE_INTEGER qpc;
+    LARGE_INTEGER qpcFrequency;
+
+    PAGED_CODE();
+
+    NT_ASSERT(m_qpcStartCapture == 0);
+    NT_ASSERT(m_nNextReadPacket > m_nLastQueuedPacket);
+
+    qpc = KeQueryPerformanceCounter(&qpcFrequency);
+    m_qpcStartCapture = qpc.QuadPart;
+    m_qpcFrequency = qpcFrequency.QuadPart;
+
+    return;
+}
+
+//
+// GetPacketQpc()
+//
+//  Returns the QPC value at which the packet was sampled, read from its
+//  ring entry while the ring still holds it and computed from the packet
+//  clock otherwise (not yet produced, or already overwritten).
+//
+#pragma code_seg()
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONGLONG CKeywordDetector::GetPacketQpc(_In_ LONGLONG PacketNumber)
+{
+    if (PacketRing != NULL && PacketNumber >= 0)
+    {
+        PACKET_ENTRY *packetEntry = &PacketRing[PacketNumber % PacketCount];
+        LONGLONG qpc = ReadAcquire64(&packetEntry->QpcWhenSampled);
+        LONGLONG lastQueuedPacket = ReadAcquire64(&m_nLastQueuedPacket);
+
+        // Same rule as CopyPacket: the DPC may be rewriting the entry
+        // after the newest one.
+        if (PacketNumber <= lastQueuedPacket && lastQueuedPacket - PacketNumber < PacketCount - 1)
+        {
+            return (ULONGLONG)qpc;
+        }
+    }
+
+    return m_qpcStartCapture + (PacketNumber * m_qpcFrequency * SamplesPerPacket / SamplesPerSecond);
+}
+
+#pragma code_seg()
+_IRQL_requires_min_(DISPATCH_LEVEL)
+VOID CKeywordDetector::DpcRoutine(_In_ LONGLONG PerformanceCounter, _In_ LONGLONG PerformanceFrequency)
+{
+    LONGLONG currentPacket;
+    LONGLONG packetNumber;
+    BYTE *waveRtBuffer;
+    UINT16 *samples;
+
+    if (m_qpcStartCapture <= 0 || PacketRing == NULL)
+    {
+        return;
+    }
+
+    // Another stream's timer DPC is producing, it catches up to the
+    // current packet on its own.
+    if (!KeTryToAcquireSpinLockAtDpcLevel(&m_ProducerLock))
+    {
+        return;
+    }
+
+    // ResetFifo may have run since the check above.
+    if (m_qpcStartCapture <= 0)
+    {
+        KeReleaseSpinLockFromDpcLevel(&m_ProducerLock);
+        return;
+    }
+
+    currentPacket = (PerformanceCounter - m_qpcStartCapture) * (SamplesPerSecond / SamplesPerPacket) / PerformanceFrequency;
+    waveRtBuffer = (BYTE *)ReadPointerAcquire((PVOID *)&m_pWaveRtBuffer);
+
+    // Packets are published strictly in order, the reader relies on it to
+    // detect overwritten slots.
+    for (packetNumber = m_nLastQueuedPacket + 1; packetNumber <= currentPacket; packetNumber++)
+    {
+        PACKET_ENTRY*   packetEntry = &PacketRing[packetNumber % PacketCount];
+
+        // If the ring is full this overwrites the oldest packet, the reader
+        // notices and skips ahead.
+        packetEntry->PacketNumber = packetNumber;
+        packetEntry->QpcWhenSampled = m_qpcStartCapture + (packetNumber * PerformanceFrequency * SamplesPerPacket / SamplesPerSecond);
+
+        //
+        // Produce into the WaveRT buffer if the OS has read the packet that
+        // last used this slot; the packet returned by the last
+        // GetReadPacket may still be being read. Otherwise keep it in the
+        // history until GetReadPacket copies it over.
+        //
+        if (waveRtBuffer != NULL &&
+            packetNumber - (LONGLONG)m_ulPacketsPerWaveRtBuffer < ReadAcquire64(&m_nNextReadPacket) - 1)
+        {
+            samples = (UINT16 *)(waveRtBuffer + ((packetNumber * m_ulWaveRtPacketSize) % m_ulWaveRtBufferSize));
+            packetEntry->InWaveRtBuffer = TRUE;
+        }
+        else
+        {
+            samples = &packetEntry->Samples[0];
+            packetEntry->InWaveRtBuffer = FALSE;
+        }
+
+        ReadCaptureTap(samples);
+
+        if (IsAnyModelArmed())
+        {
+            RunDetection(packetNumber, samples);
+        }
+
+        // Publish the packet after its contents.
+        WriteRelease64(&m_nLastQueuedPacket, packetNumber);
+    }
+
+    KeReleaseSpinLockFromDpcLevel(&m_ProducerLock);
+}
+
+#pragma code_seg()
+_IRQL_requires_min_(DISPATCH_LEVEL)
+VOID CKeywordDetector::RunDetection(_In_ LONGLONG PacketNumber, _In_reads_(SamplesPerPacket) const UINT16 *Samples)
+{
+    C_ASSERT(SamplesPerPacket == KWFE_FRAME_SAMPLES);
+    C_ASSERT(SamplesPerSecond == KWFE_SAMPLE_RATE);
+
+    // Report one detection at a time.
+    if (m_lDetectedKeyword != 0)
+    {
+        return;
+    }
+
+    if (!m_FrontEnd.ProcessPacket((const short *)Samples, m_Features))
+    {
+        // Not speech, a keyword can't span the gap.
+        for (LONG i = 0; i < MaxKeywordModels; i++)
+        {
+            m_Models[i].Matcher.Reset();
+        }
+        return;
+    }
+
+    KEYWORD_IMAGE *image = (KEYWORD_IMAGE *)ReadPointerAcquire((PVOID *)&m_pActiveImage);
+    if (image == NULL)
+    {
+        return;
+    }
+
+    if (image != m_pScoredImage)
+    {
+        // A different model was downloaded, paths through the old
+        // templates mean nothing against the new ones.
+        for (LONG i = 0; i < MaxKeywordModels; i++)
+        {
+            m_Models[i].Matcher.Reset();
+        }
+        m_pScoredImage = image;
+    }
+
+    // One pass over the codebook serves every armed model.
+    m_Scorer.Score(&image->Codebook, m_Features);
+
+    const unsigned int *distances = m_Scorer.GetDistances();
+    unsigned int bestScore = 0xFFFFFFFF;
+    unsigned int matchedStart = 0;
+    LONG detected = 0;
+
+    for (ULONG k = 0; k < image->KeywordCount; k++)
+    {
+        LONG slot = image->Slots[k];
+        KEYWORD_MODEL *model = &m_Models[slot];
+        const KWFE_TEMPLATE *keywordTemplate = &image->Templates[k];
+
+        if (!model->Armed)
+        {
+            continue;
+        }
+
+        // Of several models matching on the same packet, report the
+        // closest one.
+        if (model->Matcher.Push(keywordTemplate, distances, keywordTemplate->Threshold, (unsigned int)PacketNumber) &&
+            model->Matcher.GetLastScore() < bestScore)
+        {
+            bestScore = model->Matcher.GetLastScore();
+            matchedStart = model->Matcher.GetLastStart();
+            detected = slot + 1;
+        }
+    }
+
+    if (detected != 0)
+    {
+        // The keyword spans the packets on the matching path, from the
+        // first one aligned to the template through this one.
+        m_nKeywordStopPacket = PacketNumber;
+        m_nKeywordStartPacket = PacketNumber - (LONGLONG)((unsigned int)PacketNumber - matchedStart);
+        InterlockedExchange(&m_lDetectedKeyword, detected);
+    }
+}
+
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+BOOL CKeywordDetector::TakeDetection(_Out_ GUID *EventId)
+{
+    PAGED_CODE();
+
+    LONG detected = InterlockedExchange(&m_lDetectedKeyword, 0);
+
+    if (detected == 0)
+    {
+        return FALSE;
+    }
+
+    *EventId = m_Models[detected - 1].EventId;
+
+    // From the start of the first matching packet to the end of the last.
+    m_ullKeywordStartTimestamp = GetPacketQpc(m_nKeywordStartPacket);
+    m_ullKeywordStopTimestamp = GetPacketQpc(m_nKeywordStopPacket) + (m_qpcFrequency * SamplesPerPacket / SamplesPerSecond);
+
+    return TRUE;
+}
+
+//
+// Checks that every section of a compiled model lies within the image and
+// that every template only uses codewords the codebook has.
+//
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS CKeywordDetector::ValidateKeywordModel(_In_reads_bytes_(ImageSize) const BYTE *Image, _In_ ULONG ImageSize)
+{
+    PAGED_CODE();
+
+    const CONTOSO_KEYWORDMODEL_HEADER *header = (const CONTOSO_KEYWORDMODEL_HEADER *)Image;
+    const CONTOSO_KEYWORDMODEL_KEYWORD *keywords;
+
+    C_ASSERT(CONTOSO_KEYWORDMODEL_BANDS == KWFE_MEL_BANDS);
+    C_ASSERT(CONTOSO_KEYWORDMODEL_MAX_CODEWORDS == KWFE_MAX_CODEWORDS);
+    C_ASSERT(CONTOSO_KEYWORDMODEL_MAX_FRAMES == KWFE_MAX_TEMPLATE_FRAMES);
+    C_ASSERT(CONTOSO_KEYWORDMODEL_MAX_KEYWORDS == MaxKeywordModels);
+    C_ASSERT(CONTOSO_KEYWORDMODEL_LOADED_IMAGES == MaxCachedKeywordImages);
+
+    if (ImageSize < sizeof(*header) ||
+        header->Signature != CONTOSO_KEYWORDMODEL_SIGNATURE ||
+        header->Version != CONTOSO_KEYWORDMODEL_VERSION ||
+        header->ImageSize != ImageSize)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (header->CodewordCount == 0 ||
+        header->CodewordCount > CONTOSO_KEYWORDMODEL_MAX_CODEWORDS ||
+        header->CodebookOffset % CONTOSO_KEYWORDMODEL_ALIGNMENT != 0 ||
+        (ULONGLONG)header->CodebookOffset + (ULONGLONG)header->CodewordCount * CONTOSO_KEYWORDMODEL_BANDS * sizeof(SHORT) > ImageSize)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (header->KeywordCount == 0 ||
+        header->KeywordCount > CONTOSO_KEYWORDMODEL_MAX_KEYWORDS ||
+        header->KeywordsOffset % CONTOSO_KEYWORDMODEL_ALIGNMENT != 0 ||
+        (ULONGLONG)header->KeywordsOffset + (ULONGLONG)header->KeywordCount * sizeof(CONTOSO_KEYWORDMODEL_KEYWORD) > ImageSize)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    keywords = (const CONTOSO_KEYWORDMODEL_KEYWORD *)(Image + header->KeywordsOffset);
+
+    for (ULONG k = 0; k < header->KeywordCount; k++)
+    {
+        const BYTE *codes = Image + keywords[k].CodesOffset;
+
+        if (keywords[k].EventId == GUID_NULL ||
+            keywords[k].FrameCount == 0 ||
+            keywords[k].FrameCount > CONTOSO_KEYWORDMODEL_MAX_FRAMES ||
+            (ULONGLONG)keywords[k].CodesOffset + keywords[k].FrameCount > ImageSize)
+        {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        for (ULONG j = 0; j < k; j++)
+        {
+            if (keywords[j].EventId == keywords[k].EventId)
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+        }
+
+        for (ULONG i = 0; i < keywords[k].FrameCount; i++)
+        {
+            if (codes[i] >= header->CodewordCount)
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// LoadKeywordModel()
+//
+//  Makes a compiled model the one the DPC scores against. A model that is
+//  already loaded, recognized by its ModelId and size, is not copied or
+//  checked again; activating it is a pointer swap. Image may be NULL when
+//  the caller expects the model to be loaded, STATUS_NOT_FOUND tells it
+//  to send the image. Up to MaxCachedKeywordImages images stay loaded,
+//  the least recently used one that is not active is freed to make room.
+//
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS CKeywordDetector::LoadKeywordModel(_In_ REFGUID ModelId, _In_reads_bytes_opt_(ImageSize) const BYTE *Image, _In_ ULONG ImageSize)
+{
+    PAGED_CODE();
+
+    const CONTOSO_KEYWORDMODEL_HEADER *header = (const CONTOSO_KEYWORDMODEL_HEADER *)Image;
+    const CONTOSO_KEYWORDMODEL_KEYWORD *keywords;
+    KEYWORD_IMAGE *image = NULL;
+    BYTE *imageCopy;
+    BOOL cached = FALSE;
+    LARGE_INTEGER qpcStart;
+    LARGE_INTEGER qpcFrequency;
+    NTSTATUS ntStatus = STATUS_SUCCESS;
+
+    if (Image != NULL && ImageSize < sizeof(*header))
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    qpcStart = KeQueryPerformanceCounter(&qpcFrequency);
+
+    KeWaitForSingleObject(&m_KeywordImagesLock, Executive, KernelMode, FALSE, NULL);
+
+    for (PLIST_ENTRY le = m_KeywordImages.Flink; le != &m_KeywordImages; le = le->Flink)
+    {
+        KEYWORD_IMAGE *candidate = CONTAINING_RECORD(le, KEYWORD_IMAGE, ListEntry);
+
+        if (candidate->ModelId == ModelId && candidate->ImageSize == ImageSize)
+        {
+            image = candidate;
+            break;
+        }
+    }
+
+    if (image != NULL)
+    {
+        // Most recently used first.
+        RemoveEntryList(&image->ListEntry);
+        InsertHeadList(&m_KeywordImages, &image->ListEntry);
+        cached = TRUE;
+    }
+    else if (Image == NULL)
+    {
+        // Evicted, or loaded before the driver restarted.
+        ntStatus = STATUS_NOT_FOUND;
+        goto Done;
+    }
+    else
+    {
+        image = (KEYWORD_IMAGE *)ExAllocatePool2(POOL_FLAG_NON_PAGED,
+                                                 ALIGN_UP_BY(sizeof(KEYWORD_IMAGE), CONTOSO_KEYWORDMODEL_ALIGNMENT) + ImageSize,
+                                                 MINWAVERT_POOLTAG);
+        if (image == NULL)
+        {
+            ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+
+        //
+        // Validate the copy, the caller's buffer can change after it is
+        // checked.
+        //
+        imageCopy = (BYTE *)image + ALIGN_UP_BY(sizeof(KEYWORD_IMAGE), CONTOSO_KEYWORDMODEL_ALIGNMENT);
+        RtlCopyMemory(imageCopy, Image, ImageSize);
+
+        ntStatus = ValidateKeywordModel(imageCopy, ImageSize);
+        if (NT_SUCCESS(ntStatus) && ((const CONTOSO_KEYWORDMODEL_HEADER *)imageCopy)->ModelId != ModelId)
+        {
+            ntStatus = STATUS_INVALID_PARAMETER;
+        }
+        if (!NT_SUCCESS(ntStatus))
+        {
+            ExFreePoolWithTag(image, MINWAVERT_POOLTAG);
+            image = NULL;
+            goto Done;
+        }
+
+        if (m_ulKeywordImages >= MaxCachedKeywordImages)
+        {
+            KEYWORD_IMAGE *active = (KEYWORD_IMAGE *)ReadPointerAcquire((PVOID *)&m_pActiveImage);
+
+            for (PLIST_ENTRY le = m_KeywordImages.Blink; le != &m_KeywordImages; le = le->Blink)
+            {
+                KEYWORD_IMAGE *victim = CONTAINING_RECORD(le, KEYWORD_IMAGE, ListEntry);
+
+                if (victim != active)
+                {
+                    RemoveEntryList(&victim->ListEntry);
+                    m_ulKeywordImages--;
+
+                    // A DPC that read the image before it was replaced may
+                    // still be scoring against it.
+                    KeFlushQueuedDpcs();
+                    if (m_pScoredImage == victim)
+                    {
+                        m_pScoredImage = NULL;
+                    }
+
+                    ExFreePoolWithTag(victim, MINWAVERT_POOLTAG);
+                    break;
+                }
+            }
+        }
+
+        //
+        // The image is used in place, only the pointers into it are set up.
+        //
+        header = (const CONTOSO_KEYWORDMODEL_HEADER *)imageCopy;
+        keywords = (const CONTOSO_KEYWORDMODEL_KEYWORD *)(imageCopy + header->KeywordsOffset);
+
+        image->Image = imageCopy;
+        image->ModelId = header->ModelId;
+        image->ImageSize = ImageSize;
+        image->KeywordCount = header->KeywordCount;
+        image->Codebook.Count = header->CodewordCount;
+        image->Codebook.Frames = (const short *)(imageCopy + header->CodebookOffset);
+
+        for (ULONG k = 0; k < header->KeywordCount; k++)
+        {
+            image->Templates[k].FrameCount = keywords[k].FrameCount;
+            image->Templates[k].Threshold = keywords[k].Threshold;
+            image->Templates[k].Codes = imageCopy + keywords[k].CodesOffset;
+        }
+
+        InsertHeadList(&m_KeywordImages, &image->ListEntry);
+        m_ulKeywordImages++;
+    }
+
+    header = (const CONTOSO_KEYWORDMODEL_HEADER *)image->Image;
+    keywords = (const CONTOSO_KEYWORDMODEL_KEYWORD *)(image->Image + header->KeywordsOffset);
+
+    //
+    // Give every keyword of the image a model slot. Slots of keywords the
+    // image no longer has are freed unless they are armed.
+    //
+    for (LONG i = 2; i < MaxKeywordModels; i++)
+    {
+        BOOL inImage = FALSE;
+
+        for (ULONG k = 0; k < image->KeywordCount; k++)
+        {
+            if (keywords[k].EventId == m_Models[i].EventId)
+            {
+                inImage = TRUE;
+                break;
+            }
+        }
+
+        if (!inImage && !m_Models[i].Armed)
+        {
+            m_Models[i].Data = 0;
+            m_Models[i].EventId = GUID_NULL;
+        }
+    }
+
+    for (ULONG k = 0; k < image->KeywordCount; k++)
+    {
+        LONG slot = FindModel(keywords[k].EventId, TRUE);
+
+        if (slot < 0)
+        {
+            ntStatus = STATUS_INSUFFICIENT_RESOURCES;
+            goto Done;
+        }
+
+        // Only differs from what the DPC may be reading if the image is
+        // not the active one.
+        image->Slots[k] = slot;
+    }
+
+    WritePointerRelease((PVOID *)&m_pActiveImage, image);
+
+Done:
+    KeReleaseMutex(&m_KeywordImagesLock, FALSE);
+
+    DPF(D_VERBOSE, ("LoadKeywordModel: %s %lu byte model in %I64d us, status 0x%x",
+        cached ? "activated cached" : (Image != NULL) ? "loaded" : "did not find",
+        ImageSize,
+        (KeQueryPerformanceCounter(NULL).QuadPart - qpcStart.QuadPart) * 1000000 / qpcFrequency.QuadPart,
+        ntStatus));
+
+    return ntStatus;
+}
+
+#pragma code_seg()
+_IRQL_requires_max_(PASSIVE_LEVEL)
+BOOL CKeywordDetector::CopyPacket
+(
+    _In_ LONGLONG PacketNumber,
+    _In_ ULONG PacketSize,
+    _In_ ULONG WaveRtBufferSize,
+    _Out_writes_(WaveRtBufferSize) BYTE *WaveRtBuffer,
+    _Out_ ULONGLONG *PerformanceCount
+)
+{
+    PACKET_ENTRY *packetEntry = &PacketRing[PacketNumber % PacketCount];
+    BYTE *packetData = WaveRtBuffer + ((PacketNumber * PacketSize) % WaveRtBufferSize);
+
+    *PerformanceCount = packetEntry->QpcWhenSampled;
+    if (!packetEntry->InWaveRtBuffer)
+    {
+        RtlCopyMemory(packetData, packetEntry->Samples, sizeof(packetEntry->Samples));
+    }
+
+    // The DPC may have started on this slot while it was being copied,
+    // in which case the copy is torn.
+    return (ReadAcquire64(&m_nLastQueuedPacket) - PacketNumber < PacketCount - 1);
+}
+
+#pragma code_seg()
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS CKeywordDetector::GetReadPacket
+(
+    _In_ ULONG PacketsPerWaveRtBuffer,
+    _In_ ULONG WaveRtBufferSize,
+    _Out_writes_(WaveRtBufferSize) BYTE *WaveRtBuffer,
+    _Out_ ULONG *PacketNumber,
+    _Out_ ULONG64 *PerformanceCounterValue,
+    _Out_ BOOL *MoreData
+)
+{
+    NTSTATUS ntStatus;
+    LONGLONG packetNumber;
+    LONGLONG lastQueuedPacket;
+    LONGLONG burstEnd;
+    ULONG packetSize = WaveRtBufferSize / PacketsPerWaveRtBuffer;
+
+    NT_ASSERT(SamplesPerPacket * 2 == packetSize);
+    NT_ASSERT(sizeof(PacketRing->Samples) == packetSize);
+
+    if (PacketRing == NULL)
+    {
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    packetNumber = m_nNextReadPacket;
+
+    if (packetNumber <= m_nFilledThroughPacket)
+    {
+        //
+        // Copied by an earlier burst, only report it.
+        //
+        *PerformanceCounterValue = m_BurstQpc[packetNumber % MaxBurstPackets];
+    }
+    else
+    {
+        for (;;)
+        {
+            lastQueuedPacket = ReadAcquire64(&m_nLastQueuedPacket);
+            if (packetNumber > lastQueuedPacket)
+            {
+                return STATUS_DEVICE_NOT_READY;
+            }
+
+            // Overrun, the oldest packets have been overwritten. Skip to the
+            // oldest one the DPC is not about to overwrite next.
+            if (lastQueuedPacket - packetNumber >= PacketCount - 1)
+            {
+                m_nOverrunPackets += lastQueuedPacket - PacketCount + 2 - packetNumber;
+                packetNumber = lastQueuedPacket - PacketCount + 2;
+            }
+
+            if (CopyPacket(packetNumber, packetSize, WaveRtBufferSize, WaveRtBuffer, PerformanceCounterValue))
+            {
+                break;
+            }
+        }
+
+        m_nFilledThroughPacket = packetNumber;
+
+        //
+        // Burst: while draining history, also fill the following WaveRT
+        // packets now. The OS has already read those slots, the one being
+        // returned is never overwritten.
+        //
+        burstEnd = packetNumber + min(m_ulBurstPackets, PacketsPerWaveRtBuffer) - 1;
+        while (m_nFilledThroughPacket < burstEnd)
+        {
+            LONGLONG nextPacket = m_nFilledThroughPacket + 1;
+            ULONGLONG qpc;
+
+            if (nextPacket > ReadAcquire64(&m_nLastQueuedPacket) ||
+                !CopyPacket(nextPacket, packetSize, WaveRtBufferSize, WaveRtBuffer, &qpc))
+            {
+                break;
+            }
+
+            m_BurstQpc[nextPacket % MaxBurstPackets] = qpc;
+            m_nFilledThroughPacket = nextPacket;
+        }
+    }
+
+    m_llLastReadLatency = KeQueryPerformanceCounter(NULL).QuadPart - (LONGLONG)*PerformanceCounterValue;
+
+    WriteRelease64(&m_nNextReadPacket, packetNumber + 1);
+    *MoreData = (packetNumber < m_nFilledThroughPacket) || (packetNumber < ReadAcquire64(&m_nLastQueuedPacket));
+
+    ntStatus = RtlLongLongToULong(packetNumber, PacketNumber);
+
     return ntStatus;
 }
 
@@ -15,6 +15,10 @@ Abstract:
 #ifndef _SYSVAD_MINWAVERT_H_
 #define _SYSVAD_MINWAVERT_H_
 
+#include "SharedToneSource.h"
+#include "KeywordFrontEnd.h"
+#include "KeywordDecimator.h"
+
 #ifdef SYSVAD_BTH_BYPASS
 #include "bthhfpmicwavtable.h"
 #endif // SYSVAD_BTH_BYPASS
@@ -38,6 +42,10 @@ class CKeywordDetector
 {
 public:
     CKeywordDetector();
+    ~CKeywordDetector();
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    NTSTATUS Init();
 
     _IRQL_requires_max_(PASSIVE_LEVEL)
     NTSTATUS ResetDetector(_In_ GUID eventId);
@@ -58,7 +66,7 @@ public:
     NTSTATUS SetArmed(_In_ GUID eventId, _In_ BOOL Arm);
 
     _IRQL_requires_max_(PASSIVE_LEVEL)
-    VOID NotifyDetection();
+    VOID DisarmDetected(_In_ GUID eventId);
 
     _IRQL_requires_max_(PASSIVE_LEVEL)
     NTSTATUS GetArmed(_In_ GUID eventId, _Out_ BOOL *Arm);
@@ -72,61 +80,205 @@ public:
     _IRQL_requires_max_(PASSIVE_LEVEL)
     VOID Stop();
 
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    VOID AttachWaveRtBuffer(_In_ ULONG PacketsPerWaveRtBuffer, _In_ ULONG WaveRtBufferSize, _In_reads_(WaveRtBufferSize) BYTE *WaveRtBuffer);
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    NTSTATUS AttachCaptureTap(_In_ PVOID Owner, _In_ PWAVEFORMATEXTENSIBLE WfExt);
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    VOID DetachCaptureTap(_In_ PVOID Owner);
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    VOID WriteCaptureTap(_In_ PVOID Owner, _In_reads_bytes_(Length) const BYTE *Data, _In_ ULONG Length);
+
     _IRQL_requires_min_(DISPATCH_LEVEL)
     VOID DpcRoutine(_In_ LONGLONG PerformanceCounter, _In_ LONGLONG PerformanceFrequency);
 
+    BOOL IsDetectionPending()
+    {
+        return m_lDetectedKeyword != 0;
+    }
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    BOOL TakeDetection(_Out_ GUID *EventId);
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    NTSTATUS LoadKeywordModel(_In_ REFGUID ModelId, _In_reads_bytes_opt_(ImageSize) const BYTE *Image, _In_ ULONG ImageSize);
+
     _IRQL_requires_max_(PASSIVE_LEVEL)
     NTSTATUS GetReadPacket(_In_ ULONG PacketsPerWaveRtBuffer, _In_  ULONG WaveRtBufferSize, _Out_writes_(WaveRtBufferSize) BYTE *WaveRtBuffer, _Out_ ULONG *PacketNumber, _Out_ ULONGLONG *PerformanceCount, _Out_ BOOL *MoreData);
 
 private:
-    _IRQL_requires_max_(PASSIVE_LEVEL)
+    _IRQL_requires_max_(DISPATCH_LEVEL)
     VOID ResetFifo();
 
     _IRQL_requires_max_(PASSIVE_LEVEL)
-    NTSTATUS ReadKeywordTimestampRegistry();
+    VOID StartBufferingStream();
 
     _IRQL_requires_max_(PASSIVE_LEVEL)
-    VOID StartBufferingStream();
+    LONG FindModel(_In_ GUID eventId, _In_ BOOL Add);
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    BOOL IsAnyModelArmed();
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    ULONGLONG GetPacketQpc(_In_ LONGLONG PacketNumber);
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    static NTSTATUS ValidateKeywordModel(_In_reads_bytes_(ImageSize) const BYTE *Image, _In_ ULONG ImageSize);
+
+    _IRQL_requires_min_(DISPATCH_LEVEL)
+    _Requires_lock_held_(m_ProducerLock)
+    VOID ReadCaptureTap(_Out_writes_(SamplesPerPacket) UINT16 *Samples);
+
+    _IRQL_requires_min_(DISPATCH_LEVEL)
+    VOID RunDetection(_In_ LONGLONG PacketNumber, _In_reads_(SamplesPerPacket) const UINT16 *Samples);
+
+    _IRQL_requires_max_(PASSIVE_LEVEL)
+    BOOL CopyPacket(_In_ LONGLONG PacketNumber, _In_ ULONG PacketSize, _In_ ULONG WaveRtBufferSize, _Out_writes_(WaveRtBufferSize) BYTE *WaveRtBuffer, _Out_ ULONGLONG *PerformanceCount);
 
     // The Contoso keyword detector processes 10ms packets of 16KHz 16-bit PCM
     // audio samples
     static const int SamplesPerSecond = 16000;
     static const int SamplesPerPacket = (10 * SamplesPerSecond / 1000);
 
-    typedef struct
+    // History depth limits, the depth itself comes from KeywordHistoryMs.
+    static const int MinHistoryMs = 1000;
+    static const int MaxHistoryMs = 10000;
+
+    // Most packets a single GetReadPacket call copies, see KeywordBurstPackets.
+    static const int MaxBurstPackets = 16;
+
+    // Keyword models that can be configured at the same time.
+    static const int MaxKeywordModels = 32;
+
+    // Compiled model images kept loaded, see LoadKeywordModel.
+    static const int MaxCachedKeywordImages = 4;
+
+    // Capture tap ring, a power of two of 16 kHz samples, and the most it
+    // may lag the producer before DpcRoutine drops the backlog.
+    static const LONG TapRingSamples = 4096;
+    static const LONG MaxTapLagSamples = 8 * SamplesPerPacket;
+
+    // Packets are padded to whole cache lines so the DPC filling one packet
+    // never shares a line with the packet being read.
+    typedef struct DECLSPEC_CACHEALIGN
     {
-        LIST_ENTRY  ListEntry;
         LONGLONG    PacketNumber;
         LONGLONG    QpcWhenSampled;
+        BOOL        InWaveRtBuffer;             // Samples were produced into the WaveRT buffer, not here.
         UINT16      Samples[SamplesPerPacket];
     } PACKET_ENTRY;
 
+    // One keyword model, found by its event id. CONTOSO_KEYWORD1 and
+    // CONTOSO_KEYWORD2 always own the first two slots.
+    typedef struct
+    {
+        GUID                    EventId;        // GUID_NULL if the slot is free.
+        BOOL                    Armed;
+        LONGLONG                Data;
+        KeywordMatcher          Matcher;
+    } KEYWORD_MODEL;
+
+    // A validated copy of a compiled model image, followed in the same
+    // allocation by the image itself. The codebook and templates point
+    // into the image.
+    typedef struct
+    {
+        LIST_ENTRY              ListEntry;
+        const BYTE *            Image;
+        GUID                    ModelId;
+        ULONG                   ImageSize;
+        ULONG                   KeywordCount;
+        KWFE_CODEBOOK           Codebook;
+        KWFE_TEMPLATE           Templates[MaxKeywordModels];
+        LONG                    Slots[MaxKeywordModels];    // m_Models index of each keyword.
+    } KEYWORD_IMAGE;
+
     BOOL            m_streamRunning;
 
-    BOOL            m_SoundDetectorArmed1;
-    BOOL            m_SoundDetectorArmed2;
-    LONGLONG        m_SoundDetectorData1;
-    LONGLONG        m_SoundDetectorData2;
+    KEYWORD_MODEL   m_Models[MaxKeywordModels];
 
     LONGLONG        m_qpcStartCapture;
     LONGLONG        m_qpcFrequency;
-    LONGLONG        m_nLastQueuedPacket;
 
     ULONGLONG       m_ullKeywordStartTimestamp;
     ULONGLONG       m_ullKeywordStopTimestamp;
 
-    KSPIN_LOCK      PacketPoolSpinLock;
-    LIST_ENTRY      PacketPoolHead;
-    PACKET_ENTRY    PacketPool[1 * SamplesPerSecond / SamplesPerPacket];    // Enough storage for 1 second of audio data
-
-    KSPIN_LOCK      PacketFifoSpinLock;
-    LIST_ENTRY      PacketFifoHead;
+    // Single producer (DpcRoutine), single consumer (GetReadPacket) ring
+    // indexed by packet number. Each index is written by one side only and
+    // lives on its own cache line. Every stream's timer DPC calls
+    // DpcRoutine; m_ProducerLock keeps it to one processor at a time, a
+    // DPC that finds it held leaves the packets to the one holding it.
+    KSPIN_LOCK      m_ProducerLock;
+    DECLSPEC_CACHEALIGN
+    volatile LONGLONG m_nLastQueuedPacket;      // Producer: last packet published.
+    DECLSPEC_CACHEALIGN
+    volatile LONGLONG m_nNextReadPacket;        // Consumer: next packet to read.
+    PACKET_ENTRY *  PacketRing;                 // Cache aligned, PacketCount entries.
+    LONGLONG        PacketCount;
+
+    // Packets GetReadPacket already copied into the WaveRT buffer ahead of
+    // the OS asking for them, and their timestamps.
+    LONGLONG        m_nFilledThroughPacket;
+    ULONGLONG       m_BurstQpc[MaxBurstPackets];
+    ULONG           m_ulBurstPackets;
+
+    // Consumer side counters, reported when the stream stops: packets the
+    // reader skipped on overrun, and how long the last packet read had
+    // been queued, in QPC ticks.
+    LONGLONG        m_nOverrunPackets;
+    LONGLONG        m_llLastReadLatency;
+
+    // WaveRT buffer of the running keyword stream, if any. While attached
+    // the DPC produces samples straight into it whenever the packet's slot
+    // has been read by the OS, the ring samples only hold the history.
+    BYTE * volatile m_pWaveRtBuffer;
+    ULONG           m_ulWaveRtBufferSize;
+    ULONG           m_ulWaveRtPacketSize;
+    ULONG           m_ulPacketsPerWaveRtBuffer;
+
+    // Loaded images, most recently used first. Downloading an image that
+    // is already loaded only swaps m_pActiveImage.
+    LIST_ENTRY              m_KeywordImages;
+    ULONG                   m_ulKeywordImages;
+    KMUTEX                  m_KeywordImagesLock;
+    KEYWORD_IMAGE * volatile m_pActiveImage;
+
+    // Detection pipeline, run by the DPC on every packet while any model
+    // is armed. Features and codeword distances are computed once and
+    // shared by all armed models.
+    KeywordFrontEnd         m_FrontEnd;
+    KeywordScorer           m_Scorer;
+    KEYWORD_IMAGE *         m_pScoredImage;         // DPC only, the image the matchers follow.
+    short                   m_Features[KWFE_MEL_BANDS];
+    volatile LONG           m_lDetectedKeyword;     // Model index + 1 once detected, 0 otherwise.
+    LONGLONG                m_nKeywordStartPacket;
+    LONGLONG                m_nKeywordStopPacket;
+
+    // Host capture stream feeding the detector, see AttachCaptureTap. The
+    // owner's DPC decimates into the ring, DpcRoutine takes a packet out
+    // whenever it produces one. Single producer, single consumer: the
+    // host capture and keyword timers both run DpcRoutine, only the one
+    // holding m_ProducerLock reads the ring.
+    PVOID volatile          m_pTapOwner;
+    KeywordDecimator        m_Decimator;            // Owner only.
+    short *                 m_pTapCoefficients;
+    short *                 m_pTapRing;             // TapRingSamples samples.
+    BOOL                    m_bTapPrimed;           // Under m_ProducerLock, the ring is two packets deep.
+    DECLSPEC_CACHEALIGN
+    volatile LONG           m_lTapProduced;         // Producer: samples written.
+    DECLSPEC_CACHEALIGN
+    volatile LONG           m_lTapConsumed;         // Consumer: samples read.
 
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 // CMiniportWaveRT
 //   
+IO_WORKITEM_ROUTINE KeywordDetectionWorkItemCallback;
+
 #pragma code_seg()
 class CMiniportWaveRT : 
     public IMiniportWaveRT,
@@ -168,6 +320,13 @@ private:
     CONSTRICTOR_OPTION                  m_LoopbackProtection;
 
     CKeywordDetector                    m_KeywordDetector;
+    PIO_WORKITEM                        m_pKeywordDetectionWorkItem;
+    volatile LONG                       m_lKeywordDetectionQueued;
+
+    // Capture tone sources shared by streams with the same pin, format
+    // and tone settings.
+    LIST_ENTRY                          m_SharedToneSources;
+    KMUTEX                              m_SharedToneSourcesLock;
 
     union {
         PVOID                           m_DeviceContext;
@@ -232,6 +391,19 @@ public:
         _In_ PCMiniportWaveRTStream _Stream
     );
     
+    NTSTATUS AcquireSharedToneSource
+    (
+        _In_  ULONG                     _Pin,
+        _In_  PSHARED_TONE_PARAMETERS   _ToneParameters,
+        _In_  PWAVEFORMATEXTENSIBLE     _WfExt,
+        _Out_ PSharedToneSource *       _ppSource
+    );
+
+    VOID ReleaseSharedToneSource
+    (
+        _In_  PSharedToneSource         _Source
+    );
+
     NTSTATUS IsFormatSupported
     ( 
         _In_ ULONG          _ulPin, 
@@ -300,7 +472,9 @@ public:
         m_DeviceFlags(MiniportPair->DeviceFlags),
         m_pMiniportPair(MiniportPair),
         m_pAudioModules(NULL),
-        m_pPortClsNotifications(NULL)
+        m_pPortClsNotifications(NULL),
+        m_pKeywordDetectionWorkItem(NULL),
+        m_lKeywordDetectionQueued(0)
     {
         PAGED_CODE();
 
@@ -376,6 +550,9 @@ public:
 
         KeInitializeSpinLock(&m_DeviceFormatsAndModesLock);
         m_DeviceFormatsAndModesIrql = PASSIVE_LEVEL;
+
+        InitializeListHead(&m_SharedToneSources);
+        KeInitializeMutex(&m_SharedToneSourcesLock, 1);
     }
 
 #pragma code_seg()
@@ -389,6 +566,7 @@ public:
     // Friends
     friend class        CMiniportWaveRTStream;
     friend class        CMiniportTopologySimple;
+    friend IO_WORKITEM_ROUTINE KeywordDetectionWorkItemCallback;
     
     friend NTSTATUS PropertyHandler_WaveFilter
     (   
@@ -399,8 +577,16 @@ public:
     VOID DpcRoutine(LONGLONG PerformanceCounter, LONGLONG PerformanceFrequency)
     {
         m_KeywordDetector.DpcRoutine(PerformanceCounter, PerformanceFrequency);
+        if (m_KeywordDetector.IsDetectionPending())
+        {
+            QueueKeywordDetection();
+        }
     }
 
+    VOID QueueKeywordDetection();
+
+    VOID ProcessKeywordDetection();
+
     NTSTATUS PropertyHandlerEffectListRequest
     (
         _In_ PPCPROPERTY_REQUEST PropertyRequest
@@ -44,6 +44,18 @@ Return Value:
             m_AudioModuleCount = 0;
         }
     
+        if (m_pSharedToneSource)
+        {
+            m_pMiniport->ReleaseSharedToneSource(m_pSharedToneSource);
+            m_pSharedToneSource = NULL;
+        }
+
+        if (m_bCaptureTapAttached)
+        {
+            m_bCaptureTapAttached = FALSE;
+            m_pMiniport->m_KeywordDetector.DetachCaptureTap(this);
+        }
+
         if (m_bUnregisterStream)
         {
             m_pMiniport->StreamClosed(m_ulPin, this);
@@ -89,6 +101,9 @@ Return Value:
         ExFreePoolWithTag( m_pWfExt, MINWAVERTSTREAM_POOLTAG );
         m_pWfExt = NULL;
     }
+
+    // Allocated by RtlQueryRegistryValues.
+    RtlFreeUnicodeString(&m_HostCaptureReplayFile);
     if (m_pNotificationTimer)
     {
         ExDeleteTimer
@@ -133,6 +148,7 @@ NTSTATUS CMiniportWaveRTStream::ReadRegistrySettings()
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"LoopbackCaptureToneDCOffset",     &m_dwLoopbackCaptureToneDCOffset,       (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD,  &m_dwLoopbackCaptureToneDCOffset,           sizeof(DWORD) },
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"HostCaptureToneInitialPhase",     &m_dwHostCaptureToneInitialPhase,       (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD,  &m_dwHostCaptureToneInitialPhase,           sizeof(DWORD) },
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"LoopbackCaptureToneInitialPhase", &m_dwLoopbackCaptureToneInitialPhase,   (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD,  &m_dwLoopbackCaptureToneInitialPhase,       sizeof(DWORD) },
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"HostCaptureReplayFile",           &m_HostCaptureReplayFile,               (REG_SZ << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_NONE,      NULL,                                       0 },
         { NULL,   0,                                                        NULL,                               NULL,                                   0,                                                              NULL,                                       0 }
     };
 
@@ -250,6 +266,11 @@ Return Value:
     m_dwLoopbackCaptureToneDCOffset = 0; 
     m_dwHostCaptureToneInitialPhase = 0; 
     m_dwLoopbackCaptureToneInitialPhase = 0; 
+    m_bUseReplaySource = FALSE;
+    m_pSharedToneSource = NULL;
+    m_ullSharedToneSourcePosition = 0;
+    m_bCaptureTapAttached = FALSE;
+    RtlInitUnicodeString(&m_HostCaptureReplayFile, NULL);
 
 
 #if defined(SYSVAD_BTH_BYPASS) || defined(SYSVAD_USB_SIDEBAND)
@@ -405,6 +426,47 @@ Return Value:
         {
             return ntStatus;
         }
+
+        //
+        // Host capture pins replay a file instead of the tone when one is
+        // configured. Fall back to the tone if the file cannot be used.
+        //
+        if (!m_pMiniport->IsLoopbackPin(Pin_) && m_HostCaptureReplayFile.Length != 0)
+        {
+            NTSTATUS replayStatus = m_ReplaySource.Init(&m_HostCaptureReplayFile, m_pWfExt);
+            if (NT_SUCCESS(replayStatus))
+            {
+                m_bUseReplaySource = TRUE;
+            }
+            else
+            {
+                DPF(D_TERSE, ("Capture replay disabled, 0x%x", replayStatus));
+            }
+        }
+
+        //
+        // Host capture streams with the same format and tone settings share
+        // one rendered tone. Keep the private generator if this fails.
+        //
+        if (!m_pMiniport->IsLoopbackPin(Pin_) && !m_bUseReplaySource)
+        {
+            SHARED_TONE_PARAMETERS toneParameters;
+
+            toneParameters.Frequency    = toneFrequency;
+            toneParameters.Amplitude    = toneAmplitudeDouble;
+            toneParameters.DCOffset     = toneDCOffsetDouble;
+            toneParameters.InitialPhase = toneInitialPhaseDouble;
+
+            NTSTATUS sharedStatus = m_pMiniport->AcquireSharedToneSource(Pin_, &toneParameters, m_pWfExt, &m_pSharedToneSource);
+            if (NT_SUCCESS(sharedStatus))
+            {
+                m_ullSharedToneSourcePosition = m_pSharedToneSource->GetAttachPosition();
+            }
+            else
+            {
+                DPF(D_TERSE, ("Shared capture tone disabled, 0x%x", sharedStatus));
+            }
+        }
     }
     else if (!g_DoNotCreateDataFiles)
     {
@@ -1206,7 +1268,28 @@ NTSTATUS CMiniportWaveRTStream::SetState
             // Wait until all work items are completed.
             if (!m_bCapture && !g_DoNotCreateDataFiles)
             {
+                SYSVAD_SAVEDATA_STATISTICS saveDataStatistics;
+
                 m_SaveData.WaitAllWorkItems();
+
+                // Spew the render data file writer health for this stream.
+                //Event type: eMINIPORT_IHV_DEFINED
+                //Parameter 1: Bytes written to the data file
+                //Parameter 2: Bytes dropped
+                //Parameter 3: Maximum work item queue depth
+                //Parameter 4: 99th percentile write latency, in us
+                m_SaveData.GetStatistics(&saveDataStatistics);
+                pAdapterComm->WriteEtwEvent(eMINIPORT_IHV_DEFINED,
+                                            saveDataStatistics.BytesWritten,
+                                            saveDataStatistics.BytesDropped,
+                                            saveDataStatistics.MaxQueueDepth,
+                                            saveDataStatistics.WriteLatencyP99Us);
+            }
+
+            // Silence the replay filled in because the reader thread fell behind.
+            if (m_bUseReplaySource)
+            {
+                DPF(D_TERSE, ("Capture replay underran by %lu bytes", m_ReplaySource.GetUnderrunBytes()));
             }
             break;
 
@@ -1251,6 +1334,15 @@ NTSTATUS CMiniportWaveRTStream::SetState
                 {
                     m_pMiniport->m_KeywordDetector.Stop();
                 }
+                else if (m_bCaptureTapAttached)
+                {
+                    // No WriteBytes call feeds the tap past this point.
+                    KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+                    m_bCaptureTapAttached = FALSE;
+                    KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+
+                    m_pMiniport->m_KeywordDetector.DetachCaptureTap(this);
+                }
 
                 // Pause DMA
                 if (m_ulNotificationIntervalMs > 0)
@@ -1332,6 +1424,33 @@ NTSTATUS CMiniportWaveRTStream::SetState
             if (m_pMiniport->IsKeywordDetectorPin(m_ulPin))
             {
                 m_pMiniport->m_KeywordDetector.Run();
+                if (m_ulNotificationsPerBuffer > 1)
+                {
+                    // Let the detector produce straight into our buffer.
+                    m_pMiniport->m_KeywordDetector.AttachWaveRtBuffer(m_ulNotificationsPerBuffer, m_ulDmaBufferSize, m_pDmaBuffer);
+                }
+            }
+            else if (m_bCapture &&
+                     !m_pMiniport->IsLoopbackPin(m_ulPin) &&
+                     m_pMiniport->m_ulMaxKeywordDetectorStreams > 0)
+            {
+                // Let the keyword detector listen to what this stream captures.
+                NTSTATUS tapStatus = m_pMiniport->m_KeywordDetector.AttachCaptureTap(this, m_pWfExt);
+                if (NT_SUCCESS(tapStatus))
+                {
+                    KeAcquireSpinLock(&m_PositionSpinLock, &oldIrql);
+                    m_bCaptureTapAttached = TRUE;
+                    KeReleaseSpinLock(&m_PositionSpinLock, oldIrql);
+                }
+                else
+                {
+                    DPF(D_VERBOSE, ("Keyword capture tap not attached, 0x%x", tapStatus));
+                }
+            }
+            if (m_pSharedToneSource)
+            {
+                // Rejoin at the producer, the data rendered while paused is stale.
+                m_ullSharedToneSourcePosition = m_pSharedToneSource->GetAttachPosition();
             }
             ullPerfCounterTemp = KeQueryPerformanceCounter(&m_ullPerformanceCounterFrequency);
             m_ullLastDPCTimeStamp = m_ullDmaTimeStamp = KSCONVERT_PERFORMANCE_TIME(m_ullPerformanceCounterFrequency.QuadPart, ullPerfCounterTemp);
@@ -1494,7 +1613,10 @@ VOID CMiniportWaveRTStream::WriteBytes
 
 Routine Description:
 
-This function writes the audio buffer using a sine wave generator
+This function writes the audio buffer using a sine wave generator, the
+tone shared with the other streams of the pin, or the replay source when
+HostCaptureReplayFile is configured, and passes it on to the keyword
+detector when this stream feeds it
 Arguments:
 
 ByteDisplacement - # of bytes to process.
@@ -1508,7 +1630,26 @@ ByteDisplacement - # of bytes to process.
     while (ByteDisplacement > 0)
     {
         ULONG runWrite = min(ByteDisplacement, m_ulDmaBufferSize - bufferOffset);
+        if (m_bUseReplaySource)
+        {
+            m_ReplaySource.ReadSamples(m_pDmaBuffer + bufferOffset, runWrite);
+        }
+        else if (m_pSharedToneSource)
+        {
+            m_pSharedToneSource->ReadSamples(&m_ullSharedToneSourcePosition, m_pDmaBuffer + bufferOffset, runWrite);
+            if (m_ToneGenerator.m_Mute)
+            {
+                RtlZeroMemory(m_pDmaBuffer + bufferOffset, runWrite);
+            }
+        }
+        else
+        {
             m_ToneGenerator.GenerateSine(m_pDmaBuffer + bufferOffset, runWrite);
+        }
+        if (m_bCaptureTapAttached)
+        {
+            m_pMiniport->m_KeywordDetector.WriteCaptureTap(this, m_pDmaBuffer + bufferOffset, runWrite);
+        }
         bufferOffset = (bufferOffset + runWrite) % m_ulDmaBufferSize;
         ByteDisplacement -= runWrite;
     }
@@ -1716,6 +1857,47 @@ CMiniportWaveRTStream::PropertyHandlerModuleCommand
                 GetAudioModuleListCount());
 } // PropertyHandlerModuleCommand
 
+//=============================================================================
+#pragma code_seg("PAGE")
+NTSTATUS
+CMiniportWaveRTStream::PropertyHandlerSaveDataStatistics
+(
+    _In_ PPCPROPERTY_REQUEST      PropertyRequest
+)
+{
+    NTSTATUS ntStatus;
+
+    PAGED_CODE();
+
+    DPF_ENTER(("[CMiniportWaveRTStream::PropertyHandlerSaveDataStatistics]"));
+
+    if (PropertyRequest->Verb & KSPROPERTY_TYPE_BASICSUPPORT)
+    {
+        return PropertyHandler_BasicSupport(PropertyRequest, KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT, VT_ILLEGAL);
+    }
+
+    if (m_bCapture || g_DoNotCreateDataFiles)
+    {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    ntStatus = ValidatePropertyParams(PropertyRequest, sizeof(SYSVAD_SAVEDATA_STATISTICS));
+    if (NT_SUCCESS(ntStatus))
+    {
+        if (PropertyRequest->Verb & KSPROPERTY_TYPE_GET)
+        {
+            m_SaveData.GetStatistics((PSYSVAD_SAVEDATA_STATISTICS)PropertyRequest->Value);
+            PropertyRequest->ValueSize = sizeof(SYSVAD_SAVEDATA_STATISTICS);
+        }
+        else
+        {
+            ntStatus = STATUS_INVALID_DEVICE_REQUEST;
+        }
+    }
+
+    return ntStatus;
+} // PropertyHandlerSaveDataStatistics
+
 //=============================================================================
 #pragma code_seg()
 void
@@ -17,6 +17,8 @@ Abstract:
 
 #include "savedata.h"
 #include "tonegenerator.h"
+#include "ReplaySource.h"
+#include "SharedToneSource.h"
 
 
 //
@@ -121,6 +123,12 @@ protected:
     ULONG                       m_ulContentId;
     CSaveData                   m_SaveData;
     ToneGenerator               m_ToneGenerator;
+    ReplaySource                m_ReplaySource;
+    BOOL                        m_bUseReplaySource;
+    PSharedToneSource           m_pSharedToneSource;    // Host capture tone shared with other streams, if any.
+    ULONGLONG                   m_ullSharedToneSourcePosition;
+    BOOL                        m_bCaptureTapAttached;  // Feeding the keyword detector, see CKeywordDetector::AttachCaptureTap.
+    UNICODE_STRING              m_HostCaptureReplayFile; // WAV or raw PCM file replayed instead of the tone, e.g. \??\C:\corpus\speech.wav
     GUID                        m_SignalProcessingMode;
     BOOLEAN                     m_bEoSReceived;
     BOOLEAN                     m_bLastBufferRendered;
@@ -253,6 +261,11 @@ public:
         _In_ PPCPROPERTY_REQUEST PropertyRequest
     );
 
+    NTSTATUS PropertyHandlerSaveDataStatistics
+    (
+        _In_ PPCPROPERTY_REQUEST PropertyRequest
+    );
+
 private:
 
     //
@@ -15,6 +15,8 @@ Abstract:
 #ifndef _SYSVAD_USBHSSPEAKERWAVTABLE_H_
 #define _SYSVAD_USBHSSPEAKERWAVTABLE_H_
 
+#include "SysVadShared.h"
+
 //
 // Function prototypes.
 //
@@ -646,11 +648,32 @@ PCPROPERTY_ITEM PropertiesUsbHsSpeakerOffloadPin[] =
         KSPROPERTY_OFFLOAD_PIN_VERIFY_STREAM_OBJECT_POINTER, // define properties
         KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
         PropertyHandler_OffloadPin
-    }
+    },
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
 };
 
 DEFINE_PCAUTOMATION_TABLE_PROP(AutomationUsbHsSpeakerOffloadPin, PropertiesUsbHsSpeakerOffloadPin);
 
+//=============================================================================
+
+static
+PCPROPERTY_ITEM PropertiesUsbHsSpeakerHostPin[] =
+{
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationUsbHsSpeakerHostPin, PropertiesUsbHsSpeakerHostPin);
+
 //=============================================================================
 static
 PCPIN_DESCRIPTOR UsbHsSpeakerWaveMiniportPins[] =
@@ -660,7 +683,7 @@ PCPIN_DESCRIPTOR UsbHsSpeakerWaveMiniportPins[] =
         USBHSSPEAKER_MAX_INPUT_SYSTEM_STREAMS,
         USBHSSPEAKER_MAX_INPUT_SYSTEM_STREAMS, 
         0,
-        NULL,
+        &AutomationUsbHsSpeakerHostPin,        // AutomationTable
         {
             0,
             NULL,
@@ -0,0 +1,364 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    KeywordDecimator.cpp
+
+Abstract:
+
+    Implementation of the SYSVAD keyword decimator.
+
+    The prototype lowpass runs at L times the input rate, cut off at
+    KWDEC_CUTOFF_HZ so the band up to the 8 kHz output Nyquist frequency
+    holds the transition, and has L * KWDEC_TAPS_PER_PHASE taps under a
+    Blackman window. Output n uses phase (n * M) mod L against the input
+    samples up to (n * M) / L, so no zero stuffed sample is ever multiplied.
+    Each phase is normalized to unity gain on its own, which keeps the
+    44.1 kHz phases from modulating the level.
+
+    Float samples are converted from their bits, not with floating point
+    instructions, so Process is safe wherever integer code is.
+
+
+--*/
+#include <math.h>
+#include "KeywordDecimator.h"
+
+#define KWDEC_PI    3.14159265358979323846
+
+static unsigned int
+KwdecGcd
+(
+    unsigned int    A,
+    unsigned int    B
+)
+{
+    while (B != 0)
+    {
+        unsigned int t = A % B;
+        A = B;
+        B = t;
+    }
+    return A;
+}
+
+//
+// IEEE single bits to Q31, saturated. NaN saturates as well.
+//
+static int
+KwdecFloatBitsToQ31
+(
+    unsigned int    Bits
+)
+{
+    int exponent = (int)((Bits >> 23) & 0xFF);
+    unsigned int mantissa = (Bits & 0x7FFFFF) | 0x800000;
+    int shift = exponent - 119;             // value * 2^31 = mantissa * 2^(exponent - 127 - 23 + 31)
+    unsigned int magnitude;
+
+    if (exponent == 0 || shift <= -24)
+    {
+        return 0;                           // Zero, denormal or below 2^-31.
+    }
+
+    if (shift >= 8)
+    {
+        magnitude = 0x7FFFFFFF;             // 1.0 or more.
+    }
+    else if (shift >= 0)
+    {
+        magnitude = mantissa << shift;
+    }
+    else
+    {
+        magnitude = mantissa >> -shift;
+    }
+
+    return (Bits & 0x80000000) ? -(int)magnitude : (int)magnitude;
+}
+
+unsigned int
+KeywordDecimator::GetCoefficientCount
+(
+    unsigned int        SampleRate
+)
+{
+    unsigned int g;
+
+    if (SampleRate <= KWDEC_OUTPUT_RATE)
+    {
+        return 0;
+    }
+
+    g = KwdecGcd(KWDEC_OUTPUT_RATE, SampleRate);
+    if (KWDEC_OUTPUT_RATE / g > KWDEC_MAX_PHASES)
+    {
+        return 0;
+    }
+
+    return KWDEC_OUTPUT_RATE / g * KWDEC_TAPS_PER_PHASE;
+}
+
+bool
+KeywordDecimator::Init
+(
+    unsigned int        SampleRate,
+    unsigned int        Channels,
+    KWDEC_SAMPLE_TYPE   SampleType,
+    short *             Coefficients,
+    unsigned int        CoefficientCount
+)
+{
+    unsigned int g;
+
+    switch (SampleType)
+    {
+    case KwdecPcm16:
+        m_BytesPerSample = 2;
+        break;
+    case KwdecPcm24:
+        m_BytesPerSample = 3;
+        break;
+    case KwdecPcm32:
+    case KwdecFloat32:
+        m_BytesPerSample = 4;
+        break;
+    default:
+        return false;
+    }
+
+    if (Channels == 0 || Channels > KWDEC_MAX_CHANNELS || SampleRate < KWDEC_OUTPUT_RATE)
+    {
+        return false;
+    }
+
+    m_SampleType = SampleType;
+    m_Channels = Channels;
+    m_BlockAlign = Channels * m_BytesPerSample;
+    m_DownmixScale = 65536 / (int)Channels;
+    m_Coefficients = 0;
+
+    g = KwdecGcd(KWDEC_OUTPUT_RATE, SampleRate);
+    m_InterpolationFactor = KWDEC_OUTPUT_RATE / g;
+    m_DecimationFactor = SampleRate / g;
+
+    if (m_InterpolationFactor != m_DecimationFactor)
+    {
+        unsigned int L = m_InterpolationFactor;
+        unsigned int taps = L * KWDEC_TAPS_PER_PHASE;
+        double center = (taps - 1) / 2.0;
+        double cutoff = 2.0 * KWDEC_PI * KWDEC_CUTOFF_HZ / ((double)SampleRate * L);
+
+        if (Coefficients == 0 || CoefficientCount < GetCoefficientCount(SampleRate))
+        {
+            return false;
+        }
+
+        for (unsigned int p = 0; p < L; p++)
+        {
+            double h[KWDEC_TAPS_PER_PHASE];
+            double sum = 0.0;
+
+            // Tap k of phase p multiplies the sample k inputs back.
+            for (unsigned int k = 0; k < KWDEC_TAPS_PER_PHASE; k++)
+            {
+                unsigned int n = p + k * L;
+                double x = n - center;
+                double w = 0.42 - 0.5 * cos(2.0 * KWDEC_PI * n / (taps - 1)) + 0.08 * cos(4.0 * KWDEC_PI * n / (taps - 1));
+
+                h[k] = w * ((x == 0.0) ? cutoff / KWDEC_PI : sin(cutoff * x) / (KWDEC_PI * x));
+                sum += h[k];
+            }
+
+            // Stored oldest sample first, in history order.
+            for (unsigned int k = 0; k < KWDEC_TAPS_PER_PHASE; k++)
+            {
+                double q = h[k] / sum * 32768.0;
+
+                Coefficients[p * KWDEC_TAPS_PER_PHASE + (KWDEC_TAPS_PER_PHASE - 1 - k)] = (short)floor(q + 0.5);
+            }
+        }
+
+        m_Coefficients = Coefficients;
+    }
+
+    Reset();
+
+    return true;
+}
+
+void
+KeywordDecimator::Reset()
+{
+    m_Phase = 0;
+    m_HistoryPos = 0;
+    m_PartialBytes = 0;
+
+    for (unsigned int i = 0; i < 2 * KWDEC_TAPS_PER_PHASE; i++)
+    {
+        m_History[i] = 0;
+    }
+}
+
+unsigned int
+KeywordDecimator::GetMaxInputLength
+(
+    unsigned int        OutputSamples
+) const
+{
+    // n frames produce at most n * L / M + 1 samples; one more frame may
+    // be completed from the partial frame carried in.
+    if (OutputSamples < 2)
+    {
+        return 0;
+    }
+
+    return (OutputSamples - 2) * m_DecimationFactor / m_InterpolationFactor * m_BlockAlign;
+}
+
+//
+// Averages the channels of one frame, Q15 with rounding.
+//
+short
+KeywordDecimator::Downmix
+(
+    const unsigned char *   Frame
+) const
+{
+    long long sum = 0;
+    unsigned int c;
+
+    // One loop per type, the type never changes between frames.
+    switch (m_SampleType)
+    {
+    case KwdecPcm16:
+        for (c = 0; c < m_Channels; c++, Frame += 2)
+        {
+            sum += (short)((unsigned int)Frame[0] | (unsigned int)Frame[1] << 8);
+        }
+        break;
+    case KwdecPcm24:
+        for (c = 0; c < m_Channels; c++, Frame += 3)
+        {
+            sum += (int)((unsigned int)Frame[0] << 8 | (unsigned int)Frame[1] << 16 | (unsigned int)Frame[2] << 24) >> 16;
+        }
+        break;
+    case KwdecPcm32:
+        for (c = 0; c < m_Channels; c++, Frame += 4)
+        {
+            sum += (int)((unsigned int)Frame[2] << 16 | (unsigned int)Frame[3] << 24) >> 16;
+        }
+        break;
+    default:
+        for (c = 0; c < m_Channels; c++, Frame += 4)
+        {
+            sum += KwdecFloatBitsToQ31((unsigned int)Frame[0] | (unsigned int)Frame[1] << 8 | (unsigned int)Frame[2] << 16 | (unsigned int)Frame[3] << 24) >> 16;
+        }
+        break;
+    }
+
+    if (m_Channels == 1)
+    {
+        return (short)sum;
+    }
+
+    return (short)((sum * m_DownmixScale + 0x8000) >> 16);
+}
+
+//
+// Adds one input sample and writes the outputs that become due.
+//
+unsigned int
+KeywordDecimator::PushSample
+(
+    short                   Sample,
+    short *                 Output
+)
+{
+    unsigned int produced = 0;
+
+    if (m_Coefficients == 0)
+    {
+        Output[0] = Sample;
+        return 1;
+    }
+
+    m_History[m_HistoryPos] = Sample;
+    m_History[m_HistoryPos + KWDEC_TAPS_PER_PHASE] = Sample;
+    m_HistoryPos = (m_HistoryPos + 1) % KWDEC_TAPS_PER_PHASE;
+
+    while (m_Phase < m_InterpolationFactor)
+    {
+        const short *window = &m_History[m_HistoryPos];
+        const short *taps = &m_Coefficients[m_Phase * KWDEC_TAPS_PER_PHASE];
+        int acc = 0;
+
+        // Every phase sums to 1.0, the accumulator stays within 32 bits.
+        for (unsigned int k = 0; k < KWDEC_TAPS_PER_PHASE; k++)
+        {
+            acc += taps[k] * window[k];
+        }
+
+        acc = (acc + 0x4000) >> 15;
+        if (acc > 32767)
+        {
+            acc = 32767;
+        }
+        else if (acc < -32768)
+        {
+            acc = -32768;
+        }
+
+        Output[produced++] = (short)acc;
+        m_Phase += m_DecimationFactor;
+    }
+
+    m_Phase -= m_InterpolationFactor;
+
+    return produced;
+}
+
+unsigned int
+KeywordDecimator::Process
+(
+    const unsigned char *   Data,
+    unsigned int            Length,
+    short *                 Output
+)
+{
+    unsigned int produced = 0;
+
+    if (m_PartialBytes > 0)
+    {
+        while (m_PartialBytes < m_BlockAlign && Length > 0)
+        {
+            m_Partial[m_PartialBytes++] = *Data++;
+            Length--;
+        }
+
+        if (m_PartialBytes < m_BlockAlign)
+        {
+            return 0;
+        }
+
+        produced += PushSample(Downmix(m_Partial), Output);
+        m_PartialBytes = 0;
+    }
+
+    while (Length >= m_BlockAlign)
+    {
+        produced += PushSample(Downmix(Data), Output + produced);
+        Data += m_BlockAlign;
+        Length -= m_BlockAlign;
+    }
+
+    while (Length > 0)
+    {
+        m_Partial[m_PartialBytes++] = *Data++;
+        Length--;
+    }
+
+    return produced;
+}
@@ -0,0 +1,136 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    KeywordDecimator.h
+
+Abstract:
+
+    Declaration of the SYSVAD keyword decimator: a polyphase resampler that
+    turns interleaved multi-channel capture audio (16, 24 or 32-bit PCM or
+    32-bit float, 16 kHz or faster) into the 16 kHz 16-bit mono stream the
+    keyword front end works on.
+
+    Like KeywordFrontEnd this module has no kernel or Windows dependencies.
+    Processing is integer only; Init designs the filter in double precision,
+    kernel mode callers save the floating point state around it.
+
+
+--*/
+#ifndef _SYSVAD_KEYWORDDECIMATOR_H
+#define _SYSVAD_KEYWORDDECIMATOR_H
+
+#define KWDEC_OUTPUT_RATE           16000
+#define KWDEC_CUTOFF_HZ             7000
+#define KWDEC_TAPS_PER_PHASE        96      // Input samples per output sample.
+#define KWDEC_MAX_PHASES            160     // 44.1 kHz is 160/441 of the input rate.
+#define KWDEC_MAX_CHANNELS          16
+#define KWDEC_MAX_BLOCK_ALIGN       (KWDEC_MAX_CHANNELS * 4)
+
+typedef enum _KWDEC_SAMPLE_TYPE
+{
+    KwdecPcm16,
+    KwdecPcm24,
+    KwdecPcm32,                             // Also 24 bits in a 32-bit container.
+    KwdecFloat32,
+} KWDEC_SAMPLE_TYPE;
+
+///////////////////////////////////////////////////////////////////////////////
+// KeywordDecimator
+//   Downmixes each input frame to one Q15 sample, then resamples by L/M
+//   (L = 16000 / g, M = SampleRate / g, g their gcd) with a windowed sinc
+//   split into L phases of KWDEC_TAPS_PER_PHASE taps. Each output is one
+//   dot product of contiguous 16-bit coefficients and history samples,
+//   a loop the compiler vectorizes. 16 kHz input is only downmixed.
+//
+class KeywordDecimator
+{
+public:
+    //
+    // Coefficients Init needs for SampleRate: 0 for 16 kHz, which needs no
+    // filter, and for rates that can't be decimated (slower than 16 kHz or
+    // more than KWDEC_MAX_PHASES phases).
+    //
+    static unsigned int
+    GetCoefficientCount
+    (
+        unsigned int        SampleRate
+    );
+
+    //
+    // Designs the filter into Coefficients, CoefficientCount values as
+    // returned by GetCoefficientCount, which must stay valid while the
+    // decimator is used. Returns false if the format is not supported.
+    //
+    bool
+    Init
+    (
+        unsigned int        SampleRate,
+        unsigned int        Channels,
+        KWDEC_SAMPLE_TYPE   SampleType,
+        short *             Coefficients,
+        unsigned int        CoefficientCount
+    );
+
+    void
+    Reset();
+
+    //
+    // Most input bytes Process may be given at once so that it produces no
+    // more than OutputSamples samples, whatever its state.
+    //
+    unsigned int
+    GetMaxInputLength
+    (
+        unsigned int        OutputSamples
+    ) const;
+
+    //
+    // Consumes Length bytes of interleaved frames and returns the number of
+    // 16 kHz samples written to Output. Length need not be a whole number
+    // of frames, a partial frame is completed by the next call.
+    //
+    unsigned int
+    Process
+    (
+        const unsigned char *   Data,
+        unsigned int            Length,
+        short *                 Output
+    );
+
+private:
+    short
+    Downmix
+    (
+        const unsigned char *   Frame
+    ) const;
+
+    unsigned int
+    PushSample
+    (
+        short                   Sample,
+        short *                 Output
+    );
+
+    unsigned int        m_InterpolationFactor;      // L
+    unsigned int        m_DecimationFactor;         // M
+    unsigned int        m_Phase;                    // Phase of the next output, L or more when it needs more input.
+    unsigned int        m_Channels;
+    unsigned int        m_BytesPerSample;
+    unsigned int        m_BlockAlign;
+    int                 m_DownmixScale;             // 65536 / m_Channels.
+    KWDEC_SAMPLE_TYPE   m_SampleType;
+    const short *       m_Coefficients;             // L phases, oldest sample's tap first.
+
+    // The last KWDEC_TAPS_PER_PHASE samples, written twice so the newest
+    // window is always contiguous at m_History + m_HistoryPos.
+    unsigned int        m_HistoryPos;
+    short               m_History[2 * KWDEC_TAPS_PER_PHASE];
+
+    unsigned int        m_PartialBytes;
+    unsigned char       m_Partial[KWDEC_MAX_BLOCK_ALIGN];
+};
+
+#endif // _SYSVAD_KEYWORDDECIMATOR_H
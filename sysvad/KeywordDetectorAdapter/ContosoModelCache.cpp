@@ -0,0 +1,385 @@
+// ContosoModelCache.cpp : Implements the cache of compiled Contoso keyword models.
+//
+
+#include "stdafx.h"
+
+#include <strsafe.h>
+
+#include <KeywordDetectorOemAdapter.h>
+#include "ContosoKeywordDetector.h"
+#include "ContosoModelCache.h"
+
+// Larger files are not keyword models.
+#define CONTOSO_KEYWORDMODEL_MAX_FILE_SIZE  (16 * 1024 * 1024)
+
+ContosoModelCache g_ContosoModelCache;
+
+ContosoModelCache::ContosoModelCache()
+    : m_NumModels(0),
+      m_UseCount(0),
+      m_NumLoadedImages(0)
+{
+    InitializeSRWLock(&m_Lock);
+    ZeroMemory(m_Models, sizeof(m_Models));
+}
+
+ContosoModelCache::~ContosoModelCache()
+{
+    for (ULONG i = 0; i < m_NumModels; i++)
+    {
+        UnmapModel(&m_Models[i]);
+    }
+    m_NumModels = 0;
+}
+
+HRESULT ContosoModelCache::MapModel(
+    _In_ ULONG UserId,
+    _In_ LANGID LangId,
+    _Out_ Model *pModel)
+{
+    WCHAR path[MAX_PATH];
+    WCHAR directory[MAX_PATH];
+    HANDLE file;
+    LARGE_INTEGER fileSize;
+    const CONTOSO_KEYWORDMODEL_HEADER *header;
+    HRESULT hr = S_OK;
+
+    ZeroMemory(pModel, sizeof(*pModel));
+
+    if (ExpandEnvironmentStringsW(L"%ProgramData%\\Contoso\\KeywordModels", directory, ARRAYSIZE(directory)) == 0)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    hr = StringCchPrintfW(path, ARRAYSIZE(path), L"%s\\%lu_%04x.ckm", directory, UserId, LangId);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (fileSize.QuadPart < (LONGLONG)sizeof(CONTOSO_KEYWORDMODEL_HEADER) ||
+             fileSize.QuadPart > CONTOSO_KEYWORDMODEL_MAX_FILE_SIZE)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+    else
+    {
+        // The mapping keeps the file open.
+        pModel->Mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (pModel->Mapping == nullptr)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    CloseHandle(file);
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    pModel->View = (const BYTE *)MapViewOfFile(pModel->Mapping, FILE_MAP_READ, 0, 0, 0);
+    if (pModel->View == nullptr)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        UnmapModel(pModel);
+        return hr;
+    }
+
+    pModel->Size = (ULONG)fileSize.QuadPart;
+    pModel->UserId = UserId;
+    pModel->LangId = LangId;
+
+    //
+    // Only what this cache reads is checked here, the driver checks the
+    // rest of the image when it loads it.
+    //
+    header = (const CONTOSO_KEYWORDMODEL_HEADER *)pModel->View;
+    if (header->Signature != CONTOSO_KEYWORDMODEL_SIGNATURE ||
+        header->Version != CONTOSO_KEYWORDMODEL_VERSION ||
+        header->ImageSize != pModel->Size ||
+        header->UserId != UserId ||
+        header->LangId != LangId ||
+        header->KeywordCount > CONTOSO_KEYWORDMODEL_MAX_KEYWORDS ||
+        header->KeywordsOffset % CONTOSO_KEYWORDMODEL_ALIGNMENT != 0 ||
+        (ULONGLONG)header->KeywordsOffset + (ULONGLONG)header->KeywordCount * sizeof(CONTOSO_KEYWORDMODEL_KEYWORD) > pModel->Size)
+    {
+        UnmapModel(pModel);
+        return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+
+    return S_OK;
+}
+
+void ContosoModelCache::UnmapModel(_Inout_ Model *pModel)
+{
+    if (pModel->View != nullptr)
+    {
+        UnmapViewOfFile(pModel->View);
+        pModel->View = nullptr;
+    }
+    if (pModel->Mapping != nullptr)
+    {
+        CloseHandle(pModel->Mapping);
+        pModel->Mapping = nullptr;
+    }
+}
+
+//
+// Returns the mapped model of UserId and LangId, mapping it if needed and
+// unmapping the least recently used one when the cache is full. The caller
+// holds m_Lock.
+//
+HRESULT ContosoModelCache::GetModel(
+    _In_ ULONG UserId,
+    _In_ LANGID LangId,
+    _Outptr_ Model **ppModel)
+{
+    Model *pModel = nullptr;
+    HRESULT hr;
+
+    for (ULONG i = 0; i < m_NumModels; i++)
+    {
+        if (m_Models[i].UserId == UserId && m_Models[i].LangId == LangId)
+        {
+            pModel = &m_Models[i];
+            break;
+        }
+    }
+
+    if (pModel == nullptr)
+    {
+        Model newModel;
+
+        hr = MapModel(UserId, LangId, &newModel);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        if (m_NumModels < MaxModels)
+        {
+            pModel = &m_Models[m_NumModels++];
+        }
+        else
+        {
+            pModel = &m_Models[0];
+            for (ULONG i = 1; i < m_NumModels; i++)
+            {
+                if (m_Models[i].LastUse < pModel->LastUse)
+                {
+                    pModel = &m_Models[i];
+                }
+            }
+            UnmapModel(pModel);
+        }
+
+        *pModel = newModel;
+    }
+
+    pModel->LastUse = ++m_UseCount;
+    *ppModel = pModel;
+
+    return S_OK;
+}
+
+const CONTOSO_KEYWORDMODEL_KEYWORD *ContosoModelCache::FindKeywordInModel(
+    _In_ const Model *pModel,
+    _In_ REFGUID EventId)
+{
+    const CONTOSO_KEYWORDMODEL_HEADER *header = (const CONTOSO_KEYWORDMODEL_HEADER *)pModel->View;
+    const CONTOSO_KEYWORDMODEL_KEYWORD *keywords = (const CONTOSO_KEYWORDMODEL_KEYWORD *)(pModel->View + header->KeywordsOffset);
+
+    for (ULONG k = 0; k < header->KeywordCount; k++)
+    {
+        if (keywords[k].EventId == EventId)
+        {
+            return &keywords[k];
+        }
+    }
+
+    return nullptr;
+}
+
+//
+// Returns the index of ModelId in m_LoadedImages, or m_NumLoadedImages if
+// the driver does not have the image. The caller holds m_Lock.
+//
+ULONG ContosoModelCache::FindLoadedImage(_In_ REFGUID ModelId)
+{
+    ULONG i = 0;
+
+    while (i < m_NumLoadedImages && m_LoadedImages[i] != ModelId)
+    {
+        i++;
+    }
+
+    return i;
+}
+
+//
+// Makes ModelId, at Index as returned by FindLoadedImage, the most
+// recently armed image. An image not loaded yet takes the place of the
+// least recently armed one if the driver is full, as in the driver. The
+// caller holds m_Lock.
+//
+void ContosoModelCache::TouchLoadedImage(_In_ REFGUID ModelId, _In_ ULONG Index)
+{
+    if (Index == m_NumLoadedImages && m_NumLoadedImages < ARRAYSIZE(m_LoadedImages))
+    {
+        m_NumLoadedImages++;
+    }
+    else if (Index == m_NumLoadedImages)
+    {
+        Index = m_NumLoadedImages - 1;
+    }
+
+    MoveMemory(&m_LoadedImages[1], &m_LoadedImages[0], Index * sizeof(GUID));
+    m_LoadedImages[0] = ModelId;
+}
+
+void ContosoModelCache::ForgetLoadedImages()
+{
+    AcquireSRWLockExclusive(&m_Lock);
+    m_NumLoadedImages = 0;
+    ReleaseSRWLockExclusive(&m_Lock);
+}
+
+HRESULT ContosoModelCache::BuildArmingPattern(
+    _In_ ULONG UserId,
+    _In_ LANGID LangId,
+    _In_reads_(NumEventIds) const GUID *EventIds,
+    _In_ ULONG NumEventIds,
+    _Outptr_ SOUNDDETECTOR_PATTERNHEADER **ppPatternData)
+{
+    CONTOSO_KEYWORDMODELCONFIGURATION *pPatternData = nullptr;
+    const ULONG modelOffset = (sizeof(*pPatternData) + CONTOSO_KEYWORDMODEL_ALIGNMENT - 1) & ~(CONTOSO_KEYWORDMODEL_ALIGNMENT - 1);
+    const CONTOSO_KEYWORDMODEL_HEADER *header = nullptr;
+    Model *pModel = nullptr;
+    ULONG loadedIndex = 0;
+    BOOL loaded = FALSE;
+    HRESULT hr;
+
+    *ppPatternData = nullptr;
+
+    AcquireSRWLockExclusive(&m_Lock);
+
+    hr = GetModel(UserId, LangId, &pModel);
+    if (SUCCEEDED(hr))
+    {
+        for (ULONG i = 0; i < NumEventIds; i++)
+        {
+            if (FindKeywordInModel(pModel, EventIds[i]) == nullptr)
+            {
+                hr = E_INVALIDARG;
+                break;
+            }
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        header = (const CONTOSO_KEYWORDMODEL_HEADER *)pModel->View;
+        loadedIndex = FindLoadedImage(header->ModelId);
+        loaded = (loadedIndex < m_NumLoadedImages);
+
+        // An image the driver has loaded is armed by its ModelId alone.
+        pPatternData = (CONTOSO_KEYWORDMODELCONFIGURATION*)CoTaskMemAlloc(loaded ? sizeof(*pPatternData) : modelOffset + pModel->Size);
+        if (pPatternData == nullptr)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        ZeroMemory(pPatternData, loaded ? sizeof(*pPatternData) : modelOffset);
+        pPatternData->Header.Size = loaded ? sizeof(*pPatternData) : modelOffset + pModel->Size;
+        pPatternData->Header.PatternType = CONTOSO_KEYWORDCONFIGURATION_IDENTIFIER2;
+        pPatternData->ContosoDetectorConfigurationData = 0x12345678;
+        pPatternData->ModelOffset = loaded ? 0 : modelOffset;
+        pPatternData->ModelSize = pModel->Size;
+        pPatternData->ModelId = header->ModelId;
+        if (!loaded)
+        {
+            CopyMemory((BYTE*)pPatternData + modelOffset, pModel->View, pModel->Size);
+        }
+
+        TouchLoadedImage(header->ModelId, loadedIndex);
+
+        *ppPatternData = &pPatternData->Header;
+    }
+
+    ReleaseSRWLockExclusive(&m_Lock);
+
+    return hr;
+}
+
+HRESULT ContosoModelCache::GetKeywords(
+    _In_ ULONG UserId,
+    _In_ LANGID LangId,
+    _Out_writes_to_(MaxKeywords, *NumKeywords) CONTOSO_KEYWORDMODEL_KEYWORD *Keywords,
+    _In_ ULONG MaxKeywords,
+    _Out_ ULONG *NumKeywords)
+{
+    Model *pModel = nullptr;
+    HRESULT hr;
+
+    *NumKeywords = 0;
+
+    AcquireSRWLockExclusive(&m_Lock);
+
+    hr = GetModel(UserId, LangId, &pModel);
+    if (SUCCEEDED(hr))
+    {
+        const CONTOSO_KEYWORDMODEL_HEADER *header = (const CONTOSO_KEYWORDMODEL_HEADER *)pModel->View;
+        ULONG count = min(header->KeywordCount, MaxKeywords);
+
+        CopyMemory(Keywords, pModel->View + header->KeywordsOffset, count * sizeof(CONTOSO_KEYWORDMODEL_KEYWORD));
+        *NumKeywords = count;
+    }
+
+    ReleaseSRWLockExclusive(&m_Lock);
+
+    return hr;
+}
+
+HRESULT ContosoModelCache::FindKeyword(
+    _In_ REFGUID EventId,
+    _Out_ CONTOSO_KEYWORDMODEL_KEYWORD *Keyword,
+    _Out_ ULONG *UserId,
+    _Out_ LANGID *LangId)
+{
+    HRESULT hr = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+
+    AcquireSRWLockExclusive(&m_Lock);
+
+    for (ULONG i = 0; i < m_NumModels; i++)
+    {
+        const CONTOSO_KEYWORDMODEL_KEYWORD *keyword = FindKeywordInModel(&m_Models[i], EventId);
+
+        if (keyword != nullptr)
+        {
+            *Keyword = *keyword;
+            *UserId = m_Models[i].UserId;
+            *LangId = m_Models[i].LangId;
+            hr = S_OK;
+            break;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&m_Lock);
+
+    return hr;
+}
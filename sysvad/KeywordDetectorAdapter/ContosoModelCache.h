@@ -0,0 +1,88 @@
+// ContosoModelCache.h : Declares the cache of compiled Contoso keyword models.
+//
+// Requires ContosoKeywordDetector.h.
+//
+
+#pragma once
+
+//
+// Compiled models (CONTOSO_KEYWORDMODEL_HEADER) are mapped read-only from
+// %ProgramData%\Contoso\KeywordModels\<UserId>_<LangId>.ckm on first use and
+// stay mapped for the life of the process, keyed by user and language.
+// Keywords are found by event id within a model. Nothing is parsed or
+// rebuilt when arming. The first arming pattern of a model carries the
+// mapped image as is; while the driver still has it loaded, later ones
+// only carry its ModelId.
+//
+class ContosoModelCache
+{
+public:
+    static const ULONG MaxModels = 8;
+
+    ContosoModelCache();
+    ~ContosoModelCache();
+
+    // Builds an arming pattern for the model of UserId and LangId, after
+    // checking the model has every event in EventIds.
+    HRESULT BuildArmingPattern(
+        _In_ ULONG UserId,
+        _In_ LANGID LangId,
+        _In_reads_(NumEventIds) const GUID *EventIds,
+        _In_ ULONG NumEventIds,
+        _Outptr_ SOUNDDETECTOR_PATTERNHEADER **ppPatternData);
+
+    // Copies out up to MaxKeywords keywords of the model of UserId and LangId.
+    HRESULT GetKeywords(
+        _In_ ULONG UserId,
+        _In_ LANGID LangId,
+        _Out_writes_to_(MaxKeywords, *NumKeywords) CONTOSO_KEYWORDMODEL_KEYWORD *Keywords,
+        _In_ ULONG MaxKeywords,
+        _Out_ ULONG *NumKeywords);
+
+    // Finds a keyword by event id in the models mapped so far.
+    HRESULT FindKeyword(
+        _In_ REFGUID EventId,
+        _Out_ CONTOSO_KEYWORDMODEL_KEYWORD *Keyword,
+        _Out_ ULONG *UserId,
+        _Out_ LANGID *LangId);
+
+    // Forgets which images the driver has loaded, so the next pattern of
+    // every model carries its image.
+    void ForgetLoadedImages();
+
+private:
+    struct Model
+    {
+        ULONG           UserId;
+        LANGID          LangId;
+        HANDLE          Mapping;
+        const BYTE *    View;
+        ULONG           Size;
+        ULONGLONG       LastUse;
+    };
+
+    HRESULT GetModel(_In_ ULONG UserId, _In_ LANGID LangId, _Outptr_ Model **ppModel);
+
+    static HRESULT MapModel(_In_ ULONG UserId, _In_ LANGID LangId, _Out_ Model *pModel);
+
+    static void UnmapModel(_Inout_ Model *pModel);
+
+    static const CONTOSO_KEYWORDMODEL_KEYWORD *FindKeywordInModel(_In_ const Model *pModel, _In_ REFGUID EventId);
+
+    ULONG FindLoadedImage(_In_ REFGUID ModelId);
+
+    void TouchLoadedImage(_In_ REFGUID ModelId, _In_ ULONG Index);
+
+    SRWLOCK     m_Lock;
+    Model       m_Models[MaxModels];
+    ULONG       m_NumModels;
+    ULONGLONG   m_UseCount;
+
+    // ModelIds of the images sent to the driver, most recently armed
+    // first. The driver keeps as many loaded and frees the least recently
+    // armed, so these are the ones it has.
+    GUID        m_LoadedImages[CONTOSO_KEYWORDMODEL_LOADED_IMAGES];
+    ULONG       m_NumLoadedImages;
+};
+
+extern ContosoModelCache g_ContosoModelCache;
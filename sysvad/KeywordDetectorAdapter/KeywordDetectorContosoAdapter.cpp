@@ -11,6 +11,7 @@
 #include <initguid.h>
 #include "KeywordDetectorContosoAdapter.h"
 #include "ContosoKeywordDetector.h"
+#include "ContosoModelCache.h"
 #include <wrl.h>
 
 using namespace Microsoft::WRL;
@@ -191,6 +192,10 @@ public:
     {
         const WAVEFORMATEX waveFormat = { WAVE_FORMAT_PCM, 1, 16000, 32000, 2, 16, 0 };
 
+        // The OS asks whenever it starts using the detector, which may be
+        // a restarted driver with no models loaded.
+        g_ContosoModelCache.ForgetLoadedImages();
+
         *ppFormat = (WAVEFORMATEX *)CoTaskMemAlloc(sizeof(WAVEFORMATEX));
         if (*ppFormat == nullptr)
         {
@@ -220,7 +225,29 @@ public:
         _Outptr_ DETECTIONEVENT** EventIds,
         _Out_ ULONG* NumEvents)
     {
-        if (LangId == 0x0409)
+        CONTOSO_KEYWORDMODEL_KEYWORD keywords[CONTOSO_KEYWORDMODEL_MAX_KEYWORDS];
+        ULONG numKeywords = 0;
+
+        // The speaker independent model of the language, if one is installed,
+        // lists the events.
+        if (SUCCEEDED(g_ContosoModelCache.GetKeywords(0, LangId, keywords, ARRAYSIZE(keywords), &numKeywords)) && numKeywords > 0)
+        {
+            *EventIds = (DETECTIONEVENT *)CoTaskMemAlloc(numKeywords * sizeof(DETECTIONEVENT));
+            if (*EventIds == nullptr)
+            {
+                return E_OUTOFMEMORY;
+            }
+
+            for (ULONG i = 0; i < numKeywords; i++)
+            {
+                DETECTIONEVENT event = { keywords[i].EventId, EVENTFEATURES_NoEventFeatures, {0}, L"", TRUE };
+
+                wcsncpy_s(event.DisplayName, keywords[i].DisplayName, _TRUNCATE);
+                (*EventIds)[i] = event;
+            }
+            *NumEvents = numKeywords;
+        }
+        else if (LangId == 0x0409)
         {
                 DETECTIONEVENT events[] = { { CONTOSO_KEYWORD1, EVENTFEATURES_NoEventFeatures, {0}, L"Contoso 1", TRUE },
                                             { CONTOSO_KEYWORD2, EVENTFEATURES_NoEventFeatures, {0}, L"Contoso 2", TRUE } };
@@ -279,9 +306,41 @@ public:
         _Outptr_ SOUNDDETECTOR_PATTERNHEADER** ppPatternData)
     {
         CONTOSO_KEYWORDCONFIGURATION *pPatternData = nullptr;
+        GUID eventIds[CONTOSO_KEYWORDMODEL_MAX_KEYWORDS];
+        HRESULT hr;
 
         UNREFERENCED_PARAMETER(UserModelData);
 
+        if (NumEventSelectors == 0 || NumEventSelectors > ARRAYSIZE(eventIds))
+        {
+            return E_INVALIDARG;
+        }
+
+        // All events armed together come from one compiled model.
+        for (ULONG i = 0; i < NumEventSelectors; i++)
+        {
+            if ((ULONG)EventSelectors[i].UserId != (ULONG)EventSelectors[0].UserId ||
+                EventSelectors[i].LangId != EventSelectors[0].LangId)
+            {
+                return E_INVALIDARG;
+            }
+            eventIds[i] = EventSelectors[i].Event.EventId;
+        }
+
+        // The cached model is copied into the pattern as is the first time,
+        // later patterns only name it and the driver swaps pointers.
+        hr = g_ContosoModelCache.BuildArmingPattern((ULONG)EventSelectors[0].UserId,
+                                                    EventSelectors[0].LangId,
+                                                    eventIds,
+                                                    NumEventSelectors,
+                                                    ppPatternData);
+        if (hr != HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) &&
+            hr != HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND))
+        {
+            return hr;
+        }
+
+        // No compiled model installed, arm the built-in keywords.
         if (NumEventSelectors > 2)
         {
             return E_INVALIDARG;
@@ -320,6 +379,9 @@ public:
         _Outptr_ WCHAR** DebugOutput)
     {
         const CONTOSO_KEYWORDDETECTIONRESULT *contosoResult;
+        CONTOSO_KEYWORDMODEL_KEYWORD keyword;
+        ULONG userId = 0;
+        LANGID langId = 0x0409;
 
         UNREFERENCED_PARAMETER(UserModelData);
         UNREFERENCED_PARAMETER(DebugOutput);
@@ -340,6 +402,10 @@ public:
         {
             wcscpy_s(EventSelector->Event.DisplayName, L"Contoso 2");
         }
+        else if (SUCCEEDED(g_ContosoModelCache.FindKeyword(contosoResult->EventId, &keyword, &userId, &langId)))
+        {
+            wcsncpy_s(EventSelector->Event.DisplayName, keyword.DisplayName, _TRUNCATE);
+        }
         else
         {
             return E_INVALIDARG;
@@ -348,8 +414,8 @@ public:
         // Fill in event action information for the actual detection, based on what has been armed.
         EventSelector->Event.EventId = contosoResult->EventId;
         EventSelector->Armed = TRUE;
-        EventSelector->UserId = 0;
-        EventSelector->LangId = 0x0409;
+        EventSelector->UserId = userId;
+        EventSelector->LangId = langId;
 
         EventAction->EventdActionType = EVENTACTIONTYPE_Accept;
         EventAction->EventActionContextType = EVENTACTIONCONTEXTTYPE_None;
@@ -0,0 +1,328 @@
+//
+// ModelCacheBench.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Times the arming paths of the Contoso keyword model cache
+//
+//  ModelCacheBench writes a compiled keyword model of the given size under
+//  a scratch %ProgramData% and runs ContosoModelCache over it, unchanged
+//  from the adapter, timing three cases:
+//
+//      load    mapping the model into a new cache, and its first keyword
+//              lookup.
+//      miss    an arming pattern for a model the driver does not have
+//              loaded, which carries the whole image.
+//      hit     an arming pattern for a model the driver has loaded, which
+//              only carries its ModelId.
+//
+//  Each case is run several times over and the median and slowest times are
+//  reported with the size of the pattern sent to the driver. What the driver
+//  does with a pattern is not timed here; LoadKeywordModel traces how long
+//  it took to copy and check each image it loads.
+//
+//  It is a console program for Windows, built from a Visual Studio developer
+//  command prompt with the Windows SDK, in this directory:
+//
+//      cl /nologo /W4 /O2 /EHsc /DUNICODE /D_UNICODE /I.. /I..\.. ^
+//          ModelCacheBench.cpp ..\ContosoModelCache.cpp ole32.lib
+//
+//      ModelCacheBench [-z kilobytes] [-p passes]
+//
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <initguid.h>
+#include <KeywordDetectorOemAdapter.h>
+#include "ContosoKeywordDetector.h"
+#include "ContosoModelCache.h"
+
+#define BENCH_USER_ID           0
+#define BENCH_LANG_ID           0x0409
+#define BENCH_FRAMES            60
+
+typedef struct _BENCH_OPTIONS
+{
+    ULONG   ulModelBytes;
+    ULONG   ulPasses;
+} BENCH_OPTIONS;
+
+static double g_f64TicksPerUs;
+
+static double ElapsedUs(const LARGE_INTEGER &Start)
+{
+    LARGE_INTEGER stop;
+
+    QueryPerformanceCounter(&stop);
+    return (double)(stop.QuadPart - Start.QuadPart) / g_f64TicksPerUs;
+}
+
+static ULONG AlignUp(ULONG Value)
+{
+    return (Value + CONTOSO_KEYWORDMODEL_ALIGNMENT - 1) & ~(CONTOSO_KEYWORDMODEL_ALIGNMENT - 1);
+}
+
+//
+// Writes a model of ModelBytes bytes for BENCH_USER_ID and BENCH_LANG_ID
+// under Directory\Contoso\KeywordModels, with both Contoso keywords and the
+// rest of the image padding after their codes.
+//
+static HRESULT WriteModel(const WCHAR *Directory, ULONG ModelBytes)
+{
+    const ULONG codebookOffset = sizeof(CONTOSO_KEYWORDMODEL_HEADER);
+    const ULONG keywordsOffset = AlignUp(codebookOffset + CONTOSO_KEYWORDMODEL_MAX_CODEWORDS * CONTOSO_KEYWORDMODEL_BANDS * sizeof(SHORT));
+    const ULONG codesOffset = AlignUp(keywordsOffset + 2 * sizeof(CONTOSO_KEYWORDMODEL_KEYWORD));
+    const GUID eventIds[2] = { CONTOSO_KEYWORD1, CONTOSO_KEYWORD2 };
+    WCHAR path[MAX_PATH];
+    HANDLE file;
+    DWORD written = 0;
+    HRESULT hr = S_OK;
+
+    if (ModelBytes < codesOffset + 2 * BENCH_FRAMES || ModelBytes > 16 * 1024 * 1024)
+    {
+        return E_INVALIDARG;
+    }
+
+    std::vector<BYTE> image(ModelBytes, 0);
+    CONTOSO_KEYWORDMODEL_HEADER *header = (CONTOSO_KEYWORDMODEL_HEADER *)image.data();
+    CONTOSO_KEYWORDMODEL_KEYWORD *keywords = (CONTOSO_KEYWORDMODEL_KEYWORD *)(image.data() + keywordsOffset);
+    SHORT *codebook = (SHORT *)(image.data() + codebookOffset);
+
+    header->Signature = CONTOSO_KEYWORDMODEL_SIGNATURE;
+    header->Version = CONTOSO_KEYWORDMODEL_VERSION;
+    header->LangId = BENCH_LANG_ID;
+    header->ImageSize = ModelBytes;
+    header->UserId = BENCH_USER_ID;
+    header->CodewordCount = CONTOSO_KEYWORDMODEL_MAX_CODEWORDS;
+    header->CodebookOffset = codebookOffset;
+    header->KeywordCount = 2;
+    header->KeywordsOffset = keywordsOffset;
+    hr = CoCreateGuid(&header->ModelId);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    for (ULONG i = 0; i < CONTOSO_KEYWORDMODEL_MAX_CODEWORDS * CONTOSO_KEYWORDMODEL_BANDS; i++)
+    {
+        codebook[i] = (SHORT)((i * 2654435761u) >> 20);
+    }
+
+    for (ULONG i = 0; i < 2; i++)
+    {
+        keywords[i].EventId = eventIds[i];
+        keywords[i].FrameCount = BENCH_FRAMES;
+        keywords[i].Threshold = 4096;
+        keywords[i].CodesOffset = codesOffset + i * BENCH_FRAMES;
+        swprintf_s(keywords[i].DisplayName, ARRAYSIZE(keywords[i].DisplayName), L"Keyword %lu", i + 1);
+        for (ULONG j = 0; j < BENCH_FRAMES; j++)
+        {
+            image[keywords[i].CodesOffset + j] = (BYTE)(j * 37 + i);
+        }
+    }
+
+    swprintf_s(path, ARRAYSIZE(path), L"%ls\\Contoso", Directory);
+    CreateDirectoryW(path, nullptr);
+    swprintf_s(path, ARRAYSIZE(path), L"%ls\\Contoso\\KeywordModels", Directory);
+    CreateDirectoryW(path, nullptr);
+    swprintf_s(path, ARRAYSIZE(path), L"%ls\\Contoso\\KeywordModels\\%lu_%04x.ckm", Directory, BENCH_USER_ID, BENCH_LANG_ID);
+
+    file = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!WriteFile(file, image.data(), ModelBytes, &written, nullptr) || written != ModelBytes)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(file);
+    return hr;
+}
+
+static void Report(const char *Name, std::vector<double> &Times, ULONG PatternBytes)
+{
+    std::vector<double>::iterator median = Times.begin() + Times.size() / 2;
+    double maxUs = *std::max_element(Times.begin(), Times.end());
+
+    std::nth_element(Times.begin(), median, Times.end());
+    printf("%-8s %12lu %12.2f %12.2f\n", Name, PatternBytes, *median, maxUs);
+}
+
+static HRESULT RunCases(const BENCH_OPTIONS *pOptions)
+{
+    const GUID eventIds[2] = { CONTOSO_KEYWORD1, CONTOSO_KEYWORD2 };
+    CONTOSO_KEYWORDMODEL_KEYWORD keywords[CONTOSO_KEYWORDMODEL_MAX_KEYWORDS];
+    std::vector<double> loadUs, missUs, hitUs;
+    ULONG missBytes = 0;
+    ULONG hitBytes = 0;
+    ULONG numKeywords = 0;
+    LARGE_INTEGER start;
+    HRESULT hr = S_OK;
+
+    printf("%-8s %12s %12s %12s\n", "case", "pattern B", "median us", "max us");
+
+    //
+    // A new cache maps the model again, so each load pass pays for the
+    // file open, the mapping and the page faults of the header and keywords.
+    //
+    for (ULONG pass = 0; pass < pOptions->ulPasses && SUCCEEDED(hr); pass++)
+    {
+        ContosoModelCache *pCache = new ContosoModelCache();
+
+        QueryPerformanceCounter(&start);
+        hr = pCache->GetKeywords(BENCH_USER_ID, BENCH_LANG_ID, keywords, ARRAYSIZE(keywords), &numKeywords);
+        loadUs.push_back(ElapsedUs(start));
+
+        delete pCache;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        ContosoModelCache cache;
+
+        hr = cache.GetKeywords(BENCH_USER_ID, BENCH_LANG_ID, keywords, ARRAYSIZE(keywords), &numKeywords);
+
+        //
+        // Forgetting the loaded images makes every pattern carry the image,
+        // as it does for the first arm and after the driver evicts it.
+        //
+        for (ULONG pass = 0; pass < pOptions->ulPasses && SUCCEEDED(hr); pass++)
+        {
+            SOUNDDETECTOR_PATTERNHEADER *pPattern = nullptr;
+
+            cache.ForgetLoadedImages();
+            QueryPerformanceCounter(&start);
+            hr = cache.BuildArmingPattern(BENCH_USER_ID, BENCH_LANG_ID, eventIds, ARRAYSIZE(eventIds), &pPattern);
+            missUs.push_back(ElapsedUs(start));
+            if (SUCCEEDED(hr))
+            {
+                missBytes = pPattern->Size;
+                CoTaskMemFree(pPattern);
+            }
+        }
+
+        // The last miss left the image loaded, so these are all hits.
+        for (ULONG pass = 0; pass < pOptions->ulPasses && SUCCEEDED(hr); pass++)
+        {
+            SOUNDDETECTOR_PATTERNHEADER *pPattern = nullptr;
+
+            QueryPerformanceCounter(&start);
+            hr = cache.BuildArmingPattern(BENCH_USER_ID, BENCH_LANG_ID, eventIds, ARRAYSIZE(eventIds), &pPattern);
+            hitUs.push_back(ElapsedUs(start));
+            if (SUCCEEDED(hr))
+            {
+                hitBytes = pPattern->Size;
+                CoTaskMemFree(pPattern);
+            }
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        Report("load", loadUs, 0);
+        Report("miss", missUs, missBytes);
+        Report("hit", hitUs, hitBytes);
+    }
+
+    return hr;
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+        "Usage: ModelCacheBench [-z kilobytes] [-p passes]\n"
+        "\n"
+        "  -z kilobytes  size of the compiled model, 16 to 16384 (default 512)\n"
+        "  -p passes     times each case is run (default 101)\n");
+}
+
+static bool ParseOptions(int argc, char **argv, BENCH_OPTIONS *pOptions)
+{
+    pOptions->ulModelBytes = 512 * 1024;
+    pOptions->ulPasses = 101;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc || argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0')
+        {
+            return false;
+        }
+
+        ULONG value = strtoul(argv[++i], nullptr, 10);
+
+        switch (argv[i - 1][1])
+        {
+        case 'z':
+            if (value < 16 || value > 16384)
+            {
+                return false;
+            }
+            pOptions->ulModelBytes = value * 1024;
+            break;
+        case 'p':
+            if (value == 0)
+            {
+                return false;
+            }
+            pOptions->ulPasses = value;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BENCH_OPTIONS options;
+    LARGE_INTEGER frequency;
+    WCHAR directory[MAX_PATH];
+    HRESULT hr;
+
+    if (!ParseOptions(argc, argv, &options))
+    {
+        Usage();
+        return 1;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    g_f64TicksPerUs = (double)frequency.QuadPart / 1000000.0;
+
+    //
+    // The cache finds models under %ProgramData%, so point it at a scratch
+    // directory rather than the machine's models.
+    //
+    if (GetTempPathW(ARRAYSIZE(directory), directory) == 0 ||
+        wcscat_s(directory, L"ModelCacheBench") != 0)
+    {
+        fprintf(stderr, "ModelCacheBench: no temporary directory\n");
+        return 1;
+    }
+
+    CreateDirectoryW(directory, nullptr);
+    SetEnvironmentVariableW(L"ProgramData", directory);
+
+    hr = WriteModel(directory, options.ulModelBytes);
+    if (SUCCEEDED(hr))
+    {
+        printf("ModelCacheBench: %lu KB model, %lu passes\n", options.ulModelBytes / 1024, options.ulPasses);
+        hr = RunCases(&options);
+    }
+
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "ModelCacheBench: failed, 0x%08lx\n", (ULONG)hr);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,470 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    KeywordFrontEnd
+
+Abstract:
+
+    Implementation of the SYSVAD keyword detection front end.
+
+    Every packet goes through the energy VAD, which tracks the noise floor
+    and costs one multiply-add per sample. Only packets the VAD marks as
+    speech are windowed, transformed with a 256 point fixed-point FFT and
+    reduced to KWFE_MEL_BANDS log-mel energies. The per-frame mean of the
+    log energies is removed, so the features do not depend on input gain.
+
+    Templates are sequences of indices into a codebook shared by all
+    keyword models. The scorer measures the feature frame against every
+    codeword once per packet, O(codewords * bands); each model's matcher
+    then updates its accumulated cost column from that table, O(template
+    frames) per packet. Adding a model adds no band arithmetic.
+
+
+--*/
+#include "KeywordFrontEnd.h"
+
+// Packets quieter than this never count as speech, about -60 dBFS.
+#define KWFE_MIN_ENERGY             (KWFE_FRAME_SAMPLES * 32ULL * 32ULL)
+
+// Speech is 8x (9 dB) above the noise floor.
+#define KWFE_SPEECH_RATIO           8
+
+// Packets that stay "speech" after the energy drops, 200 ms.
+#define KWFE_HANGOVER_PACKETS       20
+
+// The noise floor rises by 1/64 of the difference per packet.
+#define KWFE_NOISE_RISE_SHIFT       6
+
+#define KWFE_MAX_PATH_LENGTH        0xFFF0
+
+// Band energies more than 30 dB (5 in log2) below the strongest band are
+// raised to that level.
+#define KWFE_DYNAMIC_RANGE_Q8       (5 << 8)
+
+//
+// Periodic Hann window, Q15.
+//
+static const short g_KwfeWindow[KWFE_FFT_SIZE] =
+{
+         0,      5,     20,     44,     79,    123,    177,    241,    315,    398,    491,    593,
+       705,    827,    958,   1098,   1247,   1406,   1573,   1749,   1935,   2128,   2331,   2542,
+      2761,   2989,   3224,   3468,   3719,   3978,   4244,   4518,   4799,   5086,   5381,   5682,
+      5990,   6304,   6624,   6950,   7281,   7618,   7961,   8308,   8660,   9017,   9379,   9744,
+     10114,  10487,  10864,  11244,  11628,  12014,  12403,  12794,  13187,  13583,  13980,  14378,
+     14778,  15178,  15580,  15981,  16383,  16786,  17187,  17589,  17989,  18389,  18787,  19184,
+     19580,  19973,  20364,  20753,  21139,  21523,  21903,  22280,  22653,  23023,  23388,  23750,
+     24107,  24459,  24806,  25149,  25486,  25817,  26143,  26463,  26777,  27085,  27386,  27681,
+     27968,  28249,  28523,  28789,  29048,  29299,  29543,  29778,  30006,  30225,  30436,  30639,
+     30832,  31018,  31194,  31361,  31520,  31669,  31809,  31940,  32062,  32174,  32276,  32369,
+     32452,  32526,  32590,  32644,  32688,  32723,  32747,  32762,  32767,  32762,  32747,  32723,
+     32688,  32644,  32590,  32526,  32452,  32369,  32276,  32174,  32062,  31940,  31809,  31669,
+     31520,  31361,  31194,  31018,  30832,  30639,  30436,  30225,  30006,  29778,  29543,  29299,
+     29048,  28789,  28523,  28249,  27968,  27681,  27386,  27085,  26777,  26463,  26143,  25817,
+     25486,  25149,  24806,  24459,  24107,  23750,  23388,  23023,  22653,  22280,  21903,  21523,
+     21139,  20753,  20364,  19973,  19580,  19184,  18787,  18389,  17989,  17589,  17187,  16786,
+     16384,  15981,  15580,  15178,  14778,  14378,  13980,  13583,  13187,  12794,  12403,  12014,
+     11628,  11244,  10864,  10487,  10114,   9744,   9379,   9017,   8660,   8308,   7961,   7618,
+      7281,   6950,   6624,   6304,   5990,   5682,   5381,   5086,   4799,   4518,   4244,   3978,
+      3719,   3468,   3224,   2989,   2761,   2542,   2331,   2128,   1935,   1749,   1573,   1406,
+      1247,   1098,    958,    827,    705,    593,    491,    398,    315,    241,    177,    123,
+        79,     44,     20,      5,
+};
+
+//
+// cos(2 pi k / N) and sin(2 pi k / N) for k < N / 2, Q15.
+//
+static const short g_KwfeCos[KWFE_FFT_SIZE / 2] =
+{
+     32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,  32137,  31971,  31785,  31580,
+     31356,  31113,  30852,  30571,  30273,  29956,  29621,  29268,  28898,  28510,  28105,  27683,
+     27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,  23170,  22594,  22005,  21403,
+     20787,  20159,  19519,  18868,  18204,  17530,  16846,  16151,  15446,  14732,  14010,  13279,
+     12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,   6393,   5602,   4808,   4011,
+      3212,   2410,   1608,    804,      0,   -804,  -1608,  -2410,  -3212,  -4011,  -4808,  -5602,
+     -6393,  -7179,  -7962,  -8739,  -9512, -10278, -11039, -11793, -12539, -13279, -14010, -14732,
+    -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+    -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790, -27245, -27683, -28105, -28510,
+    -28898, -29268, -29621, -29956, -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+    -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+};
+
+static const short g_KwfeSin[KWFE_FFT_SIZE / 2] =
+{
+         0,    804,   1608,   2410,   3212,   4011,   4808,   5602,   6393,   7179,   7962,   8739,
+      9512,  10278,  11039,  11793,  12539,  13279,  14010,  14732,  15446,  16151,  16846,  17530,
+     18204,  18868,  19519,  20159,  20787,  21403,  22005,  22594,  23170,  23731,  24279,  24811,
+     25329,  25832,  26319,  26790,  27245,  27683,  28105,  28510,  28898,  29268,  29621,  29956,
+     30273,  30571,  30852,  31113,  31356,  31580,  31785,  31971,  32137,  32285,  32412,  32521,
+     32609,  32678,  32728,  32757,  32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,
+     32137,  31971,  31785,  31580,  31356,  31113,  30852,  30571,  30273,  29956,  29621,  29268,
+     28898,  28510,  28105,  27683,  27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,
+     23170,  22594,  22005,  21403,  20787,  20159,  19519,  18868,  18204,  17530,  16846,  16151,
+     15446,  14732,  14010,  13279,  12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,
+      6393,   5602,   4808,   4011,   3212,   2410,   1608,    804,
+};
+
+//
+// Mel filter bank, 125 Hz to 7.6 kHz. Band b rises from bin [b] to bin
+// [b + 1] and falls to bin [b + 2].
+//
+static const unsigned char g_KwfeMelBins[KWFE_MEL_BANDS + 2] =
+{
+         2,      4,      6,      9,     12,     15,     19,     23,     28,     34,     40,     48,
+        56,     66,     77,     90,    105,    122,
+};
+
+//
+// log2(Value) in Q8, linear between powers of two. Value must be > 0.
+//
+static int KwfeLog2Q8(unsigned long long Value)
+{
+    int msb = 63;
+
+    while ((Value & (1ULL << msb)) == 0)
+    {
+        msb--;
+    }
+
+    // The 8 bits below the leading one are the fraction.
+    unsigned int fraction = (msb >= 8) ? (unsigned int)(Value >> (msb - 8)) & 0xFF
+                                       : (unsigned int)(Value << (8 - msb)) & 0xFF;
+
+    return (msb << 8) | (int)fraction;
+}
+
+//=============================================================================
+// KeywordFrontEnd
+//=============================================================================
+
+void KeywordFrontEnd::Reset()
+{
+    m_NoiseFloor = 0;
+    m_Hangover = 0;
+
+    for (int i = 0; i < KWFE_FFT_SIZE - KWFE_FRAME_SAMPLES; i++)
+    {
+        m_History[i] = 0;
+    }
+}
+
+bool KeywordFrontEnd::ProcessPacket
+(
+    const short *   Samples,
+    short *         Features
+)
+{
+    const int historySamples = KWFE_FFT_SIZE - KWFE_FRAME_SAMPLES;
+    unsigned long long energy = 0;
+    bool produced = false;
+
+    //
+    // Energy VAD.
+    //
+    for (int i = 0; i < KWFE_FRAME_SAMPLES; i++)
+    {
+        energy += (unsigned long long)((int)Samples[i] * (int)Samples[i]);
+    }
+
+    if (m_NoiseFloor == 0)
+    {
+        m_NoiseFloor = (energy > KWFE_MIN_ENERGY) ? energy : KWFE_MIN_ENERGY;
+    }
+
+    if (energy > KWFE_MIN_ENERGY && energy > m_NoiseFloor * KWFE_SPEECH_RATIO)
+    {
+        m_Hangover = KWFE_HANGOVER_PACKETS;
+    }
+    else
+    {
+        // Track the floor only outside speech: fall at once, rise slowly.
+        if (energy < m_NoiseFloor)
+        {
+            m_NoiseFloor = (energy > KWFE_MIN_ENERGY) ? energy : KWFE_MIN_ENERGY;
+        }
+        else
+        {
+            m_NoiseFloor += (energy - m_NoiseFloor) >> KWFE_NOISE_RISE_SHIFT;
+        }
+
+        if (m_Hangover > 0)
+        {
+            m_Hangover--;
+        }
+    }
+
+    //
+    // Features, only while there is speech.
+    //
+    if (m_Hangover > 0)
+    {
+        for (int i = 0; i < historySamples; i++)
+        {
+            m_Frame[i] = (short)(((int)m_History[i] * g_KwfeWindow[i]) >> 15);
+        }
+        for (int i = 0; i < KWFE_FRAME_SAMPLES; i++)
+        {
+            m_Frame[historySamples + i] = (short)(((int)Samples[i] * g_KwfeWindow[historySamples + i]) >> 15);
+        }
+
+        ComputeFeatures(Features);
+        produced = true;
+    }
+
+    //
+    // Keep the tail of this packet for the next window.
+    //
+    for (int i = 0; i < historySamples; i++)
+    {
+        m_History[i] = Samples[KWFE_FRAME_SAMPLES - historySamples + i];
+    }
+
+    return produced;
+}
+
+void KeywordFrontEnd::ComputeFeatures
+(
+    short *         Features
+)
+{
+    int logEnergy[KWFE_MEL_BANDS];
+    int peak = 0;
+    int mean = 0;
+
+    //
+    // Bit reversed load of the windowed frame.
+    //
+    for (int i = 0; i < KWFE_FFT_SIZE; i++)
+    {
+        unsigned int r = 0;
+        for (int b = 0; b < KWFE_FFT_LOG2; b++)
+        {
+            r |= ((i >> b) & 1) << (KWFE_FFT_LOG2 - 1 - b);
+        }
+        m_Re[r] = m_Frame[i];
+        m_Im[r] = 0;
+    }
+
+    //
+    // Radix-2 decimation in time. Every stage halves the values, so they
+    // stay within 16 bits and the result is the DFT divided by N.
+    //
+    for (int half = 1, step = KWFE_FFT_SIZE / 2; half < KWFE_FFT_SIZE; half <<= 1, step >>= 1)
+    {
+        for (int k = 0; k < KWFE_FFT_SIZE; k += 2 * half)
+        {
+            for (int j = 0; j < half; j++)
+            {
+                int wr = g_KwfeCos[j * step];
+                int wi = -g_KwfeSin[j * step];
+                int a = k + j;
+                int b = a + half;
+
+                int tr = (int)(((long long)m_Re[b] * wr - (long long)m_Im[b] * wi) >> 15);
+                int ti = (int)(((long long)m_Re[b] * wi + (long long)m_Im[b] * wr) >> 15);
+
+                m_Re[b] = (m_Re[a] - tr) >> 1;
+                m_Im[b] = (m_Im[a] - ti) >> 1;
+                m_Re[a] = (m_Re[a] + tr) >> 1;
+                m_Im[a] = (m_Im[a] + ti) >> 1;
+            }
+        }
+    }
+
+    //
+    // Triangular mel bands over the power spectrum, Q8 weights.
+    //
+    for (int band = 0; band < KWFE_MEL_BANDS; band++)
+    {
+        int lo = g_KwfeMelBins[band];
+        int center = g_KwfeMelBins[band + 1];
+        int hi = g_KwfeMelBins[band + 2];
+        unsigned long long bandEnergy = 1;
+
+        for (int k = lo; k < hi; k++)
+        {
+            unsigned long long power = (unsigned long long)((long long)m_Re[k] * m_Re[k] + (long long)m_Im[k] * m_Im[k]);
+            unsigned int weight = (k < center) ? (unsigned int)(((k - lo) << 8) / (center - lo))
+                                               : (unsigned int)(((hi - k) << 8) / (hi - center));
+            bandEnergy += (power * weight) >> 8;
+        }
+
+        logEnergy[band] = KwfeLog2Q8(bandEnergy);
+        if (logEnergy[band] > peak)
+        {
+            peak = logEnergy[band];
+        }
+    }
+
+    //
+    // Limit the dynamic range so bands holding only noise all look alike,
+    // then remove the mean.
+    //
+    for (int band = 0; band < KWFE_MEL_BANDS; band++)
+    {
+        if (logEnergy[band] < peak - KWFE_DYNAMIC_RANGE_Q8)
+        {
+            logEnergy[band] = peak - KWFE_DYNAMIC_RANGE_Q8;
+        }
+        mean += logEnergy[band];
+    }
+
+    mean /= KWFE_MEL_BANDS;
+
+    for (int band = 0; band < KWFE_MEL_BANDS; band++)
+    {
+        Features[band] = (short)(logEnergy[band] - mean);
+    }
+}
+
+//=============================================================================
+// KeywordScorer
+//=============================================================================
+
+void KeywordScorer::Score
+(
+    const KWFE_CODEBOOK *   Codebook,
+    const short *           Features
+)
+{
+    unsigned int count = Codebook->Count;
+
+    if (count > KWFE_MAX_CODEWORDS)
+    {
+        count = KWFE_MAX_CODEWORDS;
+    }
+
+    for (unsigned int c = 0; c < count; c++)
+    {
+        const short * codeword = Codebook->Frames + c * KWFE_MEL_BANDS;
+        unsigned int distance = 0;
+
+        for (int band = 0; band < KWFE_MEL_BANDS; band++)
+        {
+            int d = (int)Features[band] - (int)codeword[band];
+            distance += (unsigned int)(d < 0 ? -d : d);
+        }
+
+        m_Distance[c] = distance;
+    }
+}
+
+//=============================================================================
+// KeywordMatcher
+//=============================================================================
+
+//
+// True if path A has a lower average cost than path B.
+//
+static bool KwfeIsBetter(unsigned int CostA, unsigned int LengthA, unsigned int CostB, unsigned int LengthB)
+{
+    return (unsigned long long)CostA * LengthB < (unsigned long long)CostB * LengthA;
+}
+
+void KeywordMatcher::Reset()
+{
+    m_Valid = false;
+    m_LastScore = 0xFFFFFFFF;
+    m_LastStart = 0;
+}
+
+bool KeywordMatcher::Push
+(
+    const KWFE_TEMPLATE *   Template,
+    const unsigned int *    CodeDistances,
+    unsigned int            Threshold,
+    unsigned int            FrameNumber
+)
+{
+    unsigned int frames = Template->FrameCount;
+    unsigned int diagCost = 0;
+    unsigned int diagLength = 0;
+    unsigned int diagStart = 0;
+
+    if (frames == 0 || frames > KWFE_MAX_TEMPLATE_FRAMES || Template->Codes == 0)
+    {
+        return false;
+    }
+
+    for (unsigned int j = 0; j < frames; j++)
+    {
+        unsigned int distance = CodeDistances[Template->Codes[j]];
+        unsigned int cost;
+        unsigned int length;
+        unsigned int start;
+
+        if (j == 0)
+        {
+            // A new path may start at every frame.
+            cost = 0;
+            length = 0;
+            start = FrameNumber;
+            if (m_Valid && KwfeIsBetter(m_Cost[0] + distance, m_Length[0] + 1, distance, 1))
+            {
+                cost = m_Cost[0];
+                length = m_Length[0];
+                start = m_Start[0];
+            }
+        }
+        else
+        {
+            // Vertical: the new column's previous template frame.
+            cost = m_Cost[j - 1];
+            length = m_Length[j - 1];
+            start = m_Start[j - 1];
+
+            if (m_Valid)
+            {
+                // Diagonal: the old column's previous template frame.
+                if (KwfeIsBetter(diagCost, diagLength, cost, length))
+                {
+                    cost = diagCost;
+                    length = diagLength;
+                    start = diagStart;
+                }
+                // Horizontal: the old column's same template frame.
+                if (KwfeIsBetter(m_Cost[j], m_Length[j], cost, length))
+                {
+                    cost = m_Cost[j];
+                    length = m_Length[j];
+                    start = m_Start[j];
+                }
+            }
+        }
+
+        // The old value becomes the next frame's diagonal.
+        if (m_Valid)
+        {
+            diagCost = m_Cost[j];
+            diagLength = m_Length[j];
+            diagStart = m_Start[j];
+        }
+
+        if (length >= KWFE_MAX_PATH_LENGTH)
+        {
+            // Keep the average, shorten the path.
+            cost >>= 1;
+            length >>= 1;
+        }
+
+        m_Cost[j] = cost + distance;
+        m_Length[j] = (unsigned short)(length + 1);
+        m_Start[j] = start;
+    }
+
+    m_Valid = true;
+    m_LastScore = m_Cost[frames - 1] / m_Length[frames - 1];
+    m_LastStart = m_Start[frames - 1];
+
+    if (m_LastScore <= Threshold)
+    {
+        // Start over so one utterance is reported once, the score stays
+        // available to the caller.
+        m_Valid = false;
+        return true;
+    }
+
+    return false;
+}
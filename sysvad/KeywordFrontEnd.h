@@ -0,0 +1,177 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    KeywordFrontEnd.h
+
+Abstract:
+
+    Declaration of the SYSVAD keyword detection front end: an energy based
+    voice activity detector, a fixed-point log-mel feature extractor, a
+    codebook scorer shared by all keyword models and a streaming DTW
+    template matcher per model.
+
+    This module only does integer arithmetic on caller supplied memory and
+    has no kernel or Windows dependencies, so it builds unchanged for a host
+    benchmark.
+
+
+--*/
+#ifndef _SYSVAD_KEYWORDFRONTEND_H
+#define _SYSVAD_KEYWORDFRONTEND_H
+
+#define KWFE_SAMPLE_RATE            16000
+#define KWFE_FRAME_SAMPLES          160     // One 10 ms packet.
+#define KWFE_FFT_SIZE               256
+#define KWFE_FFT_LOG2               8
+#define KWFE_MEL_BANDS              16
+#define KWFE_MAX_TEMPLATE_FRAMES    100     // 1 second of features.
+#define KWFE_MAX_CODEWORDS          256
+
+//
+// Feature frames shared by all keyword templates: Count frames of
+// KWFE_MEL_BANDS log-mel values each (Q8 log2, mean removed), as produced
+// by KeywordFrontEnd.
+//
+typedef struct _KWFE_CODEBOOK
+{
+    unsigned int    Count;                  // At most KWFE_MAX_CODEWORDS.
+    const short *   Frames;                 // Count * KWFE_MEL_BANDS values.
+} KWFE_CODEBOOK;
+
+//
+// A keyword template: FrameCount indices into the codebook.
+//
+typedef struct _KWFE_TEMPLATE
+{
+    unsigned int            FrameCount;
+    unsigned int            Threshold;      // Largest average per-frame distance that still matches.
+    const unsigned char *   Codes;          // FrameCount codebook indices.
+} KWFE_TEMPLATE;
+
+///////////////////////////////////////////////////////////////////////////////
+// KeywordFrontEnd
+//   Turns 10 ms packets of 16 kHz 16-bit mono audio into one feature frame
+//   per packet while the VAD reports speech.
+//
+class KeywordFrontEnd
+{
+public:
+    void
+    Reset();
+
+    //
+    // Processes one packet. Returns true and fills Features when the packet
+    // is speech (or within the hangover after speech), false otherwise; the
+    // FFT is skipped entirely for non-speech packets.
+    //
+    bool
+    ProcessPacket
+    (
+        const short *   Samples,            // KWFE_FRAME_SAMPLES samples.
+        short *         Features            // KWFE_MEL_BANDS values.
+    );
+
+    bool
+    IsSpeech() const
+    {
+        return m_Hangover > 0;
+    }
+
+private:
+    void
+    ComputeFeatures
+    (
+        short *         Features
+    );
+
+    // VAD state.
+    unsigned long long  m_NoiseFloor;       // Average energy of non-speech packets.
+    int                 m_Hangover;         // Packets left before speech ends.
+
+    // Analysis window overlap and FFT work area.
+    short               m_History[KWFE_FFT_SIZE - KWFE_FRAME_SAMPLES];
+    short               m_Frame[KWFE_FFT_SIZE];
+    int                 m_Re[KWFE_FFT_SIZE];
+    int                 m_Im[KWFE_FFT_SIZE];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// KeywordScorer
+//   Distance of one feature frame to every codeword. Computed once per
+//   packet and shared by every armed model, so the per-model cost of a
+//   frame is a table lookup instead of a KWFE_MEL_BANDS wide distance.
+//
+class KeywordScorer
+{
+public:
+    void
+    Score
+    (
+        const KWFE_CODEBOOK *   Codebook,
+        const short *           Features    // KWFE_MEL_BANDS values.
+    );
+
+    const unsigned int *
+    GetDistances() const
+    {
+        return m_Distance;
+    }
+
+private:
+    unsigned int        m_Distance[KWFE_MAX_CODEWORDS];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// KeywordMatcher
+//   Subsequence DTW of the incoming feature frames against one template.
+//   The keyword may start at any frame; the score is the average per-frame
+//   distance of the best path ending at the current frame.
+//
+class KeywordMatcher
+{
+public:
+    void
+    Reset();
+
+    //
+    // Adds one feature frame, given as its distances to every codeword,
+    // and the caller's number for it. Returns true if the best path
+    // through the whole template scores at or below Threshold.
+    //
+    bool
+    Push
+    (
+        const KWFE_TEMPLATE *   Template,
+        const unsigned int *    CodeDistances,
+        unsigned int            Threshold,
+        unsigned int            FrameNumber
+    );
+
+    unsigned int
+    GetLastScore() const
+    {
+        return m_LastScore;
+    }
+
+    //
+    // Number of the frame the best path of the last Push started at.
+    //
+    unsigned int
+    GetLastStart() const
+    {
+        return m_LastStart;
+    }
+
+private:
+    unsigned int        m_Cost[KWFE_MAX_TEMPLATE_FRAMES];   // Accumulated distance per template frame.
+    unsigned short      m_Length[KWFE_MAX_TEMPLATE_FRAMES]; // Path length per template frame.
+    unsigned int        m_Start[KWFE_MAX_TEMPLATE_FRAMES];  // First frame of the path per template frame.
+    bool                m_Valid;
+    unsigned int        m_LastScore;
+    unsigned int        m_LastStart;
+};
+
+#endif // _SYSVAD_KEYWORDFRONTEND_H
@@ -0,0 +1,1054 @@
+//
+// KeywordHost.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Times the keyword detector's portable modules outside the driver
+//
+//  KeywordHost runs each case named on the command line over generated
+//  audio, one 10 ms packet at a time, the way CKeywordDetector's DPC
+//  calls them. For each case it reports the time per packet, that time as
+//  a share of the 10 ms the packet lasts, the slowest single packet and a
+//  checksum of what the case produced, so a change to a module can be
+//  checked for speed and for its output. The audio is streamed several
+//  times over and the times are the median pass's.
+//
+//      KeywordHost [options] case ...
+//
+//  See Usage for the cases and options.
+//
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "KeywordFrontEnd.h"
+#include "KeywordDecimator.h"
+
+#define HOST_PACKET_NS          10000000ull     // 10 ms.
+#define HOST_PI                 3.14159265358979323846
+
+typedef struct _HOST_OPTIONS
+{
+    double          f64Seconds;
+    unsigned int    uPasses;
+    unsigned int    uModels;                    // Armed keyword models.
+    unsigned int    uCodewords;
+    unsigned int    uTemplateFrames;
+    unsigned int    uInputRate;                 // Decimator input.
+    unsigned int    uInputChannels;
+    unsigned int    uInputFormat;               // Index into g_apszFormats.
+    unsigned int    uQueuePackets;              // Packets each queue holds.
+    unsigned int    uBurstPackets;              // Packets the producer queues at a time.
+    unsigned int    uStreamPackets;             // Packets streamed through a queue per pass.
+    bool            fCsv;
+} HOST_OPTIONS;
+
+// Decimator input formats, in KWDEC_SAMPLE_TYPE order.
+static const char *g_apszFormats[] = { "pcm16", "pcm24", "pcm32", "float" };
+
+//
+// What one case did over one pass.
+//
+typedef struct _HOST_RESULT
+{
+    unsigned long long  u64Nanoseconds;
+    unsigned long long  u64MaxNanoseconds;      // Slowest packet.
+    unsigned long long  u64Checksum;
+    unsigned int        uPackets;
+    unsigned int        uActivePackets;         // Packets that did more than the cheapest path.
+} HOST_RESULT;
+
+//
+// One case, with the state the driver would keep for it between packets.
+//
+class CHostCase
+{
+public:
+    virtual ~CHostCase() {}
+
+    virtual const char *GetName() = 0;
+
+    // Sets up fresh state, returns false if the case cannot run.
+    virtual bool Initialize(const HOST_OPTIONS *pOptions) = 0;
+
+    // Processes every packet once.
+    virtual void Run(HOST_RESULT *pResult) = 0;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Folds bytes into a 64 bit FNV-1a checksum.
+//
+static unsigned long long UpdateChecksum(unsigned long long u64Checksum, const void *pvBytes, size_t cBytes)
+{
+    const unsigned char *pu8Bytes = (const unsigned char *)pvBytes;
+
+    for (size_t i = 0; i < cBytes; i++)
+    {
+        u64Checksum = (u64Checksum ^ pu8Bytes[i]) * 0x100000001B3ull;
+    }
+
+    return u64Checksum;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Reproducible 24 bit random numbers.
+//
+static unsigned int NextRandom(unsigned int *pu32State)
+{
+    *pu32State = *pu32State * 1664525 + 1013904223;
+    return *pu32State >> 8;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Reproducible white noise, uniform within +/- u32Peak.
+//
+static int NextNoise(unsigned int *pu32State, unsigned int u32Peak)
+{
+    return (int)(NextRandom(pu32State) % (2 * u32Peak + 1)) - (int)u32Peak;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Fills Samples with f64Seconds of 16 kHz mono: a noise floor at about
+//  -72 dBFS, below the VAD's minimum, and if fSpeech words of voiced
+//  sound around -20 dBFS. A word is 400 ms of a 110 to 150 Hz pitch glide
+//  with harmonics up to 4 kHz falling 6 dB per octave, faded in and out,
+//  followed by 200 ms of the noise floor.
+//
+static void GenerateAudio(std::vector<short> &Samples, double f64Seconds, bool fSpeech)
+{
+    const unsigned int uWordSamples = KWFE_SAMPLE_RATE * 400 / 1000;
+    const unsigned int uGapSamples = KWFE_SAMPLE_RATE * 200 / 1000;
+    unsigned int uPackets = (unsigned int)(f64Seconds * KWFE_SAMPLE_RATE / KWFE_FRAME_SAMPLES);
+    unsigned int u32State = 0x12345678;
+    double f64Phase = 0.0;
+
+    Samples.resize(uPackets * KWFE_FRAME_SAMPLES);
+
+    for (size_t i = 0; i < Samples.size(); i++)
+    {
+        // The audio starts with a gap, so the VAD learns the floor first.
+        unsigned int uInWord = (unsigned int)(i % (uWordSamples + uGapSamples));
+        double f64Sample = NextNoise(&u32State, 14);
+
+        if (fSpeech && (uInWord >= uGapSamples))
+        {
+            double f64Position = (double)(uInWord - uGapSamples) / uWordSamples;
+            double f64Pitch = 110.0 + 40.0 * f64Position;
+            double f64Envelope = 0.5 - 0.5 * cos(2.0 * HOST_PI * f64Position);
+            double f64Voiced = 0.0;
+
+            f64Phase += 2.0 * HOST_PI * f64Pitch / KWFE_SAMPLE_RATE;
+            for (unsigned int h = 1; h * f64Pitch < 4000.0; h++)
+            {
+                f64Voiced += sin(h * f64Phase) / h;
+            }
+
+            f64Sample += 3300.0 * f64Envelope * f64Voiced;
+        }
+
+        Samples[i] = (short)f64Sample;
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The detection pipeline of CKeywordDetector::RunDetection: the front
+//  end on every packet, and on speech packets the scorer against the
+//  codebook and every armed model's matcher. The codebook and templates
+//  are random; the thresholds are 0, which never match, so every matcher
+//  runs on every speech packet as it does until a keyword is found.
+//
+class CHostDetect : public CHostCase
+{
+public:
+    CHostDetect(bool fSpeech) : m_fSpeech(fSpeech) {}
+
+    const char *GetName() { return m_fSpeech ? "speech" : "silence"; }
+
+    bool Initialize(const HOST_OPTIONS *pOptions)
+    {
+        unsigned int u32State = 0x9E3779B9;
+
+        if ((pOptions->uModels == 0) || (pOptions->uModels > MaxModels) ||
+            (pOptions->uCodewords == 0) || (pOptions->uCodewords > KWFE_MAX_CODEWORDS) ||
+            (pOptions->uTemplateFrames == 0) || (pOptions->uTemplateFrames > KWFE_MAX_TEMPLATE_FRAMES))
+        {
+            return false;
+        }
+
+        GenerateAudio(m_Samples, pOptions->f64Seconds, m_fSpeech);
+
+        // Features are Q8 log2 energies with the mean removed, within
+        // about +/- 5 in log2.
+        m_Codewords.resize(pOptions->uCodewords * KWFE_MEL_BANDS);
+        for (size_t i = 0; i < m_Codewords.size(); i++)
+        {
+            m_Codewords[i] = (short)NextNoise(&u32State, 5 << 8);
+        }
+        m_Codebook.Count = pOptions->uCodewords;
+        m_Codebook.Frames = m_Codewords.data();
+
+        m_uModels = pOptions->uModels;
+        m_Codes.resize(m_uModels * pOptions->uTemplateFrames);
+        for (size_t i = 0; i < m_Codes.size(); i++)
+        {
+            m_Codes[i] = (unsigned char)(NextRandom(&u32State) % pOptions->uCodewords);
+        }
+        for (unsigned int m = 0; m < m_uModels; m++)
+        {
+            m_Templates[m].FrameCount = pOptions->uTemplateFrames;
+            m_Templates[m].Threshold = 0;
+            m_Templates[m].Codes = &m_Codes[m * pOptions->uTemplateFrames];
+        }
+
+        return true;
+    }
+
+    void Run(HOST_RESULT *pResult)
+    {
+        unsigned int uPackets = (unsigned int)(m_Samples.size() / KWFE_FRAME_SAMPLES);
+        auto Last = std::chrono::steady_clock::now();
+        auto Start = Last;
+
+        m_FrontEnd.Reset();
+        for (unsigned int m = 0; m < m_uModels; m++)
+        {
+            m_Matchers[m].Reset();
+        }
+
+        for (unsigned int p = 0; p < uPackets; p++)
+        {
+            bool fSpeech = ProcessPacket(&m_Samples[p * KWFE_FRAME_SAMPLES], p);
+            auto Now = std::chrono::steady_clock::now();
+            unsigned long long u64Nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(Now - Last).count();
+
+            pResult->u64MaxNanoseconds = std::max(pResult->u64MaxNanoseconds, u64Nanoseconds);
+            Last = Now;
+
+            if (fSpeech)
+            {
+                pResult->uActivePackets++;
+                pResult->u64Checksum = UpdateChecksum(pResult->u64Checksum, m_Features, sizeof(m_Features));
+            }
+        }
+
+        pResult->u64Nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(Last - Start).count();
+        pResult->uPackets = uPackets;
+    }
+
+private:
+    static const unsigned int MaxModels = 32;  // CKeywordDetector::MaxKeywordModels.
+
+    bool ProcessPacket(const short *pSamples, unsigned int uPacket)
+    {
+        if (!m_FrontEnd.ProcessPacket(pSamples, m_Features))
+        {
+            for (unsigned int m = 0; m < m_uModels; m++)
+            {
+                m_Matchers[m].Reset();
+            }
+            return false;
+        }
+
+        m_Scorer.Score(&m_Codebook, m_Features);
+
+        for (unsigned int m = 0; m < m_uModels; m++)
+        {
+            m_Matchers[m].Push(&m_Templates[m], m_Scorer.GetDistances(), m_Templates[m].Threshold, uPacket);
+        }
+
+        return true;
+    }
+
+    bool                        m_fSpeech;
+    std::vector<short>          m_Samples;
+    std::vector<short>          m_Codewords;
+    std::vector<unsigned char>  m_Codes;
+    KWFE_CODEBOOK               m_Codebook;
+    KWFE_TEMPLATE               m_Templates[MaxModels];
+    unsigned int                m_uModels;
+
+    KeywordFrontEnd             m_FrontEnd;
+    KeywordScorer               m_Scorer;
+    KeywordMatcher              m_Matchers[MaxModels];
+    short                       m_Features[KWFE_MEL_BANDS];
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The capture tap's KeywordDecimator::Process on one 10 ms packet of the
+//  host capture format at a time, as the owner's DPC calls it. The input
+//  is a 1 kHz tone at -6 dBFS with -40 dBFS of noise, its phase turned on
+//  each channel so the downmix does not cancel it.
+//
+class CHostDecimate : public CHostCase
+{
+public:
+    const char *GetName() { return "decimate"; }
+
+    bool Initialize(const HOST_OPTIONS *pOptions)
+    {
+        static const unsigned int au32BytesPerSample[] = { 2, 3, 4, 4 };
+        KWDEC_SAMPLE_TYPE eSampleType = (KWDEC_SAMPLE_TYPE)pOptions->uInputFormat;
+        unsigned int u32BytesPerSample = au32BytesPerSample[pOptions->uInputFormat];
+        unsigned int u32Frames = (unsigned int)(pOptions->f64Seconds * pOptions->uInputRate);
+        unsigned int u32State = 0x12345678;
+
+        // A packet is a whole number of frames.
+        if ((pOptions->uInputRate % 100) != 0)
+        {
+            return false;
+        }
+
+        m_Coefficients.resize(KeywordDecimator::GetCoefficientCount(pOptions->uInputRate));
+        if (!m_Decimator.Init(pOptions->uInputRate, pOptions->uInputChannels, eSampleType,
+                              m_Coefficients.data(), (unsigned int)m_Coefficients.size()))
+        {
+            return false;
+        }
+
+        m_u32PacketBytes = pOptions->uInputRate / 100 * pOptions->uInputChannels * u32BytesPerSample;
+        m_Output.resize(KWFE_FRAME_SAMPLES + 2);
+        m_Input.resize((size_t)u32Frames * pOptions->uInputChannels * u32BytesPerSample);
+
+        for (unsigned int i = 0; i < u32Frames; i++)
+        {
+            for (unsigned int c = 0; c < pOptions->uInputChannels; c++)
+            {
+                unsigned char *pu8Sample = &m_Input[((size_t)i * pOptions->uInputChannels + c) * u32BytesPerSample];
+                double f64Sample = 0.5 * sin(2.0 * HOST_PI * (1000.0 * i / pOptions->uInputRate + (double)c / (2 * pOptions->uInputChannels))) +
+                                   NextNoise(&u32State, 1 << 20) / 104857600.0;
+                int i32Sample = (int)(f64Sample * 2147483647.0);
+
+                if (eSampleType == KwdecFloat32)
+                {
+                    float f32Sample = (float)f64Sample;
+                    memcpy(&i32Sample, &f32Sample, sizeof(i32Sample));
+                }
+
+                // Little endian, the top u32BytesPerSample bytes of the
+                // Q31 value.
+                for (unsigned int b = 0; b < u32BytesPerSample; b++)
+                {
+                    pu8Sample[b] = (unsigned char)((unsigned int)i32Sample >> (8 * (4 - u32BytesPerSample + b)));
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void Run(HOST_RESULT *pResult)
+    {
+        unsigned int uPackets = (unsigned int)(m_Input.size() / m_u32PacketBytes);
+        auto Last = std::chrono::steady_clock::now();
+        auto Start = Last;
+
+        m_Decimator.Reset();
+
+        for (unsigned int p = 0; p < uPackets; p++)
+        {
+            unsigned int uProduced = m_Decimator.Process(&m_Input[(size_t)p * m_u32PacketBytes], m_u32PacketBytes, m_Output.data());
+            auto Now = std::chrono::steady_clock::now();
+            unsigned long long u64Nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(Now - Last).count();
+
+            pResult->u64MaxNanoseconds = std::max(pResult->u64MaxNanoseconds, u64Nanoseconds);
+            Last = Now;
+
+            pResult->u64Checksum = UpdateChecksum(pResult->u64Checksum, m_Output.data(), uProduced * sizeof(short));
+        }
+
+        pResult->u64Nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(Last - Start).count();
+        pResult->uPackets = uPackets;
+        pResult->uActivePackets = uPackets;
+    }
+
+private:
+    KeywordDecimator            m_Decimator;
+    std::vector<short>          m_Coefficients;
+    std::vector<unsigned char>  m_Input;
+    std::vector<short>          m_Output;
+    unsigned int                m_u32PacketBytes;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Just enough of the WDM list and spin lock routines for the list queue
+//  to read as the driver's did. The spin lock yields while it waits,
+//  since unlike a DPC the thread holding it may be preempted.
+//
+typedef struct _LIST_ENTRY
+{
+    struct _LIST_ENTRY  *Flink;
+    struct _LIST_ENTRY  *Blink;
+} LIST_ENTRY;
+
+typedef std::atomic<bool> KSPIN_LOCK;
+
+#define CONTAINING_RECORD(address, type, field) ((type *)((char *)(address) - offsetof(type, field)))
+
+static void InitializeListHead(LIST_ENTRY *pHead)
+{
+    pHead->Flink = pHead->Blink = pHead;
+}
+
+static bool IsListEmpty(const LIST_ENTRY *pHead)
+{
+    return pHead->Flink == pHead;
+}
+
+static LIST_ENTRY *ExInterlockedInsertTailList(LIST_ENTRY *pHead, LIST_ENTRY *pEntry, KSPIN_LOCK *pLock)
+{
+    while (pLock->exchange(true, std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+
+    LIST_ENTRY *pLast = pHead->Blink;
+
+    pEntry->Flink = pHead;
+    pEntry->Blink = pLast;
+    pLast->Flink = pEntry;
+    pHead->Blink = pEntry;
+
+    pLock->store(false, std::memory_order_release);
+
+    return (pLast == pHead) ? NULL : pLast;
+}
+
+static LIST_ENTRY *ExInterlockedRemoveHeadList(LIST_ENTRY *pHead, KSPIN_LOCK *pLock)
+{
+    LIST_ENTRY *pEntry = NULL;
+
+    while (pLock->exchange(true, std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+
+    if (!IsListEmpty(pHead))
+    {
+        pEntry = pHead->Flink;
+        pHead->Flink = pEntry->Flink;
+        pEntry->Flink->Blink = pHead;
+    }
+
+    pLock->store(false, std::memory_order_release);
+
+    return pEntry;
+}
+
+//
+// A keyword packet as CKeywordDetector keeps it, padded to whole cache
+// lines. ListEntry is only used by the list queue.
+//
+typedef struct alignas(64) _HOST_PACKET
+{
+    LIST_ENTRY          ListEntry;
+    long long           PacketNumber;
+    long long           QpcWhenSampled;         // steady_clock ns when queued.
+    unsigned short      Samples[KWFE_FRAME_SAMPLES];
+} HOST_PACKET;
+
+//
+// What one queue did over one pass.
+//
+typedef struct _HOST_QUEUE_RESULT
+{
+    unsigned long long  u64Nanoseconds;
+    unsigned long long  u64Produced;
+    unsigned long long  u64Read;
+    unsigned long long  u64MedianLatency;       // From queued to copied out, ns.
+    unsigned long long  u64P99Latency;
+    unsigned long long  u64MaxLatency;
+    unsigned long long  u64Errors;              // Packets out of order or torn.
+} HOST_QUEUE_RESULT;
+
+//
+// The keyword packet queue between CKeywordDetector::DpcRoutine, the
+// producer, and GetReadPacket, the consumer.
+//
+class CHostQueue
+{
+public:
+    virtual ~CHostQueue() {}
+
+    virtual const char *GetName() = 0;
+
+    virtual bool Initialize(unsigned int uPackets) = 0;
+
+    // Queues packet llPacketNumber, overwriting the oldest if full.
+    virtual void Produce(long long llPacketNumber) = 0;
+
+    // Copies the oldest queued packet out, returns false if there is none.
+    virtual bool Consume(unsigned short *pu16Samples, long long *pllPacketNumber, long long *pllQpc) = 0;
+};
+
+static long long GetHostQpc()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//
+// Every sample of a packet holds its number, so a torn copy shows.
+//
+static void FillPacket(HOST_PACKET *pPacket, long long llPacketNumber)
+{
+    pPacket->PacketNumber = llPacketNumber;
+    for (unsigned int i = 0; i < KWFE_FRAME_SAMPLES; i++)
+    {
+        pPacket->Samples[i] = (unsigned short)llPacketNumber;
+    }
+    pPacket->QpcWhenSampled = GetHostQpc();
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The packet lists CKeywordDetector used before the ring: a pool and a
+//  FIFO, each behind its own spin lock. The producer takes a packet from
+//  the pool, or on overrun the oldest from the FIFO, and queues it on the
+//  FIFO; the consumer takes it off the FIFO, copies it and returns it to
+//  the pool.
+//
+class CHostListQueue : public CHostQueue
+{
+public:
+    const char *GetName() { return "list"; }
+
+    bool Initialize(unsigned int uPackets)
+    {
+        m_Packets.assign(uPackets, HOST_PACKET());
+        InitializeListHead(&m_PoolHead);
+        InitializeListHead(&m_FifoHead);
+        m_PoolLock = false;
+        m_FifoLock = false;
+
+        for (unsigned int i = 0; i < uPackets; i++)
+        {
+            ExInterlockedInsertTailList(&m_PoolHead, &m_Packets[i].ListEntry, &m_PoolLock);
+        }
+
+        return uPackets > 0;
+    }
+
+    void Produce(long long llPacketNumber)
+    {
+        LIST_ENTRY *pListEntry;
+
+        do
+        {
+            pListEntry = ExInterlockedRemoveHeadList(&m_PoolHead, &m_PoolLock);
+            if (pListEntry != NULL) break;
+
+            pListEntry = ExInterlockedRemoveHeadList(&m_FifoHead, &m_FifoLock);
+            if (pListEntry != NULL) break;
+        } while (true);
+
+        FillPacket(CONTAINING_RECORD(pListEntry, HOST_PACKET, ListEntry), llPacketNumber);
+
+        ExInterlockedInsertTailList(&m_FifoHead, pListEntry, &m_FifoLock);
+    }
+
+    bool Consume(unsigned short *pu16Samples, long long *pllPacketNumber, long long *pllQpc)
+    {
+        LIST_ENTRY *pListEntry = ExInterlockedRemoveHeadList(&m_FifoHead, &m_FifoLock);
+
+        if (pListEntry == NULL)
+        {
+            return false;
+        }
+
+        HOST_PACKET *pPacket = CONTAINING_RECORD(pListEntry, HOST_PACKET, ListEntry);
+
+        *pllPacketNumber = pPacket->PacketNumber;
+        *pllQpc = pPacket->QpcWhenSampled;
+        memcpy(pu16Samples, pPacket->Samples, sizeof(pPacket->Samples));
+
+        ExInterlockedInsertTailList(&m_PoolHead, pListEntry, &m_PoolLock);
+
+        return true;
+    }
+
+private:
+    std::vector<HOST_PACKET>    m_Packets;
+    LIST_ENTRY                  m_PoolHead;
+    LIST_ENTRY                  m_FifoHead;
+    alignas(64) KSPIN_LOCK      m_PoolLock;
+    alignas(64) KSPIN_LOCK      m_FifoLock;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  The single producer, single consumer ring CKeywordDetector uses now,
+//  indexed by packet number. The producer publishes each packet with a
+//  release store of the last queued index; the consumer skips ahead on
+//  overrun and retries a copy the producer lapped, as GetReadPacket does.
+//
+class CHostRingQueue : public CHostQueue
+{
+public:
+    const char *GetName() { return "ring"; }
+
+    bool Initialize(unsigned int uPackets)
+    {
+        m_Packets.assign(uPackets, HOST_PACKET());
+        m_llPacketCount = uPackets;
+        m_llLastQueuedPacket = -1;
+        m_llNextReadPacket = 0;
+
+        // The overrun rule leaves one packet to the producer.
+        return uPackets > 1;
+    }
+
+    void Produce(long long llPacketNumber)
+    {
+        FillPacket(&m_Packets[llPacketNumber % m_llPacketCount], llPacketNumber);
+
+        m_llLastQueuedPacket.store(llPacketNumber, std::memory_order_release);
+    }
+
+    bool Consume(unsigned short *pu16Samples, long long *pllPacketNumber, long long *pllQpc)
+    {
+        long long llPacketNumber = m_llNextReadPacket;
+
+        for (;;)
+        {
+            long long llLastQueuedPacket = m_llLastQueuedPacket.load(std::memory_order_acquire);
+            if (llPacketNumber > llLastQueuedPacket)
+            {
+                return false;
+            }
+
+            if (llLastQueuedPacket - llPacketNumber >= m_llPacketCount - 1)
+            {
+                llPacketNumber = llLastQueuedPacket - m_llPacketCount + 2;
+            }
+
+            const HOST_PACKET *pPacket = &m_Packets[llPacketNumber % m_llPacketCount];
+
+            *pllQpc = pPacket->QpcWhenSampled;
+            memcpy(pu16Samples, pPacket->Samples, sizeof(pPacket->Samples));
+
+            // Keep the copy ahead of the check that it was not lapped.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_llLastQueuedPacket.load(std::memory_order_relaxed) - llPacketNumber < m_llPacketCount - 1)
+            {
+                break;
+            }
+        }
+
+        *pllPacketNumber = llPacketNumber;
+        m_llNextReadPacket.store(llPacketNumber + 1, std::memory_order_release);
+
+        return true;
+    }
+
+private:
+    std::vector<HOST_PACKET>        m_Packets;
+    long long                       m_llPacketCount;
+    alignas(64) std::atomic<long long> m_llLastQueuedPacket;
+    alignas(64) std::atomic<long long> m_llNextReadPacket;
+};
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Streams pOptions->uStreamPackets packets through a queue, a producer
+//  thread queuing pOptions->uBurstPackets at a time and yielding, as
+//  successive DPCs would, and this thread reading them as fast as they
+//  come. Checks that packets come out in order and whole.
+//
+static void RunQueuePass(const HOST_OPTIONS *pOptions, CHostQueue *pQueue, HOST_QUEUE_RESULT *pResult)
+{
+    std::vector<unsigned long long> Latencies;
+    std::atomic<bool> fDone(false);
+    unsigned short au16Samples[KWFE_FRAME_SAMPLES];
+    long long llLastPacket = -1;
+
+    Latencies.reserve(pOptions->uStreamPackets);
+
+    auto Start = std::chrono::steady_clock::now();
+
+    std::thread Producer([&]()
+    {
+        for (unsigned int p = 0; p < pOptions->uStreamPackets; p++)
+        {
+            pQueue->Produce(p);
+            if ((p + 1) % pOptions->uBurstPackets == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+        fDone.store(true, std::memory_order_release);
+    });
+
+    for (;;)
+    {
+        bool fProducerDone = fDone.load(std::memory_order_acquire);
+        long long llPacketNumber;
+        long long llQpc;
+
+        if (!pQueue->Consume(au16Samples, &llPacketNumber, &llQpc))
+        {
+            if (fProducerDone)
+            {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        Latencies.push_back(GetHostQpc() - llQpc);
+
+        if (llPacketNumber <= llLastPacket)
+        {
+            pResult->u64Errors++;
+        }
+        for (unsigned int i = 0; i < KWFE_FRAME_SAMPLES; i++)
+        {
+            if (au16Samples[i] != (unsigned short)llPacketNumber)
+            {
+                pResult->u64Errors++;
+                break;
+            }
+        }
+        llLastPacket = llPacketNumber;
+    }
+
+    Producer.join();
+
+    pResult->u64Nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count();
+    pResult->u64Produced = pOptions->uStreamPackets;
+    pResult->u64Read = Latencies.size();
+
+    if (!Latencies.empty())
+    {
+        std::sort(Latencies.begin(), Latencies.end());
+        pResult->u64MedianLatency = Latencies[Latencies.size() / 2];
+        pResult->u64P99Latency = Latencies[Latencies.size() * 99 / 100];
+        pResult->u64MaxLatency = Latencies.back();
+    }
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Streams through a queue pOptions->uPasses times and prints a line with
+//  its median pass.
+//
+static bool RunQueue(const HOST_OPTIONS *pOptions, CHostQueue *pQueue)
+{
+    std::vector<HOST_QUEUE_RESULT> Results(pOptions->uPasses);
+
+    for (unsigned int uPass = 0; uPass < pOptions->uPasses; uPass++)
+    {
+        if (!pQueue->Initialize(pOptions->uQueuePackets))
+        {
+            fprintf(stderr, "KeywordHost: %s cannot hold %u packets\n", pQueue->GetName(), pOptions->uQueuePackets);
+            return false;
+        }
+
+        memset(&Results[uPass], 0, sizeof(Results[uPass]));
+        RunQueuePass(pOptions, pQueue, &Results[uPass]);
+    }
+
+    std::vector<HOST_QUEUE_RESULT>::iterator Median = Results.begin() + pOptions->uPasses / 2;
+
+    std::nth_element(Results.begin(), Median, Results.end(),
+                     [](const HOST_QUEUE_RESULT &a, const HOST_QUEUE_RESULT &b) { return a.u64Nanoseconds < b.u64Nanoseconds; });
+
+    printf(pOptions->fCsv ? "%s,%llu,%.1f,%.0f,%llu,%llu,%llu,%llu\n" : "%-10s %8llu %7.1f %12.0f %10llu %10llu %10llu %6llu\n",
+           pQueue->GetName(), Median->u64Produced, 100.0 * Median->u64Read / Median->u64Produced,
+           Median->u64Read * 1e9 / Median->u64Nanoseconds,
+           Median->u64MedianLatency, Median->u64P99Latency, Median->u64MaxLatency, Median->u64Errors);
+
+    return Median->u64Errors == 0;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Makes the queue called pszName, or returns NULL.
+//
+static CHostQueue *CreateQueue(const char *pszName)
+{
+    if (strcmp(pszName, "ring") == 0)
+    {
+        return new CHostRingQueue();
+    }
+    if (strcmp(pszName, "list") == 0)
+    {
+        return new CHostListQueue();
+    }
+
+    return NULL;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Makes the case called pszName, or returns NULL.
+//
+static CHostCase *CreateCase(const char *pszName)
+{
+    if (strcmp(pszName, "speech") == 0)
+    {
+        return new CHostDetect(true);
+    }
+    if (strcmp(pszName, "silence") == 0)
+    {
+        return new CHostDetect(false);
+    }
+    if (strcmp(pszName, "decimate") == 0)
+    {
+        return new CHostDecimate();
+    }
+
+    return NULL;
+}
+
+//-------------------------------------------------------------------------
+// Description:
+//
+//  Runs a case pOptions->uPasses times and prints a line with its median
+//  pass.
+//
+static bool RunCase(const HOST_OPTIONS *pOptions, CHostCase *pCase)
+{
+    std::vector<HOST_RESULT> Results(pOptions->uPasses);
+
+    if (!pCase->Initialize(pOptions))
+    {
+        fprintf(stderr, "KeywordHost: %s cannot run with these options\n", pCase->GetName());
+        return false;
+    }
+
+    for (unsigned int uPass = 0; uPass < pOptions->uPasses; uPass++)
+    {
+        memset(&Results[uPass], 0, sizeof(Results[uPass]));
+        Results[uPass].u64Checksum = 0xCBF29CE484222325ull;
+        pCase->Run(&Results[uPass]);
+    }
+
+    std::vector<HOST_RESULT>::iterator Median = Results.begin() + pOptions->uPasses / 2;
+
+    std::nth_element(Results.begin(), Median, Results.end(),
+                     [](const HOST_RESULT &a, const HOST_RESULT &b) { return a.u64Nanoseconds < b.u64Nanoseconds; });
+
+    double f64NsPerPacket = (double)Median->u64Nanoseconds / Median->uPackets;
+
+    printf(pOptions->fCsv ? "%s,%u,%.1f,%.1f,%.4f,%llu,%016llx\n" : "%-10s %8u %7.1f %12.1f %8.4f %10llu  %016llx\n",
+           pCase->GetName(), Median->uPackets, 100.0 * Median->uActivePackets / Median->uPackets,
+           f64NsPerPacket, 100.0 * f64NsPerPacket / HOST_PACKET_NS,
+           Median->u64MaxNanoseconds, Median->u64Checksum);
+
+    return true;
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+        "Usage: KeywordHost [options] case ...\n"
+        "\n"
+        "  speech          VAD, log-mel features, scorer and DTW matchers on words\n"
+        "                  over a noise floor\n"
+        "  silence         the same on the noise floor alone\n"
+        "  decimate        the capture tap's decimator on a tone, 10 ms of input at a\n"
+        "                  time\n"
+        "  ring            the keyword packet ring, a producer thread against a\n"
+        "                  reader\n"
+        "  list            the same through the pool and FIFO lists it replaced\n"
+        "\n"
+        "  -s seconds      audio per pass (10)\n"
+        "  -p passes       passes per case, timed by the median pass (5)\n"
+        "  -m models       armed keyword models (2)\n"
+        "  -w codewords    codebook size (256)\n"
+        "  -t frames       frames per keyword template (100)\n"
+        "  -r rate         decimator input rate (48000)\n"
+        "  -n channels     decimator input channels (2)\n"
+        "  -f format       decimator input pcm16, pcm24, pcm32 or float (float)\n"
+        "  -q packets      packets a queue holds (100, 1 s)\n"
+        "  -b packets      packets queued at a time (1)\n"
+        "  -k packets      packets streamed through a queue per pass (1000000)\n"
+        "  -v              comma separated output\n");
+}
+
+static bool ParseOptions(int argc, char **argv, HOST_OPTIONS *pOptions, int *piFirstCase)
+{
+    int i;
+
+    memset(pOptions, 0, sizeof(*pOptions));
+    pOptions->f64Seconds = 10.0;
+    pOptions->uPasses = 5;
+    pOptions->uModels = 2;
+    pOptions->uCodewords = KWFE_MAX_CODEWORDS;
+    pOptions->uTemplateFrames = KWFE_MAX_TEMPLATE_FRAMES;
+    pOptions->uInputRate = 48000;
+    pOptions->uInputChannels = 2;
+    pOptions->uInputFormat = KwdecFloat32;
+    pOptions->uQueuePackets = 100;
+    pOptions->uBurstPackets = 1;
+    pOptions->uStreamPackets = 1000000;
+
+    for (i = 1; (i < argc) && (argv[i][0] == '-') && (argv[i][1] != '\0'); i++)
+    {
+        char chOption = argv[i][1];
+        const char *pszValue = NULL;
+
+        if (chOption == 'v')
+        {
+            pOptions->fCsv = true;
+            continue;
+        }
+
+        if ((argv[i][2] != '\0') || (i + 1 == argc))
+        {
+            return false;
+        }
+        pszValue = argv[++i];
+
+        switch (chOption)
+        {
+        case 's':
+            pOptions->f64Seconds = strtod(pszValue, NULL);
+            break;
+        case 'p':
+            pOptions->uPasses = (unsigned int)atoi(pszValue);
+            break;
+        case 'm':
+            pOptions->uModels = (unsigned int)atoi(pszValue);
+            break;
+        case 'w':
+            pOptions->uCodewords = (unsigned int)atoi(pszValue);
+            break;
+        case 't':
+            pOptions->uTemplateFrames = (unsigned int)atoi(pszValue);
+            break;
+        case 'r':
+            pOptions->uInputRate = (unsigned int)atoi(pszValue);
+            break;
+        case 'n':
+            pOptions->uInputChannels = (unsigned int)atoi(pszValue);
+            break;
+        case 'q':
+            pOptions->uQueuePackets = (unsigned int)atoi(pszValue);
+            break;
+        case 'b':
+            pOptions->uBurstPackets = (unsigned int)atoi(pszValue);
+            break;
+        case 'k':
+            pOptions->uStreamPackets = (unsigned int)atoi(pszValue);
+            break;
+        case 'f':
+            pOptions->uInputFormat = 0;
+            while ((pOptions->uInputFormat < (sizeof(g_apszFormats) / sizeof(g_apszFormats[0]))) &&
+                   (strcmp(pszValue, g_apszFormats[pOptions->uInputFormat]) != 0))
+            {
+                pOptions->uInputFormat++;
+            }
+            if (pOptions->uInputFormat == (sizeof(g_apszFormats) / sizeof(g_apszFormats[0])))
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+
+    *piFirstCase = i;
+
+    return (i < argc) && (pOptions->uPasses > 0) && (pOptions->f64Seconds >= 0.01) &&
+           (pOptions->uBurstPackets > 0) && (pOptions->uStreamPackets > 0);
+}
+
+int main(int argc, char **argv)
+{
+    HOST_OPTIONS Options;
+    int iFirstCase;
+    int iTable = 0;                             // 1 after the case header, 2 after the queue header.
+    int iResult = 0;
+
+    if (!ParseOptions(argc, argv, &Options, &iFirstCase))
+    {
+        Usage();
+        return 2;
+    }
+
+    if (!Options.fCsv)
+    {
+        printf("%.2f s per pass, %u pass(es), %u model(s), %u codewords, %u frame templates,\n"
+               "decimating %u channel(s) of %s at %u Hz,\n",
+               Options.f64Seconds, Options.uPasses, Options.uModels, Options.uCodewords, Options.uTemplateFrames,
+               Options.uInputChannels, g_apszFormats[Options.uInputFormat], Options.uInputRate);
+        printf("queues of %u packets, %u packet(s) at a time, %u packets per pass\n",
+               Options.uQueuePackets, Options.uBurstPackets, Options.uStreamPackets);
+    }
+
+    for (int i = iFirstCase; i < argc; i++)
+    {
+        CHostQueue *pQueue = CreateQueue(argv[i]);
+        CHostCase *pCase = (pQueue == NULL) ? CreateCase(argv[i]) : NULL;
+
+        if (pQueue != NULL)
+        {
+            if (iTable != 2)
+            {
+                printf(Options.fCsv ? "queue,packets,read_percent,packets_per_second,median_latency_ns,p99_latency_ns,max_latency_ns,errors\n"
+                                    : "\nqueue       packets   read%%    packets/s  median ns     p99 ns     max ns errors\n");
+                iTable = 2;
+            }
+
+            if (!RunQueue(&Options, pQueue))
+            {
+                iResult = 1;
+            }
+
+            delete pQueue;
+            continue;
+        }
+
+        if (pCase != NULL && iTable != 1)
+        {
+            printf(Options.fCsv ? "case,packets,active_percent,ns_per_packet,load_percent,max_ns,checksum\n"
+                                : "\ncase        packets active%%    ns/packet   load%%     max ns  checksum\n");
+            iTable = 1;
+        }
+
+        if (pCase == NULL)
+        {
+            fprintf(stderr, "KeywordHost: no case is called %s\n", argv[i]);
+            iResult = 1;
+            continue;
+        }
+
+        if (!RunCase(&Options, pCase))
+        {
+            iResult = 1;
+        }
+
+        delete pCase;
+    }
+
+    return iResult;
+}
@@ -0,0 +1,576 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    ReplaySource
+
+Abstract:
+
+    Implementation of SYSVAD capture replay source.
+
+    A reader thread does large sequential reads of the source file, converts
+    the samples to the negotiated capture format and keeps a double-buffered
+    ring filled. The DPC only copies out of the ring and never waits on the
+    file system; if the reader falls behind the DPC delivers silence.
+
+    Conversion is deliberately simple: channels are mapped modulo the source
+    channel count, and the sample rate is converted by picking the nearest
+    earlier source frame. The file is replayed in a loop.
+
+
+--*/
+#include <sysvad.h>
+#include "ReplaySource.h"
+
+#define REPLAYSOURCE_POOLTAG        'PRVS'
+
+#define RIFF_TAG                    0x46464952
+#define WAVE_TAG                    0x45564157
+#define FMT__TAG                    0x20746D66
+#define DATA_TAG                    0x61746164
+
+// Size of a single sequential read from the source file.
+#define REPLAY_READ_SIZE            (64 * 1024)
+
+// Each half of the ring holds this fraction of a second of audio.
+#define REPLAY_HALF_DIVISOR         4
+
+#pragma code_seg()
+//
+// Decode one source sample to a left-justified 32-bit value.
+//
+static LONG DecodeSample
+(
+    _In_reads_bytes_(ContainerBytes) const BYTE *   Sample,
+    _In_                             WORD           ContainerBytes,
+    _In_                             bool           IsFloat
+)
+{
+    switch (ContainerBytes)
+    {
+    case 1:
+        return ((LONG)Sample[0] - 128) << 24;
+    case 2:
+        return (LONG)(*(UNALIGNED SHORT *)Sample) << 16;
+    case 3:
+        return (LONG)(((ULONG)Sample[0] << 8) | ((ULONG)Sample[1] << 16) | ((ULONG)Sample[2] << 24));
+    case 4:
+        if (IsFloat)
+        {
+            // Caller saved the floating point state.
+            float value = *(UNALIGNED float *)Sample;
+            if (value >= 1.0f)
+            {
+                return _I32_MAX;
+            }
+            if (value <= -1.0f)
+            {
+                return -_I32_MAX;
+            }
+            return (LONG)(value * 2147483647.0);
+        }
+        return *(UNALIGNED LONG *)Sample;
+    default:
+        return 0;
+    }
+}
+
+//
+// Encode a left-justified 32-bit value into one destination sample.
+//
+static VOID EncodeSample
+(
+    _Out_writes_bytes_(ContainerBytes) BYTE *   Sample,
+    _In_                               WORD     ContainerBytes,
+    _In_                               LONG     Value
+)
+{
+    switch (ContainerBytes)
+    {
+    case 1:
+        Sample[0] = (BYTE)((Value >> 24) + 128);
+        break;
+    case 2:
+        *(UNALIGNED SHORT *)Sample = (SHORT)(Value >> 16);
+        break;
+    case 3:
+        Sample[0] = (BYTE)(Value >> 8);
+        Sample[1] = (BYTE)(Value >> 16);
+        Sample[2] = (BYTE)(Value >> 24);
+        break;
+    case 4:
+        *(UNALIGNED LONG *)Sample = Value;
+        break;
+    default:
+        break;
+    }
+}
+
+#pragma code_seg("PAGE")
+//
+// Ctor: basic init.
+//
+ReplaySource::ReplaySource()
+: m_FileHandle(NULL),
+  m_llDataOffset(0),
+  m_llDataLength(0),
+  m_llReadPosition(0),
+  m_SrcChannels(0),
+  m_SrcContainerBytes(0),
+  m_SrcBlockAlign(0),
+  m_SrcSamplesPerSecond(0),
+  m_SrcIsFloat(false),
+  m_DstChannels(0),
+  m_DstContainerBytes(0),
+  m_DstBlockAlign(0),
+  m_DstSamplesPerSecond(0),
+  m_pReadBuffer(NULL),
+  m_ulReadBufferSize(0),
+  m_ulReadBufferValid(0),
+  m_ulReadBufferPos(0),
+  m_ulRateStep(0),
+  m_ulRatePhase(0),
+  m_pRing(NULL),
+  m_ulRingSize(0),
+  m_ulHalfSize(0),
+  m_lBytesProduced(0),
+  m_lBytesConsumed(0),
+  m_lUnderrunBytes(0),
+  m_ulConsumeOffset(0),
+  m_ulProduceOffset(0),
+  m_pReaderThread(NULL)
+{
+    PAGED_CODE();
+
+    KeInitializeEvent(&m_DataConsumed, SynchronizationEvent, FALSE);
+    KeInitializeEvent(&m_StopReader, NotificationEvent, FALSE);
+}
+
+//
+// Dtor: stop the reader and free resources.
+//
+ReplaySource::~ReplaySource()
+{
+    PAGED_CODE();
+
+    StopReader();
+
+    if (m_FileHandle)
+    {
+        ZwClose(m_FileHandle);
+        m_FileHandle = NULL;
+    }
+
+    if (m_pReadBuffer)
+    {
+        ExFreePoolWithTag(m_pReadBuffer, REPLAYSOURCE_POOLTAG);
+        m_pReadBuffer = NULL;
+    }
+
+    if (m_pRing)
+    {
+        ExFreePoolWithTag(m_pRing, REPLAYSOURCE_POOLTAG);
+        m_pRing = NULL;
+    }
+}
+
+//
+// Reads the WAV header, or describes a raw file with the negotiated format.
+//
+NTSTATUS ReplaySource::ParseHeader
+(
+    _In_    PWAVEFORMATEXTENSIBLE   WfExt
+)
+{
+    PAGED_CODE();
+
+    NTSTATUS                    status;
+    IO_STATUS_BLOCK             ioStatusBlock;
+    LARGE_INTEGER               offset;
+    FILE_STANDARD_INFORMATION   fileInfo;
+    DWORD                       riffHeader[3] = { 0 };
+    DWORD                       chunkHeader[2];
+    WAVEFORMATEXTENSIBLE        srcFormat;
+    bool                        formatFound = false;
+    bool                        dataFound = false;
+
+    status = ZwQueryInformationFile(m_FileHandle, &ioStatusBlock, &fileInfo, sizeof(fileInfo), FileStandardInformation);
+    IF_FAILED_JUMP(status, Done);
+
+    RtlZeroMemory(&srcFormat, sizeof(srcFormat));
+
+    offset.QuadPart = 0;
+    status = ZwReadFile(m_FileHandle, NULL, NULL, NULL, &ioStatusBlock, riffHeader, sizeof(riffHeader), &offset, NULL);
+
+    if (NT_SUCCESS(status) &&
+        ioStatusBlock.Information == sizeof(riffHeader) &&
+        riffHeader[0] == RIFF_TAG &&
+        riffHeader[2] == WAVE_TAG)
+    {
+        //
+        // Walk the chunks until the data chunk.
+        //
+        offset.QuadPart = sizeof(riffHeader);
+        while (!dataFound && offset.QuadPart + sizeof(chunkHeader) <= fileInfo.EndOfFile.QuadPart)
+        {
+            status = ZwReadFile(m_FileHandle, NULL, NULL, NULL, &ioStatusBlock, chunkHeader, sizeof(chunkHeader), &offset, NULL);
+            IF_FAILED_JUMP(status, Done);
+
+            if (chunkHeader[0] == FMT__TAG)
+            {
+                LARGE_INTEGER fmtOffset;
+                fmtOffset.QuadPart = offset.QuadPart + sizeof(chunkHeader);
+                status = ZwReadFile(m_FileHandle, NULL, NULL, NULL, &ioStatusBlock, &srcFormat,
+                                    min(chunkHeader[1], (DWORD)sizeof(srcFormat)), &fmtOffset, NULL);
+                IF_FAILED_JUMP(status, Done);
+                formatFound = true;
+            }
+            else if (chunkHeader[0] == DATA_TAG)
+            {
+                m_llDataOffset = offset.QuadPart + sizeof(chunkHeader);
+                m_llDataLength = min((LONGLONG)chunkHeader[1], fileInfo.EndOfFile.QuadPart - m_llDataOffset);
+                dataFound = true;
+            }
+
+            // Chunks are word aligned.
+            offset.QuadPart += sizeof(chunkHeader) + chunkHeader[1] + (chunkHeader[1] & 1);
+        }
+
+        IF_TRUE_ACTION_JUMP(!formatFound || !dataFound, status = STATUS_INVALID_IMAGE_FORMAT, Done);
+    }
+    else
+    {
+        //
+        // Raw PCM in the negotiated format.
+        //
+        RtlCopyMemory(&srcFormat, WfExt, min(sizeof(srcFormat), sizeof(WAVEFORMATEX) + WfExt->Format.cbSize));
+        m_llDataOffset = 0;
+        m_llDataLength = fileInfo.EndOfFile.QuadPart;
+    }
+
+    //
+    // Validate the source format.
+    //
+    IF_TRUE_ACTION_JUMP(srcFormat.Format.nChannels == 0 || srcFormat.Format.nSamplesPerSec == 0,
+                        status = STATUS_NOT_SUPPORTED, Done);
+
+    m_SrcIsFloat = (srcFormat.Format.wFormatTag == WAVE_FORMAT_IEEE_FLOAT) ||
+                   (srcFormat.Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+                    IsEqualGUIDAligned(srcFormat.SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT));
+
+    IF_TRUE_ACTION_JUMP(!m_SrcIsFloat &&
+                        srcFormat.Format.wFormatTag != WAVE_FORMAT_PCM &&
+                        !(srcFormat.Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+                          IsEqualGUIDAligned(srcFormat.SubFormat, KSDATAFORMAT_SUBTYPE_PCM)),
+                        status = STATUS_NOT_SUPPORTED, Done);
+
+    m_SrcChannels           = srcFormat.Format.nChannels;
+    m_SrcBlockAlign         = srcFormat.Format.nBlockAlign;
+    m_SrcContainerBytes     = m_SrcBlockAlign / m_SrcChannels;
+    m_SrcSamplesPerSecond   = srcFormat.Format.nSamplesPerSec;
+
+    IF_TRUE_ACTION_JUMP(m_SrcContainerBytes == 0 || m_SrcContainerBytes > 4 ||
+                        (m_SrcIsFloat && m_SrcContainerBytes != 4) ||
+                        m_llDataLength < m_SrcBlockAlign,
+                        status = STATUS_NOT_SUPPORTED, Done);
+
+    status = STATUS_SUCCESS;
+
+Done:
+    return status;
+}
+
+NTSTATUS ReplaySource::Init
+(
+    _In_    PCUNICODE_STRING        FileName,
+    _In_    PWAVEFORMATEXTENSIBLE   WfExt
+)
+{
+    PAGED_CODE();
+
+    NTSTATUS            status;
+    OBJECT_ATTRIBUTES   objectAttributes;
+    IO_STATUS_BLOCK     ioStatusBlock;
+    HANDLE              threadHandle = NULL;
+
+    //
+    // Capture streams are PCM only, see ToneGenerator::Init.
+    //
+    if ((WfExt->Format.wFormatTag != WAVE_FORMAT_PCM &&
+        !(WfExt->Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+          IsEqualGUIDAligned(WfExt->SubFormat, KSDATAFORMAT_SUBTYPE_PCM))))
+    {
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    m_DstChannels           = WfExt->Format.nChannels;
+    m_DstBlockAlign         = WfExt->Format.nBlockAlign;
+    m_DstContainerBytes     = m_DstBlockAlign / m_DstChannels;
+    m_DstSamplesPerSecond   = WfExt->Format.nSamplesPerSec;
+
+    IF_TRUE_ACTION_JUMP(m_DstContainerBytes == 0 || m_DstContainerBytes > 4, status = STATUS_NOT_SUPPORTED, Done);
+
+    //
+    // Open the source for sequential reads.
+    //
+    InitializeObjectAttributes(&objectAttributes, (PUNICODE_STRING)FileName, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    status = ZwCreateFile(&m_FileHandle,
+                          GENERIC_READ | SYNCHRONIZE,
+                          &objectAttributes,
+                          &ioStatusBlock,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          FILE_SHARE_READ,
+                          FILE_OPEN,
+                          FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_SEQUENTIAL_ONLY,
+                          NULL,
+                          0);
+    IF_FAILED_ACTION_JUMP(status, DPF(D_TERSE, ("[ReplaySource::Init : Error opening %wZ, 0x%x]", FileName, status)), Done);
+
+    status = ParseHeader(WfExt);
+    IF_FAILED_ACTION_JUMP(status, DPF(D_TERSE, ("[ReplaySource::Init : Unsupported file %wZ, 0x%x]", FileName, status)), Done);
+
+    m_llReadPosition = m_llDataOffset;
+    m_ulRateStep = (ULONG)(((ULONGLONG)m_SrcSamplesPerSecond << 16) / m_DstSamplesPerSecond);
+    m_ulRatePhase = 0;
+
+    //
+    // Staging buffer, only touched by the reader thread.
+    //
+    m_ulReadBufferSize = max((ULONG)(REPLAY_READ_SIZE / m_SrcBlockAlign), 1UL) * m_SrcBlockAlign;
+    m_pReadBuffer = (PBYTE)ExAllocatePool2(POOL_FLAG_PAGED, m_ulReadBufferSize, REPLAYSOURCE_POOLTAG);
+    IF_TRUE_ACTION_JUMP(m_pReadBuffer == NULL, status = STATUS_INSUFFICIENT_RESOURCES, Done);
+
+    //
+    // Ring, read by the DPC.
+    //
+    m_ulHalfSize = max((ULONG)(WfExt->Format.nAvgBytesPerSec / REPLAY_HALF_DIVISOR / m_DstBlockAlign), 1UL) * m_DstBlockAlign;
+    m_ulRingSize = 2 * m_ulHalfSize;
+    m_pRing = (PBYTE)ExAllocatePool2(POOL_FLAG_NON_PAGED, m_ulRingSize, REPLAYSOURCE_POOLTAG);
+    IF_TRUE_ACTION_JUMP(m_pRing == NULL, status = STATUS_INSUFFICIENT_RESOURCES, Done);
+
+    //
+    // Start the reader; it prefills the ring right away.
+    //
+    InitializeObjectAttributes(&objectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    status = PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, &objectAttributes, NULL, NULL, ReplaySourceReaderThread, this);
+    IF_FAILED_JUMP(status, Done);
+
+    status = ObReferenceObjectByHandle(threadHandle, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID*)&m_pReaderThread, NULL);
+    if (!NT_SUCCESS(status))
+    {
+        // No reference for StopReader to wait on; stop the thread and wait
+        // on its handle, so it is gone before the buffers it fills are freed.
+        DPF(D_TERSE, ("[ReplaySource::Init : Error referencing the reader thread, 0x%x]", status));
+        KeSetEvent(&m_StopReader, 0, FALSE);
+        ZwWaitForSingleObject(threadHandle, FALSE, NULL);
+        m_pReaderThread = NULL;
+    }
+    ZwClose(threadHandle);
+
+Done:
+    return status;
+}
+
+//
+// Called with m_ulReadBufferPos at or past m_ulReadBufferValid; skips the
+// frames that the rate conversion stepped over and reads the next chunk,
+// looping back to the start of the data at the end of the file.
+//
+NTSTATUS ReplaySource::RefillReadBuffer()
+{
+    PAGED_CODE();
+
+    NTSTATUS        status;
+    IO_STATUS_BLOCK ioStatusBlock;
+    LARGE_INTEGER   offset;
+    LONGLONG        dataEnd = m_llDataOffset + m_llDataLength;
+    ULONG           toRead;
+
+    m_llReadPosition += m_ulReadBufferPos - m_ulReadBufferValid;
+    if (m_llReadPosition + m_SrcBlockAlign > dataEnd)
+    {
+        m_llReadPosition = m_llDataOffset + (m_llReadPosition - m_llDataOffset) % m_llDataLength;
+        if (m_llReadPosition + m_SrcBlockAlign > dataEnd)
+        {
+            m_llReadPosition = m_llDataOffset;
+        }
+    }
+
+    toRead = (ULONG)min((LONGLONG)m_ulReadBufferSize, dataEnd - m_llReadPosition);
+    toRead -= toRead % m_SrcBlockAlign;
+
+    offset.QuadPart = m_llReadPosition;
+    status = ZwReadFile(m_FileHandle, NULL, NULL, NULL, &ioStatusBlock, m_pReadBuffer, toRead, &offset, NULL);
+
+    m_ulReadBufferPos = 0;
+    m_ulReadBufferValid = 0;
+
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    m_ulReadBufferValid = (ULONG)ioStatusBlock.Information;
+    m_ulReadBufferValid -= m_ulReadBufferValid % m_SrcBlockAlign;
+    m_llReadPosition += m_ulReadBufferValid;
+
+    return m_ulReadBufferValid ? STATUS_SUCCESS : STATUS_END_OF_FILE;
+}
+
+//
+// Converts source frames into one half of the ring.
+//
+#pragma warning(push)
+// The floating point state is saved around the loop when the source is float.
+#pragma warning(disable: 28110)
+VOID ReplaySource::FillHalf
+(
+    _Out_writes_bytes_(Length)  BYTE*  Buffer,
+    _In_                        ULONG  Length
+)
+{
+    PAGED_CODE();
+
+    KFLOATING_SAVE  saveData;
+    ULONG           frames = Length / m_DstBlockAlign;
+
+    if (m_SrcIsFloat && !NT_SUCCESS(KeSaveFloatingPointState(&saveData)))
+    {
+        RtlZeroMemory(Buffer, Length);
+        return;
+    }
+
+    for (ULONG i = 0; i < frames; ++i)
+    {
+        if (m_ulReadBufferPos >= m_ulReadBufferValid && !NT_SUCCESS(RefillReadBuffer()))
+        {
+            RtlZeroMemory(Buffer, (frames - i) * m_DstBlockAlign);
+            break;
+        }
+
+        const BYTE* srcFrame = m_pReadBuffer + m_ulReadBufferPos;
+
+        for (WORD c = 0; c < m_DstChannels; ++c)
+        {
+            LONG value = DecodeSample(srcFrame + (c % m_SrcChannels) * m_SrcContainerBytes, m_SrcContainerBytes, m_SrcIsFloat);
+            EncodeSample(Buffer + c * m_DstContainerBytes, m_DstContainerBytes, value);
+        }
+        Buffer += m_DstBlockAlign;
+
+        m_ulRatePhase += m_ulRateStep;
+        m_ulReadBufferPos += (m_ulRatePhase >> 16) * m_SrcBlockAlign;
+        m_ulRatePhase &= 0xFFFF;
+    }
+
+    if (m_SrcIsFloat)
+    {
+        KeRestoreFloatingPointState(&saveData);
+    }
+}
+#pragma warning(pop)
+
+//
+// Keeps every free half of the ring filled until asked to stop.
+//
+VOID ReplaySource::ReaderLoop()
+{
+    PAGED_CODE();
+
+    PVOID       waitObjects[] = { &m_StopReader, &m_DataConsumed };
+    NTSTATUS    status;
+
+    for (;;)
+    {
+        while ((ULONG)(m_lBytesProduced - m_lBytesConsumed) <= m_ulRingSize - m_ulHalfSize)
+        {
+            FillHalf(m_pRing + m_ulProduceOffset, m_ulHalfSize);
+            m_ulProduceOffset = (m_ulProduceOffset + m_ulHalfSize) % m_ulRingSize;
+
+            // Publish the half after its samples are written.
+            InterlockedExchangeAdd(&m_lBytesProduced, (LONG)m_ulHalfSize);
+        }
+
+        status = KeWaitForMultipleObjects(ARRAYSIZE(waitObjects), waitObjects, WaitAny, Executive, KernelMode, FALSE, NULL, NULL);
+        if (status == STATUS_WAIT_0)
+        {
+            break;
+        }
+    }
+}
+
+VOID ReplaySource::StopReader()
+{
+    PAGED_CODE();
+
+    if (m_pReaderThread)
+    {
+        KeSetEvent(&m_StopReader, 0, FALSE);
+        KeWaitForSingleObject(m_pReaderThread, Executive, KernelMode, FALSE, NULL);
+        ObDereferenceObject(m_pReaderThread);
+        m_pReaderThread = NULL;
+    }
+}
+
+VOID
+ReplaySourceReaderThread
+(
+    _In_ PVOID  StartContext
+)
+{
+    PAGED_CODE();
+
+    ReplaySource* source = (ReplaySource*)StartContext;
+
+    source->ReaderLoop();
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+#pragma code_seg()
+//
+// ReadSamples()
+//
+//  Copies replayed samples into the capture buffer. Runs in the DPC, never
+//  waits; bytes the reader has not produced yet are delivered as silence.
+//
+//  Buffer - Buffer to hold the samples
+//  BufferLength - Length of the buffer.
+//
+VOID ReplaySource::ReadSamples
+(
+    _Out_writes_bytes_(BufferLength) BYTE       *Buffer,
+    _In_                             ULONG       BufferLength
+)
+{
+    ULONG available;
+    ULONG copyBytes;
+    ULONG firstRun;
+    ULONG before = m_ulConsumeOffset;
+
+    available = (ULONG)(InterlockedCompareExchange(&m_lBytesProduced, 0, 0) - m_lBytesConsumed);
+    copyBytes = min(available, BufferLength);
+
+    firstRun = min(copyBytes, m_ulRingSize - m_ulConsumeOffset);
+    RtlCopyMemory(Buffer, m_pRing + m_ulConsumeOffset, firstRun);
+    RtlCopyMemory(Buffer + firstRun, m_pRing, copyBytes - firstRun);
+    m_ulConsumeOffset = (m_ulConsumeOffset + copyBytes) % m_ulRingSize;
+
+    InterlockedExchangeAdd(&m_lBytesConsumed, (LONG)copyBytes);
+
+    // Wake the reader whenever a half became free.
+    if (copyBytes >= m_ulHalfSize || (before / m_ulHalfSize) != (m_ulConsumeOffset / m_ulHalfSize))
+    {
+        KeSetEvent(&m_DataConsumed, 0, FALSE);
+    }
+
+    if (copyBytes < BufferLength)
+    {
+        RtlZeroMemory(Buffer + copyBytes, BufferLength - copyBytes);
+        InterlockedExchangeAdd(&m_lUnderrunBytes, (LONG)(BufferLength - copyBytes));
+    }
+}
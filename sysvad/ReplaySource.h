@@ -0,0 +1,114 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    ReplaySource.h
+
+Abstract:
+
+    Declaration of SYSVAD capture replay source. Streams a WAV (or raw PCM)
+    file into the capture DMA buffer instead of the sine wave generator.
+
+
+--*/
+#ifndef _SYSVAD_REPLAYSOURCE_H
+#define _SYSVAD_REPLAYSOURCE_H
+
+KSTART_ROUTINE ReplaySourceReaderThread;
+
+class ReplaySource
+{
+protected:
+    // Source file.
+    HANDLE          m_FileHandle;
+    LONGLONG        m_llDataOffset;         // Start of the sample data in the file.
+    LONGLONG        m_llDataLength;         // Length of the sample data.
+    LONGLONG        m_llReadPosition;       // Next file offset to read.
+
+    // Source format, as found in the file header.
+    WORD            m_SrcChannels;
+    WORD            m_SrcContainerBytes;    // Bytes per sample.
+    WORD            m_SrcBlockAlign;
+    DWORD           m_SrcSamplesPerSecond;
+    bool            m_SrcIsFloat;
+
+    // Negotiated (destination) format.
+    WORD            m_DstChannels;
+    WORD            m_DstContainerBytes;
+    WORD            m_DstBlockAlign;
+    DWORD           m_DstSamplesPerSecond;
+
+    // Staging buffer for large sequential reads, in the source format.
+    PBYTE           m_pReadBuffer;
+    ULONG           m_ulReadBufferSize;
+    ULONG           m_ulReadBufferValid;
+    ULONG           m_ulReadBufferPos;
+
+    // Nearest-sample rate conversion, 16.16 fixed point.
+    ULONG           m_ulRateStep;
+    ULONG           m_ulRatePhase;
+
+    // Double-buffered ring, in the destination format. The reader thread
+    // produces a whole half at a time, the DPC consumes any amount.
+    PBYTE           m_pRing;
+    ULONG           m_ulRingSize;
+    ULONG           m_ulHalfSize;
+    volatile LONG   m_lBytesProduced;       // Wraps, only differences are used.
+    volatile LONG   m_lBytesConsumed;
+    volatile LONG   m_lUnderrunBytes;
+    ULONG           m_ulConsumeOffset;      // DPC only.
+    ULONG           m_ulProduceOffset;      // Reader thread only.
+
+    // Reader thread.
+    PKTHREAD        m_pReaderThread;
+    KEVENT          m_DataConsumed;         // Signaled by the DPC when a half frees up.
+    KEVENT          m_StopReader;
+
+public:
+    ReplaySource();
+    ~ReplaySource();
+
+    NTSTATUS
+    Init
+    (
+        _In_    PCUNICODE_STRING        FileName,
+        _In_    PWAVEFORMATEXTENSIBLE   WfExt
+    );
+
+    VOID
+    ReadSamples
+    (
+        _Out_writes_bytes_(BufferLength) BYTE       *Buffer,
+        _In_                             ULONG       BufferLength
+    );
+
+    ULONG
+    GetUnderrunBytes()
+    {
+        return (ULONG)m_lUnderrunBytes;
+    }
+
+private:
+    NTSTATUS ParseHeader
+    (
+        _In_    PWAVEFORMATEXTENSIBLE   WfExt
+    );
+
+    NTSTATUS RefillReadBuffer();
+
+    VOID FillHalf
+    (
+        _Out_writes_bytes_(Length)  BYTE*  Buffer,
+        _In_                        ULONG  Length
+    );
+
+    VOID ReaderLoop();
+
+    VOID StopReader();
+
+    friend KSTART_ROUTINE ReplaySourceReaderThread;
+};
+
+#endif // _SYSVAD_REPLAYSOURCE_H
@@ -0,0 +1,437 @@
+//
+// SaveDataBench.cpp -- Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// Description:
+//
+//  Times CSaveData's two output backends for render data files
+//
+//  SaveDataBench streams generated frames into a data file the way the
+//  save data worker does, once per backend:
+//
+//      write   opens the file, writes the frame at the file pointer and
+//              closes it again, for every frame (ZwWriteFile).
+//      mapped  copies the frame into a 1 MB view of the file, opening it to
+//              create a section and map the next view whenever the file
+//              pointer leaves the current one, and trims the file to the
+//              data written when the stream closes (UseMappedDataFiles).
+//
+//  Both stage each frame in a ring of four frames first, as the DPC does.
+//  For each frame size named on the command line and each backend it
+//  reports the throughput up to the stream closing, the median and 99th
+//  percentile time the worker spends on a frame, and how long flushing the
+//  file to disk takes afterwards, since the mapped backend leaves that to
+//  the memory manager. Each case is run several times over and the times
+//  are the median pass's.
+//
+//  The driver's calls are made through their user mode counterparts, so
+//  this runs as a console program on the machine under test. Build it from
+//  a Visual Studio developer command prompt, in this directory:
+//
+//      cl /nologo /W4 /O2 /EHsc SaveDataBench.cpp
+//
+//      SaveDataBench [-m megabytes] [-p passes] [-d directory] [frame_bytes ...]
+//
+//  A stream's frames are four times its cyclic buffer, so the defaults
+//  are those of a 10 ms buffer of 48 kHz 16-bit stereo, 32-bit float
+//  stereo and 32-bit float 8 channel audio, and the driver's default.
+//
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#define BENCH_FRAME_COUNT           4               // DEFAULT_FRAME_COUNT
+#define BENCH_VIEW_ALIGNMENT        0x10000         // MAPPED_VIEW_ALIGNMENT
+#define BENCH_VIEW_WINDOW_SIZE      (16 * BENCH_VIEW_ALIGNMENT)
+
+typedef struct _BENCH_OPTIONS
+{
+    ULONGLONG       ullStreamBytes;
+    ULONG           ulPasses;
+    WCHAR           szPath[MAX_PATH];
+} BENCH_OPTIONS;
+
+typedef struct _BENCH_RESULT
+{
+    double          f64StreamMBps;
+    double          f64MedianFrameUs;
+    double          f64P99FrameUs;
+    double          f64FlushMs;
+    bool            fFailed;
+} BENCH_RESULT;
+
+static double g_f64TicksPerUs;
+
+static double ElapsedUs(LONGLONG Start)
+{
+    LARGE_INTEGER stop;
+
+    QueryPerformanceCounter(&stop);
+    return (double)(stop.QuadPart - Start) / g_f64TicksPerUs;
+}
+
+static LONGLONG Now()
+{
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+static HANDLE OpenDataFile(const BENCH_OPTIONS *pOptions, bool fMapped, bool fOverWrite)
+{
+    // A read/write section needs read access to the file as well.
+    return CreateFileW(pOptions->szPath,
+                       fMapped ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_WRITE,
+                       0,
+                       nullptr,
+                       fOverWrite ? CREATE_ALWAYS : OPEN_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL,
+                       nullptr);
+}
+
+//
+// The mapped backend's state, as CSaveData keeps it.
+//
+typedef struct _BENCH_VIEW
+{
+    HANDLE          hSection;
+    BYTE *          pView;
+    LONGLONG        llOffset;
+    ULONG           cbSize;
+} BENCH_VIEW;
+
+static void ViewClose(BENCH_VIEW *pView)
+{
+    if (pView->pView)
+    {
+        UnmapViewOfFile(pView->pView);
+        pView->pView = nullptr;
+        pView->cbSize = 0;
+    }
+
+    if (pView->hSection)
+    {
+        CloseHandle(pView->hSection);
+        pView->hSection = nullptr;
+    }
+}
+
+static bool ViewRemap(const BENCH_OPTIONS *pOptions, BENCH_VIEW *pView, LONGLONG llFileOffset)
+{
+    LONGLONG maximumSize;
+    HANDLE file;
+
+    ViewClose(pView);
+
+    pView->llOffset = llFileOffset & ~((LONGLONG)BENCH_VIEW_ALIGNMENT - 1);
+    maximumSize = pView->llOffset + BENCH_VIEW_WINDOW_SIZE;
+
+    file = OpenDataFile(pOptions, true, false);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    // The section extends the file to cover the window, and holds its own
+    // reference on it.
+    pView->hSection = CreateFileMappingW(file, nullptr, PAGE_READWRITE,
+                                         (DWORD)(maximumSize >> 32), (DWORD)maximumSize, nullptr);
+    CloseHandle(file);
+    if (pView->hSection == nullptr)
+    {
+        return false;
+    }
+
+    pView->pView = (BYTE *)MapViewOfFile(pView->hSection, FILE_MAP_WRITE,
+                                         (DWORD)(pView->llOffset >> 32), (DWORD)pView->llOffset,
+                                         BENCH_VIEW_WINDOW_SIZE);
+    if (pView->pView == nullptr)
+    {
+        ViewClose(pView);
+        return false;
+    }
+
+    pView->cbSize = BENCH_VIEW_WINDOW_SIZE;
+    return true;
+}
+
+static bool ViewWrite(const BENCH_OPTIONS *pOptions, BENCH_VIEW *pView, LONGLONG *pllFilePtr, const BYTE *pData, ULONG ulDataSize)
+{
+    while (ulDataSize > 0)
+    {
+        LONGLONG llViewEnd = pView->llOffset + (LONGLONG)pView->cbSize;
+
+        if (pView->pView == nullptr || *pllFilePtr < pView->llOffset || *pllFilePtr >= llViewEnd)
+        {
+            if (!ViewRemap(pOptions, pView, *pllFilePtr))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        ULONG ulCopy = (ULONG)std::min((LONGLONG)ulDataSize, llViewEnd - *pllFilePtr);
+
+        memcpy(pView->pView + (*pllFilePtr - pView->llOffset), pData, ulCopy);
+
+        *pllFilePtr += ulCopy;
+        pData += ulCopy;
+        ulDataSize -= ulCopy;
+    }
+
+    return true;
+}
+
+static bool FileWrite(const BENCH_OPTIONS *pOptions, LONGLONG *pllFilePtr, const BYTE *pData, ULONG ulDataSize)
+{
+    OVERLAPPED overlapped = {};
+    DWORD written = 0;
+    HANDLE file;
+    BOOL ok;
+
+    file = OpenDataFile(pOptions, false, false);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    overlapped.Offset = (DWORD)*pllFilePtr;
+    overlapped.OffsetHigh = (DWORD)(*pllFilePtr >> 32);
+    ok = WriteFile(file, pData, ulDataSize, &written, &overlapped);
+    CloseHandle(file);
+
+    *pllFilePtr += written;
+    return ok && written == ulDataSize;
+}
+
+static BENCH_RESULT RunPass(const BENCH_OPTIONS *pOptions, ULONG ulFrameBytes, bool fMapped)
+{
+    BENCH_RESULT result = {};
+    BENCH_VIEW view = {};
+    std::vector<BYTE> ring((size_t)ulFrameBytes * BENCH_FRAME_COUNT);
+    std::vector<BYTE> source(ulFrameBytes);
+    std::vector<double> frameUs;
+    ULONGLONG frames = pOptions->ullStreamBytes / ulFrameBytes;
+    LONGLONG llFilePtr = 0;
+    LONGLONG start;
+    HANDLE file;
+
+    for (ULONG i = 0; i < ulFrameBytes; i++)
+    {
+        source[i] = (BYTE)(i * 2654435761u >> 24);
+    }
+
+    // A new stream overwrites the file.
+    DeleteFileW(pOptions->szPath);
+    file = OpenDataFile(pOptions, fMapped, true);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        result.fFailed = true;
+        return result;
+    }
+    CloseHandle(file);
+
+    frameUs.reserve((size_t)frames);
+    start = Now();
+
+    for (ULONGLONG frame = 0; frame < frames && !result.fFailed; frame++)
+    {
+        BYTE *pFrame = ring.data() + (frame % BENCH_FRAME_COUNT) * ulFrameBytes;
+        LONGLONG frameStart;
+
+        memcpy(pFrame, source.data(), ulFrameBytes);
+        source[frame % ulFrameBytes]++;
+
+        frameStart = Now();
+        result.fFailed = fMapped ? !ViewWrite(pOptions, &view, &llFilePtr, pFrame, ulFrameBytes)
+                                 : !FileWrite(pOptions, &llFilePtr, pFrame, ulFrameBytes);
+        frameUs.push_back(ElapsedUs(frameStart));
+    }
+
+    // Closing the stream trims the mapped backend's file to what was written.
+    if (fMapped)
+    {
+        ViewClose(&view);
+        file = OpenDataFile(pOptions, true, false);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            result.fFailed = true;
+        }
+        else
+        {
+            LARGE_INTEGER endOfFile;
+
+            endOfFile.QuadPart = llFilePtr;
+            if (!SetFilePointerEx(file, endOfFile, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+            {
+                result.fFailed = true;
+            }
+            CloseHandle(file);
+        }
+    }
+
+    result.f64StreamMBps = (double)llFilePtr / ElapsedUs(start);
+
+    start = Now();
+    file = OpenDataFile(pOptions, false, false);
+    if (file == INVALID_HANDLE_VALUE || !FlushFileBuffers(file))
+    {
+        result.fFailed = true;
+    }
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(file);
+    }
+    result.f64FlushMs = ElapsedUs(start) / 1000.0;
+
+    if (!frameUs.empty())
+    {
+        std::vector<double>::iterator median = frameUs.begin() + frameUs.size() / 2;
+        std::vector<double>::iterator p99 = frameUs.begin() + frameUs.size() * 99 / 100;
+
+        std::nth_element(frameUs.begin(), median, frameUs.end());
+        result.f64MedianFrameUs = *median;
+        std::nth_element(frameUs.begin(), p99, frameUs.end());
+        result.f64P99FrameUs = *p99;
+    }
+
+    return result;
+}
+
+static bool RunCase(const BENCH_OPTIONS *pOptions, ULONG ulFrameBytes, bool fMapped)
+{
+    std::vector<BENCH_RESULT> results;
+
+    for (ULONG pass = 0; pass < pOptions->ulPasses; pass++)
+    {
+        BENCH_RESULT result = RunPass(pOptions, ulFrameBytes, fMapped);
+
+        if (result.fFailed)
+        {
+            fprintf(stderr, "SaveDataBench: %s failed, error %lu\n", fMapped ? "mapped" : "write", GetLastError());
+            return false;
+        }
+        results.push_back(result);
+    }
+
+    std::vector<BENCH_RESULT>::iterator median = results.begin() + results.size() / 2;
+    std::nth_element(results.begin(), median, results.end(),
+        [](const BENCH_RESULT &a, const BENCH_RESULT &b) { return a.f64StreamMBps < b.f64StreamMBps; });
+
+    printf("%-8s %10lu %10.1f %12.2f %12.2f %10.1f\n",
+           fMapped ? "mapped" : "write", ulFrameBytes, median->f64StreamMBps,
+           median->f64MedianFrameUs, median->f64P99FrameUs, median->f64FlushMs);
+    return true;
+}
+
+static void Usage()
+{
+    fprintf(stderr,
+        "Usage: SaveDataBench [options] [frame_bytes ...]\n"
+        "\n"
+        "  -m megabytes  data streamed per pass (default 256)\n"
+        "  -p passes     passes per case (default 5)\n"
+        "  -d directory  where to write the data file (default the temp directory)\n"
+        "\n"
+        "  frame_bytes   frame sizes to run (default 7680 15360 61440 16384)\n");
+}
+
+static bool ParseOptions(int argc, char **argv, BENCH_OPTIONS *pOptions, std::vector<ULONG> *pFrameBytes)
+{
+    WCHAR directory[MAX_PATH] = L"";
+    int i;
+
+    pOptions->ullStreamBytes = 256ull * 1024 * 1024;
+    pOptions->ulPasses = 5;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i += 2)
+    {
+        if (argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+        {
+            return false;
+        }
+
+        switch (argv[i][1])
+        {
+        case 'm':
+            pOptions->ullStreamBytes = strtoull(argv[i + 1], nullptr, 10) * 1024 * 1024;
+            if (pOptions->ullStreamBytes == 0)
+            {
+                return false;
+            }
+            break;
+        case 'p':
+            pOptions->ulPasses = strtoul(argv[i + 1], nullptr, 10);
+            if (pOptions->ulPasses == 0)
+            {
+                return false;
+            }
+            break;
+        case 'd':
+            if (MultiByteToWideChar(CP_ACP, 0, argv[i + 1], -1, directory, ARRAYSIZE(directory)) == 0)
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+
+    for (; i < argc; i++)
+    {
+        ULONG frameBytes = strtoul(argv[i], nullptr, 10);
+
+        if (frameBytes == 0 || frameBytes > 64 * 1024 * 1024)
+        {
+            return false;
+        }
+        pFrameBytes->push_back(frameBytes);
+    }
+
+    if (pFrameBytes->empty())
+    {
+        *pFrameBytes = { 4 * 1920, 4 * 3840, 4 * 15360, 4 * 4096 };
+    }
+
+    if (directory[0] == L'\0' && GetTempPathW(ARRAYSIZE(directory), directory) == 0)
+    {
+        return false;
+    }
+
+    return swprintf_s(pOptions->szPath, ARRAYSIZE(pOptions->szPath), L"%ls\\SaveDataBench.wav", directory) > 0;
+}
+
+int main(int argc, char **argv)
+{
+    BENCH_OPTIONS options;
+    std::vector<ULONG> frameBytes;
+    LARGE_INTEGER frequency;
+    bool ok = true;
+
+    if (!ParseOptions(argc, argv, &options, &frameBytes))
+    {
+        Usage();
+        return 1;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    g_f64TicksPerUs = (double)frequency.QuadPart / 1000000.0;
+
+    printf("SaveDataBench: %llu MB per pass, %lu passes, %ls\n",
+           options.ullStreamBytes / (1024 * 1024), options.ulPasses, options.szPath);
+    printf("%-8s %10s %10s %12s %12s %10s\n", "backend", "frame B", "MB/s", "median us", "p99 us", "flush ms");
+
+    for (size_t i = 0; i < frameBytes.size() && ok; i++)
+    {
+        ok = RunCase(&options, frameBytes[i], false) &&
+             RunCase(&options, frameBytes[i], true);
+    }
+
+    DeleteFileW(options.szPath);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    SharedToneSource
+
+Abstract:
+
+    Implementation of SYSVAD shared capture tone source.
+
+    The sine wave is rendered once per unique (pin, format, tone settings)
+    into a one second ring. Streams attach at the current producer position
+    and copy from the ring at their own pace; whichever stream runs ahead
+    renders the next bytes for everybody. A stream that falls more than the
+    ring size behind is moved forward by whole frames and continues from
+    there, which is a phase jump in the tone but never stale data.
+
+
+--*/
+#include <sysvad.h>
+#include "SharedToneSource.h"
+
+#define SHAREDTONESOURCE_POOLTAG    'STVS'
+
+#pragma code_seg()
+//
+// Ctor: basic init.
+//
+SharedToneSource::SharedToneSource()
+: m_lRefCount(0),
+  m_ulPin(0),
+  m_pRing(NULL),
+  m_ulRingSize(0),
+  m_ullProduced(0),
+  m_lResyncCount(0)
+{
+    InitializeListHead(&m_ListEntry);
+    RtlZeroMemory(&m_ToneParameters, sizeof(m_ToneParameters));
+    RtlZeroMemory(&m_Format, sizeof(m_Format));
+    KeInitializeSpinLock(&m_RingLock);
+}
+
+//
+// Dtor: free resources.
+//
+SharedToneSource::~SharedToneSource()
+{
+    if (m_pRing)
+    {
+        ExFreePoolWithTag(m_pRing, SHAREDTONESOURCE_POOLTAG);
+        m_pRing = NULL;
+    }
+}
+
+#pragma code_seg("PAGE")
+//
+// Init()
+//
+//  Pin - Pin the source serves.
+//  ToneParameters - Tone settings, already clamped by the caller.
+//  WfExt - Format the ring is rendered in.
+//
+NTSTATUS SharedToneSource::Init
+(
+    _In_    ULONG                   Pin,
+    _In_    PSHARED_TONE_PARAMETERS ToneParameters,
+    _In_    PWAVEFORMATEXTENSIBLE   WfExt
+)
+{
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (WfExt->Format.nBlockAlign == 0 || WfExt->Format.nSamplesPerSec == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    m_ulPin = Pin;
+    m_ToneParameters = *ToneParameters;
+    m_Format = WfExt->Format;
+    m_Format.cbSize = 0;
+
+    status = m_ToneGenerator.Init(ToneParameters->Frequency,
+                                  ToneParameters->Amplitude,
+                                  ToneParameters->DCOffset,
+                                  ToneParameters->InitialPhase,
+                                  WfExt);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+    //
+    // One second of audio, a whole number of frames.
+    //
+    m_ulRingSize = m_Format.nSamplesPerSec * m_Format.nBlockAlign;
+
+    m_pRing = (PBYTE)ExAllocatePool2(POOL_FLAG_NON_PAGED, m_ulRingSize, SHAREDTONESOURCE_POOLTAG);
+    if (m_pRing == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// IsMatch()
+//
+//  Returns TRUE if a stream with these settings can attach to this source.
+//
+BOOL SharedToneSource::IsMatch
+(
+    _In_    ULONG                   Pin,
+    _In_    PSHARED_TONE_PARAMETERS ToneParameters,
+    _In_    PWAVEFORMATEXTENSIBLE   WfExt
+)
+{
+    PAGED_CODE();
+
+    return m_ulPin == Pin &&
+           m_ToneParameters.Frequency    == ToneParameters->Frequency &&
+           m_ToneParameters.Amplitude    == ToneParameters->Amplitude &&
+           m_ToneParameters.DCOffset     == ToneParameters->DCOffset &&
+           m_ToneParameters.InitialPhase == ToneParameters->InitialPhase &&
+           m_Format.wFormatTag      == WfExt->Format.wFormatTag &&
+           m_Format.nChannels       == WfExt->Format.nChannels &&
+           m_Format.nSamplesPerSec  == WfExt->Format.nSamplesPerSec &&
+           m_Format.nBlockAlign     == WfExt->Format.nBlockAlign &&
+           m_Format.wBitsPerSample  == WfExt->Format.wBitsPerSample;
+}
+
+#pragma code_seg()
+//
+// GetAttachPosition()
+//
+//  Returns the frame aligned linear position a newly attached (or
+//  restarted) stream starts reading from.
+//
+ULONGLONG SharedToneSource::GetAttachPosition()
+{
+    KIRQL     oldIrql;
+    ULONGLONG position;
+
+    KeAcquireSpinLock(&m_RingLock, &oldIrql);
+    position = m_ullProduced - (m_ullProduced % m_Format.nBlockAlign);
+    KeReleaseSpinLock(&m_RingLock, oldIrql);
+
+    return position;
+}
+
+//
+// Produce()
+//
+//  Renders the tone into the ring up to the Target linear position.
+//  Caller holds m_RingLock.
+//
+VOID SharedToneSource::Produce
+(
+    _In_    ULONGLONG               Target
+)
+{
+    if (Target <= m_ullProduced)
+    {
+        return;
+    }
+
+    //
+    // Nothing older than one ring can be read back, so don't render it.
+    // Skip whole frames to keep linear positions frame aligned.
+    //
+    if (Target - m_ullProduced > m_ulRingSize)
+    {
+        ULONGLONG skip = Target - m_ullProduced - m_ulRingSize;
+        skip -= skip % m_Format.nBlockAlign;
+        m_ullProduced += skip;
+    }
+
+    while (m_ullProduced < Target)
+    {
+        ULONG offset = (ULONG)(m_ullProduced % m_ulRingSize);
+        ULONG run = (ULONG)min(Target - m_ullProduced, (ULONGLONG)(m_ulRingSize - offset));
+
+        m_ToneGenerator.GenerateSine(m_pRing + offset, run);
+        m_ullProduced += run;
+    }
+}
+
+//
+// ReadSamples()
+//
+//  Copies BufferLength bytes starting at the stream's linear ReadPosition,
+//  rendering more of the tone first if the stream is the furthest ahead.
+//
+//  ReadPosition - Stream's linear position in the source, advanced on return.
+//  Buffer - Buffer to hold the samples
+//  BufferLength - Length of the buffer.
+//
+VOID SharedToneSource::ReadSamples
+(
+    _Inout_                          ULONGLONG  *ReadPosition,
+    _Out_writes_bytes_(BufferLength) BYTE       *Buffer,
+    _In_                             ULONG       BufferLength
+)
+{
+    KIRQL oldIrql;
+
+    while (BufferLength > 0)
+    {
+        // Half a ring at a time, so a read never overwrites its own data.
+        ULONG chunk = min(BufferLength, m_ulRingSize / 2);
+
+        KeAcquireSpinLock(&m_RingLock, &oldIrql);
+
+        for (;;)
+        {
+            Produce(*ReadPosition + chunk);
+
+            if (m_ullProduced - *ReadPosition <= m_ulRingSize)
+            {
+                break;
+            }
+
+            //
+            // This stream fell out of the ring, move it forward by whole frames.
+            //
+            ULONGLONG advance = m_ullProduced - m_ulRingSize - *ReadPosition;
+            advance += m_Format.nBlockAlign - 1;
+            advance -= advance % m_Format.nBlockAlign;
+            *ReadPosition += advance;
+            InterlockedIncrement(&m_lResyncCount);
+        }
+
+        ULONG offset = (ULONG)(*ReadPosition % m_ulRingSize);
+        ULONG run = min(chunk, m_ulRingSize - offset);
+
+        RtlCopyMemory(Buffer, m_pRing + offset, run);
+        if (run < chunk)
+        {
+            RtlCopyMemory(Buffer + run, m_pRing, chunk - run);
+        }
+
+        KeReleaseSpinLock(&m_RingLock, oldIrql);
+
+        *ReadPosition += chunk;
+        Buffer += chunk;
+        BufferLength -= chunk;
+    }
+}
@@ -0,0 +1,101 @@
+/*++
+
+Copyright (c) Microsoft Corporation All Rights Reserved
+
+Module Name:
+
+    SharedToneSource.h
+
+Abstract:
+
+    Declaration of SYSVAD shared capture tone source. One instance renders
+    the capture sine wave once into a ring that every capture stream on the
+    same pin with the same format and tone settings copies from.
+
+
+--*/
+#ifndef _SYSVAD_SHAREDTONESOURCE_H
+#define _SYSVAD_SHAREDTONESOURCE_H
+
+#include "ToneGenerator.h"
+
+//
+// Tone settings a shared source is keyed on, in addition to pin and format.
+//
+typedef struct _SHARED_TONE_PARAMETERS
+{
+    DWORD           Frequency;
+    double          Amplitude;
+    double          DCOffset;
+    double          InitialPhase;
+} SHARED_TONE_PARAMETERS;
+typedef SHARED_TONE_PARAMETERS *PSHARED_TONE_PARAMETERS;
+
+class SharedToneSource
+{
+public:
+    LIST_ENTRY      m_ListEntry;            // Owned by the miniport's source list.
+    LONG            m_lRefCount;            // Streams attached, protected by the list lock.
+
+protected:
+    ULONG           m_ulPin;
+    SHARED_TONE_PARAMETERS m_ToneParameters;
+    WAVEFORMATEX    m_Format;
+
+    ToneGenerator   m_ToneGenerator;
+
+    // Ring of the most recently rendered bytes. m_ullProduced is the linear
+    // byte position of the producer, each stream keeps its own linear read
+    // position and may trail the producer by at most m_ulRingSize bytes.
+    KSPIN_LOCK      m_RingLock;
+    PBYTE           m_pRing;
+    ULONG           m_ulRingSize;
+    ULONGLONG       m_ullProduced;
+    volatile LONG   m_lResyncCount;         // Reads that fell out of the ring.
+
+public:
+    SharedToneSource();
+    ~SharedToneSource();
+
+    NTSTATUS
+    Init
+    (
+        _In_    ULONG                   Pin,
+        _In_    PSHARED_TONE_PARAMETERS ToneParameters,
+        _In_    PWAVEFORMATEXTENSIBLE   WfExt
+    );
+
+    BOOL
+    IsMatch
+    (
+        _In_    ULONG                   Pin,
+        _In_    PSHARED_TONE_PARAMETERS ToneParameters,
+        _In_    PWAVEFORMATEXTENSIBLE   WfExt
+    );
+
+    ULONGLONG
+    GetAttachPosition();
+
+    VOID
+    ReadSamples
+    (
+        _Inout_                          ULONGLONG  *ReadPosition,
+        _Out_writes_bytes_(BufferLength) BYTE       *Buffer,
+        _In_                             ULONG       BufferLength
+    );
+
+    ULONG
+    GetResyncCount()
+    {
+        return (ULONG)m_lResyncCount;
+    }
+
+private:
+    VOID Produce
+    (
+        _In_    ULONGLONG               Target
+    );
+};
+typedef SharedToneSource *PSharedToneSource;
+
+#endif // _SYSVAD_SHAREDTONESOURCE_H
@@ -24,7 +24,36 @@ DEFINE_GUIDSTRUCT("D849C827-B24B-4C3D-A26E-338F4FF07ED5", KSPROPSETID_SysVAD);
 
 
 typedef enum{
-    KSPROPERTY_SYSVAD_DEFAULTSTREAMEFFECTS
+    KSPROPERTY_SYSVAD_DEFAULTSTREAMEFFECTS,
+    KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS
 } KSPROPERTY_SYSVAD;
 
+//
+// Value of KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS (render pin, get only).
+// Health of the render data file writer of a single stream. Every render
+// wave filter has it on its system and offload pins; capture streams write
+// no data file, so capture pins do not list it. Latency is the
+// time from queuing a frame to it being handed to the file system, the
+// percentiles are upper bounds of power-of-two microsecond buckets.
+// FramesDropped counts the writes that were lost whole; BytesDropped also
+// counts the tails cut off writes that did not fit.
+// MappedOutput is TRUE when the UseMappedDataFiles backend wrote the file,
+// so runs of the two backends can be told apart.
+//
+typedef struct _SYSVAD_SAVEDATA_STATISTICS
+{
+    ULONGLONG   BytesWritten;
+    ULONGLONG   BytesDropped;
+    ULONG       FramesWritten;
+    ULONG       FramesDropped;
+    ULONG       FramesPending;
+    ULONG       MaxQueueDepth;
+    ULONG       FrameSize;
+    ULONG       WriteLatencyP50Us;
+    ULONG       WriteLatencyP90Us;
+    ULONG       WriteLatencyP99Us;
+    ULONG       WriteLatencyMaxUs;
+    ULONG       MappedOutput;
+} SYSVAD_SAVEDATA_STATISTICS, *PSYSVAD_SAVEDATA_STATISTICS;
+
 #endif
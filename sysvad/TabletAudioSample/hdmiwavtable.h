@@ -18,6 +18,8 @@ Abstract:
 #ifndef _SYSVAD_HDMIWAVTABLE_H_
 #define _SYSVAD_HDMIWAVTABLE_H_
 
+#include "SysVadShared.h"
+
 
 //=============================================================================
 // Defines
@@ -766,6 +768,21 @@ PKSDATARANGE HdmiPinDataRangePointersBridge[] =
 };
 
 
+//=============================================================================
+
+static
+PCPROPERTY_ITEM PropertiesHdmiHostPin[] =
+{
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationHdmiHostPin, PropertiesHdmiHostPin);
+
 //=============================================================================
 static
 PCPIN_DESCRIPTOR HdmiWaveMiniportPins[] =
@@ -775,7 +792,7 @@ PCPIN_DESCRIPTOR HdmiWaveMiniportPins[] =
         HDMI_MAX_INPUT_SYSTEM_STREAMS,
         HDMI_MAX_INPUT_SYSTEM_STREAMS, 
         0,
-        NULL,
+        &AutomationHdmiHostPin,        // AutomationTable
         {
             0,
             NULL,
@@ -15,6 +15,8 @@ Abstract:
 #ifndef _SYSVAD_SPDIFWAVTABLE_H_
 #define _SYSVAD_SPDIFWAVTABLE_H_
 
+#include "SysVadShared.h"
+
 
 //=============================================================================
 // Defines
@@ -632,12 +634,33 @@ PCPROPERTY_ITEM PropertiesSpdifOffloadPin[] =
         KSPROPERTY_OFFLOAD_PIN_VERIFY_STREAM_OBJECT_POINTER, // define properties
         KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_BASICSUPPORT,
         PropertyHandler_OffloadPin
-    }
+    },
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
 };
 
 DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpdifOffloadPin, PropertiesSpdifOffloadPin);
 
 
+//=============================================================================
+
+static
+PCPROPERTY_ITEM PropertiesSpdifHostPin[] =
+{
+    {
+        &KSPROPSETID_SysVAD,
+        KSPROPERTY_SYSVAD_SAVEDATA_STATISTICS,
+        KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_BASICSUPPORT,
+        PropertyHandler_GenericPin
+    },
+};
+
+DEFINE_PCAUTOMATION_TABLE_PROP(AutomationSpdifHostPin, PropertiesSpdifHostPin);
+
 //=============================================================================
 static
 PCPIN_DESCRIPTOR SpdifWaveMiniportPins[] =
@@ -647,7 +670,7 @@ PCPIN_DESCRIPTOR SpdifWaveMiniportPins[] =
         SPDIF_MAX_INPUT_SYSTEM_STREAMS,
         SPDIF_MAX_INPUT_SYSTEM_STREAMS, 
         0,
-        NULL,
+        &AutomationSpdifHostPin,        // AutomationTable
         {
             0,
             NULL,
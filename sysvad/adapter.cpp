@@ -250,6 +250,19 @@ DRIVER_DISPATCH PnpHandler;
 // DoNotCreateDataFiles (DWORD) > 0 to override this default.
 //
 DWORD g_DoNotCreateDataFiles = 0;  // default is off.
+//
+// Rendering streams are written with ZwWriteFile by default. Use the registry
+// value UseMappedDataFiles (DWORD) > 0 to write them through a mapped view of
+// the data file instead.
+//
+DWORD g_UseMappedDataFiles = 0;    // default is off.
+//
+// The keyword detector keeps KeywordHistoryMs (DWORD, 1000 to 10000) of audio
+// for pre-roll. KeywordBurstPackets (DWORD, 1 to 16) > 1 lets one read of the
+// keyword pin fill that many WaveRT packets while draining the history.
+//
+DWORD g_KeywordHistoryMs = 1000;   // default is 1 second.
+DWORD g_KeywordBurstPackets = 1;   // default is one packet per read.
 DWORD g_DisableToneGenerator = 0;  // default is to generate tones.
 UNICODE_STRING g_RegistryPath;      // This is used to store the registry settings path for the driver
 
@@ -429,7 +442,10 @@ Returns:
     RTL_QUERY_REGISTRY_TABLE    paramTable[] = {
     // QueryRoutine     Flags                                               Name                     EntryContext             DefaultType                                                    DefaultData              DefaultLength
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"DoNotCreateDataFiles", &g_DoNotCreateDataFiles, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_DoNotCreateDataFiles, sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"UseMappedDataFiles",   &g_UseMappedDataFiles,   (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_UseMappedDataFiles,   sizeof(ULONG)},
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"DisableToneGenerator", &g_DisableToneGenerator, (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_DisableToneGenerator, sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"KeywordHistoryMs",     &g_KeywordHistoryMs,     (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_KeywordHistoryMs,     sizeof(ULONG)},
+        { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"KeywordBurstPackets",  &g_KeywordBurstPackets,  (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_KeywordBurstPackets,  sizeof(ULONG)},
 #ifdef SYSVAD_BTH_BYPASS
         { NULL,   RTL_QUERY_REGISTRY_DIRECT | RTL_QUERY_REGISTRY_TYPECHECK, L"DisableBthScoBypass",  &g_DisableBthScoBypass,  (REG_DWORD << RTL_QUERY_REGISTRY_TYPECHECK_SHIFT) | REG_DWORD, &g_DisableBthScoBypass,  sizeof(ULONG)},
 #endif // SYSVAD_BTH_BYPASS
@@ -477,7 +493,10 @@ Returns:
     // Dump settings.
     //
     DPF(D_VERBOSE, ("DoNotCreateDataFiles: %u", g_DoNotCreateDataFiles));
+    DPF(D_VERBOSE, ("UseMappedDataFiles: %u", g_UseMappedDataFiles));
     DPF(D_VERBOSE, ("DisableToneGenerator: %u", g_DisableToneGenerator));
+    DPF(D_VERBOSE, ("KeywordHistoryMs: %u", g_KeywordHistoryMs));
+    DPF(D_VERBOSE, ("KeywordBurstPackets: %u", g_KeywordBurstPackets));
 #ifdef SYSVAD_BTH_BYPASS
     DPF(D_VERBOSE, ("DisableBthScoBypass: %u", g_DisableBthScoBypass));
 #endif // SYSVAD_BTH_BYPASS
@@ -50,7 +50,6 @@ Abstract:
 // CSaveData statics
 //-----------------------------------------------------------------------------
 
-PSAVEWORKER_PARAM       CSaveData::m_pWorkItems = NULL;
 PDEVICE_OBJECT          CSaveData::m_pDeviceObject = NULL;
 //=============================================================================
 // Classes
@@ -642,8 +641,7 @@ Return Value:
         delete m_pHW;
         m_pHW = NULL;
     }
-    
-    CSaveData::DestroyWorkItems();
+
     SAFE_RELEASE(m_pPortClsEtwHelper);
     SAFE_RELEASE(m_pServiceGroupWave);
  
@@ -840,8 +838,9 @@ Return Value:
     //
     // Initialize SaveData class.
     //
-    CSaveData::SetDeviceObject(DeviceObject);   //device object is needed by CSaveData
-    ntStatus = CSaveData::InitializeWorkItems(DeviceObject);
+    // Work items are allocated per stream, CSaveData only needs the device object.
+    //
+    ntStatus = CSaveData::SetDeviceObject(DeviceObject);   //device object is needed by CSaveData
     IF_FAILED_JUMP(ntStatus, Done);
 Done:
 
@@ -16,6 +16,10 @@ Abstract:
     Each frame structure represents a portion of buffer. When that portion
     of frame is full, a workitem is scheduled to save it to disk.
 
+    When UseMappedDataFiles is set, the workitem copies the frame into a
+    mapped view of the data file instead of calling ZwWriteFile. The view
+    is a sliding window that is remapped as the file grows.
+
 
 
 --*/
@@ -52,13 +56,19 @@ Abstract:
 #define OFFLOAD_FILE_NAME           L"OFFLOAD"
 #define HOST_FILE_NAME              L"HOST"
 
-#define MAX_WORKER_ITEM_COUNT       15
+// A frame is only handed to a work item once it is full, so each stream never
+// has more than one work item per frame plus one for the trailing partial frame.
+#define WORKER_ITEM_COUNT           (DEFAULT_FRAME_COUNT + 1)
+
+// Mapped view backend. Views must start on an allocation granularity boundary.
+#define MAPPED_VIEW_ALIGNMENT       0x10000
+#define MAPPED_VIEW_WINDOW_SIZE     (16 * MAPPED_VIEW_ALIGNMENT)
 
 //=============================================================================
 // Statics
 //=============================================================================
-ULONG CSaveData::m_ulStreamId = 0;
-ULONG CSaveData::m_ulOffloadStreamId = 0;
+LONG CSaveData::m_ulStreamId = 0;
+LONG CSaveData::m_ulOffloadStreamId = 0;
 
 #pragma code_seg("PAGE")
 //=============================================================================
@@ -77,11 +87,27 @@ CSaveData::CSaveData()
     m_fFrameUsed(NULL),
     m_waveFormat(NULL),
     m_pFilePtr(NULL),
+    m_pWorkItems(NULL),
+    m_ulWorkItemCount(0),
+    m_lPendingWorkItems(1),
+    m_llBytesWritten(0),
+    m_llBytesDropped(0),
+    m_lFramesWritten(0),
+    m_lFramesDropped(0),
+    m_lMaxQueueDepth(0),
+    m_lMaxWriteLatencyUs(0),
+    m_fMappedOutput(FALSE),
+    m_SectionHandle(NULL),
+    m_pMappedView(NULL),
+    m_cbMappedViewSize(0),
     m_fWriteDisabled(FALSE),
     m_bInitialized(FALSE)
 {
     PAGED_CODE();
 
+    ExInitializeSListHead(&m_WorkItemFreeList);
+    KeInitializeEvent(&m_WorkItemsDone, NotificationEvent, FALSE);
+
     m_FileHeader.dwRiff           = RIFF_TAG;
     m_FileHeader.dwFileSize       = 0;
     m_FileHeader.dwWave           = WAVE_TAG;
@@ -91,6 +117,11 @@ CSaveData::CSaveData()
     m_DataHeader.dwData           = DATA_TAG;
     m_DataHeader.dwDataLength     = 0;
 
+    m_liMappedViewOffset.QuadPart = 0;
+
+    RtlZeroMemory((PVOID)m_alWriteLatency, sizeof(m_alWriteLatency));
+    KeQueryPerformanceCounter(&m_liQpcFrequency);
+
     RtlZeroMemory(&m_objectAttributes, sizeof(m_objectAttributes));
 } // CSaveData
 
@@ -101,10 +132,20 @@ CSaveData::~CSaveData()
 
     DPF_ENTER(("[CSaveData::~CSaveData]"));
 
+    // Make sure none of this stream's work items still reference the buffers.
+    //
+    if (m_pWorkItems)
+    {
+        WaitPendingWorkItems();
+        DestroyWorkItems();
+    }
+
     // Update the wave header in data file with real file size.
     //
     if(m_pFilePtr)
     {
+        LONGLONG llEndOfFile = m_pFilePtr->QuadPart;
+
         m_FileHeader.dwFileSize =
             (DWORD) m_pFilePtr->QuadPart - 2 * sizeof(DWORD);
         m_DataHeader.dwDataLength = (DWORD) m_pFilePtr->QuadPart -
@@ -121,8 +162,21 @@ CSaveData::~CSaveData()
                 NULL
             ))
         {
+            // The mapped backend grows the file a window at a time, trim
+            // it back to the data actually written.
+            //
+            if (m_fMappedOutput)
+            {
+                MappedViewClose();
+            }
+
             if (NT_SUCCESS(FileOpen(FALSE)))
             {
+                if (m_fMappedOutput)
+                {
+                    FileSetEndOfFile(llEndOfFile);
+                }
+
                 FileWriteHeader();
 
                 FileClose();
@@ -169,7 +223,7 @@ CSaveData::DestroyWorkItems
 
     if (m_pWorkItems)
     {
-        for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
+        for (ULONG i = 0; i < m_ulWorkItemCount; i++)
         {
             if (m_pWorkItems[i].WorkItem!=NULL)
             {
@@ -179,8 +233,11 @@ CSaveData::DestroyWorkItems
         }
         ExFreePoolWithTag(m_pWorkItems, SAVEDATA_POOLTAG);
         m_pWorkItems = NULL;
+        m_ulWorkItemCount = 0;
     }
 
+    ExInitializeSListHead(&m_WorkItemFreeList);
+
 } // DestroyWorkItems
 
 //=============================================================================
@@ -231,11 +288,13 @@ CSaveData::FileOpen
 
     if(!m_FileHandle)
     {
+        // A read/write section needs read access to the file as well.
+        //
         ntStatus =
             ZwCreateFile
             (
                 &m_FileHandle,
-                GENERIC_WRITE | SYNCHRONIZE,
+                m_fMappedOutput ? (GENERIC_READ | GENERIC_WRITE | SYNCHRONIZE) : (GENERIC_WRITE | SYNCHRONIZE),
                 &m_objectAttributes,
                 &ioStatusBlock,
                 NULL,
@@ -378,6 +437,232 @@ CSaveData::FileWriteHeader(void)
 
     return ntStatus;
 } // FileWriteHeader
+
+//=============================================================================
+NTSTATUS
+CSaveData::FileSetEndOfFile
+(
+    _In_  LONGLONG              llEndOfFile
+)
+{
+    PAGED_CODE();
+
+    NTSTATUS                    ntStatus;
+    IO_STATUS_BLOCK             ioStatusBlock;
+    FILE_END_OF_FILE_INFORMATION eofInfo;
+
+    if (!m_FileHandle)
+    {
+        DPF(D_TERSE, ("[CSaveData::FileSetEndOfFile : File not open]"));
+        return STATUS_INVALID_HANDLE;
+    }
+
+    eofInfo.EndOfFile.QuadPart = llEndOfFile;
+
+    ntStatus = ZwSetInformationFile( m_FileHandle,
+                                     &ioStatusBlock,
+                                     &eofInfo,
+                                     sizeof(eofInfo),
+                                     FileEndOfFileInformation);
+    if (!NT_SUCCESS(ntStatus))
+    {
+        DPF(D_TERSE, ("[CSaveData::FileSetEndOfFile : Error 0x%x]", ntStatus));
+    }
+
+    return ntStatus;
+} // FileSetEndOfFile
+
+//=============================================================================
+void
+CSaveData::MappedViewClose
+(
+    void
+)
+/*++
+
+Routine Description:
+
+  Unmaps the current window and closes its section. Dirty pages are written
+  back by the memory manager in the background, so this never waits for the
+  data to reach the disk.
+
+  Views are always mapped into the system process, attach to it so this
+  can also be called from the destructor.
+
+--*/
+{
+    PAGED_CODE();
+
+    KAPC_STATE                  apcState;
+
+    KeStackAttachProcess(PsInitialSystemProcess, &apcState);
+
+    if (m_pMappedView)
+    {
+        ZwUnmapViewOfSection(ZwCurrentProcess(), m_pMappedView);
+        m_pMappedView = NULL;
+        m_cbMappedViewSize = 0;
+    }
+
+    if (m_SectionHandle)
+    {
+        ZwClose(m_SectionHandle);
+        m_SectionHandle = NULL;
+    }
+
+    KeUnstackDetachProcess(&apcState);
+} // MappedViewClose
+
+//=============================================================================
+NTSTATUS
+CSaveData::MappedViewRemap
+(
+    _In_  LONGLONG              llFileOffset
+)
+/*++
+
+Routine Description:
+
+  Maps the window of the data file containing llFileOffset. The section is
+  created with a maximum size that covers the whole window, which extends the
+  file as needed. Called with m_FileSync held.
+
+--*/
+{
+    PAGED_CODE();
+
+    NTSTATUS                    ntStatus;
+    OBJECT_ATTRIBUTES           objectAttributes;
+    LARGE_INTEGER               maximumSize;
+    KAPC_STATE                  apcState;
+
+    MappedViewClose();
+
+    m_liMappedViewOffset.QuadPart = llFileOffset & ~((LONGLONG)MAPPED_VIEW_ALIGNMENT - 1);
+    maximumSize.QuadPart = m_liMappedViewOffset.QuadPart + MAPPED_VIEW_WINDOW_SIZE;
+
+    ntStatus = FileOpen(FALSE);
+    if (!NT_SUCCESS(ntStatus))
+    {
+        return ntStatus;
+    }
+
+    InitializeObjectAttributes
+    (
+        &objectAttributes,
+        NULL,
+        OBJ_KERNEL_HANDLE,
+        NULL,
+        NULL
+    );
+
+    ntStatus = ZwCreateSection( &m_SectionHandle,
+                                SECTION_MAP_READ | SECTION_MAP_WRITE,
+                                &objectAttributes,
+                                &maximumSize,
+                                PAGE_READWRITE,
+                                SEC_COMMIT,
+                                m_FileHandle);
+
+    // The section holds its own reference on the file.
+    FileClose();
+
+    if (!NT_SUCCESS(ntStatus))
+    {
+        DPF(D_TERSE, ("[CSaveData::MappedViewRemap : ZwCreateSection failed, 0x%x]", ntStatus));
+        m_SectionHandle = NULL;
+        return ntStatus;
+    }
+
+    m_cbMappedViewSize = MAPPED_VIEW_WINDOW_SIZE;
+
+    KeStackAttachProcess(PsInitialSystemProcess, &apcState);
+
+    ntStatus = ZwMapViewOfSection( m_SectionHandle,
+                                   ZwCurrentProcess(),
+                                   (PVOID *)&m_pMappedView,
+                                   0,
+                                   0,
+                                   &m_liMappedViewOffset,
+                                   &m_cbMappedViewSize,
+                                   ViewUnmap,
+                                   0,
+                                   PAGE_READWRITE);
+
+    KeUnstackDetachProcess(&apcState);
+
+    if (!NT_SUCCESS(ntStatus))
+    {
+        DPF(D_TERSE, ("[CSaveData::MappedViewRemap : ZwMapViewOfSection failed, 0x%x]", ntStatus));
+        m_pMappedView = NULL;
+        MappedViewClose();
+    }
+
+    return ntStatus;
+} // MappedViewRemap
+
+//=============================================================================
+NTSTATUS
+CSaveData::MappedViewWrite
+(
+    _In_reads_bytes_(ulDataSize)    PBYTE   pData,
+    _In_                            ULONG   ulDataSize
+)
+/*++
+
+Routine Description:
+
+  Copies a frame into the mapped window(s) of the data file, remapping
+  whenever the write position leaves the current window. Called from the
+  worker (system process) with m_FileSync held.
+
+--*/
+{
+    PAGED_CODE();
+
+    ASSERT(pData);
+    ASSERT(m_pFilePtr);
+
+    NTSTATUS                    ntStatus = STATUS_SUCCESS;
+
+    while (ulDataSize > 0)
+    {
+        LONGLONG llViewEnd = m_liMappedViewOffset.QuadPart + (LONGLONG)m_cbMappedViewSize;
+
+        if (m_pMappedView == NULL ||
+            m_pFilePtr->QuadPart < m_liMappedViewOffset.QuadPart ||
+            m_pFilePtr->QuadPart >= llViewEnd)
+        {
+            ntStatus = MappedViewRemap(m_pFilePtr->QuadPart);
+            if (!NT_SUCCESS(ntStatus))
+            {
+                break;
+            }
+            continue;
+        }
+
+        ULONG ulViewOffset = (ULONG)(m_pFilePtr->QuadPart - m_liMappedViewOffset.QuadPart);
+        ULONG ulCopy = (ULONG)min((LONGLONG)ulDataSize, llViewEnd - m_pFilePtr->QuadPart);
+
+        __try
+        {
+            RtlCopyMemory(m_pMappedView + ulViewOffset, pData, ulCopy);
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            // In-page errors (e.g. disk full) surface as exceptions.
+            ntStatus = GetExceptionCode();
+            DPF(D_TERSE, ("[CSaveData::MappedViewWrite : Exception 0x%x]", ntStatus));
+            break;
+        }
+
+        m_pFilePtr->QuadPart += ulCopy;
+        pData += ulCopy;
+        ulDataSize -= ulCopy;
+    }
+
+    return ntStatus;
+} // MappedViewWrite
 NTSTATUS
 CSaveData::SetDeviceObject
 (
@@ -413,31 +698,26 @@ CSaveData::GetNewWorkItem
     void
 )
 {
-    LARGE_INTEGER               timeOut = { 0 };
-    NTSTATUS                    ntStatus;
+    PSLIST_ENTRY                pEntry;
 
-    for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
+    pEntry = InterlockedPopEntrySList(&m_WorkItemFreeList);
+    if (NULL == pEntry)
     {
-        ntStatus =
-            KeWaitForSingleObject
-            (
-                &m_pWorkItems[i].EventDone,
-                Executive,
-                KernelMode,
-                FALSE,
-                &timeOut
-            );
-        if (STATUS_SUCCESS == ntStatus)
-        {
-            if (m_pWorkItems[i].WorkItem)
-                return &(m_pWorkItems[i]);
-            else
-                return NULL;
-        }
+        return NULL;
     }
 
-    return NULL;
+    return CONTAINING_RECORD(pEntry, SAVEWORKER_PARAM, FreeListEntry);
 } // GetNewWorkItem
+
+//=============================================================================
+void
+CSaveData::ReleaseWorkItem
+(
+    _In_  PSAVEWORKER_PARAM     pParam
+)
+{
+    InterlockedPushEntrySList(&m_WorkItemFreeList, &pParam->FreeListEntry);
+} // ReleaseWorkItem
 #pragma code_seg("PAGE")
 
 //=============================================================================
@@ -457,15 +737,27 @@ CSaveData::Initialize
     HANDLE            osDataFileHandle = NULL;     
     IO_STATUS_BLOCK   ioStatusBlock;
 
+    LONG        lStreamId;
+
     DPF_ENTER(("[CSaveData::Initialize]"));
 
+    m_fMappedOutput = (g_UseMappedDataFiles != 0);
+
     if (_bOffloaded)
     {
-        m_ulOffloadStreamId++;
+        lStreamId = InterlockedIncrement(&m_ulOffloadStreamId);
     }
     else
     {
-        m_ulStreamId++;
+        lStreamId = InterlockedIncrement(&m_ulStreamId);
+    }
+
+    // Allocate this stream's work items.
+    //
+    ntStatus = InitializeWorkItems(m_pDeviceObject);
+    if (!NT_SUCCESS(ntStatus))
+    {
+        return ntStatus;
     }
 
     // Probe if OSData volume exists.
@@ -503,7 +795,7 @@ CSaveData::Initialize
 
     // Allocate data file name.
     //
-    RtlStringCchPrintfW(szTemp, MAX_PATH, L"%s_%s_%d.wav", NT_SUCCESS(ntStatus) ? OSDATA_FILE_NAME : DEFAULT_FILE_NAME, _bOffloaded ? OFFLOAD_FILE_NAME : HOST_FILE_NAME, _bOffloaded ? m_ulOffloadStreamId : m_ulStreamId);
+    RtlStringCchPrintfW(szTemp, MAX_PATH, L"%s_%s_%d.wav", NT_SUCCESS(ntStatus) ? OSDATA_FILE_NAME : DEFAULT_FILE_NAME, _bOffloaded ? OFFLOAD_FILE_NAME : HOST_FILE_NAME, lStreamId);
     m_FileName.Length = 0;
     ntStatus = RtlStringCchLengthW (szTemp, sizeof(szTemp)/sizeof(szTemp[0]), &cLen);
     if (NT_SUCCESS(ntStatus))
@@ -644,25 +936,24 @@ CSaveData::InitializeWorkItems
         ExAllocatePool2
         (
             POOL_FLAG_NON_PAGED,
-            sizeof(SAVEWORKER_PARAM) * MAX_WORKER_ITEM_COUNT,
+            sizeof(SAVEWORKER_PARAM) * WORKER_ITEM_COUNT,
             SAVEDATA_POOLTAG
         );
     if (m_pWorkItems)
     {
-        for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
-        {
+        m_ulWorkItemCount = WORKER_ITEM_COUNT;
 
+        for (ULONG i = 0; i < m_ulWorkItemCount; i++)
+        {
             m_pWorkItems[i].WorkItem = IoAllocateWorkItem(DeviceObject);
             if(m_pWorkItems[i].WorkItem == NULL)
             {
-              return STATUS_INSUFFICIENT_RESOURCES;
+                DestroyWorkItems();
+                return STATUS_INSUFFICIENT_RESOURCES;
             }
-            KeInitializeEvent
-            (
-                &m_pWorkItems[i].EventDone,
-                NotificationEvent,
-                TRUE
-            );
+            m_pWorkItems[i].pSaveData = this;
+
+            InterlockedPushEntrySList(&m_WorkItemFreeList, &m_pWorkItems[i].FreeListEntry);
         }
     }
     else
@@ -719,18 +1010,43 @@ SaveFrameWorkerCallback
                 NULL
             ))
         {
-            if (NT_SUCCESS(pSaveData->FileOpen(FALSE)))
+            NTSTATUS ntStatus = STATUS_UNSUCCESSFUL;
+
+            if (pSaveData->m_fMappedOutput)
+            {
+                ntStatus = pSaveData->MappedViewWrite(pParam->pData, pParam->ulDataSize);
+            }
+            else if (NT_SUCCESS(pSaveData->FileOpen(FALSE)))
             { 
-                pSaveData->FileWrite(pParam->pData, pParam->ulDataSize);
+                ntStatus = pSaveData->FileWrite(pParam->pData, pParam->ulDataSize);
                 pSaveData->FileClose();
             }
+
+            if (NT_SUCCESS(ntStatus))
+            {
+                InterlockedAdd64(&pSaveData->m_llBytesWritten, pParam->ulDataSize);
+                InterlockedIncrement(&pSaveData->m_lFramesWritten);
+                pSaveData->RecordWriteLatency(pParam->llQueuedQpc);
+            }
+            else
+            {
+                pSaveData->CountDropped(pParam->ulDataSize);
+            }
             InterlockedExchange( (LONG *)&(pSaveData->m_fFrameUsed[pParam->ulFrameNo]), FALSE );
 
             KeReleaseMutex( &pSaveData->m_FileSync, FALSE );
         }
-    }
 
-    KeSetEvent(&pParam->EventDone, 0, FALSE);
+        // Return the work item to the stream's free list before dropping
+        // the pending count; the stream may be torn down right after that.
+        //
+        pSaveData->ReleaseWorkItem(pParam);
+
+        if (0 == InterlockedDecrement(&pSaveData->m_lPendingWorkItems))
+        {
+            KeSetEvent(&pSaveData->m_WorkItemsDone, 0, FALSE);
+        }
+    }
 } // SaveFrameWorkerCallback
 
 //=============================================================================
@@ -892,14 +1208,33 @@ CSaveData::SaveFrame
     pParam = GetNewWorkItem();
     if (pParam)
     {
-        pParam->pSaveData = this;
+        LONG lQueueDepth;
+        LONG lMaxQueueDepth;
+
         pParam->ulFrameNo = ulFrameNo;
         pParam->ulDataSize = ulDataSize;
         pParam->pData = m_pDataBuffer + ulFrameNo * m_ulFrameSize;
-        KeResetEvent(&pParam->EventDone);
+        pParam->llQueuedQpc = KeQueryPerformanceCounter(NULL).QuadPart;
+
+        // The pending count carries a bias of one.
+        lQueueDepth = InterlockedIncrement(&m_lPendingWorkItems) - 1;
+        lMaxQueueDepth = m_lMaxQueueDepth;
+        while (lQueueDepth > lMaxQueueDepth &&
+               InterlockedCompareExchange(&m_lMaxQueueDepth, lQueueDepth, lMaxQueueDepth) != lMaxQueueDepth)
+        {
+            lMaxQueueDepth = m_lMaxQueueDepth;
+        }
+
         IoQueueWorkItem(pParam->WorkItem, SaveFrameWorkerCallback,
                         CriticalWorkQueue, (PVOID)pParam);
     }
+    else
+    {
+        // Nobody is going to save this frame, make it available again.
+        DPF(D_BLAB, ("[No work item available for frame %d]", ulFrameNo));
+        CountDropped(ulDataSize);
+        InterlockedExchange( (LONG *)&(m_fFrameUsed[ulFrameNo]), FALSE );
+    }
 } // SaveFrame
 #pragma code_seg("PAGE")
 //=============================================================================
@@ -921,20 +1256,45 @@ CSaveData::WaitAllWorkItems
         size = m_ulBufferOffset - m_ulFrameIndex * m_ulFrameSize;
         SaveFrame(m_ulFrameIndex, size);
     }
-    
-    for (int i = 0; i < MAX_WORKER_ITEM_COUNT; i++)
+
+    WaitPendingWorkItems();
+} // WaitAllWorkItems
+
+//=============================================================================
+void
+CSaveData::WaitPendingWorkItems
+(
+    void
+)
+/*++
+
+Routine Description:
+
+  Waits for the work items queued by this stream only. The pending count
+  carries a bias of one while the stream is running, so the done event can
+  only be signaled after the bias has been dropped here.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (0 != InterlockedDecrement(&m_lPendingWorkItems))
     {
-        DPF(D_VERBOSE, ("[Waiting for WorkItem] %d", i));
+        DPF(D_VERBOSE, ("[Waiting for WorkItems]"));
         KeWaitForSingleObject
         (
-            &(m_pWorkItems[i].EventDone),
+            &m_WorkItemsDone,
             Executive,
             KernelMode,
             FALSE,
             NULL
         );
     }
-} // WaitAllWorkItems
+
+    // Restore the bias for the next run.
+    KeClearEvent(&m_WorkItemsDone);
+    InterlockedExchange(&m_lPendingWorkItems, 1);
+} // WaitPendingWorkItems
 
 #pragma code_seg()
 //=============================================================================
@@ -968,6 +1328,7 @@ CSaveData::WriteData
     // The logic below assumes that write size is <= than frame size.
     if (ulByteCount > m_ulFrameSize)
     {
+        CountTruncated(ulByteCount - m_ulFrameSize);
         ulByteCount = m_ulFrameSize;
     }
         
@@ -1027,6 +1388,7 @@ CSaveData::WriteData
             {
                 KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql);
                 DPF(D_BLAB, ("[Frame overflow, next frame is in use]"));
+                CountTruncated(ulByteCount - ulWriteBytes);
             }
         }
 
@@ -1039,8 +1401,132 @@ CSaveData::WriteData
     {
         KeReleaseSpinLock(&m_FrameInUseSpinLock, oldIrql );
         DPF(D_BLAB, ("[Frame %d is in use]", m_ulFrameIndex));
+        CountDropped(ulByteCount);
     }
 
 } // WriteData
 
+//=============================================================================
+void
+CSaveData::CountDropped
+(
+    _In_  ULONG                 ulByteCount
+)
+{
+    InterlockedAdd64(&m_llBytesDropped, ulByteCount);
+    InterlockedIncrement(&m_lFramesDropped);
+} // CountDropped
+
+//=============================================================================
+void
+CSaveData::CountTruncated
+(
+    _In_  ULONG                 ulByteCount
+)
+{
+    // Part of the write was kept, so only the lost bytes are counted.
+    InterlockedAdd64(&m_llBytesDropped, ulByteCount);
+} // CountTruncated
+
+//=============================================================================
+void
+CSaveData::RecordWriteLatency
+(
+    _In_  LONGLONG              llQueuedQpc
+)
+{
+    LONGLONG    llElapsedUs;
+    LONG        lMaxUs;
+    ULONG       ulBucket = 0;
+
+    llElapsedUs = ((KeQueryPerformanceCounter(NULL).QuadPart - llQueuedQpc) * 1000000) /
+                  m_liQpcFrequency.QuadPart;
+    if (llElapsedUs > MAXLONG)
+    {
+        llElapsedUs = MAXLONG;
+    }
+
+    while (ulBucket < SAVEDATA_LATENCY_BUCKETS - 1 && (1LL << ulBucket) <= llElapsedUs)
+    {
+        ulBucket++;
+    }
+    InterlockedIncrement(&m_alWriteLatency[ulBucket]);
+
+    lMaxUs = m_lMaxWriteLatencyUs;
+    while ((LONG)llElapsedUs > lMaxUs &&
+           InterlockedCompareExchange(&m_lMaxWriteLatencyUs, (LONG)llElapsedUs, lMaxUs) != lMaxUs)
+    {
+        lMaxUs = m_lMaxWriteLatencyUs;
+    }
+} // RecordWriteLatency
+
+//=============================================================================
+ULONG
+CSaveData::GetLatencyPercentile
+(
+    _In_  ULONG                 ulPercent
+)
+{
+    ULONGLONG   ullTotal = 0;
+    ULONGLONG   ullCount = 0;
+
+    for (ULONG i = 0; i < SAVEDATA_LATENCY_BUCKETS; i++)
+    {
+        ullTotal += m_alWriteLatency[i];
+    }
+
+    if (ullTotal == 0)
+    {
+        return 0;
+    }
+
+    for (ULONG i = 0; i < SAVEDATA_LATENCY_BUCKETS; i++)
+    {
+        ullCount += m_alWriteLatency[i];
+        if (ullCount * 100 >= ullTotal * ulPercent)
+        {
+            return 1UL << i;
+        }
+    }
+
+    return 1UL << (SAVEDATA_LATENCY_BUCKETS - 1);
+} // GetLatencyPercentile
+
+//=============================================================================
+void
+CSaveData::GetStatistics
+(
+    _Out_ PSYSVAD_SAVEDATA_STATISTICS pStatistics
+)
+/*++
+
+Routine Description:
+
+  Snapshot of the health counters. Counters are updated without a common
+  lock, so fields may be off by an in-flight frame relative to each other.
+
+--*/
+{
+    LONG        lPending;
+
+    ASSERT(pStatistics);
+
+    RtlZeroMemory(pStatistics, sizeof(*pStatistics));
+
+    // Remove the bias; the count is 0 while WaitPendingWorkItems drains.
+    lPending = m_lPendingWorkItems - 1;
+
+    pStatistics->BytesWritten       = (ULONGLONG)m_llBytesWritten;
+    pStatistics->BytesDropped       = (ULONGLONG)m_llBytesDropped;
+    pStatistics->FramesWritten      = (ULONG)m_lFramesWritten;
+    pStatistics->FramesDropped      = (ULONG)m_lFramesDropped;
+    pStatistics->FramesPending      = lPending > 0 ? (ULONG)lPending : 0;
+    pStatistics->MaxQueueDepth      = (ULONG)m_lMaxQueueDepth;
+    pStatistics->FrameSize          = m_ulFrameSize;
+    pStatistics->WriteLatencyP50Us  = GetLatencyPercentile(50);
+    pStatistics->WriteLatencyP90Us  = GetLatencyPercentile(90);
+    pStatistics->WriteLatencyP99Us  = GetLatencyPercentile(99);
+    pStatistics->WriteLatencyMaxUs  = (ULONG)m_lMaxWriteLatencyUs;
+    pStatistics->MappedOutput       = m_fMappedOutput ? TRUE : FALSE;
+} // GetStatistics
 
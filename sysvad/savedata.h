@@ -17,6 +17,8 @@ to save data to disk.
 #ifndef _SYSVAD_SAVEDATA_H
 #define _SYSVAD_SAVEDATA_H
 
+#include "SysVadShared.h"
+
 //-----------------------------------------------------------------------------
 //  Forward declaration
 //-----------------------------------------------------------------------------
@@ -29,17 +31,21 @@ typedef CSaveData *PCSaveData;
 //-----------------------------------------------------------------------------
 
 // Parameter to workitem.
-#include <pshpack1.h>
+// FreeListEntry must stay the first member, the free list is an SLIST and
+// SLIST entries require natural (16 byte on 64-bit) alignment.
 typedef struct _SAVEWORKER_PARAM {
+    SLIST_ENTRY      FreeListEntry;
     PIO_WORKITEM     WorkItem;
     ULONG            ulFrameNo;
     ULONG            ulDataSize;
     PBYTE            pData;
     PCSaveData       pSaveData;
-    KEVENT           EventDone;
+    LONGLONG         llQueuedQpc;       // When the frame was queued.
 } SAVEWORKER_PARAM;
 typedef SAVEWORKER_PARAM *PSAVEWORKER_PARAM;
-#include <poppack.h>
+
+// Write latency histogram, bucket i counts writes that took < 2^i us.
+#define SAVEDATA_LATENCY_BUCKETS    24
 
 // wave file header.
 #include <pshpack1.h>
@@ -96,9 +102,30 @@ protected:
     PLARGE_INTEGER              m_pFilePtr;
 
     static PDEVICE_OBJECT       m_pDeviceObject;
-    static ULONG                m_ulStreamId;
-    static ULONG                m_ulOffloadStreamId;
-    static PSAVEWORKER_PARAM    m_pWorkItems;
+    static LONG                 m_ulStreamId;
+    static LONG                 m_ulOffloadStreamId;
+
+    PSAVEWORKER_PARAM           m_pWorkItems;       // This stream's work items.
+    ULONG                       m_ulWorkItemCount;
+    SLIST_HEADER                m_WorkItemFreeList; // Idle work items.
+    volatile LONG               m_lPendingWorkItems;// Queued work items + 1 (bias).
+    KEVENT                      m_WorkItemsDone;    // Set when the bias is dropped and the last work item completes.
+
+    BOOL                        m_fMappedOutput;    // Write through a mapped view instead of ZwWriteFile.
+    HANDLE                      m_SectionHandle;    // Section backing the current view.
+    PBYTE                       m_pMappedView;      // Current window into the data file.
+    LARGE_INTEGER               m_liMappedViewOffset;
+    SIZE_T                      m_cbMappedViewSize;
+
+    // Health counters, see SYSVAD_SAVEDATA_STATISTICS.
+    volatile LONG64             m_llBytesWritten;
+    volatile LONG64             m_llBytesDropped;
+    volatile LONG               m_lFramesWritten;
+    volatile LONG               m_lFramesDropped;
+    volatile LONG               m_lMaxQueueDepth;
+    volatile LONG               m_lMaxWriteLatencyUs;
+    volatile LONG               m_alWriteLatency[SAVEDATA_LATENCY_BUCKETS];
+    LARGE_INTEGER               m_liQpcFrequency;
 
     BOOL                        m_fWriteDisabled;
 
@@ -108,22 +135,10 @@ public:
     CSaveData();
     ~CSaveData();
 
-    static NTSTATUS             InitializeWorkItems
-    (
-        _In_  PDEVICE_OBJECT    DeviceObject
-    );
-    static void                 DestroyWorkItems
-    (
-        void
-    );
     void                        Disable
     (
         _In_ BOOL               fDisable
     );
-    static PSAVEWORKER_PARAM    GetNewWorkItem
-    (
-        void
-    );
     NTSTATUS                    Initialize
     (
         _In_ BOOL               _bOffloaded
@@ -153,6 +168,10 @@ public:
     (
         void
     );
+    void                        GetStatistics
+    (
+        _Out_ PSYSVAD_SAVEDATA_STATISTICS pStatistics
+    );
     void                        WriteData
     (
         _In_reads_bytes_(ulByteCount)   PBYTE   pBuffer,
@@ -160,6 +179,42 @@ public:
     );
 
 private:
+    NTSTATUS                    InitializeWorkItems
+    (
+        _In_  PDEVICE_OBJECT    DeviceObject
+    );
+    void                        DestroyWorkItems
+    (
+        void
+    );
+    PSAVEWORKER_PARAM           GetNewWorkItem
+    (
+        void
+    );
+    void                        ReleaseWorkItem
+    (
+        _In_  PSAVEWORKER_PARAM pParam
+    );
+    void                        WaitPendingWorkItems
+    (
+        void
+    );
+    void                        CountDropped
+    (
+        _In_  ULONG             ulByteCount
+    );
+    void                        CountTruncated
+    (
+        _In_  ULONG             ulByteCount
+    );
+    void                        RecordWriteLatency
+    (
+        _In_  LONGLONG          llQueuedQpc
+    );
+    ULONG                       GetLatencyPercentile
+    (
+        _In_  ULONG             ulPercent
+    );
     NTSTATUS                    FileClose
     (
         void
@@ -177,6 +232,24 @@ private:
     (
         void
     );
+    NTSTATUS                    FileSetEndOfFile
+    (
+        _In_  LONGLONG          llEndOfFile
+    );
+
+    NTSTATUS                    MappedViewWrite
+    (
+        _In_reads_bytes_(ulDataSize)    PBYTE   pData,
+        _In_                            ULONG   ulDataSize
+    );
+    NTSTATUS                    MappedViewRemap
+    (
+        _In_  LONGLONG          llFileOffset
+    );
+    void                        MappedViewClose
+    (
+        void
+    );
 
     void                        SaveFrame
     (
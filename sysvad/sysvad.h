@@ -178,6 +178,9 @@ typedef struct _PortClassDeviceContext              // 32       64      Byte off
 // Global settings.
 //
 extern DWORD g_DoNotCreateDataFiles;
+extern DWORD g_UseMappedDataFiles;
+extern DWORD g_KeywordHistoryMs;
+extern DWORD g_KeywordBurstPackets;
 extern DWORD g_DisableBthScoBypass;
 extern UNICODE_STRING g_RegistryPath;
 